@@ -370,6 +370,14 @@ int vtkSlicerAstroModelingLogic::OperateModel(vtkMRMLAstroModelingParametersNode
     return 0;
     }
 
+  // on-demand volumes are read in full
+  if (!inputVolume->UpdateWholeImageData())
+    {
+    vtkErrorMacro("vtkSlicerAstroModelingLogic::OperateModel :"
+                  " could not read the whole inputVolume!");
+    return 0;
+    }
+
   vtkMRMLAstroVolumeNode *outputVolume =
     vtkMRMLAstroVolumeNode::SafeDownCast
       (this->GetMRMLScene()->GetNodeByID(pnode->GetOutputVolumeNodeID()));
@@ -1725,6 +1733,14 @@ int vtkSlicerAstroModelingLogic::UpdateModelFromTable(vtkMRMLAstroModelingParame
     return 0;
     }
 
+  // on-demand volumes are read in full
+  if (!inputVolume->UpdateWholeImageData())
+    {
+    vtkErrorMacro("vtkSlicerAstroModelingLogic::UpdateModelFromTable :"
+                  " could not read the whole inputVolume!");
+    return 0;
+    }
+
   vtkMRMLAstroVolumeNode *outputVolume =
     vtkMRMLAstroVolumeNode::SafeDownCast
       (this->GetMRMLScene()->GetNodeByID(pnode->GetOutputVolumeNodeID()));
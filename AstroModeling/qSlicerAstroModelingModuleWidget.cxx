@@ -3231,7 +3231,7 @@ void qSlicerAstroModelingModuleWidget::onApply()
     {
 
     outputVolume = vtkMRMLAstroVolumeNode::SafeDownCast
-       (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, outSS.str().c_str()));
+       (logic->GetAstroVolumeLogic()->CloneVolumeGeometry(scene, inputVolume, outSS.str().c_str()));
 
     outputVolume->SetName(outSS.str().c_str());
     d->parametersNode->SetOutputVolumeNodeID(outputVolume->GetID());
@@ -3287,7 +3287,7 @@ void qSlicerAstroModelingModuleWidget::onApply()
     {
 
     residualVolume = vtkMRMLAstroVolumeNode::SafeDownCast
-       (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, residualSS.str().c_str()));
+       (logic->GetAstroVolumeLogic()->CloneVolumeGeometry(scene, inputVolume, residualSS.str().c_str()));
 
     residualVolume->SetName(residualSS.str().c_str());
     d->parametersNode->SetResidualVolumeNodeID(residualVolume->GetID());
@@ -3748,8 +3748,7 @@ void qSlicerAstroModelingModuleWidget::onWorkFinished()
     d->parametersNode->GetParamsTableNode()->Copy(d->internalTableNode);
     this->createPlots();
 
-    outputVolume->UpdateNoiseAttributes();
-    outputVolume->UpdateRangeAttributes();
+    outputVolume->UpdateStatisticsAttributes();
     outputVolume->SetAttribute("SlicerAstro.DATAMODEL", "MODEL");
 
     vtkDoubleArray* Phi = vtkDoubleArray::SafeDownCast
@@ -30,9 +30,13 @@
 #include <vtkMRMLAstroMomentMapsParametersNode.h>
 #include <vtkMRMLTableNode.h>
 
+// vtkFits includes
+#include <vtkRunLengthLabelMap.h>
+
 // VTK includes
 #include <vtkArrayData.h>
 #include <vtkCacheManager.h>
+#include <vtkDoubleArray.h>
 #include <vtkImageData.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
@@ -45,6 +49,7 @@
 // STD includes
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 // OpenMP includes
 #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
@@ -77,6 +82,15 @@ double StringToDouble(const char* str)
   return StringToNumber<double>(str);
 }
 
+//----------------------------------------------------------------------------
+// Input voxel of a float or of a scaled integer volume
+inline double InputValue(const float *inFPixel, const void *inIPixel, int inDataType,
+                         int pos, double bscale, double bzero, double blank)
+{
+  return inFPixel ? inFPixel[pos] :
+    vtkMRMLAstroVolumeNode::GetScaledIntegerValue(inIPixel, inDataType, pos, bscale, bzero, blank);
+}
+
 }// end namespace
 
 //----------------------------------------------------------------------------
@@ -169,6 +183,14 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
     return false;
     }
 
+  // on-demand volumes are read in full
+  if (!inputVolume->UpdateWholeImageData())
+    {
+    vtkErrorMacro("vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps :"
+                  " could not read the whole inputVolume!");
+    return false;
+    }
+
   vtkMRMLAstroVolumeNode *ZeroMomentVolume =
     vtkMRMLAstroVolumeNode::SafeDownCast
       (this->GetMRMLScene()->GetNodeByID(pnode->GetZeroMomentVolumeNodeID()));
@@ -220,7 +242,7 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
   float *outZeroFPixel = NULL;
   float *outFirstFPixel = NULL;
   float *outSecondFPixel = NULL;
-  short *maskPixel = NULL;
+  vtkSmartPointer<vtkRunLengthLabelMap> maskRuns;
   double *inDPixel = NULL;
   double *outZeroDPixel = NULL;
   double *outFirstDPixel = NULL;
@@ -234,10 +256,24 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
     }
 
   const int DataType = ZeroMomentVolume->GetImageData()->GetPointData()->GetScalars()->GetDataType();
+  // scaled integer input is converted on the fly (the moment maps are float)
+  void *inIPixel = NULL;
+  const int inDataType = inputVolume->GetImageData()->GetPointData()->GetScalars()->GetDataType();
+  double bscale = 1., bzero = 0.;
+  inputVolume->GetDataScaling(bscale, bzero);
+  const double blank = inputVolume->GetDataBlank();
+
   switch (DataType)
     {
     case VTK_FLOAT:
-      inFPixel = static_cast<float*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
+      if (inputVolume->HasScaledIntegerData())
+        {
+        inIPixel = inputVolume->GetImageData()->GetScalarPointer(0,0,0);
+        }
+      else
+        {
+        inFPixel = static_cast<float*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
+        }
         outZeroFPixel = static_cast<float*> (ZeroMomentVolume->GetImageData()->GetScalarPointer(0,0,0));
       if (forceGenerateFirst)
         {
@@ -319,10 +355,18 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
   if(pnode->GetMaskActive())
     {
     double dV = fabs((pnode->GetVelocityMax() - pnode->GetVelocityMin()) / dims[2]);
-    maskPixel = static_cast<short*> (maskVolume->GetImageData()->GetScalarPointer(0,0,0));
+    // the spectra are integrated only over the runs of the mask. The
+    // runs are a temporary copy, released at the end of the calculation
+    maskRuns = vtkSmartPointer<vtkRunLengthLabelMap>::New();
+    if (!maskRuns->Encode(maskVolume->GetImageData()))
+      {
+      vtkErrorMacro("vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps :"
+                    " could not encode the mask!");
+      return false;
+      }
 
     #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
-    #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, outZeroFPixel, outZeroDPixel, outFirstFPixel, outFirstDPixel, outSecondFPixel, outSecondDPixel, ijk, world, maskPixel, cancel, status, forceGenerateFirst, VelFactor, dV)
+    #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, inIPixel, outZeroFPixel, outZeroDPixel, outFirstFPixel, outFirstDPixel, outSecondFPixel, outSecondDPixel, ijk, world, maskRuns, cancel, status, forceGenerateFirst, VelFactor, dV)
     #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
     for (int elemCnt = 0; elemCnt < numSlice; elemCnt++)
       {
@@ -372,37 +416,40 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
         double ijkCoordinates[3];
         ijkCoordinates[0] = ijk[0];
         ijkCoordinates[1] = ijk[1];
-        for (int kk = 0; kk < dims[2]; kk++)
+        int numberOfRuns = 0;
+        const vtkRunLengthLabelMap::Run *runs = maskRuns->GetPixelRuns(elemCnt, numberOfRuns);
+        for (int run = 0; run < numberOfRuns; run++)
           {
-          int posData = elemCnt + kk * numSlice;
-          if (forceGenerateFirst)
+          if (runs[run].Label <= 0)
             {
-            ijkCoordinates[2] = kk;
-            astroDisplay->GetReferenceSpace(ijkCoordinates, SpaceCoordinates);
-            SpaceCoordinates[2] *= VelFactor;
+            continue;
             }
-          switch (DataType)
+          for (int kk = runs[run].First; kk <= runs[run].Last; kk++)
             {
-            case VTK_FLOAT:
-              if (*(maskPixel + posData) > 0.001)
-                {
-                *(outZeroFPixel + elemCnt) += *(inFPixel + posData);
+            int posData = elemCnt + kk * numSlice;
+            if (forceGenerateFirst)
+              {
+              ijkCoordinates[2] = kk;
+              astroDisplay->GetReferenceSpace(ijkCoordinates, SpaceCoordinates);
+              SpaceCoordinates[2] *= VelFactor;
+              }
+            switch (DataType)
+              {
+              case VTK_FLOAT:
+                *(outZeroFPixel + elemCnt) += InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank);
                 if (forceGenerateFirst)
                   {
-                  *(outFirstFPixel + elemCnt) += *(inFPixel + posData) * SpaceCoordinates[2];
+                  *(outFirstFPixel + elemCnt) += InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) * SpaceCoordinates[2];
                   }
-                }
-              break;
-            case VTK_DOUBLE:
-              if (*(maskPixel + posData) > 0.001)
-                {
+                break;
+              case VTK_DOUBLE:
                 *(outZeroDPixel + elemCnt) += *(inDPixel + posData);
                 if (forceGenerateFirst)
                   {
                   *(outFirstDPixel + elemCnt) += *(inDPixel + posData) * SpaceCoordinates[2];
                   }
-                }
-              break;
+                break;
+              }
             }
           }
 
@@ -435,28 +482,29 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
 
         if (pnode->GetGenerateSecond())
           {
-          for (int kk = 0; kk < dims[2]; kk++)
+          for (int run = 0; run < numberOfRuns; run++)
             {
-            int posData = elemCnt + kk * numSlice;
-            ijkCoordinates[2] = kk;
-            astroDisplay->GetReferenceSpace(ijkCoordinates, SpaceCoordinates);
-            SpaceCoordinates[2] *= VelFactor;
-            switch (DataType)
+            if (runs[run].Label <= 0)
               {
-              case VTK_FLOAT:
-                if (*(maskPixel + posData) > 0.001)
-                  {
-                  *(outSecondFPixel + elemCnt) += *(inFPixel + posData) * (SpaceCoordinates[2] - *(outFirstFPixel + elemCnt))
+              continue;
+              }
+            for (int kk = runs[run].First; kk <= runs[run].Last; kk++)
+              {
+              int posData = elemCnt + kk * numSlice;
+              ijkCoordinates[2] = kk;
+              astroDisplay->GetReferenceSpace(ijkCoordinates, SpaceCoordinates);
+              SpaceCoordinates[2] *= VelFactor;
+              switch (DataType)
+                {
+                case VTK_FLOAT:
+                  *(outSecondFPixel + elemCnt) += InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) * (SpaceCoordinates[2] - *(outFirstFPixel + elemCnt))
                                                                         * (SpaceCoordinates[2] - *(outFirstFPixel + elemCnt));
-                  }
-                break;
-              case VTK_DOUBLE:
-                if (*(maskPixel + posData) > 0.001)
-                  {
+                  break;
+                case VTK_DOUBLE:
                   *(outSecondDPixel + elemCnt) += *(inDPixel + posData) * (SpaceCoordinates[2] - *(outFirstDPixel + elemCnt))
                                                                         * (SpaceCoordinates[2] - *(outFirstDPixel + elemCnt));
-                  }
-                break;
+                  break;
+                }
               }
             }
           switch (DataType)
@@ -553,9 +601,9 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
     world[2] = VelMax;
     astroDisplay->GetIJKSpace(world, ijk);
     int Zmax;
-    if (ijk[2] > dims[2])
+    if (ijk[2] > dims[2] - 1)
       {
-      Zmax = dims[2];
+      Zmax = dims[2] - 1;
       }
     else
       {
@@ -570,8 +618,34 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
       }
 
     double dV = fabs((pnode->GetVelocityMax() - pnode->GetVelocityMin()) / (Zmax - Zmin));
+
+    // lower threshold of each channel
+    std::vector<double> intensityMin(dims[2], pnode->GetIntensityMin());
+    if (pnode->GetChannelNoiseThreshold())
+      {
+      const double RMS = StringToDouble(inputVolume->GetAttribute("SlicerAstro.RMS"));
+      vtkNew<vtkDoubleArray> channelNoise;
+      if (RMS > 0. && inputVolume->ComputeChannelNoise(channelNoise.GetPointer()))
+        {
+        for (int kk = 0; kk < dims[2]; kk++)
+          {
+          const double noise = channelNoise->GetValue(kk);
+          if (noise > 0.)
+            {
+            intensityMin[kk] *= noise / RMS;
+            }
+          }
+        }
+      else
+        {
+        vtkWarningMacro("vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps :"
+                        " could not compute the noise of the channels,"
+                        " the threshold is the same for all the channels.");
+        }
+      }
+
     #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
-    #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, outZeroFPixel, outZeroDPixel, outFirstFPixel, outFirstDPixel, outSecondFPixel, outSecondDPixel, ijk, world, maskPixel, cancel, status, forceGenerateFirst, VelFactor, Zmin, Zmax, dV)
+    #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, inIPixel, outZeroFPixel, outZeroDPixel, outFirstFPixel, outFirstDPixel, outSecondFPixel, outSecondDPixel, ijk, world, maskRuns, cancel, status, forceGenerateFirst, VelFactor, Zmin, Zmax, dV)
     #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
     for (int elemCnt = 0; elemCnt < numSlice; elemCnt++)
       {
@@ -633,18 +707,18 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
           switch (DataType)
             {
             case VTK_FLOAT:
-              if (*(inFPixel + posData) > pnode->GetIntensityMin() &&
-                  *(inFPixel + posData) < pnode->GetIntensityMax())
+              if (InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) > intensityMin[kk] &&
+                  InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) < pnode->GetIntensityMax())
                 {
-                *(outZeroFPixel + elemCnt) += *(inFPixel + posData);
+                *(outZeroFPixel + elemCnt) += InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank);
                 if (forceGenerateFirst)
                   {
-                  *(outFirstFPixel + elemCnt) += *(inFPixel + posData) * SpaceCoordinates[2];
+                  *(outFirstFPixel + elemCnt) += InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) * SpaceCoordinates[2];
                   }
                 }
               break;
             case VTK_DOUBLE:
-              if (*(inDPixel + posData) > pnode->GetIntensityMin() &&
+              if (*(inDPixel + posData) > intensityMin[kk] &&
                   *(inDPixel + posData) < pnode->GetIntensityMax())
                 {
                 *(outZeroDPixel + elemCnt) += *(inDPixel + posData);
@@ -696,15 +770,15 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
             switch (DataType)
               {
               case VTK_FLOAT:
-                if (*(inFPixel + posData) > pnode->GetIntensityMin() &&
-                    *(inFPixel + posData) < pnode->GetIntensityMax())
+                if (InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) > intensityMin[kk] &&
+                    InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) < pnode->GetIntensityMax())
                   {
-                  *(outSecondFPixel + elemCnt) += *(inFPixel + posData) * (SpaceCoordinates[2] - *(outFirstFPixel + elemCnt))
+                  *(outSecondFPixel + elemCnt) += InputValue(inFPixel, inIPixel, inDataType, posData, bscale, bzero, blank) * (SpaceCoordinates[2] - *(outFirstFPixel + elemCnt))
                                                                         * (SpaceCoordinates[2] - *(outFirstFPixel + elemCnt));
                   }
                 break;
               case VTK_DOUBLE:
-                if (*(inDPixel + posData) > pnode->GetIntensityMin() &&
+                if (*(inDPixel + posData) > intensityMin[kk] &&
                     *(inDPixel + posData) < pnode->GetIntensityMax())
                   {
                   *(outSecondDPixel + elemCnt) += *(inDPixel + posData) * (SpaceCoordinates[2] - *(outFirstDPixel + elemCnt))
@@ -814,12 +888,6 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
   delete outFirstDPixel;
   delete outSecondDPixel;
 
-  if (pnode->GetMaskActive())
-    {
-    maskPixel = NULL;
-    delete maskPixel;
-    }
-
   pnode->SetStatus(0);
 
   if (cancel)
@@ -831,10 +899,9 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
 
   if (pnode->GetGenerateZero())
     {
-    ZeroMomentVolume->UpdateRangeAttributes();
-    ZeroMomentVolume->UpdateNoiseAttributes();
+    ZeroMomentVolume->UpdateStatisticsAttributes();
     int disabledModify = ZeroMomentVolume->GetAstroVolumeDisplayNode()->StartModify();
-    FirstMomentVolume->GetAstroVolumeDisplayNode()->ResetWindowLevelPresets();
+    ZeroMomentVolume->GetAstroVolumeDisplayNode()->ResetWindowLevelPresets();
     ZeroMomentVolume->GetAstroVolumeDisplayNode()->SetAutoWindowLevel(0);
     double min = StringToDouble(ZeroMomentVolume->GetAttribute("SlicerAstro.DATAMIN"));
     double max = StringToDouble(ZeroMomentVolume->GetAttribute("SlicerAstro.DATAMAX"));
@@ -846,8 +913,7 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
     }
   if (pnode->GetGenerateFirst())
     {
-    FirstMomentVolume->UpdateRangeAttributes();
-    FirstMomentVolume->UpdateNoiseAttributes();
+    FirstMomentVolume->UpdateStatisticsAttributes();
     int disabledModify = FirstMomentVolume->GetAstroVolumeDisplayNode()->StartModify();
     FirstMomentVolume->GetAstroVolumeDisplayNode()->ResetWindowLevelPresets();
     FirstMomentVolume->GetAstroVolumeDisplayNode()->SetAutoWindowLevel(0);
@@ -861,8 +927,7 @@ bool vtkSlicerAstroMomentMapsLogic::CalculateMomentMaps(vtkMRMLAstroMomentMapsPa
     }
   if (pnode->GetGenerateSecond())
     {
-    SecondMomentVolume->UpdateRangeAttributes();
-    SecondMomentVolume->UpdateNoiseAttributes();
+    SecondMomentVolume->UpdateStatisticsAttributes();
     int disabledModify = SecondMomentVolume->GetAstroVolumeDisplayNode()->StartModify();
     SecondMomentVolume->GetAstroVolumeDisplayNode()->ResetWindowLevelPresets();
     SecondMomentVolume->GetAstroVolumeDisplayNode()->SetAutoWindowLevel(0);
@@ -0,0 +1,199 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Logic includes
+#include <vtkSlicerAstroMomentMapsLogic.h>
+
+// MRML includes
+#include <vtkMRMLAstroLabelMapVolumeNode.h>
+#include <vtkMRMLAstroMomentMapsParametersNode.h>
+#include <vtkMRMLAstroVolumeDisplayNode.h>
+#include <vtkMRMLAstroVolumeNode.h>
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+const int Dims[3] = {16, 16, 8};
+const int Blank[3] = {3, 4, 2};
+
+//-----------------------------------------------------------------------------
+// the zero moment of the spectrum with the BLANK voxel is blankExpected
+// (NaN if blankExpected is NaN), expected for the other spectra
+bool CheckZeroMoment(const char* path, vtkMRMLAstroVolumeNode* zeroMomentVolume,
+                     double blankExpected, double expected)
+{
+  for (int j = 0; j < Dims[1]; j++)
+    {
+    for (int i = 0; i < Dims[0]; i++)
+      {
+      const float value = *static_cast<float*>(zeroMomentVolume->GetImageData()->GetScalarPointer(i, j, 0));
+      const double reference = (i == Blank[0] && j == Blank[1]) ? blankExpected : expected;
+      if (reference != reference)
+        {
+        if (value == value)
+          {
+          std::cerr << path << ": the zero moment of the BLANK spectrum is "
+                    << value << ", expected NaN." << std::endl;
+          return false;
+          }
+        }
+      else if (value != value || fabs(value - reference) > 1.e-4 * fabs(reference))
+        {
+        std::cerr << path << ": the zero moment of (" << i << ", " << j << ") is "
+                  << value << ", expected " << reference << std::endl;
+        return false;
+        }
+      }
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkSlicerAstroMomentMapsLogicScaledIntegersTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  vtkNew<vtkMRMLScene> scene;
+
+  vtkNew<vtkSlicerAstroMomentMapsLogic> logic;
+  logic->SetMRMLScene(scene.GetPointer());
+
+  // a linear WCS with the velocity axis in m/s
+  struct wcsprm wcs;
+  wcs.flag = -1;
+  wcsini(1, 3, &wcs);
+  const double crpix[3] = {8.5, 8.5, 1.};
+  const double cdelt[3] = {-0.01, 0.01, 1000.};
+  const double crval[3] = {180., 30., 0.};
+  const char* ctype[3] = {"RA---SIN", "DEC--SIN", "VRAD"};
+  const char* cunit[3] = {"deg", "deg", "m/s"};
+  for (int ii = 0; ii < 3; ii++)
+    {
+    wcs.crpix[ii] = crpix[ii];
+    wcs.cdelt[ii] = cdelt[ii];
+    wcs.crval[ii] = crval[ii];
+    strcpy(wcs.ctype[ii], ctype[ii]);
+    strcpy(wcs.cunit[ii], cunit[ii]);
+    }
+
+  vtkNew<vtkMRMLAstroVolumeDisplayNode> displayNode;
+  scene->AddNode(displayNode.GetPointer());
+  displayNode->SetWCSStruct(&wcs);
+  wcsfree(&wcs);
+
+  // a scaled integer cube with physical value 0.5 * 4 + 1 = 3
+  // and one BLANK voxel
+  vtkNew<vtkImageData> imageData;
+  imageData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  imageData->AllocateScalars(VTK_SHORT, 1);
+  imageData->GetPointData()->GetScalars()->FillComponent(0, 4.);
+  *static_cast<short*>(imageData->GetScalarPointer(Blank[0], Blank[1], Blank[2])) = -32768;
+
+  vtkNew<vtkMRMLAstroVolumeNode> inputVolume;
+  inputVolume->SetAttribute("SlicerAstro.NAXIS1", "16");
+  inputVolume->SetAttribute("SlicerAstro.NAXIS2", "16");
+  inputVolume->SetAttribute("SlicerAstro.BITPIX", "16");
+  inputVolume->SetAttribute("SlicerAstro.BSCALE", "0.5");
+  inputVolume->SetAttribute("SlicerAstro.BZERO", "1.");
+  inputVolume->SetAttribute("SlicerAstro.BLANK", "-32768");
+  inputVolume->SetAndObserveImageData(imageData.GetPointer());
+  scene->AddNode(inputVolume.GetPointer());
+  inputVolume->SetAndObserveDisplayNodeID(displayNode->GetID());
+
+  vtkNew<vtkImageData> zeroMomentData;
+  zeroMomentData->SetDimensions(Dims[0], Dims[1], 1);
+  zeroMomentData->AllocateScalars(VTK_FLOAT, 1);
+
+  vtkNew<vtkMRMLAstroVolumeDisplayNode> zeroMomentDisplayNode;
+  scene->AddNode(zeroMomentDisplayNode.GetPointer());
+
+  vtkNew<vtkMRMLAstroVolumeNode> zeroMomentVolume;
+  zeroMomentVolume->SetAttribute("SlicerAstro.BITPIX", "-32");
+  zeroMomentVolume->SetAndObserveImageData(zeroMomentData.GetPointer());
+  scene->AddNode(zeroMomentVolume.GetPointer());
+  zeroMomentVolume->SetAndObserveDisplayNodeID(zeroMomentDisplayNode->GetID());
+
+  vtkNew<vtkImageData> maskData;
+  maskData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  maskData->AllocateScalars(VTK_SHORT, 1);
+  maskData->GetPointData()->GetScalars()->FillComponent(0, 1.);
+
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> maskVolume;
+  maskVolume->SetAndObserveImageData(maskData.GetPointer());
+  scene->AddNode(maskVolume.GetPointer());
+
+  vtkNew<vtkMRMLAstroMomentMapsParametersNode> pnode;
+  pnode->SetInputVolumeNodeID(inputVolume->GetID());
+  pnode->SetZeroMomentVolumeNodeID(zeroMomentVolume->GetID());
+  pnode->SetMaskVolumeNodeID(maskVolume->GetID());
+  pnode->SetGenerateZero(true);
+  pnode->SetGenerateFirst(false);
+  pnode->SetGenerateSecond(false);
+  pnode->SetCores(1);
+
+  // mask path: the BLANK voxel inside the mask gives a NaN zero moment,
+  // dV = (8 - 0) / 8 channels = 1 km/s
+  pnode->SetMaskActive(true);
+  pnode->SetVelocityMin(0.);
+  pnode->SetVelocityMax(8.);
+  if (!logic->CalculateMomentMaps(pnode.GetPointer()))
+    {
+    std::cerr << "CalculateMomentMaps with the mask failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  const double NaN = sqrt(-1);
+  if (!CheckZeroMoment("Mask", zeroMomentVolume.GetPointer(), NaN, Dims[2] * 3.))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // threshold path: the thresholds include any value but the BLANK voxel is
+  // skipped, all the channels are in the velocity range, dV = 200 km/s / 7
+  pnode->SetMaskActive(false);
+  pnode->SetIntensityMin(-1.e6);
+  pnode->SetIntensityMax(1.e6);
+  pnode->SetVelocityMin(-100.);
+  pnode->SetVelocityMax(100.);
+  if (!logic->CalculateMomentMaps(pnode.GetPointer()))
+    {
+    std::cerr << "CalculateMomentMaps with the threshold failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  const double dV = 200. / (Dims[2] - 1);
+  if (!CheckZeroMoment("Threshold", zeroMomentVolume.GetPointer(),
+                       (Dims[2] - 1) * 3. * dV, Dims[2] * 3. * dV))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
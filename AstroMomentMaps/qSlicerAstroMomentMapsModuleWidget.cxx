@@ -175,6 +175,9 @@ void qSlicerAstroMomentMapsModuleWidgetPrivate::init()
   QObject::connect(ThresholdRangeWidget, SIGNAL(valuesChanged(double,double)),
                    q, SLOT(onThresholdRangeChanged(double, double)));
 
+  QObject::connect(ChannelNoiseCheckBox, SIGNAL(toggled(bool)),
+                   q, SLOT(onChannelNoiseThresholdToggled(bool)));
+
   QObject::connect(VelocityRangeWidget, SIGNAL(valuesChanged(double,double)),
                    q, SLOT(onVelocityRangeChanged(double, double)));
 
@@ -850,6 +853,18 @@ void qSlicerAstroMomentMapsModuleWidget::onGenerateZeroToggled(bool generate)
   d->parametersNode->SetGenerateZero(generate);
 }
 
+//-----------------------------------------------------------------------------
+void qSlicerAstroMomentMapsModuleWidget::onChannelNoiseThresholdToggled(bool active)
+{
+  Q_D(qSlicerAstroMomentMapsModuleWidget);
+
+  if (!d->parametersNode)
+    {
+    return;
+    }
+  d->parametersNode->SetChannelNoiseThreshold(active);
+}
+
 //-----------------------------------------------------------------------------
 void qSlicerAstroMomentMapsModuleWidget::onMaskActiveToggled(bool active)
 {
@@ -914,6 +929,7 @@ void qSlicerAstroMomentMapsModuleWidget::onMRMLAstroMomentMapsParametersNodeModi
     d->ThresholdRangeLabel->hide();
     d->ThresholdRangeWidget->hide();
     d->ThresholdUnitLabel->hide();
+    d->ChannelNoiseCheckBox->hide();
     }
   else
     {
@@ -923,6 +939,7 @@ void qSlicerAstroMomentMapsModuleWidget::onMRMLAstroMomentMapsParametersNodeModi
     d->ThresholdRangeLabel->show();
     d->ThresholdRangeWidget->show();
     d->ThresholdUnitLabel->show();
+    d->ChannelNoiseCheckBox->show();
     }
   d->ZeroMomentRadioButton->setChecked(d->parametersNode->GetGenerateZero());
   d->FirstMomentRadioButton->setChecked(d->parametersNode->GetGenerateFirst());
@@ -938,6 +955,10 @@ void qSlicerAstroMomentMapsModuleWidget::onMRMLAstroMomentMapsParametersNodeModi
   d->ThresholdRangeWidget->setMaximumValue(d->parametersNode->GetIntensityMax());
   d->ThresholdRangeWidget->blockSignals(wasBlocked);
 
+  wasBlocked = d->ChannelNoiseCheckBox->blockSignals(true);
+  d->ChannelNoiseCheckBox->setChecked(d->parametersNode->GetChannelNoiseThreshold());
+  d->ChannelNoiseCheckBox->blockSignals(wasBlocked);
+
   int status = d->parametersNode->GetStatus();
 
   if(status == 0)
@@ -1085,11 +1106,13 @@ void qSlicerAstroMomentMapsModuleWidget::onCalculate()
       vtkNew<vtkImageData> imageDataTemp;
       imageDataTemp->SetDimensions(N1, N2, 1);
       imageDataTemp->SetSpacing(1.,1.,1.);
-      imageDataTemp->AllocateScalars(inputVolume->GetImageData()->GetScalarType(), 1);
+      // moment maps of scaled integer data are float
+      imageDataTemp->AllocateScalars(inputVolume->HasScaledIntegerData() ?
+        VTK_FLOAT : inputVolume->GetImageData()->GetScalarType(), 1);
 
       // create Astro Volume for the moment map
       ZeroMomentVolume = vtkMRMLAstroVolumeNode::SafeDownCast
-         (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, outSS.str().c_str()));
+         (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, outSS.str().c_str(), false));
 
       // modify fits attributes
       ZeroMomentVolume->SetAttribute("SlicerAstro.NAXIS", "2");
@@ -1176,11 +1199,13 @@ void qSlicerAstroMomentMapsModuleWidget::onCalculate()
       vtkNew<vtkImageData> imageDataTemp;
       imageDataTemp->SetDimensions(N1, N2, 1);
       imageDataTemp->SetSpacing(1.,1.,1.);
-      imageDataTemp->AllocateScalars(inputVolume->GetImageData()->GetScalarType(), 1);
+      // moment maps of scaled integer data are float
+      imageDataTemp->AllocateScalars(inputVolume->HasScaledIntegerData() ?
+        VTK_FLOAT : inputVolume->GetImageData()->GetScalarType(), 1);
 
       // create Astro Volume for the moment map
       FirstMomentVolume = vtkMRMLAstroVolumeNode::SafeDownCast
-         (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, outSS.str().c_str()));
+         (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, outSS.str().c_str(), false));
 
       // modify fits attributes
       FirstMomentVolume->SetAttribute("SlicerAstro.NAXIS", "2");
@@ -1268,11 +1293,13 @@ void qSlicerAstroMomentMapsModuleWidget::onCalculate()
       vtkNew<vtkImageData> imageDataTemp;
       imageDataTemp->SetDimensions(N1, N2, 1);
       imageDataTemp->SetSpacing(1.,1.,1.);
-      imageDataTemp->AllocateScalars(inputVolume->GetImageData()->GetScalarType(), 1);
+      // moment maps of scaled integer data are float
+      imageDataTemp->AllocateScalars(inputVolume->HasScaledIntegerData() ?
+        VTK_FLOAT : inputVolume->GetImageData()->GetScalarType(), 1);
 
       // create Astro Volume for the moment map
       SecondMomentVolume = vtkMRMLAstroVolumeNode::SafeDownCast
-         (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, outSS.str().c_str()));
+         (logic->GetAstroVolumeLogic()->CloneVolume(scene, inputVolume, outSS.str().c_str(), false));
 
       // modify fits attributes
       SecondMomentVolume->SetAttribute("SlicerAstro.NAXIS", "2");
@@ -58,6 +58,7 @@ protected:
   bool convertFirstSegmentToLabelMap();
 
 protected slots:
+  void onChannelNoiseThresholdToggled(bool active);
   void onComputationStarted();
   void onComputationCancelled();
   void onComputationFinished();
@@ -128,7 +128,6 @@ double StringToDouble(const char* str)
 {
   return StringToNumber<double>(str);
 }
-
 }// end namespace
 
 //----------------------------------------------------------------------------
@@ -155,6 +154,28 @@ void vtkSlicerAstroSmoothingLogic::RegisterNodes()
 int vtkSlicerAstroSmoothingLogic::Apply(vtkMRMLAstroSmoothingParametersNode* pnode,
                                         vtkRenderWindow* renderWindow)
 {
+  // on-demand volumes are read in full
+  vtkMRMLAstroVolumeNode *inputVolume =
+    vtkMRMLAstroVolumeNode::SafeDownCast
+      (this->GetMRMLScene()->GetNodeByID(pnode->GetInputVolumeNodeID()));
+  if (inputVolume && !inputVolume->UpdateWholeImageData())
+    {
+    vtkErrorMacro("vtkSlicerAstroSmoothingLogic::Apply : "
+                  "could not read the whole inputVolume.");
+    return 0;
+    }
+
+  // scaled integer data are smoothed as float physical values
+  vtkMRMLAstroVolumeNode *outputVolume =
+    vtkMRMLAstroVolumeNode::SafeDownCast
+      (this->GetMRMLScene()->GetNodeByID(pnode->GetOutputVolumeNodeID()));
+  if (outputVolume && !outputVolume->ConvertScaledIntegerDataToFloat())
+    {
+    vtkErrorMacro("vtkSlicerAstroSmoothingLogic::Apply : "
+                  "could not convert the outputVolume to float.");
+    return 0;
+    }
+
   int success = 0;
   switch (pnode->GetFilter())
     {
@@ -278,10 +299,25 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicBoxCPUFilter(vtkMRMLAstroSmoothingP
   double *inDPixel = NULL;
   double *outDPixel = NULL;
   const int DataType = outputVolume->GetImageData()->GetPointData()->GetScalars()->GetDataType();
+
+  // scaled integer input is converted on the fly (the output is float, see Apply)
+  void *inIPixel = NULL;
+  const int inDataType = inputVolume->GetImageData()->GetPointData()->GetScalars()->GetDataType();
+  double bscale = 1., bzero = 0.;
+  inputVolume->GetDataScaling(bscale, bzero);
+  const double blank = inputVolume->GetDataBlank();
+
   switch (DataType)
     {
     case VTK_FLOAT:
-      inFPixel = static_cast<float*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
+      if (inputVolume->HasScaledIntegerData())
+        {
+        inIPixel = inputVolume->GetImageData()->GetScalarPointer(0,0,0);
+        }
+      else
+        {
+        inFPixel = static_cast<float*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
+        }
       outFPixel = static_cast<float*> (outputVolume->GetImageData()->GetScalarPointer(0,0,0));
       break;
     case VTK_DOUBLE:
@@ -319,7 +355,7 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicBoxCPUFilter(vtkMRMLAstroSmoothingP
   pnode->SetStatus(1);
 
   #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
-  #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, outFPixel, outDPixel, cancel, status)
+  #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, inIPixel, outFPixel, outDPixel, cancel, status)
   #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
   for (int elemCnt = 0; elemCnt < numElements; elemCnt++)
     {
@@ -392,7 +428,8 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicBoxCPUFilter(vtkMRMLAstroSmoothingP
             switch (DataType)
               {
               case VTK_FLOAT:
-                *(outFPixel + elemCnt) += *(inFPixel + posData);
+                *(outFPixel + elemCnt) += inFPixel ? *(inFPixel + posData) :
+                  vtkMRMLAstroVolumeNode::GetScaledIntegerValue(inIPixel, inDataType, posData, bscale, bzero, blank);
                 break;
               case VTK_DOUBLE:
                 *(outDPixel + elemCnt) += *(inDPixel + posData);
@@ -457,8 +494,7 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicBoxCPUFilter(vtkMRMLAstroSmoothingP
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   gettimeofday(&end, NULL);
 
@@ -865,8 +901,7 @@ int vtkSlicerAstroSmoothingLogic::IsotropicBoxCPUFilter(vtkMRMLAstroSmoothingPar
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   gettimeofday(&end, NULL);
 
@@ -982,8 +1017,7 @@ int vtkSlicerAstroSmoothingLogic::BoxGPUFilter(vtkMRMLAstroSmoothingParametersNo
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   pnode->SetStatus(100);
 
@@ -1055,10 +1089,25 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicGaussianCPUFilter(vtkMRMLAstroSmoot
   double *inDPixel = NULL;
   double *outDPixel = NULL;
   const int DataType = outputVolume->GetImageData()->GetPointData()->GetScalars()->GetDataType();
+
+  // scaled integer input is converted on the fly (the output is float, see Apply)
+  void *inIPixel = NULL;
+  const int inDataType = inputVolume->GetImageData()->GetPointData()->GetScalars()->GetDataType();
+  double bscale = 1., bzero = 0.;
+  inputVolume->GetDataScaling(bscale, bzero);
+  const double blank = inputVolume->GetDataBlank();
+
   switch (DataType)
     {
     case VTK_FLOAT:
-      inFPixel = static_cast<float*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
+      if (inputVolume->HasScaledIntegerData())
+        {
+        inIPixel = inputVolume->GetImageData()->GetScalarPointer(0,0,0);
+        }
+      else
+        {
+        inFPixel = static_cast<float*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
+        }
       outFPixel = static_cast<float*> (outputVolume->GetImageData()->GetScalarPointer(0,0,0));
       break;
     case VTK_DOUBLE:
@@ -1098,7 +1147,7 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicGaussianCPUFilter(vtkMRMLAstroSmoot
   pnode->SetStatus(1);
 
   #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
-  #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, outFPixel, outDPixel, cancel, status)
+  #pragma omp parallel for schedule(static) shared(pnode, inFPixel, inDPixel, inIPixel, outFPixel, outDPixel, cancel, status)
   #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
   for (int elemCnt = 0; elemCnt < numElements; elemCnt++)
     {
@@ -1174,7 +1223,8 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicGaussianCPUFilter(vtkMRMLAstroSmoot
             switch (DataType)
               {
               case VTK_FLOAT:
-                *(outFPixel + elemCnt) += *(inFPixel + posData) * *(GaussKernel + posKernel);
+                *(outFPixel + elemCnt) += (inFPixel ? *(inFPixel + posData) :
+                  vtkMRMLAstroVolumeNode::GetScaledIntegerValue(inIPixel, inDataType, posData, bscale, bzero, blank)) * *(GaussKernel + posKernel);
                 break;
               case VTK_DOUBLE:
                 *(outDPixel + elemCnt) += *(inDPixel + posData) * *(GaussKernel + posKernel);
@@ -1227,8 +1277,7 @@ int vtkSlicerAstroSmoothingLogic::AnisotropicGaussianCPUFilter(vtkMRMLAstroSmoot
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   gettimeofday(&end, NULL);
 
@@ -1604,8 +1653,7 @@ int vtkSlicerAstroSmoothingLogic::IsotropicGaussianCPUFilter(vtkMRMLAstroSmoothi
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   gettimeofday(&end, NULL);
 
@@ -1727,8 +1775,7 @@ int vtkSlicerAstroSmoothingLogic::GaussianGPUFilter(vtkMRMLAstroSmoothingParamet
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   pnode->SetStatus(100);
 
@@ -1981,8 +2028,7 @@ int vtkSlicerAstroSmoothingLogic::GradientCPUFilter(vtkMRMLAstroSmoothingParamet
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   double noiseMean = StringToDouble(outputVolume->GetAttribute("SlicerAstro.RMSMEAN"));
 
@@ -1999,8 +2045,7 @@ int vtkSlicerAstroSmoothingLogic::GradientCPUFilter(vtkMRMLAstroSmoothingParamet
       }
     }
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   gettimeofday(&end, NULL);
 
@@ -2132,8 +2177,7 @@ int vtkSlicerAstroSmoothingLogic::GradientGPUFilter(vtkMRMLAstroSmoothingParamet
 
   gettimeofday(&start, NULL);
 
-  outputVolume->UpdateRangeAttributes();
-  outputVolume->UpdateNoiseAttributes();
+  outputVolume->UpdateStatisticsAttributes();
 
   pnode->SetStatus(100);
 
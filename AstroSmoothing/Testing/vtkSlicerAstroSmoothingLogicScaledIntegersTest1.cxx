@@ -0,0 +1,171 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Logic includes
+#include <vtkSlicerAstroSmoothingLogic.h>
+
+// MRML includes
+#include <vtkMRMLAstroSmoothingParametersNode.h>
+#include <vtkMRMLAstroVolumeNode.h>
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+const int Dims[3] = {16, 16, 8};
+const int Blank[3] = {8, 8, 4};
+
+//-----------------------------------------------------------------------------
+float OutputValue(vtkMRMLAstroVolumeNode* volumeNode, int i, int j, int k)
+{
+  return *static_cast<float*>(volumeNode->GetImageData()->GetScalarPointer(i, j, k));
+}
+
+//-----------------------------------------------------------------------------
+// the smoothed voxels next to the BLANK voxel are NaN, the others
+// are computed from the physical values
+bool CheckOutput(const char* filter, vtkMRMLAstroVolumeNode* outputVolume,
+                 int near[3], int far[3], double expected)
+{
+  if (outputVolume->GetImageData()->GetScalarType() != VTK_FLOAT)
+    {
+    std::cerr << filter << ": the output is not float." << std::endl;
+    return false;
+    }
+
+  float value = OutputValue(outputVolume, Blank[0], Blank[1], Blank[2]);
+  if (value == value)
+    {
+    std::cerr << filter << ": the BLANK voxel is " << value << ", expected NaN." << std::endl;
+    return false;
+    }
+  value = OutputValue(outputVolume, near[0], near[1], near[2]);
+  if (value == value)
+    {
+    std::cerr << filter << ": the neighbour of the BLANK voxel is "
+              << value << ", expected NaN." << std::endl;
+    return false;
+    }
+  value = OutputValue(outputVolume, far[0], far[1], far[2]);
+  if (value != value || (expected > 0. && fabs(value - expected) > 1.e-5))
+    {
+    std::cerr << filter << ": a voxel far from the BLANK voxel is "
+              << value << ", expected " << expected << std::endl;
+    return false;
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkSlicerAstroSmoothingLogicScaledIntegersTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  vtkNew<vtkMRMLScene> scene;
+
+  vtkNew<vtkSlicerAstroSmoothingLogic> logic;
+  logic->SetMRMLScene(scene.GetPointer());
+
+  // a scaled integer cube with physical value 0.5 * 4 + 1 = 3
+  // and one BLANK voxel
+  vtkNew<vtkImageData> imageData;
+  imageData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  imageData->AllocateScalars(VTK_SHORT, 1);
+  imageData->GetPointData()->GetScalars()->FillComponent(0, 4.);
+  *static_cast<short*>(imageData->GetScalarPointer(Blank[0], Blank[1], Blank[2])) = -32768;
+
+  vtkNew<vtkMRMLAstroVolumeNode> inputVolume;
+  inputVolume->SetAttribute("SlicerAstro.BITPIX", "16");
+  inputVolume->SetAttribute("SlicerAstro.BSCALE", "0.5");
+  inputVolume->SetAttribute("SlicerAstro.BZERO", "1.");
+  inputVolume->SetAttribute("SlicerAstro.BLANK", "-32768");
+  inputVolume->SetAndObserveImageData(imageData.GetPointer());
+  scene->AddNode(inputVolume.GetPointer());
+
+  vtkNew<vtkImageData> outputData;
+  outputData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  outputData->AllocateScalars(VTK_FLOAT, 1);
+
+  vtkNew<vtkMRMLAstroVolumeNode> outputVolume;
+  outputVolume->SetAttribute("SlicerAstro.BITPIX", "-32");
+  outputVolume->SetAndObserveImageData(outputData.GetPointer());
+  scene->AddNode(outputVolume.GetPointer());
+
+  vtkNew<vtkMRMLAstroSmoothingParametersNode> pnode;
+  pnode->SetInputVolumeNodeID(inputVolume->GetID());
+  pnode->SetOutputVolumeNodeID(outputVolume->GetID());
+  pnode->SetHardware(0);
+  pnode->SetCores(1);
+
+  // anisotropic box of 3 x 3 x 5 voxels
+  pnode->SetFilter(0);
+  pnode->SetParameterX(3.);
+  pnode->SetParameterY(3.);
+  pnode->SetParameterZ(5.);
+  if (!logic->Apply(pnode.GetPointer(), NULL))
+    {
+    std::cerr << "Box filter failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  int nearBox[3] = {Blank[0], Blank[1], Blank[2] + 2};
+  int farBox[3] = {2, 2, 4};
+  if (!CheckOutput("Box", outputVolume.GetPointer(), nearBox, farBox, 3.))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // anisotropic gaussian of 3 x 3 x 5 voxels
+  pnode->SetFilter(1);
+  pnode->SetAccuracy(5);
+  pnode->SetParameterX(1.);
+  pnode->SetParameterY(1.);
+  pnode->SetParameterZ(2.);
+  pnode->SetGaussianKernels();
+  if (pnode->GetKernelLengthX() != 3 || pnode->GetKernelLengthZ() != 5)
+    {
+    std::cerr << "Unexpected gaussian kernel of " << pnode->GetKernelLengthX()
+              << " x " << pnode->GetKernelLengthY() << " x " << pnode->GetKernelLengthZ()
+              << " voxels." << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!logic->Apply(pnode.GetPointer(), NULL))
+    {
+    std::cerr << "Gaussian filter failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  int nearGaussian[3] = {Blank[0] + 1, Blank[1], Blank[2]};
+  int farGaussian[3] = {2, 2, 4};
+  if (!CheckOutput("Gaussian", outputVolume.GetPointer(), nearGaussian, farGaussian, 0.))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -31,6 +31,7 @@
 #include <QFrame>
 #include <QHBoxLayout>
 #include <QLabel>
+#include <QPushButton>
 
 // CTK includes
 #include <ctkRangeWidget.h>
@@ -48,6 +49,7 @@
 #include <vtkGlyph3D.h>
 #include <vtkIdList.h>
 #include <vtkImageChangeInformation.h>
+#include <vtkImageConstantPad.h>
 #include <vtkImageFillROI.h>
 #include <vtkImageMathematics.h>
 #include <vtkImageStencil.h>
@@ -102,6 +104,7 @@
 #include "vtkMRMLSliceLogic.h"
 #include "vtkMRMLSliceLayerLogic.h"
 #include "vtkOrientedImageDataResample.h"
+#include "vtkSlicerSegmentationsModuleLogic.h"
 #include "vtkSlicerApplicationLogic.h"
 
 //-----------------------------------------------------------------------------
@@ -240,6 +243,21 @@ double StringToDouble(const char* str)
   return StringToNumber<double>(str);
 }
 
+//----------------------------------------------------------------------------
+/// Copy the extent of image in croppedImage (padded with zeros outside of image)
+void CropOrientedImageData(vtkOrientedImageData *image, int extent[6],
+                           vtkOrientedImageData *croppedImage)
+{
+  vtkNew<vtkImageConstantPad> padder;
+  padder->SetInputData(image);
+  padder->SetOutputWholeExtent(extent);
+  padder->SetConstant(0);
+  padder->Update();
+
+  croppedImage->ShallowCopy(padder->GetOutput());
+  croppedImage->CopyDirections(image);
+}
+
 }// end namespace
 
 //-----------------------------------------------------------------------------
@@ -257,12 +275,20 @@ qSlicerSegmentEditorAstroCloudLassoEffectPrivate::qSlicerSegmentEditorAstroCloud
   , AutomaticThresholdCheckbox(NULL)
   , ThresholdRangeLabel(NULL)
   , ThresholdRangeWidget(NULL)
+  , UndoButton(NULL)
+  , RedoButton(NULL)
   , distance(0.)
 {
   this->Normals[0] = 0.;
   this->Normals[1] = 0.;
   this->Normals[2] = 0.;
 
+  for (int ii = 0; ii < 3; ii++)
+    {
+    this->LastMaskExtent[2 * ii] = 0;
+    this->LastMaskExtent[2 * ii + 1] = -1;
+    }
+
   this->PaintCoordinates_World = vtkSmartPointer<vtkPoints>::New();
   this->PaintLines_World = vtkSmartPointer<vtkCellArray>::New();
   this->FeedbackPolyData = vtkSmartPointer<vtkPolyData>::New();
@@ -364,9 +390,22 @@ void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::init()
   this->EraseModeCheckbox->setToolTip("Activate or deactivate Erase Mode. The shortcut key is 'x'.");
   q->addOptionsWidget(this->EraseModeCheckbox);
 
+  this->UndoButton = new QPushButton("Undo");
+  this->UndoButton->setToolTip("Undo the last selection. The shortcut key is 'z'.");
+  this->RedoButton = new QPushButton("Redo");
+  this->RedoButton->setToolTip("Redo the last undone selection. The shortcut key is 'y'.");
+  QFrame* undoFrame = new QFrame();
+  undoFrame->setLayout(new QHBoxLayout());
+  undoFrame->layout()->addWidget(this->UndoButton);
+  undoFrame->layout()->addWidget(this->RedoButton);
+  q->addOptionsWidget(undoFrame);
+  this->updateUndoButtons();
+
   QObject::connect(this->ThresholdRangeWidget, SIGNAL(valuesChanged(double,double)), q, SLOT(onThresholdValueChanged(double, double)));
   QObject::connect(this->EraseModeCheckbox, SIGNAL(clicked(bool)), q, SLOT(onEraseModeChanged(bool)));
   QObject::connect(this->AutomaticThresholdCheckbox, SIGNAL(clicked(bool)), q, SLOT(onAutomaticThresholdModeChanged(bool)));
+  QObject::connect(this->UndoButton, SIGNAL(clicked()), q, SLOT(onUndo()));
+  QObject::connect(this->RedoButton, SIGNAL(clicked()), q, SLOT(onRedo()));
 
   vtkMRMLUnitNode* unitNodeIntensity = qSlicerCoreApplication::application()->applicationLogic()->GetSelectionNode()->GetUnitNode("intensity");
   this->qvtkConnect( unitNodeIntensity, vtkCommand::ModifiedEvent, this, SLOT(onUnitNodeIntensityChanged(vtkObject*)));
@@ -488,8 +527,6 @@ void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::paintApply(qMRMLWidget* v
     return;
     }
 
-  q->saveStateForUndo();
-
   qSlicerSegmentEditorAbstractEffect::ModificationMode modificationMode =
     (q->m_Erase ? qSlicerSegmentEditorAbstractEffect::ModificationModeRemove
       : qSlicerSegmentEditorAbstractEffect::ModificationModeAdd);
@@ -548,16 +585,43 @@ void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::paintApply(qMRMLWidget* v
       orientedBrushPositionerOutput.GetPointer(), vtkOrientedImageDataResample::OPERATION_MAXIMUM);
     }
 
-  // Store the modifierLabelmap for subsequent automatic thresholding on the same selection.
-  this->LastMask->DeepCopy(modifierLabelmap);
+  // Store the modifierLabelmap and the selectedSegmentLabelmap, cropped to the
+  // effective extent of the selection, for subsequent automatic thresholding on the same selection.
+  int *modificationExtent = modifierLabelmap->GetExtent();
+  bool emptySelection = true;
+  if (vtkOrientedImageDataResample::CalculateEffectiveExtent(modifierLabelmap, this->LastMaskExtent))
+    {
+    emptySelection = false;
+    CropOrientedImageData(modifierLabelmap, this->LastMaskExtent, this->LastMask);
+    CropOrientedImageData(selectedSegmentLabelmap, this->LastMaskExtent, this->LastSelectedSegmentLabelmap);
+    modificationExtent = this->LastMaskExtent;
+    }
+  else
+    {
+    this->clearLastMask();
+    }
 
-  // Store the selectedSegmentLabelmap for subsequent automatic thresholding on the same selection.
-  this->LastSelectedSegmentLabelmap->DeepCopy(selectedSegmentLabelmap);
+  // Only the modified bricks of the segments are stored for undo
+  vtkOrientedImageData* referenceGeometry = q->masterVolumeImageData();
+  if (!referenceGeometry || !vtkOrientedImageDataResample::DoGeometriesMatch(modifierLabelmap, referenceGeometry))
+    {
+    referenceGeometry = modifierLabelmap;
+    }
+  // An empty selection is still a (void) step, so that the undo
+  // store does not take it for a modification outside of its steps
+  const int emptyExtent[6] = {0, -1, 0, -1, 0, -1};
+  bool undoStep = this->beginUndoStep(referenceGeometry, emptySelection ? emptyExtent : modificationExtent);
 
   // Notify editor about changes
   modifierLabelmap->Modified();
 
-  q->modifySelectedSegmentByLabelmap(modifierLabelmap, modificationMode, modifierLabelmap->GetExtent());
+  q->modifySelectedSegmentByLabelmap(modifierLabelmap, modificationMode, modificationExtent);
+
+  if (undoStep)
+    {
+    this->UndoStore.endStep();
+    }
+  this->updateUndoButtons();
 
   this->PaintCoordinates_World->Reset();
   this->PaintLines_World->Reset();
@@ -754,15 +818,10 @@ void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::reApplyPaint()
     return;
     }
 
-  int Extent[6] = { 0, 0, 0, 0, 0, 0 };
-  this->LastMask->GetExtent(Extent);
-  int sum = 0.;
-  for (int ii = 0; ii < 6; ii++)
-    {
-    sum += abs(Extent[ii]);
-    }
-
-  if (sum <= 3)
+  // Thresholding, masking and segment update are limited to the effective extent of the last selection
+  if (this->LastMaskExtent[0] > this->LastMaskExtent[1] ||
+      this->LastMaskExtent[2] > this->LastMaskExtent[3] ||
+      this->LastMaskExtent[4] > this->LastMaskExtent[5])
     {
     return;
     }
@@ -772,33 +831,18 @@ void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::reApplyPaint()
     {
     return;
     }
-  // Make sure the modifier labelmap has the same geometry as the master volume
-  if (!vtkOrientedImageDataResample::DoGeometriesMatch(this->LastMask, masterVolumeOrientedImageData))
-    {
-    return;
-    }
 
   double ThresholdMinimumValue = q->doubleParameter("ThresholdMinimumValue");
   double ThresholdMaximumValue = q->doubleParameter("ThresholdMaximumValue");
-  // Create threshold image
-  vtkNew<vtkImageThreshold> threshold;
-  threshold->SetInputData(masterVolumeOrientedImageData);
-  threshold->ThresholdBetween(ThresholdMinimumValue, ThresholdMaximumValue);
-  threshold->SetInValue(1);
-  threshold->SetOutValue(0);
-  threshold->SetOutputScalarType(this->LastMask->GetScalarType());
-  threshold->Update();
-
-  vtkNew<vtkOrientedImageData> thresholdMask;
-  thresholdMask->DeepCopy(threshold->GetOutput());
-  vtkNew<vtkMatrix4x4> modifierLabelmapToWorldMatrix;
-  this->LastMask->GetImageToWorldMatrix(modifierLabelmapToWorldMatrix.GetPointer());
-  thresholdMask->SetGeometryFromImageToWorldMatrix(modifierLabelmapToWorldMatrix.GetPointer());
-
   vtkNew<vtkOrientedImageData> ThresholdLastMask;
-  ThresholdLastMask->DeepCopy(this->LastMask);
-  q->applyImageMask(ThresholdLastMask.GetPointer(), thresholdMask.GetPointer(), q->m_EraseValue);
+  if (!qSlicerSegmentEditorAstroCloudLassoEffect::ThresholdSelection(
+        masterVolumeOrientedImageData, this->LastMask, ThresholdMinimumValue,
+        ThresholdMaximumValue, ThresholdLastMask.GetPointer(), q->m_EraseValue))
+    {
+    return;
+    }
 
+  int Extent[6] = { 0, 0, 0, 0, 0, 0 };
   if (!vtkOrientedImageDataResample::CalculateEffectiveExtent(ThresholdLastMask.GetPointer(), Extent))
     {
     this->UndoLastMask = false;
@@ -809,41 +853,109 @@ void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::reApplyPaint()
     this->UndoLastMask = true;
     }
 
+  vtkMRMLSegmentationNode* segmentationNode = parameterNode->GetSegmentationNode();
+  const char* selectedSegmentID = parameterNode->GetSelectedSegmentID();
+  if (!segmentationNode || !selectedSegmentID)
+    {
+    q->defaultModifierLabelmap();
+    return;
+    }
+
+  // The update is merged in the undo step of the selection
+  bool undoStep = this->beginUndoStep(masterVolumeOrientedImageData, this->LastMaskExtent);
+
   if (this->UndoLastMask)
     {
-    vtkMRMLSegmentationNode* segmentationNode = q->parameterSetNode()->GetSegmentationNode();
-    const char* selectedSegmentID = q->parameterSetNode()->GetSelectedSegmentID();
-    if (!segmentationNode || !selectedSegmentID)
+    // Restore the selected segment in the extent of the selection
+    if (!vtkSlicerSegmentationsModuleLogic::SetBinaryLabelmapToSegment(
+        this->LastSelectedSegmentLabelmap, segmentationNode, selectedSegmentID,
+        vtkSlicerSegmentationsModuleLogic::MODE_REPLACE, this->LastMaskExtent))
       {
-      q->defaultModifierLabelmap();
+      qCritical() << Q_FUNC_INFO << ": Failed to restore the selected segment";
+      if (undoStep)
+        {
+        this->UndoStore.endStep(true);
+        }
       return;
       }
+    }
 
-    // Get binary labelmap representation of selected segment
-    vtkSegment* selectedSegment = segmentationNode->GetSegmentation()->GetSegment(selectedSegmentID);
-    if (!selectedSegment)
-      {
-      vtkGenericWarningMacro("vtkSlicerSegmentationsModuleLogic::SetBinaryLabelmapToSegment: Invalid selected segment");
-      return;
-      }
-    vtkOrientedImageData* segmentLabelmap = vtkOrientedImageData::SafeDownCast(
-      selectedSegment->GetRepresentation(vtkSegmentationConverter::GetSegmentationBinaryLabelmapRepresentationName()) );
-    if (!segmentLabelmap)
-      {
-      vtkErrorWithObjectMacro(segmentationNode, "vtkSlicerSegmentationsModuleLogic::SetBinaryLabelmapToSegment: "
-                                                "Failed to get binary labelmap representation in segmentation " << segmentationNode->GetName());
-      return;
-      }
+  // ThresholdLastMask is already thresholded: the master volume intensity mask,
+  // which would threshold the whole master volume again, is switched off for the update.
+  int wasModifying = parameterNode->StartModify();
+  bool masterVolumeIntensityMask = parameterNode->GetMasterVolumeIntensityMask();
+  parameterNode->SetMasterVolumeIntensityMask(false);
+  q->modifySelectedSegmentByLabelmap(ThresholdLastMask.GetPointer(),
+    qSlicerSegmentEditorAbstractEffect::ModificationModeAdd, this->LastMaskExtent);
+  parameterNode->SetMasterVolumeIntensityMask(masterVolumeIntensityMask);
+  parameterNode->EndModify(wasModifying);
 
-    segmentLabelmap->DeepCopy(this->LastSelectedSegmentLabelmap);
+  if (undoStep)
+    {
+    this->UndoStore.endStep(true);
     }
-
-  q->modifySelectedSegmentByLabelmap(this->LastMask,
-    qSlicerSegmentEditorAbstractEffect::ModificationModeAdd);
+  this->updateUndoButtons();
 
   q->CreateSurface(true);
 }
 
+//----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroCloudLassoEffectPrivate::beginUndoStep(vtkOrientedImageData* referenceGeometry,
+                                                                    const int extent[6])
+{
+  Q_Q(qSlicerSegmentEditorAstroCloudLassoEffect);
+
+  if (!q->parameterSetNode())
+    {
+    return false;
+    }
+  vtkMRMLSegmentationNode* segmentationNode = q->parameterSetNode()->GetSegmentationNode();
+  if (!segmentationNode)
+    {
+    return false;
+    }
+  // the Segment Editor undo reverts the steps of the store at once
+  if (!this->UndoStore.hasSteps(segmentationNode))
+    {
+    q->saveStateForUndo();
+    }
+  if (!this->UndoStore.beginStep(segmentationNode, referenceGeometry))
+    {
+    return false;
+    }
+
+  std::vector<std::string> segmentIDs;
+  segmentationNode->GetSegmentation()->GetSegmentIDs(segmentIDs);
+  for (size_t ii = 0; ii < segmentIDs.size(); ii++)
+    {
+    this->UndoStore.saveSegment(segmentIDs[ii], extent);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::clearLastMask()
+{
+  for (int ii = 0; ii < 3; ii++)
+    {
+    this->LastMaskExtent[2 * ii] = 0;
+    this->LastMaskExtent[2 * ii + 1] = -1;
+    }
+  this->LastMask->Initialize();
+  this->LastSelectedSegmentLabelmap->Initialize();
+}
+
+//----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::updateUndoButtons()
+{
+  if (!this->UndoButton || !this->RedoButton)
+    {
+    return;
+    }
+  this->UndoButton->setEnabled(this->UndoStore.canUndo());
+  this->RedoButton->setEnabled(this->UndoStore.canRedo());
+}
+
 //----------------------------------------------------------------------------
 void qSlicerSegmentEditorAstroCloudLassoEffectPrivate::onUnitNodeIntensityChanged(vtkObject *sender)
 {
@@ -1334,6 +1446,14 @@ bool qSlicerSegmentEditorAstroCloudLassoEffect::processInteractionEvents(
         d->reApplyPaint();
         }
       }
+    if (!strcmp(key, "z"))
+      {
+      this->onUndo();
+      }
+    if (!strcmp(key, "y"))
+      {
+      this->onRedo();
+      }
     if (!strcmp(key, "c"))
       {
       bool automaticThresholdMode = this->integerParameter("AutomaticThresholdMode");
@@ -1552,6 +1672,9 @@ void qSlicerSegmentEditorAstroCloudLassoEffect::updateGUIFromMRML()
   d->AutomaticThresholdCheckbox->setChecked(automaticThresholdMode);
   d->AutomaticThresholdCheckbox->setEnabled(!eraseMode);
 
+  // the undo history may have been cleared by an external modification
+  d->updateUndoButtons();
+
   double ThresholdSingleStep = this->doubleParameter("ThresholdSingleStep");
   double ThresholdMaximumValue = this->doubleParameter("ThresholdMaximumValue");
   double ThresholdMinimumValue = this->doubleParameter("ThresholdMinimumValue");
@@ -1647,3 +1770,80 @@ void qSlicerSegmentEditorAstroCloudLassoEffect::onEraseModeChanged(bool mode)
   this->setCommonParameter("ThresholdMaximumValue", max);
   this->updateGUIFromMRML();
 }
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroCloudLassoEffect::ThresholdSelection(
+  vtkOrientedImageData *masterImage, vtkOrientedImageData *selection,
+  double minimum, double maximum, vtkOrientedImageData *thresholdedSelection,
+  double eraseValue)
+{
+  if (!masterImage || !selection || !thresholdedSelection ||
+      !selection->GetPointData()->GetScalars())
+    {
+    return false;
+    }
+
+  // Make sure the selection has the same geometry as the master volume
+  // and lies inside it
+  if (!vtkOrientedImageDataResample::DoGeometriesMatch(selection, masterImage))
+    {
+    return false;
+    }
+  int *masterExtent = masterImage->GetExtent();
+  int *selectionExtent = selection->GetExtent();
+  for (int ii = 0; ii < 3; ii++)
+    {
+    if (selectionExtent[2 * ii] > selectionExtent[2 * ii + 1] ||
+        selectionExtent[2 * ii] < masterExtent[2 * ii] ||
+        selectionExtent[2 * ii + 1] > masterExtent[2 * ii + 1])
+      {
+      return false;
+      }
+    }
+
+  // Create threshold image (only the extent of the selection is requested)
+  vtkNew<vtkImageThreshold> threshold;
+  threshold->SetInputData(masterImage);
+  threshold->ThresholdBetween(minimum, maximum);
+  threshold->SetInValue(1);
+  threshold->SetOutValue(0);
+  threshold->SetOutputScalarType(selection->GetScalarType());
+  threshold->UpdateExtent(selectionExtent);
+
+  vtkNew<vtkOrientedImageData> thresholdMask;
+  thresholdMask->ShallowCopy(threshold->GetOutput());
+  vtkNew<vtkMatrix4x4> selectionToWorldMatrix;
+  selection->GetImageToWorldMatrix(selectionToWorldMatrix.GetPointer());
+  thresholdMask->SetGeometryFromImageToWorldMatrix(selectionToWorldMatrix.GetPointer());
+
+  thresholdedSelection->DeepCopy(selection);
+  qSlicerSegmentEditorAbstractEffect::applyImageMask(thresholdedSelection, thresholdMask.GetPointer(), eraseValue);
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroCloudLassoEffect::onUndo()
+{
+  Q_D(qSlicerSegmentEditorAstroCloudLassoEffect);
+
+  if (d->UndoStore.undo())
+    {
+    // the last selection does not match the segment anymore
+    d->clearLastMask();
+    this->CreateSurface(true);
+    }
+  d->updateUndoButtons();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroCloudLassoEffect::onRedo()
+{
+  Q_D(qSlicerSegmentEditorAstroCloudLassoEffect);
+
+  if (d->UndoStore.redo())
+    {
+    d->clearLastMask();
+    this->CreateSurface(true);
+    }
+  d->updateUndoButtons();
+}
@@ -30,6 +30,7 @@
 #include <ctkVTKObject.h>
 
 class qSlicerSegmentEditorAstroCloudLassoEffectPrivate;
+class vtkOrientedImageData;
 class vtkPolyData;
 class vtkObject;
 
@@ -83,6 +84,15 @@ public:
   /// Show Segment model
   virtual void CreateSurface(bool on);
 
+  /// Copy selection to thresholdedSelection, with eraseValue where
+  /// masterImage is out of [minimum, maximum]. Only the extent of the
+  /// selection is thresholded. Returns false if the selection does not
+  /// match the geometry of masterImage or is not inside it.
+  static bool ThresholdSelection(vtkOrientedImageData *masterImage, vtkOrientedImageData *selection,
+                                 double minimum, double maximum,
+                                 vtkOrientedImageData *thresholdedSelection,
+                                 double eraseValue = 0.);
+
 public slots:
   /// Update user interface from parameter set node
   virtual void updateGUIFromMRML();
@@ -96,6 +106,12 @@ public slots:
   /// Update Threshold value to optimal one when EraseMode is on/off
   virtual void onEraseModeChanged(bool mode);
 
+  /// Undo the last selection (only the modified bricks are restored)
+  virtual void onUndo();
+
+  /// Redo the last undone selection
+  virtual void onRedo();
+
 protected:
   /// Flag determining whether to paint or erase.
   /// Overridden in the \sa qSlicerSegmentEditorEraseEffect subclass
@@ -35,6 +35,7 @@
 #include "qSlicerAstroVolumeEditorEffectsExport.h"
 
 #include "qSlicerSegmentEditorAstroCloudLassoEffect.h"
+#include "qSlicerSegmentEditorAstroUndoStore.h"
 
 // CTK includes
 #include <ctkPimpl.h>
@@ -109,6 +110,16 @@ public:
   /// create a 3-D closed surface poly mask from the 2-D selection on the 3-D View
   void createClosedSurfacePolyMask(qMRMLWidget* viewWidget);
 
+  /// Start an undo step saving the segments within extent (IJK of referenceGeometry).
+  /// All the segments are saved, since other segments may be overwritten.
+  bool beginUndoStep(vtkOrientedImageData* referenceGeometry, const int extent[6]);
+
+  /// Forget the last selection (no automatic thresholding on it)
+  void clearLastMask();
+
+  /// Enable the undo/redo buttons
+  void updateUndoButtons();
+
 protected slots:
   /// reapply the paint if the threshold settings are changed
   void reApplyPaint();
@@ -161,10 +172,15 @@ public:
   vtkSmartPointer<vtkCellArray> CloudLasso3DSelectionStrips;
   vtkSmartPointer<vtkCellArray> CloudLasso3DSelectionPolys;
 
+  /// Last selection and selected segment, cropped to LastMaskExtent
   vtkSmartPointer<vtkOrientedImageData> LastMask;
   vtkSmartPointer<vtkOrientedImageData> LastSelectedSegmentLabelmap;
+  /// Effective extent of the last selection (empty if nothing was selected)
+  int LastMaskExtent[6];
   bool UndoLastMask;
 
+  qSlicerSegmentEditorAstroUndoStore UndoStore;
+
   QList<vtkActor2D*> FeedbackActors;
   QMap<qMRMLWidget*, BrushPipeline*> BrushPipelines;
   bool DelayedPaint;
@@ -179,6 +195,8 @@ public:
   QCheckBox* AutomaticThresholdCheckbox;
   QLabel* ThresholdRangeLabel;
   ctkRangeWidget *ThresholdRangeWidget;
+  QPushButton* UndoButton;
+  QPushButton* RedoButton;
 
   double distance;
   double Normals[3];
@@ -19,12 +19,21 @@
 
 // Segmentations includes
 #include "qSlicerSegmentEditorAstroContoursEffect.h"
+#include "qSlicerSegmentEditorAstroUndoStore.h"
 #include "vtkMRMLSegmentationDisplayNode.h"
 #include "vtkMRMLSegmentationNode.h"
 #include "vtkMRMLSegmentEditorNode.h"
 #include "vtkOrientedImageData.h"
 #include <vtkSlicerSegmentationsModuleLogic.h>
 
+// SlicerAstro includes
+#include "vtkSlicerAstroConfigure.h"
+
+// STD includes
+#include <algorithm>
+#include <climits>
+#include <vector>
+
 // Qt includes
 #include <QObject>
 #include <QDebug>
@@ -37,10 +46,12 @@
 #include <QString>
 
 // VTK includes
-#include <vtkImageThreshold.h>
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
 #include <vtkMatrix4x4.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
+#include <vtkPointData.h>
 #include <vtkSmartPointer.h>
 #include <vtkStringArray.h>
 
@@ -51,6 +62,11 @@
 // AstroMRML includes
 #include <vtkMRMLAstroVolumeNode.h>
 
+// OpenMP includes
+#ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+#include <omp.h>
+#endif
+
 //-----------------------------------------------------------------------------
 class qSlicerSegmentEditorAstroContoursEffectPrivate: public QObject
 {
@@ -62,13 +78,20 @@ public:
   ~qSlicerSegmentEditorAstroContoursEffectPrivate();
   void init();
 
+  /// Enable the undo/redo buttons
+  void updateUndoButtons();
+
   QIcon AstroContoursIcon;
 
+  qSlicerSegmentEditorAstroUndoStore UndoStore;
+
   QFrame* AstroContournsFrame;
   QLabel* DataInfoLabel;
   QLabel* ContourLevelsLabel;
   QLineEdit* ContourLevelsLineEdit;
   QPushButton* ApplyButton;
+  QPushButton* UndoButton;
+  QPushButton* RedoButton;
 
 protected slots:
 
@@ -114,6 +137,175 @@ std::string DoubleToString(double Value)
   return NumberToString<double>(Value);
 }
 
+//----------------------------------------------------------------------------
+// The sorted bounds of the [lower, higher] intervals of all the contours
+// split the data range in classes: the open intervals between two bounds
+// (even classes) and the bounds themselves (odd classes). Each voxel is
+// classified once, and each contour is the union of the classes it covers.
+class ContourClasses
+{
+public:
+  ContourClasses(const std::vector<double> &lower, const std::vector<double> &higher)
+    {
+    this->NumberOfContours = lower.size();
+    this->Bounds = lower;
+    this->Bounds.insert(this->Bounds.end(), higher.begin(), higher.end());
+    std::sort(this->Bounds.begin(), this->Bounds.end());
+    this->Bounds.erase(std::unique(this->Bounds.begin(), this->Bounds.end()), this->Bounds.end());
+
+    int numberOfBounds = this->Bounds.size();
+    this->Members.assign(this->GetNumberOfClasses() * this->NumberOfContours, 0);
+    this->Active.assign(this->GetNumberOfClasses(), false);
+    for (int contour = 0; contour < this->NumberOfContours; contour++)
+      {
+      for (int bound = 0; bound < numberOfBounds; bound++)
+        {
+        // the bound itself
+        if (lower[contour] <= this->Bounds[bound] && this->Bounds[bound] <= higher[contour])
+          {
+          this->Members[(2 * bound + 1) * this->NumberOfContours + contour] = 1;
+          this->Active[2 * bound + 1] = true;
+          }
+        // the open interval below the bound
+        if (bound > 0 && lower[contour] <= this->Bounds[bound - 1] &&
+            this->Bounds[bound] <= higher[contour])
+          {
+          this->Members[2 * bound * this->NumberOfContours + contour] = 1;
+          this->Active[2 * bound] = true;
+          }
+        }
+      }
+    }
+
+  int GetNumberOfClasses() const
+    {
+    return 2 * this->Bounds.size() + 1;
+    }
+
+  unsigned short Classify(double value) const
+    {
+    std::vector<double>::const_iterator bound =
+      std::lower_bound(this->Bounds.begin(), this->Bounds.end(), value);
+    unsigned short index = 2 * (bound - this->Bounds.begin());
+    if (bound != this->Bounds.end() && *bound == value)
+      {
+      index++;
+      }
+    return index;
+    }
+
+  int NumberOfContours;
+  std::vector<double> Bounds;
+  /// Members[class * NumberOfContours + contour]
+  std::vector<short> Members;
+  /// the class belongs to at least one contour
+  std::vector<bool> Active;
+};
+
+//----------------------------------------------------------------------------
+// Single pass over the cube: store the class of each voxel and the
+// IJK extent of each class.
+template <typename T>
+void ClassifyContours(const T *pixel, const int dims[3], double bscale, double bzero,
+                      double blank, const ContourClasses &classes,
+                      unsigned short *classPixel, std::vector<int> &classExtents)
+{
+  const int numClasses = classes.GetNumberOfClasses();
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  classExtents.resize(6 * numClasses);
+  for (int cls = 0; cls < numClasses; cls++)
+    {
+    for (int axis = 0; axis < 3; axis++)
+      {
+      classExtents[6 * cls + 2 * axis] = INT_MAX;
+      classExtents[6 * cls + 2 * axis + 1] = INT_MIN;
+      }
+    }
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    {
+    std::vector<int> extents(classExtents);
+
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp for schedule(static)
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    for (int kk = 0; kk < dims[2]; kk++)
+      {
+      vtkIdType pos = kk * numSlice;
+      for (int jj = 0; jj < dims[1]; jj++)
+        {
+        for (int ii = 0; ii < dims[0]; ii++, pos++)
+          {
+          unsigned short cls = 0;
+          if (static_cast<double>(pixel[pos]) != blank)
+            {
+            cls = classes.Classify(bscale * pixel[pos] + bzero);
+            }
+          classPixel[pos] = cls;
+          if (!classes.Active[cls])
+            {
+            continue;
+            }
+          int *extent = &extents[6 * cls];
+          extent[0] = std::min(extent[0], ii);
+          extent[1] = std::max(extent[1], ii);
+          extent[2] = std::min(extent[2], jj);
+          extent[3] = std::max(extent[3], jj);
+          extent[4] = std::min(extent[4], kk);
+          extent[5] = std::max(extent[5], kk);
+          }
+        }
+      }
+
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp critical
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+      {
+      for (int cls = 0; cls < numClasses; cls++)
+        {
+        for (int axis = 0; axis < 3; axis++)
+          {
+          classExtents[6 * cls + 2 * axis] =
+            std::min(classExtents[6 * cls + 2 * axis], extents[6 * cls + 2 * axis]);
+          classExtents[6 * cls + 2 * axis + 1] =
+            std::max(classExtents[6 * cls + 2 * axis + 1], extents[6 * cls + 2 * axis + 1]);
+          }
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Write the labelmap of contour, cropped to extent, from the voxel classes
+void FillContourLabelmap(const unsigned short *classPixel, const int dims[3],
+                         const ContourClasses &classes, int contour,
+                         const int extent[6], short *outPixel)
+{
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  const int nx = extent[1] - extent[0] + 1;
+  const int ny = extent[3] - extent[2] + 1;
+  const short *members = &classes.Members[contour];
+  const int stride = classes.NumberOfContours;
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int kk = extent[4]; kk <= extent[5]; kk++)
+    {
+    for (int jj = extent[2]; jj <= extent[3]; jj++)
+      {
+      const unsigned short *in = classPixel + kk * numSlice + static_cast<vtkIdType>(jj) * dims[0];
+      short *out = outPixel + (static_cast<vtkIdType>(kk - extent[4]) * ny + (jj - extent[2])) * nx;
+      for (int ii = extent[0]; ii <= extent[1]; ii++)
+        {
+        out[ii - extent[0]] = members[in[ii] * stride];
+        }
+      }
+    }
+}
+
 }// end namespace
 
 //-----------------------------------------------------------------------------
@@ -156,7 +348,27 @@ void qSlicerSegmentEditorAstroContoursEffectPrivate::init()
   this->ApplyButton = new QPushButton("Create Contours");
   q->addOptionsWidget(this->ApplyButton);
 
+  this->UndoButton = new QPushButton("Undo");
+  this->UndoButton->setToolTip("Undo the last contours creation.");
+  this->RedoButton = new QPushButton("Redo");
+  this->RedoButton->setToolTip("Redo the last undone contours creation.");
+  QFrame* undoFrame = new QFrame();
+  undoFrame->setLayout(new QHBoxLayout());
+  undoFrame->layout()->addWidget(this->UndoButton);
+  undoFrame->layout()->addWidget(this->RedoButton);
+  q->addOptionsWidget(undoFrame);
+  this->updateUndoButtons();
+
   QObject::connect(this->ApplyButton, SIGNAL(clicked()), q, SLOT(CreateContours()));
+  QObject::connect(this->UndoButton, SIGNAL(clicked()), q, SLOT(onUndo()));
+  QObject::connect(this->RedoButton, SIGNAL(clicked()), q, SLOT(onRedo()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroContoursEffectPrivate::updateUndoButtons()
+{
+  this->UndoButton->setEnabled(this->UndoStore.canUndo());
+  this->RedoButton->setEnabled(this->UndoStore.canRedo());
 }
 
 //----------------------------------------------------------------------------
@@ -244,6 +456,9 @@ void qSlicerSegmentEditorAstroContoursEffect::updateGUIFromMRML()
              " ; RMS = " + DoubleToString(RMS) +
              " " + this->parameter("FluxUnit").toStdString();
   d->DataInfoLabel->setText(QString::fromStdString(DataInfo));
+
+  // the undo history may have been cleared by an external modification
+  d->updateUndoButtons();
 }
 
 //-----------------------------------------------------------------------------
@@ -462,11 +677,10 @@ void qSlicerSegmentEditorAstroContoursEffect::CreateContours()
     }
 
   // Create empty segment in current segmentation
-  this->scene()->SaveStateForUndo();
-
   vtkMRMLAstroVolumeNode* masterVolume = vtkMRMLAstroVolumeNode::SafeDownCast(
     this->parameterSetNode()->GetMasterVolumeNode());
 
+  std::vector<double> Lowers, Highers;
   for (int ii = 0; ii < Levels->GetNumberOfValues(); ii++)
     {
     double ContourLevel = Levels->GetValue(ii);
@@ -479,14 +693,6 @@ void qSlicerSegmentEditorAstroContoursEffect::CreateContours()
     std::string SegmentID = masterVolume->GetName();
     SegmentID += "Contour" + IntToString(ii + 1);
     SegmentIDs->InsertNextValue(SegmentID.c_str());
-    vtkSegment *Segment = segmentationNode->GetSegmentation()->GetSegment(SegmentID);
-    if(!Segment)
-      {
-      SegmentID = segmentationNode->GetSegmentation()->AddEmptySegment(SegmentID, SegmentID);
-      }
-
-    vtkNew<vtkImageThreshold> imageThreshold;
-    imageThreshold->SetInputData(masterVolume->GetImageData());
 
     double lower, higher;
     if (!renzogram)
@@ -516,23 +722,72 @@ void qSlicerSegmentEditorAstroContoursEffect::CreateContours()
         }
       }
 
-    imageThreshold->ThresholdBetween(lower, higher);
-    imageThreshold->SetInValue(1);
-    imageThreshold->SetOutValue(0);
-    imageThreshold->SetOutputScalarType(VTK_SHORT);
-    imageThreshold->Update();
-    vtkNew<vtkOrientedImageData> modifierLabelmap;
-    modifierLabelmap->DeepCopy(imageThreshold->GetOutput());
-    vtkNew<vtkMatrix4x4> IJKToRASMatrix;
-    masterVolume->GetIJKToRASMatrix(IJKToRASMatrix.GetPointer());
-    modifierLabelmap->SetGeometryFromImageToWorldMatrix(IJKToRASMatrix.GetPointer());
+    Lowers.push_back(lower);
+    Highers.push_back(higher);
+    }
+
+  if (SegmentIDs->GetNumberOfValues() == 0)
+    {
+    return;
+    }
+
+  // one pass over the cube classifies the voxels for all the levels
+  std::vector<vtkSmartPointer<vtkOrientedImageData> > labelmaps;
+  if (!qSlicerSegmentEditorAstroContoursEffect::CreateContourLabelmaps(
+        masterVolume, Lowers, Highers, labelmaps))
+    {
+    qCritical() << Q_FUNC_INFO << ": Failed to create the contour labelmaps";
+    return;
+    }
+
+  // Only the modified bricks of the contours are stored for undo
+  vtkNew<vtkMatrix4x4> IJKToRASMatrix;
+  masterVolume->GetIJKToRASMatrix(IJKToRASMatrix.GetPointer());
+  vtkNew<vtkOrientedImageData> referenceGeometry;
+  referenceGeometry->SetExtent(masterVolume->GetImageData()->GetExtent());
+  referenceGeometry->SetGeometryFromImageToWorldMatrix(IJKToRASMatrix.GetPointer());
+
+  // the Segment Editor undo reverts the steps of the store at once
+  if (!d->UndoStore.hasSteps(segmentationNode))
+    {
+    this->saveStateForUndo();
+    }
 
+  for (int contour = 0; contour < SegmentIDs->GetNumberOfValues(); contour++)
+    {
+    vtkOrientedImageData *modifierLabelmap = labelmaps[contour];
+    std::string SegmentID = SegmentIDs->GetValue(contour);
+    bool undoStep = d->UndoStore.beginStep(segmentationNode, referenceGeometry.GetPointer());
+    // the new segments are added within the undo step, which
+    // otherwise would take them for an external modification
+    vtkSegment *Segment = segmentationNode->GetSegmentation()->GetSegment(SegmentID);
+    if(!Segment)
+      {
+      SegmentID = segmentationNode->GetSegmentation()->AddEmptySegment(SegmentID, SegmentID);
+      SegmentIDs->SetValue(contour, SegmentID.c_str());
+      if (undoStep)
+        {
+        // undo removes the new segment
+        d->UndoStore.saveAddedSegment(SegmentID);
+        }
+      }
+    if (undoStep)
+      {
+      // the segment is replaced: its current extent is saved as well
+      d->UndoStore.saveSegment(SegmentID, modifierLabelmap->GetExtent(), true);
+      }
     if (!vtkSlicerSegmentationsModuleLogic::SetBinaryLabelmapToSegment(
-        modifierLabelmap.GetPointer(), segmentationNode, SegmentID, vtkSlicerSegmentationsModuleLogic::MODE_REPLACE))
+        modifierLabelmap, segmentationNode, SegmentID, vtkSlicerSegmentationsModuleLogic::MODE_REPLACE))
       {
       qCritical() << Q_FUNC_INFO << ": Failed to add modifier labelmap to selected segment";
       }
+    if (undoStep)
+      {
+      // all the contours are a single undo step
+      d->UndoStore.endStep(contour > 0);
+      }
     }
+  d->updateUndoButtons();
 
   for (int ii = 0; ii < segmentationNode->GetNumberOfDisplayNodes(); ii++)
     {
@@ -555,6 +810,112 @@ void qSlicerSegmentEditorAstroContoursEffect::CreateContours()
   this->CreateSurface(true);
 }
 
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroContoursEffect::CreateContourLabelmaps(
+  vtkMRMLAstroVolumeNode *volumeNode, const std::vector<double> &lowers,
+  const std::vector<double> &highers, std::vector<vtkSmartPointer<vtkOrientedImageData> > &labelmaps)
+{
+  labelmaps.clear();
+  if (!volumeNode || !volumeNode->GetImageData() ||
+      !volumeNode->GetImageData()->GetPointData()->GetScalars())
+    {
+    qCritical() << Q_FUNC_INFO << ": volume or image data not found";
+    return false;
+    }
+  // the classes of the voxels are stored in 16 bits
+  if (lowers.size() != highers.size() || 4 * lowers.size() + 1 > USHRT_MAX)
+    {
+    qCritical() << Q_FUNC_INFO << ": wrong number of contour levels";
+    return false;
+    }
+
+  vtkImageData *imageData = volumeNode->GetImageData();
+  vtkDataArray *scalars = imageData->GetPointData()->GetScalars();
+  int dims[3];
+  imageData->GetDimensions(dims);
+  double bscale = 1., bzero = 0.;
+  volumeNode->GetDataScaling(bscale, bzero);
+  double blank = volumeNode->GetDataBlank();
+
+  ContourClasses classes(lowers, highers);
+  std::vector<unsigned short> classPixel(static_cast<size_t>(dims[0]) * dims[1] * dims[2]);
+  std::vector<int> classExtents;
+  switch (scalars->GetDataType())
+    {
+    vtkTemplateMacro(ClassifyContours(static_cast<VTK_TT*>(scalars->GetVoidPointer(0)),
+                                      dims, bscale, bzero, blank, classes,
+                                      &classPixel[0], classExtents));
+    default:
+      qCritical() << Q_FUNC_INFO << ": unknown scalar type";
+      return false;
+    }
+
+  vtkNew<vtkMatrix4x4> IJKToRASMatrix;
+  volumeNode->GetIJKToRASMatrix(IJKToRASMatrix.GetPointer());
+
+  for (int contour = 0; contour < classes.NumberOfContours; contour++)
+    {
+    // the labelmap is cropped to the classes of the contour
+    int extent[6] = {INT_MAX, INT_MIN, INT_MAX, INT_MIN, INT_MAX, INT_MIN};
+    for (int cls = 0; cls < classes.GetNumberOfClasses(); cls++)
+      {
+      if (!classes.Members[cls * classes.NumberOfContours + contour])
+        {
+        continue;
+        }
+      for (int axis = 0; axis < 3; axis++)
+        {
+        extent[2 * axis] = std::min(extent[2 * axis], classExtents[6 * cls + 2 * axis]);
+        extent[2 * axis + 1] = std::max(extent[2 * axis + 1], classExtents[6 * cls + 2 * axis + 1]);
+        }
+      }
+
+    vtkSmartPointer<vtkOrientedImageData> labelmap = vtkSmartPointer<vtkOrientedImageData>::New();
+    if (extent[0] > extent[1])
+      {
+      // empty contour
+      labelmap->SetExtent(0, 0, 0, 0, 0, 0);
+      labelmap->AllocateScalars(VTK_SHORT, 1);
+      *static_cast<short*>(labelmap->GetScalarPointer()) = 0;
+      }
+    else
+      {
+      labelmap->SetExtent(extent);
+      labelmap->AllocateScalars(VTK_SHORT, 1);
+      FillContourLabelmap(&classPixel[0], dims, classes, contour, extent,
+                          static_cast<short*>(labelmap->GetScalarPointer()));
+      }
+    labelmap->SetGeometryFromImageToWorldMatrix(IJKToRASMatrix.GetPointer());
+    labelmaps.push_back(labelmap);
+    }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroContoursEffect::onUndo()
+{
+  Q_D(qSlicerSegmentEditorAstroContoursEffect);
+
+  if (d->UndoStore.undo())
+    {
+    this->CreateSurface(true);
+    }
+  d->updateUndoButtons();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroContoursEffect::onRedo()
+{
+  Q_D(qSlicerSegmentEditorAstroContoursEffect);
+
+  if (d->UndoStore.redo())
+    {
+    this->CreateSurface(true);
+    }
+  d->updateUndoButtons();
+}
+
 //-----------------------------------------------------------------------------
 qSlicerSegmentEditorAbstractEffect* qSlicerSegmentEditorAstroContoursEffect::clone()
 {
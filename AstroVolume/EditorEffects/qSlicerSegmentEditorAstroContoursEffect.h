@@ -25,7 +25,15 @@
 
 #include "qSlicerSegmentEditorAbstractLabelEffect.h"
 
+// STD includes
+#include <vector>
+
+// VTK includes
+#include <vtkSmartPointer.h>
+
 class qSlicerSegmentEditorAstroContoursEffectPrivate;
+class vtkMRMLAstroVolumeNode;
+class vtkOrientedImageData;
 class QString;
 
 /// \ingroup SlicerRt_QtModules_Segmentations
@@ -65,6 +73,15 @@ public:
   /// Show Segment model
   virtual void CreateSurface(bool on);
 
+  /// Labelmaps of the voxels of volumeNode with physical values in
+  /// [lowers[i], highers[i]], from a single pass over the cube. Each
+  /// labelmap has the geometry of the volume and is cropped to the
+  /// extent of its voxels (a single background voxel if empty).
+  static bool CreateContourLabelmaps(vtkMRMLAstroVolumeNode *volumeNode,
+                                     const std::vector<double> &lowers,
+                                     const std::vector<double> &highers,
+                                     std::vector<vtkSmartPointer<vtkOrientedImageData> > &labelmaps);
+
 public slots:
   /// Update user interface from parameter set node
   virtual void updateGUIFromMRML();
@@ -75,6 +92,13 @@ public slots:
   /// Apply the Contours
   virtual void CreateContours();
 
+  /// Undo the last contours creation (only the modified bricks are restored,
+  /// and the new contour segments are removed)
+  virtual void onUndo();
+
+  /// Redo the last undone contours creation
+  virtual void onRedo();
+
 protected:
   QScopedPointer<qSlicerSegmentEditorAstroContoursEffectPrivate> d_ptr;
 
@@ -0,0 +1,815 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Segmentations includes
+#include "qSlicerSegmentEditorAstroUndoStore.h"
+#include "vtkMRMLSegmentationNode.h"
+#include "vtkOrientedImageData.h"
+#include "vtkOrientedImageDataResample.h"
+#include "vtkSegment.h"
+#include "vtkSegmentation.h"
+#include "vtkSegmentationConverter.h"
+#include <vtkSlicerSegmentationsModuleLogic.h>
+
+// STD includes
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <utility>
+
+// Qt includes
+#include <QDebug>
+
+// VTK includes
+#include <vtkCallbackCommand.h>
+#include <vtkImageCast.h>
+#include <vtkImageConstantPad.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+namespace
+{
+//----------------------------------------------------------------------------
+int FloorDivide(int value, int divisor)
+{
+  return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+//----------------------------------------------------------------------------
+bool IsExtentEmpty(const int extent[6])
+{
+  return extent[0] > extent[1] || extent[2] > extent[3] || extent[4] > extent[5];
+}
+
+//----------------------------------------------------------------------------
+/// Grow extent to the bricks containing it, clipped to wholeExtent
+void AlignExtentToBricks(const int extent[6], const int wholeExtent[6],
+                         int brickSize, int alignedExtent[6])
+{
+  for (int axis = 0; axis < 3; axis++)
+    {
+    alignedExtent[2 * axis] = std::max(
+      FloorDivide(extent[2 * axis], brickSize) * brickSize, wholeExtent[2 * axis]);
+    alignedExtent[2 * axis + 1] = std::min(
+      (FloorDivide(extent[2 * axis + 1], brickSize) + 1) * brickSize - 1, wholeExtent[2 * axis + 1]);
+    }
+}
+
+//----------------------------------------------------------------------------
+/// Last index of the brick starting at first, clipped to last
+int BrickEnd(int first, int last, int brickSize)
+{
+  return std::min((FloorDivide(first, brickSize) + 1) * brickSize - 1, last);
+}
+
+//----------------------------------------------------------------------------
+void CopyGeometry(vtkOrientedImageData* geometry, vtkOrientedImageData* image)
+{
+  vtkNew<vtkMatrix4x4> imageToWorldMatrix;
+  geometry->GetImageToWorldMatrix(imageToWorldMatrix.GetPointer());
+  image->SetGeometryFromImageToWorldMatrix(imageToWorldMatrix.GetPointer());
+}
+
+//----------------------------------------------------------------------------
+vtkOrientedImageData* GetSegmentLabelmap(vtkMRMLSegmentationNode* segmentationNode,
+                                         const std::string& segmentID, bool &segmentExists)
+{
+  vtkSegment* segment = segmentationNode->GetSegmentation()->GetSegment(segmentID);
+  segmentExists = segment != NULL;
+  if (!segment)
+    {
+    return NULL;
+    }
+  vtkOrientedImageData* labelmap = vtkOrientedImageData::SafeDownCast(
+    segment->GetRepresentation(vtkSegmentationConverter::GetSegmentationBinaryLabelmapRepresentationName()));
+  if (!labelmap || !labelmap->GetPointData()->GetScalars())
+    {
+    return NULL;
+    }
+  return labelmap;
+}
+
+//----------------------------------------------------------------------------
+/// Read the segment labelmap in extent (IJK of geometry), with zeros where the
+/// segment is empty. With scalarType < 0 the scalar type of the segment is kept.
+bool ReadSegmentLabelmap(vtkMRMLSegmentationNode* segmentationNode, const std::string& segmentID,
+                         vtkOrientedImageData* geometry, const int extent[6], int scalarType,
+                         vtkOrientedImageData* output)
+{
+  bool segmentExists = false;
+  vtkOrientedImageData* labelmap = GetSegmentLabelmap(segmentationNode, segmentID, segmentExists);
+  if (!segmentExists)
+    {
+    return false;
+    }
+  if (scalarType < 0)
+    {
+    scalarType = labelmap ? labelmap->GetScalarType() : VTK_UNSIGNED_CHAR;
+    }
+
+  vtkSmartPointer<vtkImageData> image;
+  if (labelmap && !IsExtentEmpty(labelmap->GetExtent()))
+    {
+    vtkSmartPointer<vtkOrientedImageData> source = labelmap;
+    if (!vtkOrientedImageDataResample::DoGeometriesMatch(labelmap, geometry))
+      {
+      vtkNew<vtkOrientedImageData> reference;
+      CopyGeometry(geometry, reference.GetPointer());
+      reference->SetExtent(extent[0], extent[1], extent[2], extent[3], extent[4], extent[5]);
+      source = vtkSmartPointer<vtkOrientedImageData>::New();
+      if (!vtkOrientedImageDataResample::ResampleOrientedImageToReferenceOrientedImage(
+          labelmap, reference.GetPointer(), source))
+        {
+        return false;
+        }
+      }
+
+    int *sourceExtent = source->GetExtent();
+    bool overlap = true;
+    for (int axis = 0; axis < 3; axis++)
+      {
+      if (extent[2 * axis] > sourceExtent[2 * axis + 1] ||
+          extent[2 * axis + 1] < sourceExtent[2 * axis])
+        {
+        overlap = false;
+        }
+      }
+
+    if (overlap)
+      {
+      int paddedExtent[6];
+      std::copy(extent, extent + 6, paddedExtent);
+      vtkNew<vtkImageConstantPad> padder;
+      padder->SetInputData(source);
+      padder->SetOutputWholeExtent(paddedExtent);
+      padder->SetConstant(0);
+      padder->Update();
+      image = padder->GetOutput();
+
+      if (image->GetScalarType() != scalarType)
+        {
+        vtkNew<vtkImageCast> cast;
+        cast->SetInputData(image);
+        cast->SetOutputScalarType(scalarType);
+        cast->Update();
+        image = cast->GetOutput();
+        }
+      }
+    }
+
+  if (image)
+    {
+    output->ShallowCopy(image);
+    }
+  else
+    {
+    output->SetExtent(extent[0], extent[1], extent[2], extent[3], extent[4], extent[5]);
+    output->AllocateScalars(scalarType, 1);
+    memset(output->GetScalarPointer(), 0,
+           output->GetNumberOfPoints() * output->GetScalarSize());
+    }
+  CopyGeometry(geometry, output);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool BricksDiffer(vtkImageData* first, vtkImageData* second, const int extent[6])
+{
+  size_t rowSize = static_cast<size_t>(extent[1] - extent[0] + 1) * first->GetScalarSize();
+  for (int kk = extent[4]; kk <= extent[5]; kk++)
+    {
+    for (int jj = extent[2]; jj <= extent[3]; jj++)
+      {
+      if (memcmp(first->GetScalarPointer(extent[0], jj, kk),
+                 second->GetScalarPointer(extent[0], jj, kk), rowSize))
+        {
+        return true;
+        }
+      }
+    }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+/// Runs of equal bytes, stored as value and length - 1 (16 bits)
+class RunLengthEncoder
+{
+public:
+  RunLengthEncoder(std::vector<unsigned char> &data)
+    : Data(data)
+    , Value(0)
+    , Length(0)
+    {
+    }
+
+  void Push(const unsigned char *bytes, size_t numberOfBytes)
+    {
+    for (size_t ii = 0; ii < numberOfBytes; ii++)
+      {
+      if (this->Length > 0 && bytes[ii] == this->Value && this->Length < 65536)
+        {
+        this->Length++;
+        continue;
+        }
+      this->Flush();
+      this->Value = bytes[ii];
+      this->Length = 1;
+      }
+    }
+
+  void Flush()
+    {
+    if (this->Length == 0)
+      {
+      return;
+      }
+    this->Data.push_back(this->Value);
+    this->Data.push_back(static_cast<unsigned char>((this->Length - 1) & 0xff));
+    this->Data.push_back(static_cast<unsigned char>((this->Length - 1) >> 8));
+    this->Length = 0;
+    }
+
+protected:
+  std::vector<unsigned char> &Data;
+  unsigned char Value;
+  unsigned int Length;
+};
+
+//----------------------------------------------------------------------------
+void CompressBrick(vtkImageData* image, const int extent[6], std::vector<unsigned char> &data)
+{
+  size_t rowSize = static_cast<size_t>(extent[1] - extent[0] + 1) * image->GetScalarSize();
+  RunLengthEncoder encoder(data);
+  for (int kk = extent[4]; kk <= extent[5]; kk++)
+    {
+    for (int jj = extent[2]; jj <= extent[3]; jj++)
+      {
+      encoder.Push(static_cast<unsigned char*>(image->GetScalarPointer(extent[0], jj, kk)), rowSize);
+      }
+    }
+  encoder.Flush();
+}
+
+//----------------------------------------------------------------------------
+void DecompressBrick(const std::vector<unsigned char> &data, vtkImageData* image, const int extent[6])
+{
+  size_t rowSize = static_cast<size_t>(extent[1] - extent[0] + 1) * image->GetScalarSize();
+  int jj = extent[2], kk = extent[4];
+  unsigned char *row = static_cast<unsigned char*>(image->GetScalarPointer(extent[0], jj, kk));
+  size_t rowPosition = 0;
+  for (size_t ii = 0; ii + 2 < data.size(); ii += 3)
+    {
+    size_t length = (static_cast<size_t>(data[ii + 1]) | (static_cast<size_t>(data[ii + 2]) << 8)) + 1;
+    while (length > 0)
+      {
+      size_t numberOfBytes = std::min(length, rowSize - rowPosition);
+      memset(row + rowPosition, data[ii], numberOfBytes);
+      rowPosition += numberOfBytes;
+      length -= numberOfBytes;
+      if (rowPosition == rowSize)
+        {
+        rowPosition = 0;
+        if (++jj > extent[3])
+          {
+          jj = extent[2];
+          if (++kk > extent[5])
+            {
+            return;
+            }
+          }
+        row = static_cast<unsigned char*>(image->GetScalarPointer(extent[0], jj, kk));
+        }
+      }
+    }
+}
+
+}// end namespace
+
+//-----------------------------------------------------------------------------
+const int qSlicerSegmentEditorAstroUndoStore::BrickSize = 32;
+
+//-----------------------------------------------------------------------------
+qSlicerSegmentEditorAstroUndoStore::qSlicerSegmentEditorAstroUndoStore()
+  : LastStepMergeable(false)
+  , MaximumMemorySize(static_cast<size_t>(512) * 1024 * 1024)
+  , ModifyingSegments(false)
+{
+  this->SegmentationCallback = vtkSmartPointer<vtkCallbackCommand>::New();
+  this->SegmentationCallback->SetClientData(this);
+  this->SegmentationCallback->SetCallback(qSlicerSegmentEditorAstroUndoStore::onSegmentationModified);
+}
+
+//-----------------------------------------------------------------------------
+qSlicerSegmentEditorAstroUndoStore::~qSlicerSegmentEditorAstroUndoStore()
+{
+  this->observeSegmentationNode(NULL);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroUndoStore::observeSegmentationNode(vtkMRMLSegmentationNode* segmentationNode)
+{
+  if (this->ObservedSegmentationNode.GetPointer() == segmentationNode)
+    {
+    return;
+    }
+  if (this->ObservedSegmentationNode)
+    {
+    this->ObservedSegmentationNode->RemoveObserver(this->SegmentationCallback);
+    }
+  this->ObservedSegmentationNode = segmentationNode;
+  if (segmentationNode)
+    {
+    segmentationNode->AddObserver(vtkSegmentation::MasterRepresentationModified, this->SegmentationCallback);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroUndoStore::onSegmentationModified(vtkObject* vtkNotUsed(caller),
+                                                                unsigned long vtkNotUsed(eid),
+                                                                void* clientData,
+                                                                void* vtkNotUsed(callData))
+{
+  qSlicerSegmentEditorAstroUndoStore* self =
+    static_cast<qSlicerSegmentEditorAstroUndoStore*>(clientData);
+  if (!self || self->ModifyingSegments)
+    {
+    return;
+    }
+  // the stored bricks do not match the segments anymore
+  self->clear();
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::beginStep(vtkMRMLSegmentationNode* segmentationNode,
+                                                   vtkOrientedImageData* referenceGeometry)
+{
+  this->SavedSegments.clear();
+  this->CurrentStep = Step();
+
+  if (!segmentationNode || !referenceGeometry)
+    {
+    qCritical() << Q_FUNC_INFO << ": Invalid segmentation node or reference geometry";
+    return false;
+    }
+
+  if (this->ObservedSegmentationNode.GetPointer() != segmentationNode)
+    {
+    this->clear();
+    this->observeSegmentationNode(segmentationNode);
+    }
+
+  this->ModifyingSegments = true;
+  this->CurrentStep.SegmentationNode = segmentationNode;
+  this->CurrentStep.Geometry = vtkSmartPointer<vtkOrientedImageData>::New();
+  CopyGeometry(referenceGeometry, this->CurrentStep.Geometry);
+  this->CurrentStep.Geometry->SetExtent(referenceGeometry->GetExtent());
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::saveSegment(const std::string& segmentID,
+                                                     const int extent[6],
+                                                     bool includeSegmentExtent)
+{
+  vtkMRMLSegmentationNode* segmentationNode = this->CurrentStep.SegmentationNode;
+  vtkOrientedImageData* geometry = this->CurrentStep.Geometry;
+  if (!segmentationNode || !geometry)
+    {
+    qCritical() << Q_FUNC_INFO << ": no undo step has been started";
+    return false;
+    }
+
+  int savedExtent[6];
+  std::copy(extent, extent + 6, savedExtent);
+  if (includeSegmentExtent)
+    {
+    bool segmentExists = false;
+    vtkOrientedImageData* labelmap = GetSegmentLabelmap(segmentationNode, segmentID, segmentExists);
+    int segmentExtent[6] = {0, -1, 0, -1, 0, -1};
+    if (labelmap && vtkOrientedImageDataResample::DoGeometriesMatch(labelmap, geometry))
+      {
+      vtkOrientedImageDataResample::CalculateEffectiveExtent(labelmap, segmentExtent);
+      }
+    else if (labelmap)
+      {
+      geometry->GetExtent(segmentExtent);
+      }
+    if (!IsExtentEmpty(segmentExtent))
+      {
+      for (int axis = 0; axis < 3; axis++)
+        {
+        savedExtent[2 * axis] = std::min(savedExtent[2 * axis], segmentExtent[2 * axis]);
+        savedExtent[2 * axis + 1] = std::max(savedExtent[2 * axis + 1], segmentExtent[2 * axis + 1]);
+        }
+      }
+    }
+
+  SavedSegment saved;
+  saved.SegmentID = segmentID;
+  AlignExtentToBricks(savedExtent, geometry->GetExtent(), BrickSize, saved.Extent);
+  if (IsExtentEmpty(saved.Extent))
+    {
+    return true;
+    }
+
+  saved.Labelmap = vtkSmartPointer<vtkOrientedImageData>::New();
+  if (!ReadSegmentLabelmap(segmentationNode, segmentID, geometry, saved.Extent, -1, saved.Labelmap))
+    {
+    qCritical() << Q_FUNC_INFO << ": Failed to read segment " << segmentID.c_str();
+    return false;
+    }
+  this->SavedSegments.push_back(saved);
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroUndoStore::saveAddedSegment(const std::string& segmentID)
+{
+  if (!this->CurrentStep.SegmentationNode)
+    {
+    qCritical() << Q_FUNC_INFO << ": no undo step has been started";
+    return;
+    }
+  this->CurrentStep.AddedSegmentIDs.push_back(segmentID);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroUndoStore::endStep(bool mergeWithLastStep)
+{
+  Step& step = this->CurrentStep;
+  vtkMRMLSegmentationNode* segmentationNode = step.SegmentationNode;
+
+  for (size_t ii = 0; segmentationNode && ii < this->SavedSegments.size(); ii++)
+    {
+    SavedSegment& saved = this->SavedSegments[ii];
+    vtkNew<vtkOrientedImageData> current;
+    if (!ReadSegmentLabelmap(segmentationNode, saved.SegmentID, step.Geometry, saved.Extent,
+                             saved.Labelmap->GetScalarType(), current.GetPointer()))
+      {
+      continue;
+      }
+
+    step.Segments.push_back(SegmentDelta());
+    SegmentDelta& delta = step.Segments.back();
+    delta.SegmentID = saved.SegmentID;
+    delta.ScalarType = saved.Labelmap->GetScalarType();
+
+    int brick[6];
+    for (brick[4] = saved.Extent[4]; brick[4] <= saved.Extent[5]; brick[4] = brick[5] + 1)
+      {
+      brick[5] = BrickEnd(brick[4], saved.Extent[5], BrickSize);
+      for (brick[2] = saved.Extent[2]; brick[2] <= saved.Extent[3]; brick[2] = brick[3] + 1)
+        {
+        brick[3] = BrickEnd(brick[2], saved.Extent[3], BrickSize);
+        for (brick[0] = saved.Extent[0]; brick[0] <= saved.Extent[1]; brick[0] = brick[1] + 1)
+          {
+          brick[1] = BrickEnd(brick[0], saved.Extent[1], BrickSize);
+          if (!BricksDiffer(saved.Labelmap, current.GetPointer(), brick))
+            {
+            continue;
+            }
+          delta.Bricks.push_back(Brick());
+          std::copy(brick, brick + 6, delta.Bricks.back().Extent);
+          CompressBrick(saved.Labelmap, brick, delta.Bricks.back().Data);
+          }
+        }
+      }
+
+    if (delta.Bricks.empty())
+      {
+      step.Segments.pop_back();
+      }
+    }
+  this->SavedSegments.clear();
+
+  bool merge = false;
+  if (mergeWithLastStep && this->LastStepMergeable && !this->UndoSteps.empty())
+    {
+    Step& lastStep = this->UndoSteps.back();
+    merge = lastStep.SegmentationNode.GetPointer() == step.SegmentationNode.GetPointer() &&
+            vtkOrientedImageDataResample::DoGeometriesMatch(lastStep.Geometry, step.Geometry) &&
+            std::equal(lastStep.Geometry->GetExtent(), lastStep.Geometry->GetExtent() + 6,
+                       step.Geometry->GetExtent());
+    }
+
+  if (merge)
+    {
+    // the bricks of the last step hold the older content: only new bricks are added
+    Step& lastStep = this->UndoSteps.back();
+    for (size_t ii = 0; ii < step.Segments.size(); ii++)
+      {
+      SegmentDelta& delta = step.Segments[ii];
+      SegmentDelta* lastDelta = NULL;
+      for (size_t jj = 0; jj < lastStep.Segments.size(); jj++)
+        {
+        if (lastStep.Segments[jj].SegmentID == delta.SegmentID)
+          {
+          lastDelta = &lastStep.Segments[jj];
+          break;
+          }
+        }
+      if (!lastDelta)
+        {
+        lastStep.Segments.push_back(SegmentDelta());
+        lastStep.Segments.back().SegmentID = delta.SegmentID;
+        lastStep.Segments.back().ScalarType = delta.ScalarType;
+        lastStep.Segments.back().Bricks.swap(delta.Bricks);
+        continue;
+        }
+
+      std::set<std::pair<int, std::pair<int, int> > > lastBricks;
+      for (size_t jj = 0; jj < lastDelta->Bricks.size(); jj++)
+        {
+        const int *brickExtent = lastDelta->Bricks[jj].Extent;
+        lastBricks.insert(std::make_pair(brickExtent[0], std::make_pair(brickExtent[2], brickExtent[4])));
+        }
+      for (size_t jj = 0; jj < delta.Bricks.size(); jj++)
+        {
+        const int *brickExtent = delta.Bricks[jj].Extent;
+        if (lastBricks.count(std::make_pair(brickExtent[0], std::make_pair(brickExtent[2], brickExtent[4]))))
+          {
+          continue;
+          }
+        lastDelta->Bricks.push_back(Brick());
+        std::copy(brickExtent, brickExtent + 6, lastDelta->Bricks.back().Extent);
+        lastDelta->Bricks.back().Data.swap(delta.Bricks[jj].Data);
+        }
+      }
+    lastStep.AddedSegmentIDs.insert(lastStep.AddedSegmentIDs.end(),
+                                    step.AddedSegmentIDs.begin(), step.AddedSegmentIDs.end());
+    this->RedoSteps.clear();
+    }
+  else if (!step.Segments.empty() || !step.AddedSegmentIDs.empty())
+    {
+    this->UndoSteps.push_back(Step());
+    Step& newStep = this->UndoSteps.back();
+    newStep.SegmentationNode = step.SegmentationNode;
+    newStep.Geometry = step.Geometry;
+    newStep.Segments.swap(step.Segments);
+    newStep.AddedSegmentIDs.swap(step.AddedSegmentIDs);
+    this->RedoSteps.clear();
+    this->LastStepMergeable = true;
+    }
+  else if (!mergeWithLastStep)
+    {
+    this->LastStepMergeable = false;
+    }
+
+  this->CurrentStep = Step();
+  this->ModifyingSegments = false;
+  this->trimSteps();
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::replayStep(Step& step, Step& reverseStep)
+{
+  vtkMRMLSegmentationNode* segmentationNode = step.SegmentationNode;
+  if (!segmentationNode)
+    {
+    qWarning() << Q_FUNC_INFO << ": the segmentation node of the undo step has been removed";
+    return false;
+    }
+
+  reverseStep.SegmentationNode = segmentationNode;
+  reverseStep.Geometry = step.Geometry;
+
+  // the removed segments are added empty: their content is in the bricks
+  vtkSegmentation* segmentation = segmentationNode->GetSegmentation();
+  for (size_t ii = 0; ii < step.RemovedSegments.size(); ii++)
+    {
+    RemovedSegment& removed = step.RemovedSegments[ii];
+    if (segmentation->GetSegment(removed.SegmentID))
+      {
+      qWarning() << Q_FUNC_INFO << ": the segment " << removed.SegmentID.c_str() << " already exists";
+      continue;
+      }
+    std::string segmentID = segmentation->AddEmptySegment(removed.SegmentID, removed.Name);
+    vtkSegment* segment = segmentation->GetSegment(segmentID);
+    if (segment)
+      {
+      segment->SetColor(removed.Color);
+      }
+    reverseStep.AddedSegmentIDs.push_back(segmentID);
+    }
+
+  for (size_t ii = 0; ii < step.Segments.size(); ii++)
+    {
+    SegmentDelta& delta = step.Segments[ii];
+    if (delta.Bricks.empty())
+      {
+      continue;
+      }
+
+    int extent[6];
+    std::copy(delta.Bricks[0].Extent, delta.Bricks[0].Extent + 6, extent);
+    for (size_t jj = 1; jj < delta.Bricks.size(); jj++)
+      {
+      for (int axis = 0; axis < 3; axis++)
+        {
+        extent[2 * axis] = std::min(extent[2 * axis], delta.Bricks[jj].Extent[2 * axis]);
+        extent[2 * axis + 1] = std::max(extent[2 * axis + 1], delta.Bricks[jj].Extent[2 * axis + 1]);
+        }
+      }
+
+    vtkNew<vtkOrientedImageData> labelmap;
+    if (!ReadSegmentLabelmap(segmentationNode, delta.SegmentID, step.Geometry, extent,
+                             delta.ScalarType, labelmap.GetPointer()))
+      {
+      qWarning() << Q_FUNC_INFO << ": the segment " << delta.SegmentID.c_str() << " has been removed";
+      continue;
+      }
+
+    reverseStep.Segments.push_back(SegmentDelta());
+    SegmentDelta& reverseDelta = reverseStep.Segments.back();
+    reverseDelta.SegmentID = delta.SegmentID;
+    reverseDelta.ScalarType = delta.ScalarType;
+    reverseDelta.Bricks.resize(delta.Bricks.size());
+    for (size_t jj = 0; jj < delta.Bricks.size(); jj++)
+      {
+      std::copy(delta.Bricks[jj].Extent, delta.Bricks[jj].Extent + 6, reverseDelta.Bricks[jj].Extent);
+      CompressBrick(labelmap.GetPointer(), delta.Bricks[jj].Extent, reverseDelta.Bricks[jj].Data);
+      DecompressBrick(delta.Bricks[jj].Data, labelmap.GetPointer(), delta.Bricks[jj].Extent);
+      }
+
+    if (!vtkSlicerSegmentationsModuleLogic::SetBinaryLabelmapToSegment(
+        labelmap.GetPointer(), segmentationNode, delta.SegmentID,
+        vtkSlicerSegmentationsModuleLogic::MODE_REPLACE, extent))
+      {
+      qCritical() << Q_FUNC_INFO << ": Failed to restore segment " << delta.SegmentID.c_str();
+      }
+    }
+
+  for (size_t ii = 0; ii < step.AddedSegmentIDs.size(); ii++)
+    {
+    vtkSegment* segment = segmentation->GetSegment(step.AddedSegmentIDs[ii]);
+    if (!segment)
+      {
+      continue;
+      }
+    reverseStep.RemovedSegments.push_back(RemovedSegment());
+    RemovedSegment& removed = reverseStep.RemovedSegments.back();
+    removed.SegmentID = step.AddedSegmentIDs[ii];
+    removed.Name = segment->GetName() ? segment->GetName() : "";
+    segment->GetColor(removed.Color);
+    segmentation->RemoveSegment(step.AddedSegmentIDs[ii]);
+    }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::undo()
+{
+  if (this->UndoSteps.empty())
+    {
+    return false;
+    }
+
+  this->LastStepMergeable = false;
+  this->RedoSteps.push_back(Step());
+  this->ModifyingSegments = true;
+  bool success = this->replayStep(this->UndoSteps.back(), this->RedoSteps.back());
+  this->ModifyingSegments = false;
+  this->UndoSteps.pop_back();
+  if (!success)
+    {
+    this->RedoSteps.pop_back();
+    }
+  return success;
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::redo()
+{
+  if (this->RedoSteps.empty())
+    {
+    return false;
+    }
+
+  this->LastStepMergeable = false;
+  this->UndoSteps.push_back(Step());
+  this->ModifyingSegments = true;
+  bool success = this->replayStep(this->RedoSteps.back(), this->UndoSteps.back());
+  this->ModifyingSegments = false;
+  this->RedoSteps.pop_back();
+  if (!success)
+    {
+    this->UndoSteps.pop_back();
+    }
+  this->trimSteps();
+  return success;
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::canUndo() const
+{
+  return !this->UndoSteps.empty();
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::canRedo() const
+{
+  return !this->RedoSteps.empty();
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerSegmentEditorAstroUndoStore::hasSteps(vtkMRMLSegmentationNode* segmentationNode) const
+{
+  return segmentationNode && this->ObservedSegmentationNode.GetPointer() == segmentationNode &&
+         (this->canUndo() || this->canRedo());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroUndoStore::clear()
+{
+  this->UndoSteps.clear();
+  this->RedoSteps.clear();
+  this->SavedSegments.clear();
+  this->CurrentStep = Step();
+  this->LastStepMergeable = false;
+  this->ModifyingSegments = false;
+}
+
+//-----------------------------------------------------------------------------
+size_t qSlicerSegmentEditorAstroUndoStore::stepMemorySize(const Step& step)
+{
+  size_t size = sizeof(Step);
+  for (size_t ii = 0; ii < step.Segments.size(); ii++)
+    {
+    size += sizeof(SegmentDelta) + step.Segments[ii].SegmentID.size();
+    for (size_t jj = 0; jj < step.Segments[ii].Bricks.size(); jj++)
+      {
+      size += sizeof(Brick) + step.Segments[ii].Bricks[jj].Data.capacity();
+      }
+    }
+  for (size_t ii = 0; ii < step.AddedSegmentIDs.size(); ii++)
+    {
+    size += sizeof(std::string) + step.AddedSegmentIDs[ii].size();
+    }
+  for (size_t ii = 0; ii < step.RemovedSegments.size(); ii++)
+    {
+    size += sizeof(RemovedSegment) + step.RemovedSegments[ii].SegmentID.size() +
+            step.RemovedSegments[ii].Name.size();
+    }
+  return size;
+}
+
+//-----------------------------------------------------------------------------
+size_t qSlicerSegmentEditorAstroUndoStore::memorySize() const
+{
+  size_t size = 0;
+  std::list<Step>::const_iterator it;
+  for (it = this->UndoSteps.begin(); it != this->UndoSteps.end(); ++it)
+    {
+    size += stepMemorySize(*it);
+    }
+  for (it = this->RedoSteps.begin(); it != this->RedoSteps.end(); ++it)
+    {
+    size += stepMemorySize(*it);
+    }
+  return size;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroUndoStore::setMaximumMemorySize(size_t maximumMemorySize)
+{
+  this->MaximumMemorySize = maximumMemorySize;
+  this->trimSteps();
+}
+
+//-----------------------------------------------------------------------------
+size_t qSlicerSegmentEditorAstroUndoStore::maximumMemorySize() const
+{
+  return this->MaximumMemorySize;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerSegmentEditorAstroUndoStore::trimSteps()
+{
+  // the farthest redo steps go first
+  while (!this->RedoSteps.empty() && this->memorySize() > this->MaximumMemorySize)
+    {
+    this->RedoSteps.pop_front();
+    }
+  while (this->UndoSteps.size() > 1 && this->memorySize() > this->MaximumMemorySize)
+    {
+    this->UndoSteps.pop_front();
+    }
+}
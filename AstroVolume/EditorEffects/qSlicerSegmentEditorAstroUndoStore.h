@@ -0,0 +1,174 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+#ifndef __qSlicerSegmentEditorAstroUndoStore_h
+#define __qSlicerSegmentEditorAstroUndoStore_h
+
+// STD includes
+#include <list>
+#include <string>
+#include <vector>
+
+// VTK includes
+#include <vtkSmartPointer.h>
+#include <vtkWeakPointer.h>
+
+// Segmentations Editor Effects includes
+#include "qSlicerAstroVolumeEditorEffectsExport.h"
+
+class vtkCallbackCommand;
+class vtkMRMLSegmentationNode;
+class vtkObject;
+class vtkOrientedImageData;
+
+/// \brief Undo history of the Astro segment editor effects.
+///
+/// Instead of a copy of the scene, an undo step stores only the bricks
+/// of the segment labelmaps which have been modified. The bricks are
+/// BrickSize^3 voxels, aligned to the IJK grid of the reference geometry
+/// (the master volume), and are run-length compressed. Undo and redo
+/// write back only those bricks.
+///
+/// The store observes the segmentation node of its steps: if the segments
+/// are modified outside of a step (e.g. by another effect, or by the undo
+/// of the Segment Editor), the stored bricks do not match the segments
+/// anymore and the history is cleared. The effects save the state of the
+/// Segment Editor before the first step of a history (see hasSteps), so
+/// that the Segment Editor undo reverts all the steps of the store at once.
+class Q_SLICER_ASTROVOLUME_EFFECTS_EXPORT qSlicerSegmentEditorAstroUndoStore
+{
+public:
+  qSlicerSegmentEditorAstroUndoStore();
+  virtual ~qSlicerSegmentEditorAstroUndoStore();
+
+  /// Start an undo step on the segments of segmentationNode.
+  /// The bricks are defined on the IJK grid of referenceGeometry.
+  /// The history is cleared if segmentationNode is not the node of the last steps.
+  bool beginStep(vtkMRMLSegmentationNode* segmentationNode,
+                 vtkOrientedImageData* referenceGeometry);
+
+  /// Save the segment within extent (IJK of the reference geometry),
+  /// before modifying it. With includeSegmentExtent the effective extent
+  /// of the segment is saved as well (e.g. if the segment is replaced).
+  bool saveSegment(const std::string& segmentID, const int extent[6],
+                   bool includeSegmentExtent = false);
+
+  /// The segment segmentID has been added within the current step:
+  /// undo removes it and redo adds it again.
+  void saveAddedSegment(const std::string& segmentID);
+
+  /// Store the (compressed) bricks of the saved segments which have been
+  /// modified since saveSegment. With mergeWithLastStep the bricks are added
+  /// to the previous step (e.g. when the same selection is updated), unless
+  /// an undo or a redo happened in between.
+  void endStep(bool mergeWithLastStep = false);
+
+  bool undo();
+  bool redo();
+  bool canUndo() const;
+  bool canRedo() const;
+  void clear();
+
+  /// The store has undo or redo steps on the segments of segmentationNode
+  bool hasSteps(vtkMRMLSegmentationNode* segmentationNode) const;
+
+  /// Memory used by the undo and redo steps, in bytes
+  size_t memorySize() const;
+
+  /// The redo steps, then the oldest undo steps, are removed when the memory
+  /// used exceeds the maximum (in bytes). The last undo step is always kept.
+  void setMaximumMemorySize(size_t maximumMemorySize);
+  size_t maximumMemorySize() const;
+
+  static const int BrickSize;
+
+protected:
+  struct Brick
+    {
+    int Extent[6];
+    /// run-length compressed voxels
+    std::vector<unsigned char> Data;
+    };
+
+  struct SegmentDelta
+    {
+    std::string SegmentID;
+    int ScalarType;
+    std::vector<Brick> Bricks;
+    };
+
+  struct RemovedSegment
+    {
+    std::string SegmentID;
+    std::string Name;
+    double Color[3];
+    };
+
+  struct Step
+    {
+    vtkWeakPointer<vtkMRMLSegmentationNode> SegmentationNode;
+    /// geometry (without scalars) of the brick grid
+    vtkSmartPointer<vtkOrientedImageData> Geometry;
+    std::vector<SegmentDelta> Segments;
+    /// segments removed by the replay of the step (after the bricks)
+    std::vector<std::string> AddedSegmentIDs;
+    /// segments added (empty) by the replay of the step (before the bricks)
+    std::vector<RemovedSegment> RemovedSegments;
+    };
+
+  struct SavedSegment
+    {
+    std::string SegmentID;
+    int Extent[6];
+    vtkSmartPointer<vtkOrientedImageData> Labelmap;
+    };
+
+  static size_t stepMemorySize(const Step& step);
+
+  /// Write the bricks of step in the segments, storing the
+  /// overwritten bricks in reverseStep. The removed segments of step
+  /// are added before, and its added segments are removed after.
+  bool replayStep(Step& step, Step& reverseStep);
+
+  void trimSteps();
+
+  void observeSegmentationNode(vtkMRMLSegmentationNode* segmentationNode);
+
+  /// Clear the history when the segments are modified outside of the store
+  static void onSegmentationModified(vtkObject* caller, unsigned long eid,
+                                     void* clientData, void* callData);
+
+  std::list<Step> UndoSteps;
+  std::list<Step> RedoSteps;
+  Step CurrentStep;
+  std::vector<SavedSegment> SavedSegments;
+  /// the last endStep added a step that can be merged with
+  bool LastStepMergeable;
+  size_t MaximumMemorySize;
+  vtkWeakPointer<vtkMRMLSegmentationNode> ObservedSegmentationNode;
+  vtkSmartPointer<vtkCallbackCommand> SegmentationCallback;
+  /// the segments are being modified within a step, or by undo and redo
+  bool ModifyingSegments;
+
+private:
+  qSlicerSegmentEditorAstroUndoStore(const qSlicerSegmentEditorAstroUndoStore&);  /// Not implemented.
+  void operator=(const qSlicerSegmentEditorAstroUndoStore&);  /// Not implemented.
+};
+
+#endif
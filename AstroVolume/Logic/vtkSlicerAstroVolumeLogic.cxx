@@ -19,6 +19,11 @@
 
 // STD includes
 #include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <sys/time.h>
+#include <vector>
 
 // Slicer includes
 #include <vtkSlicerVolumesLogic.h>
@@ -42,6 +47,7 @@
 #include <vtkMRMLSegmentEditorNode.h>
 #include <vtkMRMLSliceNode.h>
 #include <vtkMRMLSliceViewDisplayableManagerFactory.h>
+#include <vtkMRMLTableNode.h>
 #include <vtkMRMLThreeDViewDisplayableManagerFactory.h>
 #include <vtkMRMLUnitNode.h>
 #include <vtkMRMLViewNode.h>
@@ -49,33 +55,38 @@
 #include <vtkMRMLVolumePropertyNode.h>
 
 //VTK includes
+#include <vtkAlgorithm.h>
+#include <vtkAlgorithmOutput.h>
 #include <vtkCacheManager.h>
 #include <vtkCollection.h>
 #include <vtkColorTransferFunction.h>
-#include <vtkGeneralTransform.h>
+#include <vtkDoubleArray.h>
+#include <vtkIdTypeArray.h>
 #include <vtkImageData.h>
+#include <vtkInformation.h>
+#include <vtkIntArray.h>
+#include <vtkMatrix4x4.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
 #include <vtkPiecewiseFunction.h>
 #include <vtkPointData.h>
 #include <vtkSmartPointer.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
+#include <vtkStringArray.h>
+#include <vtkTable.h>
+#include <vtkVariant.h>
 
 // WCS includes
 #include "wcslib.h"
 
-//----------------------------------------------------------------------------
-vtkStandardNewMacro(vtkSlicerAstroVolumeLogic);
-
-//----------------------------------------------------------------------------
-vtkSlicerAstroVolumeLogic::vtkSlicerAstroVolumeLogic()
-{
-  this->PresetsScene = 0;
-}
+// OpenMP includes
+#include "vtkSlicerAstroConfigure.h"
+#ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+#include <omp.h>
+#endif
 
 //----------------------------------------------------------------------------
-vtkSlicerAstroVolumeLogic::~vtkSlicerAstroVolumeLogic()
-{
-}
+vtkStandardNewMacro(vtkSlicerAstroVolumeLogic);
 
 namespace
 {
@@ -110,822 +121,2684 @@ std::string DoubleToString(double Value)
   return NumberToString<double>(Value);
 }
 
+const int HistogramCoarseBins = 4096;
+const int HistogramFineBins = 4096;
+/// fraction of the values left in the coarse tails
+const double HistogramTail = 0.001;
+
 //----------------------------------------------------------------------------
-template <typename T> bool isNaN(T value)
+template <typename T> bool HistogramRange(const T *pixel, vtkIdType numElements, double blank,
+                                          double &min, double &max)
 {
-  return value != value;
+  min = VTK_DOUBLE_MAX;
+  max = VTK_DOUBLE_MIN;
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  double threadMin = VTK_DOUBLE_MAX, threadMax = VTK_DOUBLE_MIN;
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType elemCnt = 0; elemCnt < numElements; elemCnt++)
+    {
+    const T value = pixel[elemCnt];
+    if (value != value || value == blank)
+      {
+      continue;
+      }
+    threadMin = value < threadMin ? value : threadMin;
+    threadMax = value > threadMax ? value : threadMax;
+    }
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp critical
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  min = std::min(min, threadMin);
+  max = std::max(max, threadMax);
+  }
+  }
+
+  return min <= max;
 }
 
 //----------------------------------------------------------------------------
-bool DoubleIsNaN(double Value)
+// Fill the coarse histogram of [min, max] (fine empty) or, if fine is not
+// empty, the fine histogram of the coarse bins [lowBin, highBin).
+// The threads fill private histograms.
+template <typename T> void FillHistogram(const T *pixel, vtkIdType numElements, double blank,
+                                         double min, double coarseWidth,
+                                         int lowBin, int highBin,
+                                         std::vector<vtkIdType> &coarse,
+                                         std::vector<vtkIdType> &fine)
 {
-  return isNaN<double>(Value);
+  const bool refine = !fine.empty();
+  const int numCoarseBins = static_cast<int>(coarse.size());
+  const int numFineBins = static_cast<int>(fine.size());
+  const double low = min + lowBin * coarseWidth;
+  const double fineWidth = refine ? (highBin - lowBin) * coarseWidth / numFineBins : 1.;
+  std::vector<vtkIdType> &histogram = refine ? fine : coarse;
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  std::vector<vtkIdType> threadHistogram(histogram.size(), 0);
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType elemCnt = 0; elemCnt < numElements; elemCnt++)
+    {
+    const T value = pixel[elemCnt];
+    if (value != value || value == blank)
+      {
+      continue;
+      }
+    const int coarseBin = std::min(static_cast<int>((value - min) / coarseWidth), numCoarseBins - 1);
+    if (!refine)
+      {
+      threadHistogram[coarseBin]++;
+      }
+    else if (coarseBin >= lowBin && coarseBin < highBin)
+      {
+      const int fineBin = static_cast<int>((value - low) / fineWidth);
+      threadHistogram[std::max(0, std::min(fineBin, numFineBins - 1))]++;
+      }
+    }
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp critical
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (size_t bin = 0; bin < histogram.size(); bin++)
+    {
+    histogram[bin] += threadHistogram[bin];
+    }
+  }
 }
 
 //----------------------------------------------------------------------------
-bool FloatIsNaN(double Value)
+// Adaptive histogram of the stored values: HistogramCoarseBins bins over
+// the whole range, with the coarse bins holding all but the HistogramTail
+// tails split in HistogramFineBins bins. Edges has Counts.size() + 1 values.
+template <typename T> bool AdaptiveHistogram(const T *pixel, vtkIdType numElements, double blank,
+                                             std::vector<double> &edges,
+                                             std::vector<vtkIdType> &counts)
 {
-  return isNaN<float>(Value);
-}
+  edges.clear();
+  counts.clear();
 
-}// end namespace
+  double min, max;
+  if (!HistogramRange(pixel, numElements, blank, min, max))
+    {
+    return false;
+    }
+
+  std::vector<vtkIdType> coarse(HistogramCoarseBins, 0), fine;
+  const double coarseWidth = max > min ? (max - min) / HistogramCoarseBins : 1.;
+  FillHistogram(pixel, numElements, blank, min, coarseWidth, 0, 0, coarse, fine);
+  if (!(max > min))
+    {
+    edges.push_back(min);
+    edges.push_back(max);
+    counts.push_back(coarse[0]);
+    return true;
+    }
+
+  // coarse bins of the body of the distribution
+  vtkIdType total = 0;
+  for (int bin = 0; bin < HistogramCoarseBins; bin++)
+    {
+    total += coarse[bin];
+    }
+  const double tail = HistogramTail * total;
+  int lowBin = 0, highBin = HistogramCoarseBins;
+  vtkIdType cumulative = 0;
+  for (int bin = 0; bin < HistogramCoarseBins; bin++)
+    {
+    if (cumulative + coarse[bin] > tail)
+      {
+      lowBin = bin;
+      break;
+      }
+    cumulative += coarse[bin];
+    }
+  cumulative = 0;
+  for (int bin = HistogramCoarseBins - 1; bin >= 0; bin--)
+    {
+    if (cumulative + coarse[bin] > tail)
+      {
+      highBin = bin + 1;
+      break;
+      }
+    cumulative += coarse[bin];
+    }
+
+  fine.assign(HistogramFineBins, 0);
+  FillHistogram(pixel, numElements, blank, min, coarseWidth, lowBin, highBin, coarse, fine);
+
+  const double low = min + lowBin * coarseWidth;
+  const double fineWidth = (highBin - lowBin) * coarseWidth / HistogramFineBins;
+  for (int bin = 0; bin < lowBin; bin++)
+    {
+    edges.push_back(min + bin * coarseWidth);
+    counts.push_back(coarse[bin]);
+    }
+  for (int bin = 0; bin < HistogramFineBins; bin++)
+    {
+    edges.push_back(low + bin * fineWidth);
+    counts.push_back(fine[bin]);
+    }
+  for (int bin = highBin; bin < HistogramCoarseBins; bin++)
+    {
+    edges.push_back(min + bin * coarseWidth);
+    counts.push_back(coarse[bin]);
+    }
+  edges.push_back(max);
+
+  return true;
+}
 
 //----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::PrintSelf(ostream& os, vtkIndent indent)
+// Allocate output with the given structure and zero-filled scalars of
+// scalarType.
+void AllocateZeroedImageData(int extent[6], const double origin[3], const double spacing[3],
+                             int numComponents, int scalarType, vtkImageData *output)
 {
-  this->Superclass::PrintSelf(os, indent);
+  output->Initialize();
+  output->SetExtent(extent);
+  output->SetOrigin(origin[0], origin[1], origin[2]);
+  output->SetSpacing(spacing[0], spacing[1], spacing[2]);
+  output->AllocateScalars(scalarType, numComponents);
+
+  char *pointer = static_cast<char*>(output->GetScalarPointer());
+  const vtkIdType numBytes = output->GetNumberOfPoints() *
+    output->GetNumberOfScalarComponents() * output->GetScalarSize();
+  const vtkIdType chunkSize = 16 * 1024 * 1024;
+  const vtkIdType numChunks = (numBytes + chunkSize - 1) / chunkSize;
+
+  // first touch by the threads
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType chunk = 0; chunk < numChunks; chunk++)
+    {
+    const vtkIdType first = chunk * chunkSize;
+    memset(pointer + first, 0, std::min(chunkSize, numBytes - first));
+    }
 }
 
-//---------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::UpdateFromMRMLScene()
+//----------------------------------------------------------------------------
+// Allocate output with the structure (extent, origin, spacing and number of
+// components) of input and zero-filled scalars of scalarType.
+void AllocateZeroedImageData(vtkImageData *input, int scalarType, vtkImageData *output)
 {
-  assert(this->GetMRMLScene() != 0);
+  AllocateZeroedImageData(input->GetExtent(), input->GetOrigin(), input->GetSpacing(),
+                          input->GetNumberOfScalarComponents(), scalarType, output);
 }
 
 //----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::SetMRMLSceneInternal(vtkMRMLScene * newScene)
+// Allocate output with the whole extent of the image data of volumeNode and
+// zero-filled scalars of scalarType (the type of the volume if VTK_VOID).
+// The structure comes from the pipeline information of the producer of the
+// image data, so the voxels of on-demand volumes are not read.
+bool AllocateZeroedImageData(vtkMRMLAstroVolumeNode *volumeNode, int scalarType, vtkImageData *output)
 {
-  // List of events the slice logics should listen
-  vtkNew<vtkIntArray> events;
+  vtkAlgorithmOutput *connection = volumeNode->GetImageDataConnection();
+  vtkAlgorithm *producer = connection ? connection->GetProducer() : NULL;
+  if (producer == NULL)
+    {
+    return false;
+    }
 
-  // Events that use the default priority.  Don't care the order they
-  // are triggered
-  events->InsertNextValue(vtkMRMLScene::NodeAddedEvent);
-  events->InsertNextValue(vtkMRMLScene::NodeRemovedEvent);
-  events->InsertNextValue(vtkMRMLScene::EndImportEvent);
+  producer->UpdateInformation();
+  vtkInformation *outInfo = producer->GetOutputInformation(connection->GetIndex());
+  if (!outInfo || !outInfo->Has(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT()))
+    {
+    return false;
+    }
 
-  this->SetAndObserveMRMLSceneEventsInternal(newScene, events.GetPointer());
+  int wholeExtent[6];
+  double origin[3] = {0., 0., 0.}, spacing[3] = {1., 1., 1.};
+  outInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+  if (outInfo->Has(vtkDataObject::ORIGIN()))
+    {
+    outInfo->Get(vtkDataObject::ORIGIN(), origin);
+    }
+  if (outInfo->Has(vtkDataObject::SPACING()))
+    {
+    outInfo->Get(vtkDataObject::SPACING(), spacing);
+    }
+  if (scalarType == VTK_VOID)
+    {
+    scalarType = vtkImageData::GetScalarType(outInfo);
+    }
 
-  this->ProcessMRMLSceneEvents(newScene, vtkMRMLScene::EndBatchProcessEvent, 0);
+  AllocateZeroedImageData(wholeExtent, origin, spacing,
+                          vtkImageData::GetNumberOfScalarComponents(outInfo),
+                          scalarType, output);
+  return true;
 }
 
+const int ROIHistogramBins = 4096;
+
 //----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::OnMRMLSceneEndImport()
+struct ROIAccumulator
 {
-  // set Slice Default Node
-  vtkSmartPointer<vtkMRMLNode> defaultNode = vtkMRMLSliceNode::SafeDownCast
-      (this->GetMRMLScene()->GetDefaultNodeByClass("vtkMRMLSliceNode"));
-  if (!defaultNode)
+  ROIAccumulator()
+  {
+    this->NumberOfValues = 0;
+    this->Sum = this->Sum2 = 0.;
+    this->Min = VTK_DOUBLE_MAX;
+    this->Max = VTK_DOUBLE_MIN;
+  }
+
+  void Merge(const ROIAccumulator &other)
+  {
+    this->NumberOfValues += other.NumberOfValues;
+    this->Sum += other.Sum;
+    this->Sum2 += other.Sum2;
+    this->Min = std::min(this->Min, other.Min);
+    this->Max = std::max(this->Max, other.Max);
+  }
+
+  vtkIdType NumberOfValues;
+  double Sum, Sum2, Min, Max;
+};
+
+//----------------------------------------------------------------------------
+// IJK extent of the ROI, clamped to the volume. False if they do not overlap.
+bool ROIExtent(vtkMRMLAnnotationROINode *roiNode, vtkMRMLAstroVolumeNode *volumeNode,
+               int extent[6])
+{
+  vtkImageData *imageData = volumeNode->GetImageData();
+  if (!imageData)
     {
-    vtkMRMLNode * foo = this->GetMRMLScene()->CreateNodeByClass("vtkMRMLSliceNode");
-    defaultNode.TakeReference(foo);
-    this->GetMRMLScene()->AddDefaultNode(defaultNode);
+    return false;
     }
-  vtkMRMLSliceNode * defaultSliceNode = vtkMRMLSliceNode::SafeDownCast(defaultNode);
-  defaultSliceNode->RemoveSliceOrientationPreset("Axial");
-  defaultSliceNode->RemoveSliceOrientationPreset("Sagittal");
-  defaultSliceNode->RemoveSliceOrientationPreset("Coronal");
 
-  // modify SliceNodes already allocated
-  vtkSmartPointer<vtkCollection> sliceNodes = vtkSmartPointer<vtkCollection>::Take
-      (this->GetMRMLScene()->GetNodesByClass("vtkMRMLSliceNode"));
+  double roiBounds[6];
+  roiNode->GetRASBounds(roiBounds);
+  vtkNew<vtkMatrix4x4> RAStoIJKMatrix;
+  volumeNode->GetRASToIJKMatrix(RAStoIJKMatrix.GetPointer());
 
-  for(int i = 0; i < sliceNodes->GetNumberOfItems(); i++)
+  double ijkMin[3] = {VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, VTK_DOUBLE_MAX};
+  double ijkMax[3] = {VTK_DOUBLE_MIN, VTK_DOUBLE_MIN, VTK_DOUBLE_MIN};
+  for (int corner = 0; corner < 8; corner++)
     {
-    vtkMRMLSliceNode* sliceNode =
-        vtkMRMLSliceNode::SafeDownCast(sliceNodes->GetItemAsObject(i));
-    if (sliceNode)
+    double RAS[4] = {roiBounds[corner & 1], roiBounds[2 + ((corner >> 1) & 1)],
+                     roiBounds[4 + ((corner >> 2) & 1)], 1.};
+    double ijk[4];
+    RAStoIJKMatrix->MultiplyPoint(RAS, ijk);
+    for (int ii = 0; ii < 3; ii++)
       {
-      sliceNode->DisableModifiedEventOn();
-      sliceNode->RemoveSliceOrientationPreset("Axial");
-      sliceNode->RemoveSliceOrientationPreset("Sagittal");
-      sliceNode->RemoveSliceOrientationPreset("Coronal");
-      sliceNode->DisableModifiedEventOff();
+      ijkMin[ii] = std::min(ijkMin[ii], ijk[ii]);
+      ijkMax[ii] = std::max(ijkMax[ii], ijk[ii]);
+      }
+    }
+
+  int *dims = imageData->GetDimensions();
+  for (int ii = 0; ii < 3; ii++)
+    {
+    extent[2 * ii] = std::max(0, static_cast<int>(floor(ijkMin[ii] + 0.5)));
+    extent[2 * ii + 1] = std::min(dims[ii] - 1, static_cast<int>(floor(ijkMax[ii] + 0.5)));
+    if (extent[2 * ii] > extent[2 * ii + 1])
+      {
+      return false;
       }
     }
+
+  return true;
 }
 
 //----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::OnMRMLSceneNodeAdded(vtkMRMLNode* node)
+// Moments and range (histogram empty), or the histogram of [acc.Min, acc.Max],
+// of the valid voxels of extent where mask (if not NULL) is not zero.
+// The rows of the extent are distributed over the threads.
+template <typename T, typename M> void ROIPass(const T *pixel, const M *mask,
+                                               const int dims[3], const int extent[6],
+                                               double blank, bool parallel,
+                                               ROIAccumulator &result,
+                                               std::vector<vtkIdType> &histogram)
 {
-  if (!node)
+  const bool fillHistogram = !histogram.empty();
+  const int numBins = static_cast<int>(histogram.size());
+  const double binWidth = fillHistogram ? (result.Max - result.Min) / numBins : 1.;
+  const double histogramMin = result.Min;
+  const int numRows = extent[3] - extent[2] + 1;
+  const int numRowsTotal = numRows * (extent[5] - extent[4] + 1);
+  const vtkIdType planeSize = static_cast<vtkIdType>(dims[0]) * dims[1];
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel if(parallel)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  ROIAccumulator acc;
+  std::vector<vtkIdType> threadHistogram(histogram.size(), 0);
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int row = 0; row < numRowsTotal; row++)
     {
-    return;
+    const int jj = extent[2] + row % numRows;
+    const int kk = extent[4] + row / numRows;
+    const vtkIdType first = kk * planeSize + static_cast<vtkIdType>(jj) * dims[0];
+    for (vtkIdType elemCnt = first + extent[0]; elemCnt <= first + extent[1]; elemCnt++)
+      {
+      const T value = pixel[elemCnt];
+      if (value != value || value == blank || (mask && mask[elemCnt] == 0))
+        {
+        continue;
+        }
+      if (fillHistogram)
+        {
+        const int bin = static_cast<int>((value - histogramMin) / binWidth);
+        threadHistogram[std::max(0, std::min(bin, numBins - 1))]++;
+        continue;
+        }
+      acc.NumberOfValues++;
+      acc.Sum += value;
+      acc.Sum2 += static_cast<double>(value) * value;
+      acc.Min = value < acc.Min ? value : acc.Min;
+      acc.Max = value > acc.Max ? value : acc.Max;
+      }
     }
 
-  //change axes label names
-  if (node->IsA("vtkMRMLViewNode"))
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp critical
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  if (fillHistogram)
     {
-    vtkMRMLViewNode *viewNode =
-      vtkMRMLViewNode::SafeDownCast(node);
+    for (int bin = 0; bin < numBins; bin++)
+      {
+      histogram[bin] += threadHistogram[bin];
+      }
+    }
+  else
+    {
+    result.Merge(acc);
+    }
+  }
+  }
+}
 
-    viewNode->DisableModifiedEventOn();
+//----------------------------------------------------------------------------
+template <typename T, typename M> void ROIStatisticsKernel(const T *pixel, const M *mask,
+                                                           const int dims[3], const int extent[6],
+                                                           double blank, bool parallel,
+                                                           ROIAccumulator &acc,
+                                                           std::vector<vtkIdType> &histogram)
+{
+  std::vector<vtkIdType> noHistogram;
+  ROIPass(pixel, mask, dims, extent, blank, parallel, acc, noHistogram);
+  if (acc.NumberOfValues > 0 && acc.Max > acc.Min)
+    {
+    ROIPass(pixel, mask, dims, extent, blank, parallel, acc, histogram);
+    }
+}
 
-    //setting Axes Labels
-    viewNode->SetAxisLabel(0,"W");
-    viewNode->SetAxisLabel(1,"E");
-    viewNode->SetAxisLabel(2,"Z");
-    viewNode->SetAxisLabel(3,"z");
-    viewNode->SetAxisLabel(4,"S");
-    viewNode->SetAxisLabel(5,"N");
+//----------------------------------------------------------------------------
+template <typename T> bool ROIStatisticsDispatch(const T *pixel, const void *mask, int maskType,
+                                                 const int dims[3], const int extent[6],
+                                                 double blank, bool parallel,
+                                                 ROIAccumulator &acc,
+                                                 std::vector<vtkIdType> &histogram)
+{
+  switch (maskType)
+    {
+    vtkTemplateMacro(ROIStatisticsKernel(pixel, static_cast<const VTK_TT*>(mask), dims, extent,
+                                         blank, parallel, acc, histogram));
+    default:
+      return false;
+    }
+  return true;
+}
 
-    viewNode->DisableModifiedEventOff();
 
-    //unregister RulerDisplayableManager
-    vtkMRMLThreeDViewDisplayableManagerFactory::GetInstance()->
-      UnRegisterDisplayableManager("vtkMRMLRulerDisplayableManager");
-    }
+//----------------------------------------------------------------------------
+// Source finding: the voxels above threshold are stored as runs along X,
+// indexed by row (j + k * dims[1]), and linked with a union-find over runs.
+struct SourceRun
+{
+  int Start;
+  int End;
+};
 
-  if (node->IsA("vtkMRMLSliceNode"))
-    {
-    vtkMRMLSliceNode *sliceNode =
-      vtkMRMLSliceNode::SafeDownCast(node);
+//----------------------------------------------------------------------------
+struct SourceRuns
+{
+  std::vector<SourceRun> Runs;
+  /// first run of each row (size: number of rows + 1)
+  std::vector<vtkIdType> RowOffsets;
+  std::vector<vtkIdType> Parents;
+};
 
-    sliceNode->DisableModifiedEventOn();
+//----------------------------------------------------------------------------
+// Runs of the voxels with sign * value >= threshold (physical units),
+// extracted in parallel over the planes.
+template <typename T> void ExtractSourceRuns(const T *pixel, const int dims[3],
+                                             double bscale, double bzero, double blank,
+                                             double threshold, double sign,
+                                             SourceRuns &sourceRuns)
+{
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  std::vector<std::vector<SourceRun> > planeRuns(dims[2]);
+  std::vector<vtkIdType> rowCounts(static_cast<vtkIdType>(dims[1]) * dims[2], 0);
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int kk = 0; kk < dims[2]; kk++)
+    {
+    for (int jj = 0; jj < dims[1]; jj++)
+      {
+      const T *row = pixel + kk * numSlice + static_cast<vtkIdType>(jj) * dims[0];
+      const vtkIdType rowIndex = jj + static_cast<vtkIdType>(kk) * dims[1];
+      int start = -1;
+      for (int ii = 0; ii <= dims[0]; ii++)
+        {
+        bool detected = ii < dims[0] && static_cast<double>(row[ii]) != blank &&
+                        sign * (bscale * row[ii] + bzero) >= threshold;
+        if (detected && start < 0)
+          {
+          start = ii;
+          }
+        else if (!detected && start >= 0)
+          {
+          SourceRun run;
+          run.Start = start;
+          run.End = ii - 1;
+          planeRuns[kk].push_back(run);
+          rowCounts[rowIndex]++;
+          start = -1;
+          }
+        }
+      }
+    }
 
-    // setting Axes Labels
-    sliceNode->SetAxisLabel(0,"W");
-    sliceNode->SetAxisLabel(1,"E");
-    sliceNode->SetAxisLabel(2,"Z");
-    sliceNode->SetAxisLabel(3,"z");
-    sliceNode->SetAxisLabel(4,"S");
-    sliceNode->SetAxisLabel(5,"N");
+  const vtkIdType numRows = rowCounts.size();
+  sourceRuns.RowOffsets.resize(numRows + 1);
+  sourceRuns.RowOffsets[0] = 0;
+  for (vtkIdType rowIndex = 0; rowIndex < numRows; rowIndex++)
+    {
+    sourceRuns.RowOffsets[rowIndex + 1] = sourceRuns.RowOffsets[rowIndex] + rowCounts[rowIndex];
+    }
+  sourceRuns.Runs.clear();
+  sourceRuns.Runs.reserve(sourceRuns.RowOffsets[numRows]);
+  for (int kk = 0; kk < dims[2]; kk++)
+    {
+    sourceRuns.Runs.insert(sourceRuns.Runs.end(), planeRuns[kk].begin(), planeRuns[kk].end());
+    std::vector<SourceRun>().swap(planeRuns[kk]);
+    }
+}
 
-    sliceNode->DisableModifiedEventOff();
+//----------------------------------------------------------------------------
+vtkIdType FindRootRun(std::vector<vtkIdType> &parents, vtkIdType run)
+{
+  while (parents[run] != run)
+    {
+    parents[run] = parents[parents[run]];
+    run = parents[run];
+    }
+  return run;
+}
 
-    //unregister RulerDisplayableManager
-    vtkMRMLSliceViewDisplayableManagerFactory::GetInstance()->
-      UnRegisterDisplayableManager("vtkMRMLRulerDisplayableManager");
+//----------------------------------------------------------------------------
+// The root of a set is always its lowest run
+void UnionRuns(std::vector<vtkIdType> &parents, vtkIdType first, vtkIdType second)
+{
+  first = FindRootRun(parents, first);
+  second = FindRootRun(parents, second);
+  if (first < second)
+    {
+    parents[second] = first;
+    }
+  else if (second < first)
+    {
+    parents[first] = second;
     }
+}
 
-  if (node->IsA("vtkMRMLSegmentEditorNode"))
+//----------------------------------------------------------------------------
+// Link the runs of two rows closer than radius along X
+void LinkSourceRows(SourceRuns &sourceRuns, vtkIdType row, vtkIdType otherRow, int radius)
+{
+  const vtkIdType end = sourceRuns.RowOffsets[row + 1];
+  const vtkIdType otherEnd = sourceRuns.RowOffsets[otherRow + 1];
+  vtkIdType otherFirst = sourceRuns.RowOffsets[otherRow];
+  for (vtkIdType run = sourceRuns.RowOffsets[row]; run < end; run++)
     {
-    vtkSmartPointer<vtkCollection> col = vtkSmartPointer<vtkCollection>::Take(
-      this->GetMRMLScene()->GetNodesByClass("vtkMRMLSegmentEditorNode"));
-    vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
-      this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
-    if (!selectionNode)
+    const SourceRun &current = sourceRuns.Runs[run];
+    while (otherFirst < otherEnd && sourceRuns.Runs[otherFirst].End + radius < current.Start)
       {
-      return;
+      otherFirst++;
       }
-
-    vtkMRMLSegmentEditorNode* segmentEditorNode =
-      vtkMRMLSegmentEditorNode::SafeDownCast(col->GetItemAsObject(0));
-
-    if (!segmentEditorNode)
+    for (vtkIdType other = otherFirst; other < otherEnd &&
+         sourceRuns.Runs[other].Start <= current.End + radius; other++)
       {
-      selectionNode->RemoveNodeReferenceIDs("SegmentEditorNodeRef");
-      return;
+      UnionRuns(sourceRuns.Parents, run, other);
       }
-
-    selectionNode->AddAndObserveNodeReferenceID("SegmentEditorNodeRef", segmentEditorNode->GetID());
-
-    col->RemoveAllItems();
     }
+}
 
-  //check WCS and update unit nodes
-  if (node->IsA("vtkMRMLAstroVolumeNode"))
+//----------------------------------------------------------------------------
+// Link the rows of plane kk to the previous rows within the merge radii,
+// in the planes [minPlane, kk]
+void LinkSourcePlane(SourceRuns &sourceRuns, const int dims[3], int kk, int minPlane,
+                     int radiusXY, int radiusZ)
+{
+  for (int jj = 0; jj < dims[1]; jj++)
     {
-    vtkSmartPointer<vtkCollection> listAstroVolumes = vtkSmartPointer<vtkCollection>::Take(
-      this->GetMRMLScene()->GetNodesByClass("vtkMRMLAstroVolumeNode"));
+    const vtkIdType row = jj + static_cast<vtkIdType>(kk) * dims[1];
 
-    bool WCS = false;
-    double min = std::numeric_limits<double>::max(), max = -std::numeric_limits<double>::max();
-    for(int i = 0; i < listAstroVolumes->GetNumberOfItems(); i++)
+    // runs of the same row separated by at most radiusXY - 1 voxels
+    for (vtkIdType run = sourceRuns.RowOffsets[row] + 1; run < sourceRuns.RowOffsets[row + 1]; run++)
       {
-      vtkMRMLAstroVolumeNode* astroVolumeNode =
-        vtkMRMLAstroVolumeNode::SafeDownCast(listAstroVolumes->GetItemAsObject(i));
-      if (astroVolumeNode)
+      if (sourceRuns.Runs[run].Start - sourceRuns.Runs[run - 1].End <= radiusXY)
         {
-        double mint = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMIN"));
-        if (mint < min)
-          {
-          min = mint;
-          }
-        double maxt = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMAX"));
-        if (maxt > max)
-          {
-          max = maxt;
-          }
-        vtkMRMLAstroVolumeDisplayNode* astroVolumeDisplayNode =
-             astroVolumeNode->GetAstroVolumeDisplayNode();
-        if(!astroVolumeDisplayNode)
-          {
-          continue;
-          }
-        if(astroVolumeDisplayNode->GetWCSStatus() != 0 && WCS)
-          {
-          vtkWarningMacro("Both WCS and non-WCS compatible Volumes have been added to the Scene."<<endl
-                           <<"It may results in odd behaviours."<<endl);
-          }
-        if(astroVolumeDisplayNode->GetWCSStatus() == 0)
-          {
-          WCS = true;
-          }
+        UnionRuns(sourceRuns.Parents, run - 1, run);
         }
       }
 
-    vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
-      this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
-    if (selectionNode)
+    if (sourceRuns.RowOffsets[row] == sourceRuns.RowOffsets[row + 1])
       {
-      vtkMRMLUnitNode* unitNodeIntensity = selectionNode->GetUnitNode("intensity");
-      unitNodeIntensity->SetMaximumValue(max);
-      unitNodeIntensity->SetMinimumValue(min);
-      unitNodeIntensity->SetDisplayCoefficient(1.);
-      std::string temp = " ";
-      if(max < 0.001)
+      continue;
+      }
+
+    for (int otherPlane = std::max(minPlane, kk - radiusZ); otherPlane <= kk; otherPlane++)
+      {
+      const int lastRow = otherPlane == kk ? jj - 1 : std::min(dims[1] - 1, jj + radiusXY);
+      for (int otherRow = std::max(0, jj - radiusXY); otherRow <= lastRow; otherRow++)
         {
-        temp += "\xB5";
-        unitNodeIntensity->SetDisplayCoefficient(1000000.);
+        LinkSourceRows(sourceRuns, row, otherRow + static_cast<vtkIdType>(otherPlane) * dims[1],
+                       radiusXY);
         }
-      else
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Parallel connected components: each thread links the runs of a slab of
+// planes, then the planes at the boundaries of the slabs are linked.
+// Returns the number of components; Parents holds the component of each run.
+vtkIdType LabelSourceRuns(SourceRuns &sourceRuns, const int dims[3], int radiusXY, int radiusZ)
+{
+  const vtkIdType numRuns = sourceRuns.Runs.size();
+  sourceRuns.Parents.resize(numRuns);
+  for (vtkIdType run = 0; run < numRuns; run++)
+    {
+    sourceRuns.Parents[run] = run;
+    }
+
+  int numSlabs = 1;
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  numSlabs = omp_get_max_threads();
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  numSlabs = std::max(1, std::min(numSlabs, dims[2]));
+
+  // the runs of a slab are only linked to runs of the same slab
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(static, 1)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int slab = 0; slab < numSlabs; slab++)
+    {
+    const int firstPlane = (slab * dims[2]) / numSlabs;
+    const int lastPlane = ((slab + 1) * dims[2]) / numSlabs;
+    for (int kk = firstPlane; kk < lastPlane; kk++)
+      {
+      LinkSourcePlane(sourceRuns, dims, kk, firstPlane, radiusXY, radiusZ);
+      }
+    }
+
+  for (int slab = 1; slab < numSlabs; slab++)
+    {
+    const int firstPlane = (slab * dims[2]) / numSlabs;
+    const int lastPlane = std::min(((slab + 1) * dims[2]) / numSlabs, firstPlane + radiusZ);
+    for (int kk = firstPlane; kk < lastPlane; kk++)
+      {
+      for (int otherPlane = std::max(0, kk - radiusZ); otherPlane < firstPlane; otherPlane++)
         {
-        if(max < 1.)
+        for (int jj = 0; jj < dims[1]; jj++)
           {
-          temp += "m";
-          unitNodeIntensity->SetDisplayCoefficient(1000.);
+          const vtkIdType row = jj + static_cast<vtkIdType>(kk) * dims[1];
+          const int lastRow = std::min(dims[1] - 1, jj + radiusXY);
+          for (int otherRow = std::max(0, jj - radiusXY); otherRow <= lastRow; otherRow++)
+            {
+            LinkSourceRows(sourceRuns, row, otherRow + static_cast<vtkIdType>(otherPlane) * dims[1],
+                           radiusXY);
+            }
           }
         }
-
-      temp += "Jy/beam";
-      unitNodeIntensity->SetPrecision(6);
-      unitNodeIntensity->SetPrefix("");
-      unitNodeIntensity->SetSuffix(temp.c_str());
-      selectionNode->SetUnitNodeID("intensity", unitNodeIntensity->GetID());
       }
     }
 
-  if (node->IsA("vtkMRMLAstroVolumeNode") ||
-      node->IsA("vtkMRMLAstroLabelMapVolumeNode"))
+  // the parent of a run is lower than the run: one forward pass flattens
+  // the trees, then the roots are numbered
+  vtkIdType numComponents = 0;
+  std::vector<vtkIdType> &parents = sourceRuns.Parents;
+  for (vtkIdType run = 0; run < numRuns; run++)
     {
-    // change axes label names
-    vtkSmartPointer<vtkCollection> viewNodes = vtkSmartPointer<vtkCollection>::Take
-      (this->GetMRMLScene()->GetNodesByClass("vtkMRMLViewNode"));
-
-    for(int i = 0; i < viewNodes->GetNumberOfItems(); i++)
+    if (parents[run] == run)
       {
-      vtkMRMLViewNode* viewNode =
-        vtkMRMLViewNode::SafeDownCast(viewNodes->GetItemAsObject(i));
-      if (viewNode)
-        {
-        viewNode->DisableModifiedEventOn();
+      parents[run] = -(++numComponents);
+      }
+    else
+      {
+      vtkIdType root = parents[run];
+      parents[run] = root < 0 ? root : parents[root];
+      }
+    }
+  for (vtkIdType run = 0; run < numRuns; run++)
+    {
+    parents[run] = -parents[run] - 1;
+    }
 
-        viewNode->SetAxisLabel(0,"W");
-        viewNode->SetAxisLabel(1,"E");
-        viewNode->SetAxisLabel(2,"Z");
-        viewNode->SetAxisLabel(3,"z");
-        viewNode->SetAxisLabel(4,"S");
-        viewNode->SetAxisLabel(5,"N");
+  return numComponents;
+}
 
-        viewNode->DisableModifiedEventOff();
-        }
+//----------------------------------------------------------------------------
+struct SourceProperties
+{
+  SourceProperties()
+  {
+    this->NumberOfVoxels = 0;
+    this->Sum = 0.;
+    this->Peak = VTK_DOUBLE_MIN;
+    this->SumX = this->SumY = this->SumZ = 0.;
+    this->PositionX = this->PositionY = this->PositionZ = 0.;
+    this->Extent[0] = this->Extent[2] = this->Extent[4] = VTK_INT_MAX;
+    this->Extent[1] = this->Extent[3] = this->Extent[5] = VTK_INT_MIN;
+    this->Reliability = 1.;
+  }
+
+  void Merge(const SourceProperties &other)
+  {
+    this->NumberOfVoxels += other.NumberOfVoxels;
+    this->Sum += other.Sum;
+    this->Peak = std::max(this->Peak, other.Peak);
+    this->SumX += other.SumX;
+    this->SumY += other.SumY;
+    this->SumZ += other.SumZ;
+    this->PositionX += other.PositionX;
+    this->PositionY += other.PositionY;
+    this->PositionZ += other.PositionZ;
+    for (int axis = 0; axis < 3; axis++)
+      {
+      this->Extent[2 * axis] = std::min(this->Extent[2 * axis], other.Extent[2 * axis]);
+      this->Extent[2 * axis + 1] = std::max(this->Extent[2 * axis + 1], other.Extent[2 * axis + 1]);
       }
+  }
+
+  vtkIdType NumberOfVoxels;
+  /// sum and peak of sign * value, flux weighted sums of the IJK coordinates
+  double Sum, Peak, SumX, SumY, SumZ;
+  /// sums of the IJK coordinates (FindSources only)
+  double PositionX, PositionY, PositionZ;
+  int Extent[6];
+  double Reliability;
+};
 
-    vtkSmartPointer<vtkCollection> sliceNodes = vtkSmartPointer<vtkCollection>::Take
-      (this->GetMRMLScene()->GetNodesByClass("vtkMRMLSliceNode"));
+//----------------------------------------------------------------------------
+// Properties of the components, from the properties of the runs computed
+// in parallel over the planes
+template <typename T> void MeasureSources(const T *pixel, const int dims[3],
+                                          double bscale, double bzero, double sign,
+                                          const SourceRuns &sourceRuns,
+                                          std::vector<SourceProperties> &sources)
+{
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  std::vector<SourceProperties> runProperties(sourceRuns.Runs.size());
 
-    for(int i = 0; i < sliceNodes->GetNumberOfItems(); i++)
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int kk = 0; kk < dims[2]; kk++)
+    {
+    for (int jj = 0; jj < dims[1]; jj++)
       {
-      vtkMRMLSliceNode* sliceNode =
-        vtkMRMLSliceNode::SafeDownCast(sliceNodes->GetItemAsObject(i));
-      if (sliceNode)
+      const vtkIdType rowIndex = jj + static_cast<vtkIdType>(kk) * dims[1];
+      const T *row = pixel + kk * numSlice + static_cast<vtkIdType>(jj) * dims[0];
+      for (vtkIdType run = sourceRuns.RowOffsets[rowIndex]; run < sourceRuns.RowOffsets[rowIndex + 1]; run++)
         {
-        sliceNode->DisableModifiedEventOn();
-
-        sliceNode->SetAxisLabel(0,"W");
-        sliceNode->SetAxisLabel(1,"E");
-        sliceNode->SetAxisLabel(2,"Z");
-        sliceNode->SetAxisLabel(3,"z");
-        sliceNode->SetAxisLabel(4,"S");
-        sliceNode->SetAxisLabel(5,"N");
-
-        sliceNode->DisableModifiedEventOff();
+        SourceProperties &properties = runProperties[run];
+        const SourceRun &sourceRun = sourceRuns.Runs[run];
+        double sum = 0., sumX = 0.;
+        for (int ii = sourceRun.Start; ii <= sourceRun.End; ii++)
+          {
+          const double value = sign * (bscale * row[ii] + bzero);
+          sum += value;
+          sumX += value * ii;
+          properties.Peak = std::max(properties.Peak, value);
+          }
+        properties.NumberOfVoxels = sourceRun.End - sourceRun.Start + 1;
+        properties.Sum = sum;
+        properties.SumX = sumX;
+        properties.SumY = sum * jj;
+        properties.SumZ = sum * kk;
+        properties.PositionX = 0.5 * (sourceRun.Start + sourceRun.End) * properties.NumberOfVoxels;
+        properties.PositionY = static_cast<double>(properties.NumberOfVoxels) * jj;
+        properties.PositionZ = static_cast<double>(properties.NumberOfVoxels) * kk;
+        properties.Extent[0] = sourceRun.Start;
+        properties.Extent[1] = sourceRun.End;
+        properties.Extent[2] = properties.Extent[3] = jj;
+        properties.Extent[4] = properties.Extent[5] = kk;
         }
       }
+    }
 
-    vtkMRMLSliceNode* sliceNodeRed = vtkMRMLSliceNode::SafeDownCast
-      (this->GetMRMLScene()->GetNodeByID("vtkMRMLSliceNodeRed"));
-    sliceNodeRed->SetOrientation("XY");
+  for (size_t run = 0; run < runProperties.size(); run++)
+    {
+    sources[sourceRuns.Parents[run]].Merge(runProperties[run]);
+    }
+}
 
-    vtkMRMLSliceNode* sliceNodeYellow = vtkMRMLSliceNode::SafeDownCast
-      (this->GetMRMLScene()->GetNodeByID("vtkMRMLSliceNodeYellow"));
-    sliceNodeYellow->SetOrientation("XZ");
+//----------------------------------------------------------------------------
+// Position of a source in the (log peak, log sum, log mean) space
+struct SourcePoint
+{
+  SourcePoint(const SourceProperties &source)
+  {
+    this->P[0] = log10(std::max(source.Peak, VTK_DBL_MIN));
+    this->P[1] = log10(std::max(source.Sum, VTK_DBL_MIN));
+    this->P[2] = log10(std::max(source.Sum / source.NumberOfVoxels, VTK_DBL_MIN));
+  }
+
+  bool operator<(const SourcePoint &other) const
+  {
+    return this->P[0] < other.P[0];
+  }
+
+  double P[3];
+};
 
-    vtkMRMLSliceNode* sliceNodeGreen = vtkMRMLSliceNode::SafeDownCast
-      (this->GetMRMLScene()->GetNodeByID("vtkMRMLSliceNodeGreen"));
-    sliceNodeGreen->SetOrientation("ZY");
+//----------------------------------------------------------------------------
+// Gaussian kernel density of points at point, within 5 widths
+double SourceDensity(const std::vector<SourcePoint> &points, const SourcePoint &point,
+                     const double scale[3])
+{
+  SourcePoint low(point);
+  low.P[0] -= 5. * scale[0];
+  double density = 0.;
+  for (std::vector<SourcePoint>::const_iterator other =
+       std::lower_bound(points.begin(), points.end(), low);
+       other != points.end() && other->P[0] <= point.P[0] + 5. * scale[0]; ++other)
+    {
+    double distance2 = 0.;
+    for (int axis = 0; axis < 3; axis++)
+      {
+      const double delta = (other->P[axis] - point.P[axis]) / scale[axis];
+      distance2 += delta * delta;
+      }
+    if (distance2 < 25.)
+      {
+      density += exp(-0.5 * distance2);
+      }
     }
+  return density;
 }
 
 //----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::OnMRMLSceneNodeRemoved(vtkMRMLNode *node)
+// Reliability of the positive sources: (P - N) / P, with P and N the
+// gaussian kernel densities of the positive and negative sources in the
+// (log peak, log sum, log mean) space. The kernel widths are 0.4 times the
+// standard deviations of the negative sources.
+void SourceReliability(std::vector<SourceProperties> &positives,
+                       const std::vector<SourceProperties> &negatives)
 {
-  if (!node)
+  if (negatives.size() < 3)
     {
     return;
     }
 
-  if (node->IsA("vtkMRMLSegmentEditorNode"))
+  std::vector<SourcePoint> negativePoints(negatives.begin(), negatives.end());
+  std::vector<SourcePoint> positivePoints(positives.begin(), positives.end());
+
+  const int numNegatives = negativePoints.size();
+  double mean[3] = {0., 0., 0.}, scale[3] = {0., 0., 0.};
+  for (int axis = 0; axis < 3; axis++)
     {
-    vtkSmartPointer<vtkCollection> col = vtkSmartPointer<vtkCollection>::Take(
-      this->GetMRMLScene()->GetNodesByClass("vtkMRMLSegmentEditorNode"));
-    vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
-      this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
-    if (!selectionNode)
+    for (int negative = 0; negative < numNegatives; negative++)
       {
-      return;
+      mean[axis] += negativePoints[negative].P[axis] / numNegatives;
       }
-
-    vtkMRMLSegmentEditorNode* segmentEditorNode =
-      vtkMRMLSegmentEditorNode::SafeDownCast(col->GetItemAsObject(0));
-
-    if (!segmentEditorNode)
+    for (int negative = 0; negative < numNegatives; negative++)
       {
-      selectionNode->RemoveNodeReferenceIDs("SegmentEditorNodeRef");
-      return;
+      const double delta = negativePoints[negative].P[axis] - mean[axis];
+      scale[axis] += delta * delta;
       }
+    scale[axis] = std::max(0.4 * sqrt(scale[axis] / (numNegatives - 1)), 1.e-3);
+    }
 
-    selectionNode->AddAndObserveNodeReferenceID("SegmentEditorNodeRef", segmentEditorNode->GetID());
+  std::vector<SourcePoint> sortedPositives(positivePoints);
+  std::sort(sortedPositives.begin(), sortedPositives.end());
+  std::sort(negativePoints.begin(), negativePoints.end());
 
-    col->RemoveAllItems();
+  const int numPositives = positivePoints.size();
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int positive = 0; positive < numPositives; positive++)
+    {
+    const double positiveDensity = SourceDensity(sortedPositives, positivePoints[positive], scale);
+    const double negativeDensity = SourceDensity(negativePoints, positivePoints[positive], scale);
+    positives[positive].Reliability =
+      std::max(0., (positiveDensity - negativeDensity) / positiveDensity);
     }
-
 }
 
-namespace
-{
 //----------------------------------------------------------------------------
-ArchetypeVolumeNodeSet AstroVolumeNodeSetFactory(std::string& volumeName, vtkMRMLScene* scene, int options)
+template <typename T> bool FindSourcesDispatch(const T *pixel, const int dims[3],
+                                               double bscale, double bzero, double blank,
+                                               double threshold, double sign,
+                                               int radiusXY, int radiusZ,
+                                               SourceRuns &sourceRuns,
+                                               std::vector<SourceProperties> &sources)
 {
-  ArchetypeVolumeNodeSet nodeSet(scene);
-
-  // set up the Astro node's support nodes
-  vtkNew<vtkMRMLAstroVolumeNode> astroNode;
-  astroNode->SetName(volumeName.c_str());
-  nodeSet.Scene->AddNode(astroNode.GetPointer());
-
-  vtkNew<vtkMRMLAstroVolumeDisplayNode> adisplayNode;
-  adisplayNode->SetAutoWindowLevel(0);
-  nodeSet.Scene->AddNode(adisplayNode.GetPointer());
-  astroNode->SetAndObserveDisplayNodeID(adisplayNode->GetID());
-
-  vtkNew<vtkMRMLAstroVolumeStorageNode> storageNode;
-  storageNode->SetCenterImage(options & vtkSlicerVolumesLogic::CenterImage);
-  nodeSet.Scene->AddNode(storageNode.GetPointer());
-  astroNode->SetAndObserveStorageNodeID(storageNode->GetID());
-
-  nodeSet.StorageNode = storageNode.GetPointer();
-  nodeSet.DisplayNode = adisplayNode.GetPointer();
-  nodeSet.Node = astroNode.GetPointer();
-
-  return nodeSet;
+  ExtractSourceRuns(pixel, dims, bscale, bzero, blank, threshold, sign, sourceRuns);
+  sources.assign(LabelSourceRuns(sourceRuns, dims, radiusXY, radiusZ), SourceProperties());
+  MeasureSources(pixel, dims, bscale, bzero, sign, sourceRuns, sources);
+  return true;
 }
 
-};
-
-
-namespace
-{
 //----------------------------------------------------------------------------
-ArchetypeVolumeNodeSet AstroLabelMapVolumeNodeSetFactory(std::string& volumeName, vtkMRMLScene* scene, int options)
+// Sorted positive labels present in the label map. The labels of a mask
+// come in runs along X, so a label is stored only when it changes.
+template <typename L> void CollectSourceLabels(const L *labelPixel, const int dims[3],
+                                               std::vector<int> &labels)
 {
-  ArchetypeVolumeNodeSet nodeSet(scene);
-
-  // set up the AstroLabelMap node's support nodes
-  vtkNew<vtkMRMLAstroLabelMapVolumeNode> astroLabelMapNode;
-  astroLabelMapNode->SetName(volumeName.c_str());
-  nodeSet.Scene->AddNode(astroLabelMapNode.GetPointer());
-
-  vtkNew<vtkMRMLAstroLabelMapVolumeDisplayNode> lmdisplayNode;
-  nodeSet.Scene->AddNode(lmdisplayNode.GetPointer());
-  astroLabelMapNode->SetAndObserveDisplayNodeID(lmdisplayNode->GetID());
-
-  vtkNew<vtkMRMLAstroVolumeStorageNode> storageNode;
-  storageNode->SetCenterImage(options & vtkSlicerVolumesLogic::CenterImage);
-  nodeSet.Scene->AddNode(storageNode.GetPointer());
-  astroLabelMapNode->SetAndObserveStorageNodeID(storageNode->GetID());
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  labels.clear();
 
-  nodeSet.StorageNode = storageNode.GetPointer();
-  nodeSet.DisplayNode = lmdisplayNode.GetPointer();
-  nodeSet.Node = astroLabelMapNode.GetPointer();
-
-  nodeSet.LabelMap = true;
-
-  return nodeSet;
-}
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    {
+    std::vector<int> threadLabels;
+    int lastLabel = 0;
 
-};
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp for schedule(static)
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    for (int kk = 0; kk < dims[2]; kk++)
+      {
+      const L *plane = labelPixel + kk * numSlice;
+      for (vtkIdType pos = 0; pos < numSlice; pos++)
+        {
+        const int label = static_cast<int>(plane[pos]);
+        if (label > 0 && label != lastLabel)
+          {
+          threadLabels.push_back(label);
+          }
+        lastLabel = label;
+        }
+      if (threadLabels.size() > 4096)
+        {
+        std::sort(threadLabels.begin(), threadLabels.end());
+        threadLabels.erase(std::unique(threadLabels.begin(), threadLabels.end()), threadLabels.end());
+        }
+      }
+    std::sort(threadLabels.begin(), threadLabels.end());
+    threadLabels.erase(std::unique(threadLabels.begin(), threadLabels.end()), threadLabels.end());
 
-//----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::RegisterArchetypeVolumeNodeSetFactory(vtkSlicerVolumesLogic* volumesLogic)
-{
-  if (volumesLogic)
-    {
-    volumesLogic->PreRegisterArchetypeVolumeNodeSetFactory(AstroLabelMapVolumeNodeSetFactory);
-    volumesLogic->PreRegisterArchetypeVolumeNodeSetFactory(AstroVolumeNodeSetFactory);
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp critical
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+      {
+      std::vector<int> merged;
+      merged.reserve(labels.size() + threadLabels.size());
+      std::set_union(labels.begin(), labels.end(), threadLabels.begin(), threadLabels.end(),
+                     std::back_inserter(merged));
+      labels.swap(merged);
+      }
     }
 }
 
 //----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::RegisterNodes()
+// Statistics of the labelled sources in one pass over the planes. The
+// labels are first compacted to the indices of the sorted labels present,
+// so each thread accumulates in a table of the number of sources (not of
+// the highest label), and the integrated spectrum of each plane is stored
+// as (index, sum) pairs.
+template <typename T, typename L> void SourceStatisticsKernel(const T *pixel, const L *labelPixel,
+                                                              const int dims[3], double bscale,
+                                                              double bzero, double blank,
+                                                              std::vector<int> &labels,
+                                                              std::vector<SourceProperties> &sources,
+                                                              std::vector<std::vector<std::pair<int, double> > > &planeSpectra)
 {
-  if(!this->GetMRMLScene())
+  CollectSourceLabels(labelPixel, dims, labels);
+  const int numLabels = labels.size();
+  sources.assign(numLabels, SourceProperties());
+  planeSpectra.resize(dims[2]);
+  if (numLabels == 0)
     {
     return;
     }
-  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroVolumeNode>().GetPointer());
-  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroVolumeDisplayNode>().GetPointer());
-  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroVolumeStorageNode>().GetPointer());
-  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroLabelMapVolumeNode>().GetPointer());
-  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroLabelMapVolumeDisplayNode>().GetPointer());
-}
 
-//----------------------------------------------------------------------------
-vtkMRMLScene *vtkSlicerAstroVolumeLogic::GetPresetsScene()
-{
-  if (!this->PresetsScene)
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
     {
-    this->PresetsScene = vtkSmartPointer<vtkMRMLScene>::New();
+    std::vector<SourceProperties> threadSources(numLabels);
+    std::vector<double> planeSums(numLabels, 0.);
+    /// last plane where each source was seen
+    std::vector<int> planeMarks(numLabels, -1);
+    std::vector<int> planeIndices;
+    int lastLabel = 0, index = 0;
+
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp for schedule(dynamic)
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    for (int kk = 0; kk < dims[2]; kk++)
+      {
+      vtkIdType pos = kk * numSlice;
+      for (int jj = 0; jj < dims[1]; jj++)
+        {
+        for (int ii = 0; ii < dims[0]; ii++, pos++)
+          {
+          const int label = static_cast<int>(labelPixel[pos]);
+          if (label <= 0 || static_cast<double>(pixel[pos]) == blank)
+            {
+            continue;
+            }
+          const double value = bscale * pixel[pos] + bzero;
+          if (value != value)
+            {
+            continue;
+            }
+          if (label != lastLabel)
+            {
+            lastLabel = label;
+            index = std::lower_bound(labels.begin(), labels.end(), label) - labels.begin();
+            }
+
+          SourceProperties &source = threadSources[index];
+          source.NumberOfVoxels++;
+          source.Sum += value;
+          source.Peak = std::max(source.Peak, value);
+          source.SumX += value * ii;
+          source.SumY += value * jj;
+          source.SumZ += value * kk;
+          source.Extent[0] = std::min(source.Extent[0], ii);
+          source.Extent[1] = std::max(source.Extent[1], ii);
+          source.Extent[2] = std::min(source.Extent[2], jj);
+          source.Extent[3] = std::max(source.Extent[3], jj);
+          source.Extent[4] = std::min(source.Extent[4], kk);
+          source.Extent[5] = std::max(source.Extent[5], kk);
+
+          if (planeMarks[index] != kk)
+            {
+            planeMarks[index] = kk;
+            planeIndices.push_back(index);
+            }
+          planeSums[index] += value;
+          }
+        }
+
+      std::vector<std::pair<int, double> > &spectrum = planeSpectra[kk];
+      spectrum.reserve(planeIndices.size());
+      for (size_t entry = 0; entry < planeIndices.size(); entry++)
+        {
+        spectrum.push_back(std::make_pair(planeIndices[entry], planeSums[planeIndices[entry]]));
+        planeSums[planeIndices[entry]] = 0.;
+        }
+      planeIndices.clear();
+      }
+
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp critical
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+      {
+      for (int source = 0; source < numLabels; source++)
+        {
+        if (threadSources[source].NumberOfVoxels > 0)
+          {
+          sources[source].Merge(threadSources[source]);
+          }
+        }
+      }
     }
-  this->LoadPresets(this->PresetsScene);
-  return this->PresetsScene;
 }
 
 //----------------------------------------------------------------------------
-void vtkSlicerAstroVolumeLogic::updateUnitsNodes(vtkMRMLNode *astroVolumeNode)
+template <typename T> bool SourceStatisticsDispatch(const T *pixel, const void *labelPixel,
+                                                    int labelType, const int dims[3],
+                                                    double bscale, double bzero, double blank,
+                                                    std::vector<int> &labels,
+                                                    std::vector<SourceProperties> &sources,
+                                                    std::vector<std::vector<std::pair<int, double> > > &planeSpectra)
 {
-  if (!astroVolumeNode)
+  switch (labelType)
+    {
+    vtkTemplateMacro(SourceStatisticsKernel(pixel, static_cast<const VTK_TT*>(labelPixel), dims,
+                                            bscale, bzero, blank, labels, sources, planeSpectra));
+    default:
+      return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Channels (interpolated) where the spectrum rises above and falls below
+// fraction * peak, searching from the edges inwards
+bool SpectrumWidth(const double *spectrum, int numChannels, double fraction,
+                   double &first, double &last)
+{
+  const double peak = *std::max_element(spectrum, spectrum + numChannels);
+  if (!(peak > 0.))
+    {
+    return false;
+    }
+  const double level = fraction * peak;
+
+  int channel = 0;
+  while (spectrum[channel] < level)
+    {
+    channel++;
+    }
+  first = channel == 0 ? 0. :
+    channel - 1 + (level - spectrum[channel - 1]) / (spectrum[channel] - spectrum[channel - 1]);
+
+  channel = numChannels - 1;
+  while (spectrum[channel] < level)
+    {
+    channel--;
+    }
+  last = channel == numChannels - 1 ? channel :
+    channel + (spectrum[channel] - level) / (spectrum[channel] - spectrum[channel + 1]);
+
+  return true;
+}
+
+}// end namespace
+
+//----------------------------------------------------------------------------
+// Histograms of the volumes, by node ID, valid while the image data
+// (and its scalars) are not modified. The histograms of the data as read
+// are also kept in the sidecar statistics of the storage node.
+class vtkSlicerAstroVolumeLogic::vtkHistogramCache
+{
+public:
+  struct Histogram
+    {
+    vtkImageData *ImageData;
+    unsigned long MTime;
+    vtkIdType Total;
+    std::vector<double> Edges;
+    std::vector<vtkIdType> Counts;
+    };
+
+  /// Return the histogram of volumeNode, computing it if needed
+  const Histogram* Update(vtkMRMLAstroVolumeNode *volumeNode)
+  {
+    if (!volumeNode || !volumeNode->GetID())
+      {
+      return NULL;
+      }
+
+    vtkImageData *imageData = volumeNode->GetImageData();
+    if (!imageData || !imageData->GetPointData() ||
+        !imageData->GetPointData()->GetScalars())
+      {
+      return NULL;
+      }
+
+    const unsigned long MTime = std::max(imageData->GetMTime(),
+                                         imageData->GetPointData()->GetScalars()->GetMTime());
+    Histogram &histogram = this->Histograms[volumeNode->GetID()];
+    if (histogram.ImageData == imageData && histogram.MTime == MTime && !histogram.Counts.empty())
+      {
+      return &histogram;
+      }
+
+    // histogram of a previous load of the same file
+    vtkMRMLAstroVolumeStorageNode *storageNode =
+      vtkMRMLAstroVolumeStorageNode::SafeDownCast(volumeNode->GetStorageNode());
+    vtkNew<vtkDoubleArray> cachedEdges;
+    vtkNew<vtkDoubleArray> cachedCounts;
+    if (storageNode && storageNode->ReadHistogramCache(volumeNode, cachedEdges.GetPointer(),
+                                                       cachedCounts.GetPointer()))
+      {
+      histogram.Edges.resize(cachedEdges->GetNumberOfValues());
+      for (size_t edge = 0; edge < histogram.Edges.size(); edge++)
+        {
+        histogram.Edges[edge] = cachedEdges->GetValue(edge);
+        }
+      histogram.Counts.resize(cachedCounts->GetNumberOfValues());
+      histogram.Total = 0;
+      for (size_t bin = 0; bin < histogram.Counts.size(); bin++)
+        {
+        histogram.Counts[bin] = static_cast<vtkIdType>(cachedCounts->GetValue(bin));
+        histogram.Total += histogram.Counts[bin];
+        }
+      histogram.ImageData = imageData;
+      histogram.MTime = MTime;
+      return &histogram;
+      }
+
+    int *dims = imageData->GetDimensions();
+    const vtkIdType numElements = static_cast<vtkIdType>(dims[0]) * dims[1] * dims[2];
+    void *pixel = imageData->GetScalarPointer();
+    const double blank = volumeNode->GetDataBlank();
+
+    bool success = false;
+    switch (imageData->GetPointData()->GetScalars()->GetDataType())
+      {
+      vtkTemplateMacro(success = AdaptiveHistogram(static_cast<VTK_TT*>(pixel), numElements,
+                                                   blank, histogram.Edges, histogram.Counts));
+      }
+    if (!success)
+      {
+      this->Histograms.erase(volumeNode->GetID());
+      return NULL;
+      }
+
+    // physical values (scaled integers)
+    double bscale = 1., bzero = 0.;
+    volumeNode->GetDataScaling(bscale, bzero);
+    for (size_t edge = 0; edge < histogram.Edges.size(); edge++)
+      {
+      histogram.Edges[edge] = bscale * histogram.Edges[edge] + bzero;
+      }
+    if (bscale < 0.)
+      {
+      std::reverse(histogram.Edges.begin(), histogram.Edges.end());
+      std::reverse(histogram.Counts.begin(), histogram.Counts.end());
+      }
+
+    histogram.Total = 0;
+    for (size_t bin = 0; bin < histogram.Counts.size(); bin++)
+      {
+      histogram.Total += histogram.Counts[bin];
+      }
+    histogram.ImageData = imageData;
+    histogram.MTime = MTime;
+
+    if (storageNode)
+      {
+      cachedEdges->SetNumberOfValues(histogram.Edges.size());
+      for (size_t edge = 0; edge < histogram.Edges.size(); edge++)
+        {
+        cachedEdges->SetValue(edge, histogram.Edges[edge]);
+        }
+      cachedCounts->SetNumberOfValues(histogram.Counts.size());
+      for (size_t bin = 0; bin < histogram.Counts.size(); bin++)
+        {
+        cachedCounts->SetValue(bin, histogram.Counts[bin]);
+        }
+      storageNode->WriteHistogramCache(volumeNode, cachedEdges.GetPointer(),
+                                       cachedCounts.GetPointer());
+      }
+
+    return &histogram;
+  }
+
+  std::map<std::string, Histogram> Histograms;
+};
+
+//----------------------------------------------------------------------------
+vtkSlicerAstroVolumeLogic::vtkSlicerAstroVolumeLogic()
+{
+  this->PresetsScene = 0;
+  this->HistogramCache = new vtkHistogramCache;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerAstroVolumeLogic::~vtkSlicerAstroVolumeLogic()
+{
+  delete this->HistogramCache;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::UpdateFromMRMLScene()
+{
+  assert(this->GetMRMLScene() != 0);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::SetMRMLSceneInternal(vtkMRMLScene * newScene)
+{
+  // List of events the slice logics should listen
+  vtkNew<vtkIntArray> events;
+
+  // Events that use the default priority.  Don't care the order they
+  // are triggered
+  events->InsertNextValue(vtkMRMLScene::NodeAddedEvent);
+  events->InsertNextValue(vtkMRMLScene::NodeRemovedEvent);
+  events->InsertNextValue(vtkMRMLScene::EndImportEvent);
+
+  this->SetAndObserveMRMLSceneEventsInternal(newScene, events.GetPointer());
+
+  this->ProcessMRMLSceneEvents(newScene, vtkMRMLScene::EndBatchProcessEvent, 0);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::OnMRMLSceneEndImport()
+{
+  // set Slice Default Node
+  vtkSmartPointer<vtkMRMLNode> defaultNode = vtkMRMLSliceNode::SafeDownCast
+      (this->GetMRMLScene()->GetDefaultNodeByClass("vtkMRMLSliceNode"));
+  if (!defaultNode)
+    {
+    vtkMRMLNode * foo = this->GetMRMLScene()->CreateNodeByClass("vtkMRMLSliceNode");
+    defaultNode.TakeReference(foo);
+    this->GetMRMLScene()->AddDefaultNode(defaultNode);
+    }
+  vtkMRMLSliceNode * defaultSliceNode = vtkMRMLSliceNode::SafeDownCast(defaultNode);
+  defaultSliceNode->RemoveSliceOrientationPreset("Axial");
+  defaultSliceNode->RemoveSliceOrientationPreset("Sagittal");
+  defaultSliceNode->RemoveSliceOrientationPreset("Coronal");
+
+  // modify SliceNodes already allocated
+  vtkSmartPointer<vtkCollection> sliceNodes = vtkSmartPointer<vtkCollection>::Take
+      (this->GetMRMLScene()->GetNodesByClass("vtkMRMLSliceNode"));
+
+  for(int i = 0; i < sliceNodes->GetNumberOfItems(); i++)
+    {
+    vtkMRMLSliceNode* sliceNode =
+        vtkMRMLSliceNode::SafeDownCast(sliceNodes->GetItemAsObject(i));
+    if (sliceNode)
+      {
+      sliceNode->DisableModifiedEventOn();
+      sliceNode->RemoveSliceOrientationPreset("Axial");
+      sliceNode->RemoveSliceOrientationPreset("Sagittal");
+      sliceNode->RemoveSliceOrientationPreset("Coronal");
+      sliceNode->DisableModifiedEventOff();
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::OnMRMLSceneNodeAdded(vtkMRMLNode* node)
+{
+  if (!node)
     {
     return;
     }
 
-  if (!(astroVolumeNode->IsA("vtkMRMLAstroVolumeNode")))
-    {
-    return;
-    }
+  //change axes label names
+  if (node->IsA("vtkMRMLViewNode"))
+    {
+    vtkMRMLViewNode *viewNode =
+      vtkMRMLViewNode::SafeDownCast(node);
+
+    viewNode->DisableModifiedEventOn();
+
+    //setting Axes Labels
+    viewNode->SetAxisLabel(0,"W");
+    viewNode->SetAxisLabel(1,"E");
+    viewNode->SetAxisLabel(2,"Z");
+    viewNode->SetAxisLabel(3,"z");
+    viewNode->SetAxisLabel(4,"S");
+    viewNode->SetAxisLabel(5,"N");
+
+    viewNode->DisableModifiedEventOff();
+
+    //unregister RulerDisplayableManager
+    vtkMRMLThreeDViewDisplayableManagerFactory::GetInstance()->
+      UnRegisterDisplayableManager("vtkMRMLRulerDisplayableManager");
+    }
+
+  if (node->IsA("vtkMRMLSliceNode"))
+    {
+    vtkMRMLSliceNode *sliceNode =
+      vtkMRMLSliceNode::SafeDownCast(node);
+
+    sliceNode->DisableModifiedEventOn();
+
+    // setting Axes Labels
+    sliceNode->SetAxisLabel(0,"W");
+    sliceNode->SetAxisLabel(1,"E");
+    sliceNode->SetAxisLabel(2,"Z");
+    sliceNode->SetAxisLabel(3,"z");
+    sliceNode->SetAxisLabel(4,"S");
+    sliceNode->SetAxisLabel(5,"N");
+
+    sliceNode->DisableModifiedEventOff();
+
+    //unregister RulerDisplayableManager
+    vtkMRMLSliceViewDisplayableManagerFactory::GetInstance()->
+      UnRegisterDisplayableManager("vtkMRMLRulerDisplayableManager");
+    }
+
+  if (node->IsA("vtkMRMLSegmentEditorNode"))
+    {
+    vtkSmartPointer<vtkCollection> col = vtkSmartPointer<vtkCollection>::Take(
+      this->GetMRMLScene()->GetNodesByClass("vtkMRMLSegmentEditorNode"));
+    vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
+      this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
+    if (!selectionNode)
+      {
+      return;
+      }
+
+    vtkMRMLSegmentEditorNode* segmentEditorNode =
+      vtkMRMLSegmentEditorNode::SafeDownCast(col->GetItemAsObject(0));
+
+    if (!segmentEditorNode)
+      {
+      selectionNode->RemoveNodeReferenceIDs("SegmentEditorNodeRef");
+      return;
+      }
+
+    selectionNode->AddAndObserveNodeReferenceID("SegmentEditorNodeRef", segmentEditorNode->GetID());
+
+    col->RemoveAllItems();
+    }
+
+  //check WCS and update unit nodes
+  if (node->IsA("vtkMRMLAstroVolumeNode"))
+    {
+    vtkSmartPointer<vtkCollection> listAstroVolumes = vtkSmartPointer<vtkCollection>::Take(
+      this->GetMRMLScene()->GetNodesByClass("vtkMRMLAstroVolumeNode"));
+
+    bool WCS = false;
+    double min = std::numeric_limits<double>::max(), max = -std::numeric_limits<double>::max();
+    for(int i = 0; i < listAstroVolumes->GetNumberOfItems(); i++)
+      {
+      vtkMRMLAstroVolumeNode* astroVolumeNode =
+        vtkMRMLAstroVolumeNode::SafeDownCast(listAstroVolumes->GetItemAsObject(i));
+      if (astroVolumeNode)
+        {
+        double mint = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMIN"));
+        if (mint < min)
+          {
+          min = mint;
+          }
+        double maxt = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMAX"));
+        if (maxt > max)
+          {
+          max = maxt;
+          }
+        vtkMRMLAstroVolumeDisplayNode* astroVolumeDisplayNode =
+             astroVolumeNode->GetAstroVolumeDisplayNode();
+        if(!astroVolumeDisplayNode)
+          {
+          continue;
+          }
+        if(astroVolumeDisplayNode->GetWCSStatus() != 0 && WCS)
+          {
+          vtkWarningMacro("Both WCS and non-WCS compatible Volumes have been added to the Scene."<<endl
+                           <<"It may results in odd behaviours."<<endl);
+          }
+        if(astroVolumeDisplayNode->GetWCSStatus() == 0)
+          {
+          WCS = true;
+          }
+        }
+      }
+
+    vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
+      this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
+    if (selectionNode)
+      {
+      vtkMRMLUnitNode* unitNodeIntensity = selectionNode->GetUnitNode("intensity");
+      unitNodeIntensity->SetMaximumValue(max);
+      unitNodeIntensity->SetMinimumValue(min);
+      unitNodeIntensity->SetDisplayCoefficient(1.);
+      std::string temp = " ";
+      if(max < 0.001)
+        {
+        temp += "\xB5";
+        unitNodeIntensity->SetDisplayCoefficient(1000000.);
+        }
+      else
+        {
+        if(max < 1.)
+          {
+          temp += "m";
+          unitNodeIntensity->SetDisplayCoefficient(1000.);
+          }
+        }
+
+      temp += "Jy/beam";
+      unitNodeIntensity->SetPrecision(6);
+      unitNodeIntensity->SetPrefix("");
+      unitNodeIntensity->SetSuffix(temp.c_str());
+      selectionNode->SetUnitNodeID("intensity", unitNodeIntensity->GetID());
+      }
+    }
+
+  if (node->IsA("vtkMRMLAstroVolumeNode") ||
+      node->IsA("vtkMRMLAstroLabelMapVolumeNode"))
+    {
+    // change axes label names
+    vtkSmartPointer<vtkCollection> viewNodes = vtkSmartPointer<vtkCollection>::Take
+      (this->GetMRMLScene()->GetNodesByClass("vtkMRMLViewNode"));
+
+    for(int i = 0; i < viewNodes->GetNumberOfItems(); i++)
+      {
+      vtkMRMLViewNode* viewNode =
+        vtkMRMLViewNode::SafeDownCast(viewNodes->GetItemAsObject(i));
+      if (viewNode)
+        {
+        viewNode->DisableModifiedEventOn();
+
+        viewNode->SetAxisLabel(0,"W");
+        viewNode->SetAxisLabel(1,"E");
+        viewNode->SetAxisLabel(2,"Z");
+        viewNode->SetAxisLabel(3,"z");
+        viewNode->SetAxisLabel(4,"S");
+        viewNode->SetAxisLabel(5,"N");
+
+        viewNode->DisableModifiedEventOff();
+        }
+      }
+
+    vtkSmartPointer<vtkCollection> sliceNodes = vtkSmartPointer<vtkCollection>::Take
+      (this->GetMRMLScene()->GetNodesByClass("vtkMRMLSliceNode"));
+
+    for(int i = 0; i < sliceNodes->GetNumberOfItems(); i++)
+      {
+      vtkMRMLSliceNode* sliceNode =
+        vtkMRMLSliceNode::SafeDownCast(sliceNodes->GetItemAsObject(i));
+      if (sliceNode)
+        {
+        sliceNode->DisableModifiedEventOn();
+
+        sliceNode->SetAxisLabel(0,"W");
+        sliceNode->SetAxisLabel(1,"E");
+        sliceNode->SetAxisLabel(2,"Z");
+        sliceNode->SetAxisLabel(3,"z");
+        sliceNode->SetAxisLabel(4,"S");
+        sliceNode->SetAxisLabel(5,"N");
+
+        sliceNode->DisableModifiedEventOff();
+        }
+      }
+
+    vtkMRMLSliceNode* sliceNodeRed = vtkMRMLSliceNode::SafeDownCast
+      (this->GetMRMLScene()->GetNodeByID("vtkMRMLSliceNodeRed"));
+    sliceNodeRed->SetOrientation("XY");
+
+    vtkMRMLSliceNode* sliceNodeYellow = vtkMRMLSliceNode::SafeDownCast
+      (this->GetMRMLScene()->GetNodeByID("vtkMRMLSliceNodeYellow"));
+    sliceNodeYellow->SetOrientation("XZ");
+
+    vtkMRMLSliceNode* sliceNodeGreen = vtkMRMLSliceNode::SafeDownCast
+      (this->GetMRMLScene()->GetNodeByID("vtkMRMLSliceNodeGreen"));
+    sliceNodeGreen->SetOrientation("ZY");
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::OnMRMLSceneNodeRemoved(vtkMRMLNode *node)
+{
+  if (!node)
+    {
+    return;
+    }
+
+  if (node->IsA("vtkMRMLAstroVolumeNode"))
+    {
+    this->ClearHistogramCache(vtkMRMLAstroVolumeNode::SafeDownCast(node));
+    }
+
+  if (node->IsA("vtkMRMLSegmentEditorNode"))
+    {
+    vtkSmartPointer<vtkCollection> col = vtkSmartPointer<vtkCollection>::Take(
+      this->GetMRMLScene()->GetNodesByClass("vtkMRMLSegmentEditorNode"));
+    vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
+      this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
+    if (!selectionNode)
+      {
+      return;
+      }
+
+    vtkMRMLSegmentEditorNode* segmentEditorNode =
+      vtkMRMLSegmentEditorNode::SafeDownCast(col->GetItemAsObject(0));
+
+    if (!segmentEditorNode)
+      {
+      selectionNode->RemoveNodeReferenceIDs("SegmentEditorNodeRef");
+      return;
+      }
+
+    selectionNode->AddAndObserveNodeReferenceID("SegmentEditorNodeRef", segmentEditorNode->GetID());
+
+    col->RemoveAllItems();
+    }
+
+}
+
+namespace
+{
+//----------------------------------------------------------------------------
+ArchetypeVolumeNodeSet AstroVolumeNodeSetFactory(std::string& volumeName, vtkMRMLScene* scene, int options)
+{
+  ArchetypeVolumeNodeSet nodeSet(scene);
+
+  // set up the Astro node's support nodes
+  vtkNew<vtkMRMLAstroVolumeNode> astroNode;
+  astroNode->SetName(volumeName.c_str());
+  nodeSet.Scene->AddNode(astroNode.GetPointer());
+
+  vtkNew<vtkMRMLAstroVolumeDisplayNode> adisplayNode;
+  adisplayNode->SetAutoWindowLevel(0);
+  nodeSet.Scene->AddNode(adisplayNode.GetPointer());
+  astroNode->SetAndObserveDisplayNodeID(adisplayNode->GetID());
+
+  vtkNew<vtkMRMLAstroVolumeStorageNode> storageNode;
+  storageNode->SetCenterImage(options & vtkSlicerVolumesLogic::CenterImage);
+  nodeSet.Scene->AddNode(storageNode.GetPointer());
+  astroNode->SetAndObserveStorageNodeID(storageNode->GetID());
+
+  nodeSet.StorageNode = storageNode.GetPointer();
+  nodeSet.DisplayNode = adisplayNode.GetPointer();
+  nodeSet.Node = astroNode.GetPointer();
+
+  return nodeSet;
+}
+
+};
+
+
+namespace
+{
+//----------------------------------------------------------------------------
+ArchetypeVolumeNodeSet AstroLabelMapVolumeNodeSetFactory(std::string& volumeName, vtkMRMLScene* scene, int options)
+{
+  ArchetypeVolumeNodeSet nodeSet(scene);
+
+  // set up the AstroLabelMap node's support nodes
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> astroLabelMapNode;
+  astroLabelMapNode->SetName(volumeName.c_str());
+  nodeSet.Scene->AddNode(astroLabelMapNode.GetPointer());
+
+  vtkNew<vtkMRMLAstroLabelMapVolumeDisplayNode> lmdisplayNode;
+  nodeSet.Scene->AddNode(lmdisplayNode.GetPointer());
+  astroLabelMapNode->SetAndObserveDisplayNodeID(lmdisplayNode->GetID());
+
+  vtkNew<vtkMRMLAstroVolumeStorageNode> storageNode;
+  storageNode->SetCenterImage(options & vtkSlicerVolumesLogic::CenterImage);
+  nodeSet.Scene->AddNode(storageNode.GetPointer());
+  astroLabelMapNode->SetAndObserveStorageNodeID(storageNode->GetID());
+
+  nodeSet.StorageNode = storageNode.GetPointer();
+  nodeSet.DisplayNode = lmdisplayNode.GetPointer();
+  nodeSet.Node = astroLabelMapNode.GetPointer();
+
+  nodeSet.LabelMap = true;
+
+  return nodeSet;
+}
+
+};
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::RegisterArchetypeVolumeNodeSetFactory(vtkSlicerVolumesLogic* volumesLogic)
+{
+  if (volumesLogic)
+    {
+    volumesLogic->PreRegisterArchetypeVolumeNodeSetFactory(AstroLabelMapVolumeNodeSetFactory);
+    volumesLogic->PreRegisterArchetypeVolumeNodeSetFactory(AstroVolumeNodeSetFactory);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::RegisterNodes()
+{
+  if(!this->GetMRMLScene())
+    {
+    return;
+    }
+  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroVolumeNode>().GetPointer());
+  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroVolumeDisplayNode>().GetPointer());
+  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroVolumeStorageNode>().GetPointer());
+  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroLabelMapVolumeNode>().GetPointer());
+  this->GetMRMLScene()->RegisterNodeClass(vtkNew<vtkMRMLAstroLabelMapVolumeDisplayNode>().GetPointer());
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLScene *vtkSlicerAstroVolumeLogic::GetPresetsScene()
+{
+  if (!this->PresetsScene)
+    {
+    this->PresetsScene = vtkSmartPointer<vtkMRMLScene>::New();
+    }
+  this->LoadPresets(this->PresetsScene);
+  return this->PresetsScene;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::updateUnitsNodes(vtkMRMLNode *astroVolumeNode)
+{
+  if (!astroVolumeNode)
+    {
+    return;
+    }
+
+  if (!(astroVolumeNode->IsA("vtkMRMLAstroVolumeNode")))
+    {
+    return;
+    }
+
+  vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
+    this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
+  if (selectionNode)
+    {
+    vtkMRMLUnitNode* unitNode1 = selectionNode->GetUnitNode("intensity");
+    double max = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMAX"));
+    double min = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMIN"));
+    unitNode1->SetMaximumValue(max);
+    unitNode1->SetMinimumValue(min);
+    unitNode1->SetDisplayCoefficient(1.);
+    std::string temp = " ";
+    if(max < 0.001)
+      {
+      temp += "\xB5";
+      unitNode1->SetDisplayCoefficient(1000000.);
+      }
+    else
+      {
+      if(max < 1.)
+        {
+        temp += "m";
+        unitNode1->SetDisplayCoefficient(1000.);
+        }
+      }
+
+    temp += "Jy/beam";
+    unitNode1->SetPrecision(6);
+    unitNode1->SetPrefix("");
+    unitNode1->SetSuffix(temp.c_str());
+    unitNode1->SetAttribute("DisplayHint","");
+    selectionNode->SetUnitNodeID("intensity", unitNode1->GetID());
+    }
+
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAstroLabelMapVolumeNode *vtkSlicerAstroVolumeLogic::CreateAndAddLabelVolume(vtkMRMLScene *scene,
+                                                                                   vtkMRMLAstroVolumeNode *volumeNode,
+                                                                                   const char *name)
+{
+  if (scene == NULL || volumeNode == NULL || name == NULL)
+    {
+    return NULL;
+    }
+
+  // Create a volume node as copy of source volume
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> labelNode;
+  std::string uname = this->GetMRMLScene()->GetUniqueNameByString(name);
+  labelNode->SetName(uname.c_str());
+  scene->AddNode(labelNode.GetPointer());
+
+  this->CreateLabelVolumeFromVolume(scene, labelNode.GetPointer(), volumeNode);
+
+  return labelNode.GetPointer();
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAstroLabelMapVolumeNode *vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume(vtkMRMLScene *scene,
+                                                                                       vtkMRMLAstroLabelMapVolumeNode *labelNode,
+                                                                                       vtkMRMLAstroVolumeNode *inputVolume)
+{
+  if (scene == NULL || labelNode == NULL || inputVolume == NULL)
+    {
+    return NULL;
+    }
+
+  // Create a display node if the label node does not have one
+  vtkSmartPointer<vtkMRMLAstroLabelMapVolumeDisplayNode> labelDisplayNode =
+    vtkMRMLAstroLabelMapVolumeDisplayNode::SafeDownCast(labelNode->GetDisplayNode());
+  if (labelDisplayNode.GetPointer() == NULL)
+    {
+    vtkMRMLAstroVolumeDisplayNode* astroVolumeDisplay = inputVolume->GetAstroVolumeDisplayNode();
+    labelDisplayNode = vtkSmartPointer<vtkMRMLAstroLabelMapVolumeDisplayNode>::New();
+    labelDisplayNode->SetSpaceQuantities(astroVolumeDisplay->GetSpaceQuantities());
+    labelDisplayNode->SetSpace(astroVolumeDisplay->GetSpace());
+    labelDisplayNode->SetAttribute("SlicerAstro.NAXIS", inputVolume->GetAttribute("SlicerAstro.NAXIS"));
+
+    struct wcsprm* labelWCS;
+    struct wcsprm* volumeWCS;
+
+    labelWCS = labelDisplayNode->GetWCSStruct();
+    volumeWCS = astroVolumeDisplay->GetWCSStruct();
+
+    if (!labelWCS || !volumeWCS)
+      {
+      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume : "
+                    "WCS not found!");
+      return NULL;
+      }
+    labelWCS->flag=-1;
+
+    labelDisplayNode->SetWCSStatus(wcscopy(1, volumeWCS, labelWCS));
+    if (labelDisplayNode->GetWCSStatus())
+      {
+      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume : "
+                    "wcscopy ERROR "<<labelDisplayNode->GetWCSStatus()<<":\n"<<
+                    "Message from "<<labelWCS->err->function<<
+                    "at line "<<labelWCS->err->line_no<<" of file "<<labelWCS->err->file<<
+                    ": \n"<<labelWCS->err->msg<<"\n");
+      return NULL;
+      }
+
+    labelDisplayNode->SetWCSStatus(wcsset(labelWCS));
+    if (labelDisplayNode->GetWCSStatus())
+      {
+      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume :"
+                    "wcsset ERROR "<<labelDisplayNode->GetWCSStatus()<<":\n"<<
+                    "Message from "<<labelWCS->err->function<<
+                    "at line "<<labelWCS->err->line_no<<" of file "<<labelWCS->err->file<<
+                    ": \n"<<labelWCS->err->msg<<"\n");
+      return NULL;
+      }
+
+    scene->AddNode(labelDisplayNode);
+    }
+
+  // We need to copy from the volume node to get required attributes, but
+  // the copy copies inputVolume's name as well.  So save the original name
+  // and re-set the name after the copy.
+  std::string origName(labelNode->GetName());
+  labelNode->Copy(inputVolume);
+  labelNode->SetAndObserveStorageNodeID(NULL);
+  labelNode->SetName(origName.c_str());
+  labelNode->SetAndObserveDisplayNodeID(labelDisplayNode->GetID());
+
+  // Associate labelmap with the source volume
+  //TODO: Obsolete, replace mechanism with node references
+  if (inputVolume->GetID())
+    {
+    labelNode->SetAttribute("AssociatedNodeID", inputVolume->GetID());
+    }
+
+  std::vector<std::string> keys = inputVolume->GetAttributeNames();
+  for (std::vector<std::string>::iterator kit = keys.begin(); kit != keys.end(); ++kit)
+    {
+    labelNode->SetAttribute((*kit).c_str(), inputVolume->GetAttribute((*kit).c_str()));
+    }
+  labelNode->SetAttribute("SlicerAstro.DATAMODEL", "MASK");
+  labelNode->SetAttribute("SlicerAstro.BITPIX", "16");
+  // the label values are not scaled
+  labelNode->SetAttribute("SlicerAstro.BSCALE", "1.");
+  labelNode->SetAttribute("SlicerAstro.BZERO", "0.");
+  labelNode->RemoveAttribute("SlicerAstro.BLANK");
+
+  // Set the display node to have a label map lookup table
+  this->SetAndObserveColorToDisplayNode(labelDisplayNode,
+                                        /* labelMap = */ 1, /* filename= */ 0);
+
+  // Make an image data of the same size and shape as the input volume,
+  // but 16 bit and filled with zeros (the voxels of the input are not read).
+  vtkNew<vtkImageData> imageData;
+  if (inputVolume->GetImageData() &&
+      AllocateZeroedImageData(inputVolume, VTK_SHORT, imageData.GetPointer()))
+    {
+    labelNode->SetAndObserveImageData(imageData.GetPointer());
+    }
+
+  return labelNode;
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAstroVolumeNode *vtkSlicerAstroVolumeLogic::CloneVolumeGeometry(vtkMRMLScene *scene,
+                                                                       vtkMRMLAstroVolumeNode *volumeNode,
+                                                                       const char *name,
+                                                                       int scalarType)
+{
+  if (scene == NULL || volumeNode == NULL || volumeNode->GetImageData() == NULL)
+    {
+    return NULL;
+    }
+
+  // the geometry of on-demand volumes comes from the header (the voxels are not read)
+  vtkNew<vtkImageData> imageData;
+  if (!AllocateZeroedImageData(volumeNode, scalarType, imageData.GetPointer()))
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CloneVolumeGeometry : "
+                  "unable to get the geometry of "<<volumeNode->GetID());
+    return NULL;
+    }
+
+  vtkMRMLAstroVolumeNode *clonedVolumeNode = vtkMRMLAstroVolumeNode::SafeDownCast
+    (vtkSlicerVolumesLogic::CloneVolume(scene, volumeNode, name, /* cloneImageData = */ false));
+  if (!clonedVolumeNode)
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CloneVolumeGeometry : "
+                  "unable to clone "<<volumeNode->GetID());
+    return NULL;
+    }
+
+  clonedVolumeNode->SetAndObserveImageData(imageData.GetPointer());
+
+  return clonedVolumeNode;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerAstroVolumeLogic::CalculateRMSinROI(vtkMRMLAnnotationROINode *roiNode,
+                                                    vtkMRMLAstroVolumeNode *inputVolume)
+{
+  if (!roiNode)
+    {
+    return 0.;
+    }
+
+  ROIStatistics statistics;
+  if (!this->CalculateROIStatistics(roiNode, inputVolume, statistics))
+    {
+    return 0.;
+    }
+
+  inputVolume->SetAttribute("SlicerAstro.RMS", DoubleToString(statistics.RMS).c_str());
+  inputVolume->SetAttribute("SlicerAstro.RMSMEAN", DoubleToString(statistics.Mean).c_str());
+
+  return statistics.RMS;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerAstroVolumeLogic::CalculateROIStatistics(vtkMRMLAnnotationROINode *roiNode,
+                                                       vtkMRMLAstroVolumeNode *inputVolume,
+                                                       ROIStatistics &statistics,
+                                                       vtkMRMLVolumeNode *maskVolume)
+{
+  // on-demand volumes are read in full
+  if (!roiNode || !inputVolume || !inputVolume->UpdateWholeImageData())
+    {
+    return false;
+    }
+
+  int extent[6];
+  if (!ROIExtent(roiNode, inputVolume, extent))
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateROIStatistics : "
+                  "the ROI does not overlap the volume.");
+    return false;
+    }
+
+  std::string error;
+  if (!this->CalculateExtentStatistics(inputVolume, extent, maskVolume, true, statistics, error))
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateROIStatistics : "<<error);
+    return false;
+    }
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerAstroVolumeLogic::CalculateROIStatistics(vtkCollection *roiNodes,
+                                                       vtkMRMLAstroVolumeNode *inputVolume,
+                                                       vtkTable *table,
+                                                       vtkMRMLVolumeNode *maskVolume)
+{
+  // on-demand volumes are read in full (before the parallel loop)
+  if (!roiNodes || !inputVolume || !table || !inputVolume->UpdateWholeImageData())
+    {
+    return false;
+    }
+
+  const int numROIs = roiNodes->GetNumberOfItems();
+  std::vector<ROIStatistics> statistics(numROIs);
+  std::vector<int> extents(6 * numROIs, 0);
+  std::vector<char> valid(numROIs, 0);
+  for (int roi = 0; roi < numROIs; roi++)
+    {
+    vtkMRMLAnnotationROINode *roiNode =
+      vtkMRMLAnnotationROINode::SafeDownCast(roiNodes->GetItemAsObject(roi));
+    valid[roi] = roiNode && ROIExtent(roiNode, inputVolume, &extents[6 * roi]);
+    }
+
+  // one ROI per thread; the errors are reported after the loop
+  std::vector<std::string> errors(numROIs);
+  std::vector<char> failed(numROIs, 0);
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int roi = 0; roi < numROIs; roi++)
+    {
+    failed[roi] = valid[roi] &&
+      !this->CalculateExtentStatistics(inputVolume, &extents[6 * roi], maskVolume,
+                                       false, statistics[roi], errors[roi]);
+    }
+
+  bool success = true;
+  for (int roi = 0; roi < numROIs; roi++)
+    {
+    if (failed[roi])
+      {
+      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateROIStatistics : ROI "
+                    <<roi<<" : "<<errors[roi]);
+      success = false;
+      }
+    }
+  if (!success)
+    {
+    return false;
+    }
+
+  table->Initialize();
+  const char* names[8] = {"ROI", "N", "Mean", "RMS", "RobustSigma", "Min", "Max", "FluxSum"};
+  for (int column = 0; column < 8; column++)
+    {
+    vtkSmartPointer<vtkAbstractArray> array;
+    if (column == 0)
+      {
+      array = vtkSmartPointer<vtkStringArray>::New();
+      }
+    else if (column == 1)
+      {
+      array = vtkSmartPointer<vtkIdTypeArray>::New();
+      }
+    else
+      {
+      array = vtkSmartPointer<vtkDoubleArray>::New();
+      }
+    array->SetName(names[column]);
+    array->SetNumberOfTuples(numROIs);
+    table->AddColumn(array);
+    }
+
+  const double NaN = sqrt(-1);
+  for (int roi = 0; roi < numROIs; roi++)
+    {
+    vtkMRMLNode *roiNode = vtkMRMLNode::SafeDownCast(roiNodes->GetItemAsObject(roi));
+    const ROIStatistics &roiStatistics = statistics[roi];
+    table->SetValue(roi, 0, vtkVariant(roiNode && roiNode->GetName() ? roiNode->GetName() : ""));
+    table->SetValue(roi, 1, vtkVariant(valid[roi] ? roiStatistics.NumberOfValues : 0));
+    table->SetValue(roi, 2, vtkVariant(valid[roi] ? roiStatistics.Mean : NaN));
+    table->SetValue(roi, 3, vtkVariant(valid[roi] ? roiStatistics.RMS : NaN));
+    table->SetValue(roi, 4, vtkVariant(valid[roi] ? roiStatistics.RobustSigma : NaN));
+    table->SetValue(roi, 5, vtkVariant(valid[roi] ? roiStatistics.Min : NaN));
+    table->SetValue(roi, 6, vtkVariant(valid[roi] ? roiStatistics.Max : NaN));
+    table->SetValue(roi, 7, vtkVariant(valid[roi] ? roiStatistics.FluxSum : NaN));
+    }
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerAstroVolumeLogic::CalculateExtentStatistics(vtkMRMLAstroVolumeNode *inputVolume,
+                                                          int extent[6],
+                                                          vtkMRMLVolumeNode *maskVolume,
+                                                          bool parallel,
+                                                          ROIStatistics &statistics,
+                                                          std::string &error)
+{
+  vtkImageData *imageData = inputVolume->GetImageData();
+  if (!imageData || !imageData->GetPointData() || !imageData->GetPointData()->GetScalars())
+    {
+    error = "imageData not allocated.";
+    return false;
+    }
+
+  if (imageData->GetNumberOfScalarComponents() > 1)
+    {
+    error = "imageData with more than one components.";
+    return false;
+    }
+
+  int *dims = imageData->GetDimensions();
+  const void *mask = NULL;
+  int maskType = VTK_UNSIGNED_CHAR;
+  if (maskVolume)
+    {
+    vtkImageData *maskData = maskVolume->GetImageData();
+    if (!maskData || !maskData->GetPointData() || !maskData->GetPointData()->GetScalars())
+      {
+      error = "mask imageData not allocated.";
+      return false;
+      }
+    int *maskDims = maskData->GetDimensions();
+    if (maskDims[0] != dims[0] || maskDims[1] != dims[1] || maskDims[2] != dims[2] ||
+        maskData->GetNumberOfScalarComponents() > 1)
+      {
+      error = "the mask does not match the volume.";
+      return false;
+      }
+    mask = maskData->GetScalarPointer();
+    maskType = maskData->GetPointData()->GetScalars()->GetDataType();
+    }
+
+  const void *pixel = imageData->GetScalarPointer();
+  const double blank = inputVolume->GetDataBlank();
+  double bscale = 1., bzero = 0.;
+  inputVolume->GetDataScaling(bscale, bzero);
+
+  // first pass: moments and range; second pass: histogram for the robust sigma
+  ROIAccumulator acc;
+  std::vector<vtkIdType> histogram(ROIHistogramBins, 0);
+  bool success = true;
+  switch (imageData->GetPointData()->GetScalars()->GetDataType())
+    {
+    vtkTemplateMacro(success = ROIStatisticsDispatch(static_cast<const VTK_TT*>(pixel), mask,
+                                                     maskType, dims, extent, blank, parallel,
+                                                     acc, histogram));
+    }
+  if (!success)
+    {
+    error = "attempt to allocate scalars of type not allowed";
+    return false;
+    }
+
+  const double NaN = sqrt(-1);
+  statistics.NumberOfValues = acc.NumberOfValues;
+  if (acc.NumberOfValues == 0)
+    {
+    statistics.Mean = statistics.RMS = statistics.RobustSigma = NaN;
+    statistics.Min = statistics.Max = NaN;
+    statistics.FluxSum = 0.;
+    return true;
+    }
+
+  const double rawMean = acc.Sum / acc.NumberOfValues;
+  const double variance = std::max(0., acc.Sum2 / acc.NumberOfValues - rawMean * rawMean);
+  statistics.Mean = bscale * rawMean + bzero;
+  statistics.RMS = fabs(bscale) * sqrt(variance);
+  statistics.Min = bscale * acc.Min + bzero;
+  statistics.Max = bscale * acc.Max + bzero;
+  if (statistics.Min > statistics.Max)
+    {
+    std::swap(statistics.Min, statistics.Max);
+    }
+  statistics.FluxSum = bscale * acc.Sum + bzero * acc.NumberOfValues;
+
+  // robust sigma of a gaussian from the interquartile range
+  double quartiles[2] = {acc.Min, acc.Min};
+  const double binWidth = (acc.Max - acc.Min) / ROIHistogramBins;
+  for (int ii = 0; ii < 2 && binWidth > 0.; ii++)
+    {
+    const double target = (ii == 0 ? 0.25 : 0.75) * acc.NumberOfValues;
+    vtkIdType cumulative = 0;
+    for (int bin = 0; bin < ROIHistogramBins; bin++)
+      {
+      if (histogram[bin] > 0 && cumulative + histogram[bin] >= target)
+        {
+        quartiles[ii] = acc.Min + binWidth * (bin + (target - cumulative) / histogram[bin]);
+        break;
+        }
+      cumulative += histogram[bin];
+      }
+    }
+  statistics.RobustSigma = fabs(bscale) * (quartiles[1] - quartiles[0]) / 1.349;
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerAstroVolumeLogic::SourceFinderParameters::SourceFinderParameters()
+{
+  this->Threshold = 0.;
+  this->MergeRadiusXY = 1;
+  this->MergeRadiusZ = 1;
+  this->MinimumSize = 1;
+  this->MinimumChannels = 1;
+  this->MinimumReliability = 0.;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerAstroVolumeLogic::FindSources(vtkMRMLAstroVolumeNode *inputVolume,
+                                           const SourceFinderParameters &parameters,
+                                           vtkMRMLAstroLabelMapVolumeNode *labelVolume,
+                                           vtkTable *catalogue)
+{
+  if (!inputVolume || !labelVolume)
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::FindSources : "
+                  "inputVolume or labelVolume not found.");
+    return -1;
+    }
+
+  // on-demand volumes are read in full
+  if (!inputVolume->UpdateWholeImageData())
+    {
+    return -1;
+    }
+
+  vtkImageData *imageData = inputVolume->GetImageData();
+  if (!imageData || !imageData->GetPointData() || !imageData->GetPointData()->GetScalars())
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::FindSources : "
+                  "imageData not allocated.");
+    return -1;
+    }
+
+  if (imageData->GetNumberOfScalarComponents() > 1)
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::FindSources : "
+                  "imageData with more than one components.");
+    return -1;
+    }
+
+  if (parameters.MinimumReliability > 0. && parameters.Threshold <= 0.)
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::FindSources : "
+                  "the reliability needs a positive threshold.");
+    return -1;
+    }
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  int dims[3];
+  imageData->GetDimensions(dims);
+  const void *pixel = imageData->GetScalarPointer();
+  const int dataType = imageData->GetPointData()->GetScalars()->GetDataType();
+  const double blank = inputVolume->GetDataBlank();
+  double bscale = 1., bzero = 0.;
+  inputVolume->GetDataScaling(bscale, bzero);
+  const int radiusXY = std::max(1, parameters.MergeRadiusXY);
+  const int radiusZ = std::max(0, parameters.MergeRadiusZ);
+
+  // positive (and negative) detections
+  const int numSigns = parameters.MinimumReliability > 0. ? 2 : 1;
+  SourceRuns sourceRuns[2];
+  std::vector<SourceProperties> components[2];
+  for (int sign = 0; sign < numSigns; sign++)
+    {
+    switch (dataType)
+      {
+      vtkTemplateMacro(FindSourcesDispatch(static_cast<const VTK_TT*>(pixel), dims, bscale, bzero,
+                                           blank, parameters.Threshold, sign == 0 ? 1. : -1.,
+                                           radiusXY, radiusZ, sourceRuns[sign], components[sign]));
+      default:
+        vtkErrorMacro("vtkSlicerAstroVolumeLogic::FindSources : "
+                      "attempt to allocate scalars of type not allowed");
+        return -1;
+      }
+    }
+
+  // size filters, then reliability of the remaining sources
+  std::vector<vtkIdType> candidates[2];
+  std::vector<SourceProperties> filtered[2];
+  for (int sign = 0; sign < numSigns; sign++)
+    {
+    for (size_t component = 0; component < components[sign].size(); component++)
+      {
+      const SourceProperties &source = components[sign][component];
+      if (source.NumberOfVoxels >= parameters.MinimumSize &&
+          source.Extent[5] - source.Extent[4] + 1 >= parameters.MinimumChannels)
+        {
+        candidates[sign].push_back(component);
+        filtered[sign].push_back(source);
+        }
+      }
+    }
+  if (numSigns == 2)
+    {
+    SourceReliability(filtered[0], filtered[1]);
+    }
+
+  // labels of the components (0: discarded)
+  std::vector<int> labels(components[0].size(), 0);
+  std::vector<vtkIdType> sources;
+  for (size_t candidate = 0; candidate < candidates[0].size(); candidate++)
+    {
+    components[0][candidates[0][candidate]].Reliability = filtered[0][candidate].Reliability;
+    if (filtered[0][candidate].Reliability >= parameters.MinimumReliability)
+      {
+      sources.push_back(candidates[0][candidate]);
+      }
+    }
+
+  if (sources.size() > static_cast<size_t>(VTK_SHORT_MAX))
+    {
+    vtkWarningMacro("vtkSlicerAstroVolumeLogic::FindSources : "
+                    "found "<<sources.size()<<" sources, only the "<<VTK_SHORT_MAX<<
+                    " brightest are labelled.");
+    std::vector<std::pair<double, vtkIdType> > fluxes(sources.size());
+    for (size_t source = 0; source < sources.size(); source++)
+      {
+      fluxes[source] = std::make_pair(-components[0][sources[source]].Sum, sources[source]);
+      }
+    std::partial_sort(fluxes.begin(), fluxes.begin() + VTK_SHORT_MAX, fluxes.end());
+    sources.resize(VTK_SHORT_MAX);
+    for (int source = 0; source < VTK_SHORT_MAX; source++)
+      {
+      sources[source] = fluxes[source].second;
+      }
+    std::sort(sources.begin(), sources.end());
+    }
+
+  const int numSources = sources.size();
+  for (int source = 0; source < numSources; source++)
+    {
+    labels[sources[source]] = source + 1;
+    }
+
+  // label volume
+  vtkNew<vtkImageData> labelImageData;
+  AllocateZeroedImageData(imageData, VTK_SHORT, labelImageData.GetPointer());
+  short *labelPixel = static_cast<short*>(labelImageData->GetScalarPointer());
+  const SourceRuns &positiveRuns = sourceRuns[0];
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int kk = 0; kk < dims[2]; kk++)
+    {
+    for (int jj = 0; jj < dims[1]; jj++)
+      {
+      const vtkIdType rowIndex = jj + static_cast<vtkIdType>(kk) * dims[1];
+      short *row = labelPixel + kk * numSlice + static_cast<vtkIdType>(jj) * dims[0];
+      for (vtkIdType run = positiveRuns.RowOffsets[rowIndex]; run < positiveRuns.RowOffsets[rowIndex + 1]; run++)
+        {
+        const short label = static_cast<short>(labels[positiveRuns.Parents[run]]);
+        if (label > 0)
+          {
+          std::fill(row + positiveRuns.Runs[run].Start, row + positiveRuns.Runs[run].End + 1, label);
+          }
+        }
+      }
+    }
+
+  vtkNew<vtkMatrix4x4> IJKToRASMatrix;
+  inputVolume->GetIJKToRASMatrix(IJKToRASMatrix.GetPointer());
+  labelVolume->SetIJKToRASMatrix(IJKToRASMatrix.GetPointer());
+  labelVolume->SetAndObserveImageData(labelImageData.GetPointer());
+  labelVolume->UpdateRangeAttributes();
 
-  vtkMRMLSelectionNode* selectionNode =  vtkMRMLSelectionNode::SafeDownCast(
-    this->GetMRMLScene()->GetNodeByID("vtkMRMLSelectionNodeSingleton"));
-  if (selectionNode)
+  // catalogue
+  if (catalogue)
     {
-    vtkMRMLUnitNode* unitNode1 = selectionNode->GetUnitNode("intensity");
-    double max = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMAX"));
-    double min = StringToDouble(astroVolumeNode->GetAttribute("SlicerAstro.DATAMIN"));
-    unitNode1->SetMaximumValue(max);
-    unitNode1->SetMinimumValue(min);
-    unitNode1->SetDisplayCoefficient(1.);
-    std::string temp = " ";
-    if(max < 0.001)
+    catalogue->Initialize();
+    const int numColumns = 15;
+    const char* names[numColumns] = {"ID", "N", "NChannels", "X", "Y", "Z",
+                                     "XMin", "XMax", "YMin", "YMax", "ZMin", "ZMax",
+                                     "Peak", "FluxSum", "Reliability"};
+    for (int column = 0; column < numColumns; column++)
       {
-      temp += "\xB5";
-      unitNode1->SetDisplayCoefficient(1000000.);
+      vtkSmartPointer<vtkAbstractArray> array;
+      if (column == 1)
+        {
+        array = vtkSmartPointer<vtkIdTypeArray>::New();
+        }
+      else if (column == 0 || column == 2 || (column >= 6 && column <= 11))
+        {
+        array = vtkSmartPointer<vtkIntArray>::New();
+        }
+      else
+        {
+        array = vtkSmartPointer<vtkDoubleArray>::New();
+        }
+      array->SetName(names[column]);
+      array->SetNumberOfTuples(numSources);
+      catalogue->AddColumn(array);
       }
-    else
+
+    for (int source = 0; source < numSources; source++)
       {
-      if(max < 1.)
+      const SourceProperties &properties = components[0][sources[source]];
+      catalogue->SetValue(source, 0, vtkVariant(source + 1));
+      catalogue->SetValue(source, 1, vtkVariant(properties.NumberOfVoxels));
+      catalogue->SetValue(source, 2, vtkVariant(properties.Extent[5] - properties.Extent[4] + 1));
+      // flux weighted centroid, or geometric one if the flux is not positive
+      // (threshold <= 0)
+      double centroid[3] = {properties.PositionX, properties.PositionY, properties.PositionZ};
+      double weight = properties.NumberOfVoxels;
+      if (properties.Sum > 0.)
         {
-        temp += "m";
-        unitNode1->SetDisplayCoefficient(1000.);
+        centroid[0] = properties.SumX;
+        centroid[1] = properties.SumY;
+        centroid[2] = properties.SumZ;
+        weight = properties.Sum;
+        }
+      for (int axis = 0; axis < 3; axis++)
+        {
+        catalogue->SetValue(source, 3 + axis, vtkVariant(centroid[axis] / weight));
+        }
+      for (int bound = 0; bound < 6; bound++)
+        {
+        catalogue->SetValue(source, 6 + bound, vtkVariant(properties.Extent[bound]));
         }
+      catalogue->SetValue(source, 12, vtkVariant(properties.Peak));
+      catalogue->SetValue(source, 13, vtkVariant(properties.Sum));
+      catalogue->SetValue(source, 14, vtkVariant(properties.Reliability));
       }
-
-    temp += "Jy/beam";
-    unitNode1->SetPrecision(6);
-    unitNode1->SetPrefix("");
-    unitNode1->SetSuffix(temp.c_str());
-    unitNode1->SetAttribute("DisplayHint","");
-    selectionNode->SetUnitNodeID("intensity", unitNode1->GetID());
     }
 
+  gettimeofday(&end, NULL);
+  long mtime = ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000.0) + 0.5;
+  vtkDebugMacro("FindSources Time : "<<mtime<<" ms /n");
+
+  return numSources;
 }
 
 //---------------------------------------------------------------------------
-vtkMRMLAstroLabelMapVolumeNode *vtkSlicerAstroVolumeLogic::CreateAndAddLabelVolume(vtkMRMLScene *scene,
-                                                                                   vtkMRMLAstroVolumeNode *volumeNode,
-                                                                                   const char *name)
+bool vtkSlicerAstroVolumeLogic::CalculateSourceStatistics(vtkMRMLAstroVolumeNode *inputVolume,
+                                                          vtkMRMLAstroLabelMapVolumeNode *labelVolume,
+                                                          vtkMRMLTableNode *tableNode)
 {
-  if (scene == NULL || volumeNode == NULL || name == NULL)
+  if (!inputVolume || !labelVolume || !tableNode)
     {
-    return NULL;
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateSourceStatistics : "
+                  "inputVolume, labelVolume or tableNode not found.");
+    return false;
     }
 
-  // Create a volume node as copy of source volume
-  vtkNew<vtkMRMLAstroLabelMapVolumeNode> labelNode;
-  std::string uname = this->GetMRMLScene()->GetUniqueNameByString(name);
-  labelNode->SetName(uname.c_str());
-  scene->AddNode(labelNode.GetPointer());
-
-  this->CreateLabelVolumeFromVolume(scene, labelNode.GetPointer(), volumeNode);
-
-  // Make an image data of the same size and shape as the input volume, but filled with zeros
-  vtkSlicerVolumesLogic::ClearVolumeImageData(labelNode.GetPointer());
-
-  return labelNode.GetPointer();
-}
+  // on-demand volumes are read in full
+  if (!inputVolume->UpdateWholeImageData())
+    {
+    return false;
+    }
 
-//---------------------------------------------------------------------------
-vtkMRMLAstroLabelMapVolumeNode *vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume(vtkMRMLScene *scene,
-                                                                                       vtkMRMLAstroLabelMapVolumeNode *labelNode,
-                                                                                       vtkMRMLAstroVolumeNode *inputVolume)
-{
-  if (scene == NULL || labelNode == NULL || inputVolume == NULL)
+  vtkImageData *imageData = inputVolume->GetImageData();
+  vtkImageData *labelData = labelVolume->GetImageData();
+  if (!imageData || !imageData->GetPointData() || !imageData->GetPointData()->GetScalars() ||
+      !labelData || !labelData->GetPointData() || !labelData->GetPointData()->GetScalars())
     {
-    return NULL;
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateSourceStatistics : "
+                  "imageData not allocated.");
+    return false;
     }
 
-  // Create a display node if the label node does not have one
-  vtkSmartPointer<vtkMRMLAstroLabelMapVolumeDisplayNode> labelDisplayNode =
-    vtkMRMLAstroLabelMapVolumeDisplayNode::SafeDownCast(labelNode->GetDisplayNode());
-  if (labelDisplayNode.GetPointer() == NULL)
+  int dims[3], labelDims[3];
+  imageData->GetDimensions(dims);
+  labelData->GetDimensions(labelDims);
+  if (dims[0] != labelDims[0] || dims[1] != labelDims[1] || dims[2] != labelDims[2] ||
+      imageData->GetNumberOfScalarComponents() > 1 || labelData->GetNumberOfScalarComponents() > 1)
     {
-    vtkMRMLAstroVolumeDisplayNode* astroVolumeDisplay = inputVolume->GetAstroVolumeDisplayNode();
-    labelDisplayNode = vtkSmartPointer<vtkMRMLAstroLabelMapVolumeDisplayNode>::New();
-    labelDisplayNode->SetSpaceQuantities(astroVolumeDisplay->GetSpaceQuantities());
-    labelDisplayNode->SetSpace(astroVolumeDisplay->GetSpace());
-    labelDisplayNode->SetAttribute("SlicerAstro.NAXIS", inputVolume->GetAttribute("SlicerAstro.NAXIS"));
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateSourceStatistics : "
+                  "the label map does not match the volume.");
+    return false;
+    }
 
-    struct wcsprm* labelWCS;
-    struct wcsprm* volumeWCS;
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
 
-    labelWCS = labelDisplayNode->GetWCSStruct();
-    volumeWCS = astroVolumeDisplay->GetWCSStruct();
+  const double blank = inputVolume->GetDataBlank();
+  double bscale = 1., bzero = 0.;
+  inputVolume->GetDataScaling(bscale, bzero);
 
-    if (!labelWCS || !volumeWCS)
-      {
-      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume : "
-                    "WCS not found!");
-      return NULL;
-      }
-    labelWCS->flag=-1;
+  std::vector<int> labels;
+  std::vector<SourceProperties> sources;
+  std::vector<std::vector<std::pair<int, double> > > planeSpectra;
+  bool success = true;
+  switch (imageData->GetPointData()->GetScalars()->GetDataType())
+    {
+    vtkTemplateMacro(success = SourceStatisticsDispatch(static_cast<const VTK_TT*>(imageData->GetScalarPointer()),
+                                                        labelData->GetScalarPointer(),
+                                                        labelData->GetPointData()->GetScalars()->GetDataType(),
+                                                        dims, bscale, bzero, blank, labels, sources,
+                                                        planeSpectra));
+    default:
+      success = false;
+    }
+  if (!success)
+    {
+    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateSourceStatistics : "
+                  "attempt to allocate scalars of type not allowed");
+    return false;
+    }
 
-    labelDisplayNode->SetWCSStatus(wcscopy(1, volumeWCS, labelWCS));
-    if (labelDisplayNode->GetWCSStatus())
+  // integrated spectra of the sources over their channels. Sources
+  // with only blank voxels have no row
+  std::vector<int> rows;
+  std::vector<vtkIdType> spectrumOffsets(sources.size() + 1, 0);
+  for (size_t index = 0; index < sources.size(); index++)
+    {
+    const SourceProperties &source = sources[index];
+    vtkIdType numChannels = 0;
+    if (source.NumberOfVoxels > 0)
       {
-      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume : "
-                    "wcscopy ERROR "<<labelDisplayNode->GetWCSStatus()<<":\n"<<
-                    "Message from "<<labelWCS->err->function<<
-                    "at line "<<labelWCS->err->line_no<<" of file "<<labelWCS->err->file<<
-                    ": \n"<<labelWCS->err->msg<<"\n");
-      return NULL;
+      rows.push_back(index);
+      numChannels = source.Extent[5] - source.Extent[4] + 1;
       }
-
-    labelDisplayNode->SetWCSStatus(wcsset(labelWCS));
-    if (labelDisplayNode->GetWCSStatus())
+    spectrumOffsets[index + 1] = spectrumOffsets[index] + numChannels;
+    }
+  std::vector<double> spectra(spectrumOffsets.back(), 0.);
+  for (int kk = 0; kk < dims[2]; kk++)
+    {
+    for (size_t entry = 0; entry < planeSpectra[kk].size(); entry++)
       {
-      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CreateLabelVolumeFromVolume :"
-                    "wcsset ERROR "<<labelDisplayNode->GetWCSStatus()<<":\n"<<
-                    "Message from "<<labelWCS->err->function<<
-                    "at line "<<labelWCS->err->line_no<<" of file "<<labelWCS->err->file<<
-                    ": \n"<<labelWCS->err->msg<<"\n");
-      return NULL;
+      const int index = planeSpectra[kk][entry].first;
+      spectra[spectrumOffsets[index] + kk - sources[index].Extent[4]] += planeSpectra[kk][entry].second;
       }
-
-    scene->AddNode(labelDisplayNode);
+    std::vector<std::pair<int, double> >().swap(planeSpectra[kk]);
     }
 
-  // We need to copy from the volume node to get required attributes, but
-  // the copy copies inputVolume's name as well.  So save the original name
-  // and re-set the name after the copy.
-  std::string origName(labelNode->GetName());
-  labelNode->Copy(inputVolume);
-  labelNode->SetAndObserveStorageNodeID(NULL);
-  labelNode->SetName(origName.c_str());
-  labelNode->SetAndObserveDisplayNodeID(labelDisplayNode->GetID());
+  // velocities from the spectral axis of the WCS. 2-D data have
+  // no spectrum: W50, W20 and VSys are NaN
+  const bool spectral = dims[2] > 1;
+  vtkMRMLAstroVolumeDisplayNode *astroDisplay = inputVolume->GetAstroVolumeDisplayNode();
+  struct wcsprm *WCS = astroDisplay ? astroDisplay->GetWCSStruct() : NULL;
+  if (WCS && WCS->naxis < 3)
+    {
+    WCS = NULL;
+    }
+  double velocityFactor = 1.;
+  if (WCS && !strcmp(WCS->cunit[2], "m/s"))
+    {
+    velocityFactor = 0.001;
+    }
 
-  // Associate labelmap with the source volume
-  //TODO: Obsolete, replace mechanism with node references
-  if (inputVolume->GetID())
+  const int numRows = rows.size();
+  const double NaN = sqrt(-1);
+  int wasModifying = tableNode->StartModify();
+  vtkTable *table = tableNode->GetTable();
+  table->Initialize();
+  const int numColumns = 16;
+  const char* names[numColumns] = {"Label", "N", "FluxSum", "Peak", "X", "Y", "Z",
+                                   "XMin", "XMax", "YMin", "YMax", "ZMin", "ZMax",
+                                   "W50", "W20", "VSys"};
+  for (int column = 0; column < numColumns; column++)
     {
-    labelNode->SetAttribute("AssociatedNodeID", inputVolume->GetID());
+    vtkSmartPointer<vtkAbstractArray> array;
+    if (column == 1)
+      {
+      array = vtkSmartPointer<vtkIdTypeArray>::New();
+      }
+    else if (column == 0 || (column >= 7 && column <= 12))
+      {
+      array = vtkSmartPointer<vtkIntArray>::New();
+      }
+    else
+      {
+      array = vtkSmartPointer<vtkDoubleArray>::New();
+      }
+    array->SetName(names[column]);
+    array->SetNumberOfTuples(numRows);
+    table->AddColumn(array);
     }
 
-  std::vector<std::string> keys = inputVolume->GetAttributeNames();
-  for (std::vector<std::string>::iterator kit = keys.begin(); kit != keys.end(); ++kit)
+  for (int row = 0; row < numRows; row++)
     {
-    labelNode->SetAttribute((*kit).c_str(), inputVolume->GetAttribute((*kit).c_str()));
+    const int index = rows[row];
+    const SourceProperties &source = sources[index];
+    double centroid[3] = {NaN, NaN, NaN};
+    if (source.Sum != 0.)
+      {
+      centroid[0] = source.SumX / source.Sum;
+      centroid[1] = source.SumY / source.Sum;
+      centroid[2] = source.SumZ / source.Sum;
+      }
+    table->SetValue(row, 0, vtkVariant(labels[index]));
+    table->SetValue(row, 1, vtkVariant(source.NumberOfVoxels));
+    table->SetValue(row, 2, vtkVariant(source.Sum));
+    table->SetValue(row, 3, vtkVariant(source.Peak));
+    for (int axis = 0; axis < 3; axis++)
+      {
+      table->SetValue(row, 4 + axis, vtkVariant(centroid[axis]));
+      }
+    for (int bound = 0; bound < 6; bound++)
+      {
+      table->SetValue(row, 7 + bound, vtkVariant(source.Extent[bound]));
+      }
+
+    // edges of the profile at 50% and 20% of the peak, in velocity
+    const double *spectrum = &spectra[spectrumOffsets[index]];
+    const int numChannels = spectrumOffsets[index + 1] - spectrumOffsets[index];
+    double velocities[4] = {NaN, NaN, NaN, NaN};
+    for (int width = 0; spectral && width < 2; width++)
+      {
+      double edges[2];
+      if (!SpectrumWidth(spectrum, numChannels, width == 0 ? 0.5 : 0.2, edges[0], edges[1]))
+        {
+        continue;
+        }
+      for (int edge = 0; edge < 2; edge++)
+        {
+        double ijk[3] = {source.Extent[0] * 0.5 + source.Extent[1] * 0.5,
+                         source.Extent[2] * 0.5 + source.Extent[3] * 0.5,
+                         source.Extent[4] + edges[edge]};
+        double world[3] = {0., 0., ijk[2]};
+        if (WCS)
+          {
+          astroDisplay->GetReferenceSpace(ijk, world);
+          world[2] *= velocityFactor;
+          }
+        velocities[2 * width + edge] = world[2];
+        }
+      }
+    table->SetValue(row, 13, vtkVariant(fabs(velocities[1] - velocities[0])));
+    table->SetValue(row, 14, vtkVariant(fabs(velocities[3] - velocities[2])));
+    table->SetValue(row, 15, vtkVariant((velocities[0] + velocities[1]) * 0.5));
     }
-  labelNode->SetAttribute("SlicerAstro.DATAMODEL", "MASK");
-  labelNode->SetAttribute("SlicerAstro.BITPIX", "16");
 
-  // Set the display node to have a label map lookup table
-  this->SetAndObserveColorToDisplayNode(labelDisplayNode,
-                                        /* labelMap = */ 1, /* filename= */ 0);
+  table->Modified();
+  tableNode->EndModify(wasModifying);
 
-  // Copy and set image data of the input volume to the label volume
-  vtkNew<vtkImageData> imageData;
-  imageData->DeepCopy(inputVolume->GetImageData());
-  labelNode->SetAndObserveImageData(imageData.GetPointer());
+  gettimeofday(&end, NULL);
+  long mtime = ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000.0) + 0.5;
+  vtkDebugMacro("CalculateSourceStatistics Time : "<<mtime<<" ms /n");
 
-  return labelNode;
+  return true;
 }
 
 //---------------------------------------------------------------------------
-double vtkSlicerAstroVolumeLogic::CalculateRMSinROI(vtkMRMLAnnotationROINode *roiNode,
-                                                    vtkMRMLAstroVolumeNode *inputVolume)
+bool vtkSlicerAstroVolumeLogic::GetHistogram(vtkMRMLAstroVolumeNode *volumeNode,
+                                             vtkDoubleArray *binEdges,
+                                             vtkIdTypeArray *counts)
 {
-  if (!roiNode)
+  const vtkHistogramCache::Histogram *histogram = this->HistogramCache->Update(volumeNode);
+  if (!histogram || !binEdges || !counts)
     {
-    return 0.;
+    return false;
     }
 
-  if (inputVolume->GetImageData() == NULL)
-   {
-   vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateRMSinROI : "
-                 "imageData not allocated.");
-   return false;
-   }
-
-  //We calculate the noise as the std of 6 slices of the datacube.
-  int *dims = inputVolume->GetImageData()->GetDimensions();
-  int numComponents = inputVolume->GetImageData()->GetNumberOfScalarComponents();
-  if (numComponents > 1)
+  binEdges->SetNumberOfValues(histogram->Edges.size());
+  for (size_t edge = 0; edge < histogram->Edges.size(); edge++)
     {
-    vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateRMSinROI : "
-                  "imageData with more than one components.");
-    return 0.;
+    binEdges->SetValue(edge, histogram->Edges[edge]);
     }
-  int numSlice = dims[0] * dims[1];
-  const int DataType = inputVolume->GetImageData()->GetPointData()->GetScalars()->GetDataType();
-  float *outFPixel = NULL;
-  double *outDPixel = NULL;
-  switch (DataType)
+  counts->SetNumberOfValues(histogram->Counts.size());
+  for (size_t bin = 0; bin < histogram->Counts.size(); bin++)
     {
-    case VTK_FLOAT:
-      outFPixel = static_cast<float*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
-      break;
-    case VTK_DOUBLE:
-      outDPixel = static_cast<double*> (inputVolume->GetImageData()->GetScalarPointer(0,0,0));
-      break;
-    default:
-      vtkErrorMacro("vtkSlicerAstroVolumeLogic::CalculateRMSinROI : "
-                    "attempt to allocate scalars of type not allowed");
-      return false;
+    counts->SetValue(bin, histogram->Counts[bin]);
     }
 
-  double noise = 0., mean = 0., roiBounds[6], volumeBounds[6];
-  int cont = 0;
+  return true;
+}
 
-  roiNode->GetRASBounds(roiBounds);
-  inputVolume->GetRASBounds(volumeBounds);
+//---------------------------------------------------------------------------
+bool vtkSlicerAstroVolumeLogic::GetPercentiles(vtkMRMLAstroVolumeNode *volumeNode,
+                                               int numberOfPercentiles,
+                                               const double *percentiles,
+                                               double *values)
+{
+  const vtkHistogramCache::Histogram *histogram = this->HistogramCache->Update(volumeNode);
+  if (!histogram || histogram->Total == 0)
+    {
+    return false;
+    }
 
-  for (int ii = 0; ii < 6; ii++)
+  for (int ii = 0; ii < numberOfPercentiles; ii++)
     {
-    if (fabs(roiBounds[ii]) - fabs(volumeBounds[ii]) > 1E-06)
+    const double target = std::max(0., std::min(100., percentiles[ii])) * 0.01 * histogram->Total;
+    // interpolate linearly within the bin
+    values[ii] = histogram->Edges.back();
+    double cumulative = 0.;
+    for (size_t bin = 0; bin < histogram->Counts.size(); bin++)
       {
-      roiBounds[ii] = volumeBounds[ii];
+      const vtkIdType count = histogram->Counts[bin];
+      if (count > 0 && cumulative + count >= target)
+        {
+        values[ii] = histogram->Edges[bin] + (histogram->Edges[bin + 1] - histogram->Edges[bin]) *
+                     std::max(0., target - cumulative) / count;
+        break;
+        }
+      cumulative += count;
       }
     }
 
-  vtkNew<vtkGeneralTransform> RAStoIJKTransform;
-  RAStoIJKTransform->Identity();
-  RAStoIJKTransform->PostMultiply();
-  vtkNew<vtkMatrix4x4> RAStoIJKMatrix;
-  inputVolume->GetRASToIJKMatrix(RAStoIJKMatrix);
-  RAStoIJKTransform->Concatenate(RAStoIJKMatrix);
-
-  double ijkMin[3], RASMin[3], ijkMax[3], RASMax[3];
-  RASMin[0] = roiBounds[0];
-  RASMin[1] = roiBounds[2];
-  RASMin[2] = roiBounds[4];
-  RASMax[0] = roiBounds[1];
-  RASMax[1] = roiBounds[3];
-  RASMax[2] = roiBounds[5];
-
-  RAStoIJKTransform->TransformPoint(RASMin, ijkMin);
-  RAStoIJKTransform->TransformPoint(RASMax, ijkMax);
+  return true;
+}
 
-  roiBounds[0] = (int) ijkMin[0];
-  roiBounds[2] = (int) ijkMin[1];
-  roiBounds[4] = (int) ijkMin[2];
-  roiBounds[1] = (int) ijkMax[0];
-  roiBounds[3] = (int) ijkMax[1];
-  roiBounds[5] = (int) ijkMax[2];
+//---------------------------------------------------------------------------
+double vtkSlicerAstroVolumeLogic::GetPercentile(vtkMRMLAstroVolumeNode *volumeNode,
+                                                double percentile)
+{
+  double value = 0.;
+  this->GetPercentiles(volumeNode, 1, &percentile, &value);
+  return value;
+}
 
-  if (roiBounds[0] > roiBounds[1])
+//---------------------------------------------------------------------------
+bool vtkSlicerAstroVolumeLogic::UpdateWindowLevelFromHistogram(vtkMRMLAstroVolumeNode *volumeNode,
+                                                               double lowPercentile,
+                                                               double highPercentile)
+{
+  vtkMRMLAstroVolumeDisplayNode *displayNode =
+    volumeNode ? volumeNode->GetAstroVolumeDisplayNode() : NULL;
+  if (!displayNode)
     {
-    int temp = roiBounds[0];
-    roiBounds[0] = roiBounds[1];
-    roiBounds[1] = temp;
+    return false;
     }
 
-  if (roiBounds[2] > roiBounds[3])
+  const vtkHistogramCache::Histogram *histogram = this->HistogramCache->Update(volumeNode);
+  const double percentiles[2] = {lowPercentile, highPercentile};
+  double values[4] = {0., 0., 0., 0.};
+  if (!histogram || !this->GetPercentiles(volumeNode, 2, percentiles, values))
     {
-    int temp = roiBounds[2];
-    roiBounds[2] = roiBounds[3];
-    roiBounds[3] = temp;
+    vtkWarningMacro("vtkSlicerAstroVolumeLogic::UpdateWindowLevelFromHistogram : "
+                    "histogram of "<<volumeNode->GetName()<<" not available.");
+    return false;
     }
+  values[2] = histogram->Edges.front();
+  values[3] = histogram->Edges.back();
 
-  if (roiBounds[4] > roiBounds[5])
+  // the display works on the stored values
+  if (volumeNode->HasScaledIntegerData())
     {
-    int temp = roiBounds[4];
-    roiBounds[4] = roiBounds[5];
-    roiBounds[5] = temp;
+    double bscale = 1., bzero = 0.;
+    volumeNode->GetDataScaling(bscale, bzero);
+    for (int ii = 0; ii < 4; ii++)
+      {
+      values[ii] = (values[ii] - bzero) / bscale;
+      }
+    if (bscale < 0.)
+      {
+      std::swap(values[0], values[1]);
+      std::swap(values[2], values[3]);
+      }
     }
 
-  cont = (roiBounds[1] - roiBounds[0]) *
-         (roiBounds[3] - roiBounds[2]) *
-         (roiBounds[5] - roiBounds[4]);
-
-  int firstElement, lastElement;
-
-  firstElement = roiBounds[0] + roiBounds[2] * dims[0] +
-                 roiBounds[4] * numSlice;
-
-  lastElement = roiBounds[1] + roiBounds[3] * dims[0] +
-                roiBounds[5] * numSlice;
+  int wasModifying = displayNode->StartModify();
+  displayNode->SetAutoWindowLevel(0);
+  displayNode->SetWindowLevel(values[1] - values[0], 0.5 * (values[0] + values[1]));
+  displayNode->SetThreshold(values[2], values[3]);
+  displayNode->EndModify(wasModifying);
 
+  return true;
+}
 
-  switch (DataType)
+//---------------------------------------------------------------------------
+void vtkSlicerAstroVolumeLogic::ClearHistogramCache(vtkMRMLAstroVolumeNode *volumeNode)
+{
+  if (!volumeNode)
     {
-    case VTK_FLOAT:
-      for (int elemCnt = firstElement; elemCnt <= lastElement; elemCnt++)
-        { 
-        int ref  = (int) floor(elemCnt / dims[0]);
-        ref *= dims[0];
-        int x = elemCnt - ref;
-        ref = (int) floor(elemCnt / numSlice);
-        ref *= numSlice;
-        ref = elemCnt - ref;
-        int y = (int) floor(ref / dims[0]);
-        if (x < roiBounds[0] ||  x > roiBounds[1] ||
-            y < roiBounds[2] ||  y > roiBounds[3])
-          {
-          continue;
-          }
-        if (FloatIsNaN(*(outFPixel + elemCnt)))
-          {
-          continue;
-          }
-        mean += *(outFPixel + elemCnt);
-        }
-      mean /= cont;
-      for (int elemCnt = firstElement; elemCnt <= lastElement; elemCnt++)
-        {
-        int ref  = (int) floor(elemCnt / dims[0]);
-        ref *= dims[0];
-        int x = elemCnt - ref;
-        ref = (int) floor(elemCnt / numSlice);
-        ref *= numSlice;
-        ref = elemCnt - ref;
-        int y = (int) floor(ref / dims[0]);
-        if (x < roiBounds[0] ||  x > roiBounds[1] ||
-            y < roiBounds[2] ||  y > roiBounds[3])
-          {
-          continue;
-          }
-        if (FloatIsNaN(*(outFPixel + elemCnt)))
-          {
-          continue;
-          }
-        noise += (*(outFPixel + elemCnt) - mean) * (*(outFPixel+elemCnt) - mean);
-        }
-      noise = sqrt(noise / cont);
-      break;
-    case VTK_DOUBLE:
-      for (int elemCnt = firstElement; elemCnt <= lastElement; elemCnt++)
-        {
-        int ref  = (int) floor(elemCnt / dims[0]);
-        ref *= dims[0];
-        int x = elemCnt - ref;
-        ref = (int) floor(elemCnt / numSlice);
-        ref *= numSlice;
-        ref = elemCnt - ref;
-        int y = (int) floor(ref / dims[0]);
-        if (x < roiBounds[0] ||  x > roiBounds[1] ||
-            y < roiBounds[2] ||  y > roiBounds[3])
-          {
-          continue;
-          }
-        if (DoubleIsNaN(*(outDPixel + elemCnt)))
-          {
-          continue;
-          }
-        mean += *(outDPixel + elemCnt);
-        }
-      mean /= cont;
-      for (int elemCnt = firstElement; elemCnt <= lastElement; elemCnt++)
-        {
-        int ref  = (int) floor(elemCnt / dims[0]);
-        ref *= dims[0];
-        int x = elemCnt - ref;
-        ref = (int) floor(elemCnt / numSlice);
-        ref *= numSlice;
-        ref = elemCnt - ref;
-        int y = (int) floor(ref / dims[0]);
-        if (x < roiBounds[0] ||  x > roiBounds[1] ||
-            y < roiBounds[2] ||  y > roiBounds[3])
-          {
-          continue;
-          }
-        if (DoubleIsNaN(*(outDPixel + elemCnt)))
-          {
-          continue;
-          }
-        noise += (*(outDPixel + elemCnt) - mean) * (*(outDPixel+elemCnt) - mean);
-        }
-      noise = sqrt(noise / cont);
-      break;
+    this->HistogramCache->Histograms.clear();
+    }
+  else if (volumeNode->GetID())
+    {
+    this->HistogramCache->Histograms.erase(volumeNode->GetID());
     }
-
-  inputVolume->SetAttribute("SlicerAstro.RMS", DoubleToString(noise).c_str());
-  inputVolume->SetAttribute("SlicerAstro.RMSMEAN", DoubleToString(mean).c_str());
-  outFPixel = NULL;
-  outDPixel = NULL;
-  delete outFPixel;
-  delete outDPixel;
-
-  return noise;
 }
 
 //---------------------------------------------------------------------------
@@ -941,7 +2814,17 @@ bool vtkSlicerAstroVolumeLogic::synchronizePresetsToVolumeNode(vtkMRMLNode *node
   double noise = StringToDouble(node->GetAttribute("SlicerAstro.RMS"));
   if (noise < 0.000000001)
     {
-    noise = (max - min) / 100.;
+    // std of a gaussian noise from the 15.87 and 84.13 percentiles
+    const double percentiles[2] = {15.87, 84.13};
+    double values[2] = {0., 0.};
+    if (this->GetPercentiles(vtkMRMLAstroVolumeNode::SafeDownCast(node), 2, percentiles, values))
+      {
+      noise = (values[1] - values[0]) * 0.5;
+      }
+    if (noise < 0.000000001)
+      {
+      noise = (max - min) / 100.;
+      }
     }
   double noise3 = noise * 3.;
   double noise7 = noise * 7.;
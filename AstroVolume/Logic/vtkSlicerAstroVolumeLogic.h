@@ -31,12 +31,18 @@
 
 // STD includes
 #include <cstdlib>
+#include <string>
 
 #include "vtkSlicerAstroVolumeModuleLogicExport.h"
 
+class vtkCollection;
+class vtkDoubleArray;
+class vtkIdTypeArray;
+class vtkTable;
 class vtkMRMLAnnotationROINode;
 class vtkMRMLAstroLabelMapVolumeNode;
 class vtkMRMLAstroVolumeNode;
+class vtkMRMLTableNode;
 class vtkMRMLVolumeNode;
 
 class VTK_SLICER_ASTROVOLUME_MODULE_LOGIC_EXPORT vtkSlicerAstroVolumeLogic :
@@ -84,10 +90,122 @@ public:
                                                               vtkMRMLAstroLabelMapVolumeNode *labelNode,
                                                               vtkMRMLAstroVolumeNode *inputVolume);
 
+  /// Clone volumeNode (attributes, geometry and display nodes) and add it
+  /// to the scene without copying its voxels: the image data of the clone
+  /// has the dimensions of volumeNode, scalarType (that of volumeNode if
+  /// VTK_VOID) and is filled with zeros.
+  vtkMRMLAstroVolumeNode *CloneVolumeGeometry(vtkMRMLScene *scene,
+                                              vtkMRMLAstroVolumeNode *volumeNode,
+                                              const char *name,
+                                              int scalarType = VTK_VOID);
+
   /// Calculate RMS (as standard deviation) given a ROI node
+  /// and store it (and the mean) in the RMS attributes of the volume
   double CalculateRMSinROI(vtkMRMLAnnotationROINode* roiNode,
                            vtkMRMLAstroVolumeNode *inputVolume);
 
+  /// Statistics of the (physical) values in a ROI
+  struct ROIStatistics
+    {
+    /// number of valid (not NaN or BLANK, inside the mask) voxels
+    vtkIdType NumberOfValues;
+    double Mean;
+    /// standard deviation
+    double RMS;
+    /// interquartile range / 1.349
+    double RobustSigma;
+    double Min;
+    double Max;
+    /// sum of the values
+    double FluxSum;
+    };
+
+  /// Calculate the statistics of the voxels of inputVolume in the ROI,
+  /// in parallel over the IJK extent of the ROI. If maskVolume is given
+  /// (e.g. a label map with the same dimensions) only voxels with a
+  /// non-zero mask value are used.
+  bool CalculateROIStatistics(vtkMRMLAnnotationROINode* roiNode,
+                              vtkMRMLAstroVolumeNode *inputVolume,
+                              ROIStatistics &statistics,
+                              vtkMRMLVolumeNode *maskVolume = NULL);
+
+  /// Batch version: the ROIs (vtkMRMLAnnotationROINode) are computed in
+  /// parallel, and table is filled with one row per ROI (columns ROI, N,
+  /// Mean, RMS, RobustSigma, Min, Max, FluxSum).
+  bool CalculateROIStatistics(vtkCollection *roiNodes,
+                              vtkMRMLAstroVolumeNode *inputVolume,
+                              vtkTable *table,
+                              vtkMRMLVolumeNode *maskVolume = NULL);
+
+  /// Parameters of FindSources
+  struct SourceFinderParameters
+    {
+    SourceFinderParameters();
+    /// detection threshold (physical units): voxels with values >= Threshold
+    double Threshold;
+    /// detected voxels closer than MergeRadiusXY pixels (along X and Y)
+    /// (at least 1) and MergeRadiusZ channels belong to the same source
+    int MergeRadiusXY;
+    int MergeRadiusZ;
+    /// minimum number of voxels and of channels of a source
+    int MinimumSize;
+    int MinimumChannels;
+    /// minimum reliability (0 - 1). If positive, the negative detections
+    /// (voxels <= -Threshold) are linked as well, and the reliability of
+    /// each source is estimated from the density of negative and positive
+    /// sources with similar peak, sum and mean values
+    double MinimumReliability;
+    };
+
+  /// Find the sources of inputVolume: parallel 3-D connected component
+  /// labelling (union-find of the runs of detected voxels along X), then
+  /// size and reliability filters. The sources are labelled 1..N in
+  /// labelVolume (allocated to match inputVolume) and, if catalogue is
+  /// given, listed in it (one row per source: ID, N, NChannels, X, Y, Z
+  /// (flux weighted IJK centroid, or geometric if the flux sum is not
+  /// positive), XMin, XMax, YMin, YMax, ZMin, ZMax, Peak, FluxSum,
+  /// Reliability).
+  /// Returns the number of sources, -1 on failure.
+  int FindSources(vtkMRMLAstroVolumeNode *inputVolume,
+                  const SourceFinderParameters &parameters,
+                  vtkMRMLAstroLabelMapVolumeNode *labelVolume,
+                  vtkTable *catalogue = NULL);
+
+  /// Measure the sources labelled (label > 0) in labelVolume on inputVolume,
+  /// in one parallel pass over both volumes, and fill tableNode with one
+  /// row per label: Label, N, FluxSum, Peak, X, Y, Z (flux weighted IJK
+  /// centroid), XMin, XMax, YMin, YMax, ZMin, ZMax, and W50, W20 (widths
+  /// at 50% and 20% of the peak of the integrated spectrum) and VSys
+  /// (middle of the W50 edges). The velocities are in km/s, or in
+  /// channels if the volume has no spectral WCS (NaN for 2-D data).
+  bool CalculateSourceStatistics(vtkMRMLAstroVolumeNode *inputVolume,
+                                 vtkMRMLAstroLabelMapVolumeNode *labelVolume,
+                                 vtkMRMLTableNode *tableNode);
+
+  /// Histogram of the (physical) values of the volume. The histogram is
+  /// computed in parallel and cached until the image data is modified.
+  /// It has 4096 bins over the whole range, and the bins holding the
+  /// central 99.8% of the values are split in 4096 finer bins.
+  /// binEdges has one value more than counts.
+  bool GetHistogram(vtkMRMLAstroVolumeNode *volumeNode,
+                    vtkDoubleArray *binEdges, vtkIdTypeArray *counts);
+
+  /// Values at the given percentiles (0 - 100) of the cached histogram
+  bool GetPercentiles(vtkMRMLAstroVolumeNode *volumeNode, int numberOfPercentiles,
+                      const double *percentiles, double *values);
+  double GetPercentile(vtkMRMLAstroVolumeNode *volumeNode, double percentile);
+
+  /// Automatic window/level of the display node of volumeNode from the
+  /// cached histogram: the window spans the values at lowPercentile and
+  /// highPercentile, the threshold the whole range of the values.
+  /// AutoWindowLevel of the display node is turned off.
+  bool UpdateWindowLevelFromHistogram(vtkMRMLAstroVolumeNode *volumeNode,
+                                      double lowPercentile = 0.1,
+                                      double highPercentile = 99.9);
+
+  /// Discard the cached histogram of volumeNode (of all volumes if NULL)
+  void ClearHistogramCache(vtkMRMLAstroVolumeNode *volumeNode = NULL);
+
 protected:
   vtkSlicerAstroVolumeLogic();
   virtual ~vtkSlicerAstroVolumeLogic();
@@ -105,6 +223,15 @@ protected:
   vtkSmartPointer<vtkMRMLScene> PresetsScene;
   bool Init;
 
+  class vtkHistogramCache;
+  vtkHistogramCache *HistogramCache;
+
+  /// Statistics of the voxels of inputVolume in extent. It does not report
+  /// errors (it can run in a parallel loop): on failure error is set.
+  bool CalculateExtentStatistics(vtkMRMLAstroVolumeNode *inputVolume, int extent[6],
+                                 vtkMRMLVolumeNode *maskVolume, bool parallel,
+                                 ROIStatistics &statistics, std::string &error);
+
 private:
 
   vtkSlicerAstroVolumeLogic(const vtkSlicerAstroVolumeLogic&); // Not implemented
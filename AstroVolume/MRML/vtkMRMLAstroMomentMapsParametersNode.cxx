@@ -56,6 +56,7 @@ vtkMRMLAstroMomentMapsParametersNode::vtkMRMLAstroMomentMapsParametersNode()
   this->SetGenerateSecond(true);
   this->SetIntensityMin(-1.);
   this->SetIntensityMax(1.);
+  this->SetChannelNoiseThreshold(false);
   this->SetVelocityMin(-1.);
   this->SetVelocityMax(1.);
   this->OutputSerial = 1;
@@ -173,6 +174,12 @@ void vtkMRMLAstroMomentMapsParametersNode::ReadXMLAttributes(const char** atts)
       continue;
       }
 
+    if (!strcmp(attName, "ChannelNoiseThreshold"))
+      {
+      this->ChannelNoiseThreshold = StringToInt(attValue);
+      continue;
+      }
+
     if (!strcmp(attName, "GenerateZero"))
       {
       this->GenerateZero = StringToInt(attValue);
@@ -268,6 +275,7 @@ void vtkMRMLAstroMomentMapsParametersNode::WriteXML(ostream& of, int nIndent)
   of << indent << " GenerateSecond=\"" << this->GenerateSecond << "\"";
   of << indent << " IntensityMin=\"" << this->IntensityMin << "\"";
   of << indent << " IntensityMax=\"" << this->IntensityMax << "\"";
+  of << indent << " ChannelNoiseThreshold=\"" << this->ChannelNoiseThreshold << "\"";
   of << indent << " VelocityMin=\"" << this->VelocityMin << "\"";
   of << indent << " VelocityMax=\"" << this->VelocityMax << "\"";
   of << indent << " OutputSerial=\"" << this->OutputSerial << "\"";
@@ -296,6 +304,7 @@ void vtkMRMLAstroMomentMapsParametersNode::Copy(vtkMRMLNode *anode)
   this->SetGenerateSecond(node->GetGenerateSecond());
   this->SetIntensityMin(node->GetIntensityMin());
   this->SetIntensityMax(node->GetIntensityMax());
+  this->SetChannelNoiseThreshold(node->GetChannelNoiseThreshold());
   this->SetVelocityMin(node->GetVelocityMin());
   this->SetVelocityMax(node->GetVelocityMax());
   this->SetOutputSerial(node->GetOutputSerial());
@@ -320,6 +329,7 @@ void vtkMRMLAstroMomentMapsParametersNode::PrintSelf(ostream& os, vtkIndent inde
   os << "GenerateSecond: " << this->GenerateSecond << "\n";
   os << "IntensityMin: " << this->IntensityMin << "\n";
   os << "IntensityMax: " << this->IntensityMax << "\n";
+  os << "ChannelNoiseThreshold: " << this->ChannelNoiseThreshold << "\n";
   os << "VelocityMin: " << this->VelocityMin << "\n";
   os << "VelocityMax: " << this->VelocityMax << "\n";
   os << "OutputSerial: " << this->OutputSerial << "\n";
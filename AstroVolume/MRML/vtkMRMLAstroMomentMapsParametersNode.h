@@ -91,6 +91,13 @@ class VTK_MRML_ASTRO_EXPORT vtkMRMLAstroMomentMapsParametersNode : public vtkMRM
   vtkSetMacro(IntensityMax,double);
   vtkGetMacro(IntensityMax,double);
 
+  ///
+  /// Scale IntensityMin, in each channel, by the ratio between the noise
+  /// of the channel and the RMS of the input volume
+  /// (see vtkMRMLAstroVolumeNode::ComputeChannelNoise)
+  vtkSetMacro(ChannelNoiseThreshold,bool);
+  vtkGetMacro(ChannelNoiseThreshold,bool);
+
   vtkSetMacro(VelocityMin,double);
   vtkGetMacro(VelocityMin,double);
 
@@ -125,6 +132,7 @@ protected:
 
   double IntensityMin;
   double IntensityMax;
+  bool ChannelNoiseThreshold;
   double VelocityMin;
   double VelocityMax;
 
@@ -17,15 +17,25 @@
 
 ==============================================================================*/
 
+#include <algorithm>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <cstdlib>
 #include <math.h>
+#include <sys/time.h>
 
 // VTK includes
+#include <vtkAlgorithm.h>
+#include <vtkAlgorithmOutput.h>
+#include <vtkDoubleArray.h>
+#include <vtkFloatArray.h>
 #include <vtkImageData.h>
+#include <vtkInformation.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
 #include <vtkPointData.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
 
 // MRML includes
 #include <vtkMRMLAstroLabelMapVolumeNode.h>
@@ -35,22 +45,18 @@
 #include <vtkMRMLVolumeNode.h>
 #include <vtkMRMLVolumePropertyNode.h>
 
+// OpenMP includes
+#include "vtkSlicerAstroConfigure.h"
+#ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+#include <omp.h>
+#endif
+
 //------------------------------------------------------------------------------
 const char* vtkMRMLAstroVolumeNode::PRESET_REFERENCE_ROLE = "preset";
 
 //----------------------------------------------------------------------------
 vtkMRMLNodeNewMacro(vtkMRMLAstroVolumeNode);
 
-//----------------------------------------------------------------------------
-vtkMRMLAstroVolumeNode::vtkMRMLAstroVolumeNode()
-{
-}
-
-//----------------------------------------------------------------------------
-vtkMRMLAstroVolumeNode::~vtkMRMLAstroVolumeNode()
-{
-}
-
 //----------------------------------------------------------------------------
 const char *vtkMRMLAstroVolumeNode::GetPresetNodeReferenceRole()
 {
@@ -114,13 +120,458 @@ bool ShortIsNaN(double Value)
   return isNaN<short>(Value);
 }
 
+//----------------------------------------------------------------------------
+double StringToDouble(const char* str)
+{
+  return StringToNumber<double>(str);
+}
+
+//----------------------------------------------------------------------------
+// Partial statistics of the stored values, merged across threads
+struct StatisticsAccumulator
+{
+  StatisticsAccumulator()
+    : Min(0.), Max(0.), NumberOfValues(0), NumberOfBlanks(0), Sum(0.)
+  {
+    for (int ii = 0; ii < 2; ii++)
+      {
+      this->NoiseSum[ii] = 0.;
+      this->NoiseSum2[ii] = 0.;
+      this->NoiseValues[ii] = 0;
+      }
+  }
+
+  void Merge(const StatisticsAccumulator &other)
+  {
+    if (other.NumberOfValues > 0)
+      {
+      if (this->NumberOfValues == 0 || other.Min < this->Min)
+        {
+        this->Min = other.Min;
+        }
+      if (this->NumberOfValues == 0 || other.Max > this->Max)
+        {
+        this->Max = other.Max;
+        }
+      }
+    this->NumberOfValues += other.NumberOfValues;
+    this->NumberOfBlanks += other.NumberOfBlanks;
+    this->Sum += other.Sum;
+    for (int ii = 0; ii < 2; ii++)
+      {
+      this->NoiseSum[ii] += other.NoiseSum[ii];
+      this->NoiseSum2[ii] += other.NoiseSum2[ii];
+      this->NoiseValues[ii] += other.NoiseValues[ii];
+      }
+  }
+
+  double Min, Max;
+  vtkIdType NumberOfValues, NumberOfBlanks;
+  double Sum;
+  double NoiseSum[2], NoiseSum2[2];
+  vtkIdType NoiseValues[2];
+};
+
+//----------------------------------------------------------------------------
+// Range and sum of [first, last) in a single pass. NaNs and BLANK values
+// are counted and skipped. The loop has no other branches so that the
+// compiler can vectorise it.
+template <typename T> void AccumulateRange(const T *pixel, vtkIdType first, vtkIdType last,
+                                           double blank, StatisticsAccumulator &acc)
+{
+  T min = 0, max = 0;
+  bool found = false;
+  double sum = 0.;
+  vtkIdType blanks = 0;
+  for (vtkIdType elemCnt = first; elemCnt < last; elemCnt++)
+    {
+    const T value = pixel[elemCnt];
+    if (value != value || value == blank)
+      {
+      blanks++;
+      continue;
+      }
+    if (!found)
+      {
+      min = max = value;
+      found = true;
+      }
+    min = value < min ? value : min;
+    max = value > max ? value : max;
+    sum += value;
+    }
+
+  if (found)
+    {
+    StatisticsAccumulator block;
+    block.Min = min;
+    block.Max = max;
+    block.NumberOfValues = last - first - blanks;
+    acc.Merge(block);
+    }
+  acc.NumberOfBlanks += blanks;
+  acc.Sum += sum;
+}
+
+//----------------------------------------------------------------------------
+template <typename T> void AccumulateNoise(const T *pixel, vtkIdType first, vtkIdType last,
+                                           double blank, int noiseRange,
+                                           StatisticsAccumulator &acc)
+{
+  for (vtkIdType elemCnt = first; elemCnt < last; elemCnt++)
+    {
+    const T value = pixel[elemCnt];
+    if (value != value || value == blank)
+      {
+      continue;
+      }
+    acc.NoiseSum[noiseRange] += value;
+    acc.NoiseSum2[noiseRange] += static_cast<double>(value) * value;
+    acc.NoiseValues[noiseRange]++;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Range of [first, last) and the parts of the two noise ranges it overlaps.
+template <typename T> void AccumulateChunk(const T *pixel, vtkIdType first, vtkIdType last,
+                                           double blank, bool range,
+                                           const vtkIdType noiseRanges[2][2],
+                                           StatisticsAccumulator &acc)
+{
+  for (int ii = 0; ii < 2; ii++)
+    {
+    const vtkIdType noiseFirst = std::max(first, noiseRanges[ii][0]);
+    const vtkIdType noiseLast = std::min(last, noiseRanges[ii][1] + 1);
+    if (noiseFirst < noiseLast)
+      {
+      AccumulateNoise(pixel, noiseFirst, noiseLast, blank, ii, acc);
+      }
+    }
+  if (range)
+    {
+    AccumulateRange(pixel, first, last, blank, acc);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Fused statistics kernel: the data are traversed once, in parallel blocks.
+// Each block accumulates range, blanks and sum and, while it is in cache,
+// the sums of the parts of the two noise ranges [first, last] it overlaps.
+// If range is false only the noise ranges are visited.
+template <typename T> void FusedStatistics(const T *pixel, vtkIdType numElements,
+                                           double blank, bool range,
+                                           const vtkIdType noiseRanges[2][2],
+                                           StatisticsAccumulator &result)
+{
+  const vtkIdType blockSize = 64 * 1024;
+  const vtkIdType numBlocks = (numElements + blockSize - 1) / blockSize;
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  StatisticsAccumulator acc;
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType block = 0; block < numBlocks; block++)
+    {
+    const vtkIdType first = block * blockSize;
+    const vtkIdType last = std::min(first + blockSize, numElements);
+    AccumulateChunk(pixel, first, last, blank, range, noiseRanges, acc);
+    }
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp critical
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  result.Merge(acc);
+  }
+}
+
+//----------------------------------------------------------------------------
+// Noise ranges of UpdateNoiseAttributes: two channels at each end of the
+// cube (rows for 2-D images, pixels for 1-D data), clamped to the data.
+void NoiseRanges(const int dims[3], int naxis, vtkIdType noiseRanges[2][2])
+{
+  vtkIdType step = 1, length = dims[0];
+  if (naxis == 3)
+    {
+    step = static_cast<vtkIdType>(dims[0]) * dims[1];
+    length = dims[2];
+    }
+  else if (naxis == 2)
+    {
+    step = dims[0];
+    length = dims[1];
+    }
+
+  const vtkIdType numElements = step * length;
+  noiseRanges[0][0] = step * 2;
+  noiseRanges[0][1] = step * 4;
+  noiseRanges[1][0] = step * (length - 4);
+  noiseRanges[1][1] = step * (length - 2);
+  for (int ii = 0; ii < 2; ii++)
+    {
+    noiseRanges[ii][0] = std::max(static_cast<vtkIdType>(0), noiseRanges[ii][0]);
+    noiseRanges[ii][1] = std::min(numElements - 1, noiseRanges[ii][1]);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Median of the values (or of |value - center| if absolute) of every
+// step-th valid element of pixel[0, n) that fall in [low, high], from a
+// histogram of numBins bins. The threads fill private histograms.
+template <typename T> bool HistogramMedian(const T *pixel, vtkIdType n, vtkIdType step,
+                                           double blank, bool absolute, double center,
+                                           double low, double high, int numBins,
+                                           bool parallel, double &median)
+{
+  if (!(high > low))
+    {
+    median = low;
+    return true;
+    }
+
+  const double binWidth = (high - low) / numBins;
+  const vtkIdType numSamples = (n + step - 1) / step;
+  std::vector<vtkIdType> histogram(numBins, 0);
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel if(parallel)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  std::vector<vtkIdType> threadHistogram(numBins, 0);
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType sample = 0; sample < numSamples; sample++)
+    {
+    const T value = pixel[sample * step];
+    if (value != value || value == blank)
+      {
+      continue;
+      }
+    const double x = absolute ? fabs(value - center) : value;
+    if (x < low || x > high)
+      {
+      continue;
+      }
+    const int bin = std::min(static_cast<int>((x - low) / binWidth), numBins - 1);
+    threadHistogram[bin]++;
+    }
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp critical
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int bin = 0; bin < numBins; bin++)
+    {
+    histogram[bin] += threadHistogram[bin];
+    }
+  }
+
+  vtkIdType total = 0;
+  for (int bin = 0; bin < numBins; bin++)
+    {
+    total += histogram[bin];
+    }
+  if (total == 0)
+    {
+    return false;
+    }
+
+  // interpolate linearly within the bin of the median
+  const double half = 0.5 * total;
+  vtkIdType cumulative = 0;
+  for (int bin = 0; bin < numBins; bin++)
+    {
+    if (cumulative + histogram[bin] >= half)
+      {
+      median = low + binWidth * (bin + (half - cumulative) / histogram[bin]);
+      return true;
+      }
+    cumulative += histogram[bin];
+    }
+  median = high;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Robust noise of the stored values: median and 1.4826 * MAD, refined by
+// clippingIterations iterations that only keep |value - median| < sigma * noise.
+template <typename T> bool RobustNoiseEstimate(const T *pixel, vtkIdType n, vtkIdType step,
+                                               double blank, int clippingIterations, double sigma,
+                                               int numBins, bool parallel,
+                                               double &median, double &noise)
+{
+  // range of the samples
+  double min = VTK_DOUBLE_MAX, max = VTK_DOUBLE_MIN;
+  const vtkIdType numSamples = (n + step - 1) / step;
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel if(parallel)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  double threadMin = VTK_DOUBLE_MAX, threadMax = VTK_DOUBLE_MIN;
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType sample = 0; sample < numSamples; sample++)
+    {
+    const T value = pixel[sample * step];
+    if (value != value || value == blank)
+      {
+      continue;
+      }
+    threadMin = value < threadMin ? value : threadMin;
+    threadMax = value > threadMax ? value : threadMax;
+    }
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp critical
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  {
+  min = std::min(min, threadMin);
+  max = std::max(max, threadMax);
+  }
+  }
+
+  if (min > max)
+    {
+    return false;
+    }
+
+  double low = min, high = max;
+  for (int iteration = 0; iteration <= clippingIterations; iteration++)
+    {
+    double mad = 0.;
+    if (!HistogramMedian(pixel, n, step, blank, false, 0., low, high, numBins, parallel, median) ||
+        !HistogramMedian(pixel, n, step, blank, true, median, 0.,
+                         std::max(high - median, median - low), numBins, parallel, mad))
+      {
+      return false;
+      }
+    noise = 1.4826 * mad;
+    if (noise <= 0.)
+      {
+      break;
+      }
+    low = std::max(min, median - sigma * noise);
+    high = std::min(max, median + sigma * noise);
+    }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Physical statistics from the accumulated stored values
+void FinishStatistics(const StatisticsAccumulator &acc, const vtkIdType noiseRanges[2][2],
+                      double bscale, double bzero, double typeMin, double typeMax,
+                      vtkMRMLAstroVolumeNode::Statistics &statistics)
+{
+  // range (the scalar type limits if all the values are blank, as before)
+  statistics.Min = typeMax;
+  statistics.Max = typeMin;
+  if (acc.NumberOfValues > 0)
+    {
+    statistics.Min = bscale * acc.Min + bzero;
+    statistics.Max = bscale * acc.Max + bzero;
+    if (statistics.Min > statistics.Max)
+      {
+      std::swap(statistics.Min, statistics.Max);
+      }
+    }
+  statistics.NumberOfValues = acc.NumberOfValues;
+  statistics.NumberOfBlanks = acc.NumberOfBlanks;
+  statistics.Mean = acc.NumberOfValues > 0 ?
+    bscale * acc.Sum / acc.NumberOfValues + bzero : 0.;
+
+  // noise: std of the two noise ranges, normalised as the original
+  // estimator by the length of the range
+  double noise[2] = {0., 0.}, mean[2] = {0., 0.};
+  for (int ii = 0; ii < 2; ii++)
+    {
+    const double cont = noiseRanges[0][1] - noiseRanges[0][0];
+    if (cont <= 0.)
+      {
+      continue;
+      }
+    const double rawMean = acc.NoiseSum[ii] / cont;
+    const double variance = acc.NoiseSum2[ii] - 2. * rawMean * acc.NoiseSum[ii] +
+                            acc.NoiseValues[ii] * rawMean * rawMean;
+    mean[ii] = bscale * rawMean + bzero;
+    noise[ii] = fabs(bscale) * sqrt(std::max(0., variance) / cont);
+    }
+  statistics.Noise = (noise[0] + noise[1]) * 0.5;
+  statistics.NoiseMean = (mean[0] + mean[1]) * 0.5;
+}
+
+//----------------------------------------------------------------------------
+// BLANK values are converted to NaN.
+template <typename T> void ScaledIntegerToFloat(const T *inPixel, float *outPixel,
+                                                vtkIdType numElements,
+                                                double bscale, double bzero, double blank)
+{
+  const float NaN = sqrt(-1);
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType elemCnt = 0; elemCnt < numElements; elemCnt++)
+    {
+    outPixel[elemCnt] = inPixel[elemCnt] == blank ? NaN :
+      static_cast<float>(bscale * inPixel[elemCnt] + bzero);
+    }
+}
+
 }// end namespace
 
+//----------------------------------------------------------------------------
+vtkMRMLAstroVolumeNode::vtkMRMLAstroVolumeNode()
+{
+  this->NoiseMethod = vtkMRMLAstroVolumeNode::EdgeChannelsNoise;
+  this->NoiseSampling = 1;
+  this->NoiseClippingIterations = 0;
+  this->NoiseClippingSigma = 3.;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLAstroVolumeNode::~vtkMRMLAstroVolumeNode()
+{
+}
+
 //----------------------------------------------------------------------------
 void vtkMRMLAstroVolumeNode::ReadXMLAttributes(const char** atts)
 {
+  int disabledModify = this->StartModify();
+
   this->Superclass::ReadXMLAttributes(atts);
 
+  const char* attName;
+  const char* attValue;
+  while (*atts != NULL)
+    {
+    attName = *(atts++);
+    attValue = *(atts++);
+    if (!strcmp(attName, "noiseMethod"))
+      {
+      this->NoiseMethod = StringToInt(attValue);
+      }
+    else if (!strcmp(attName, "noiseSampling"))
+      {
+      this->NoiseSampling = StringToInt(attValue);
+      }
+    else if (!strcmp(attName, "noiseClippingIterations"))
+      {
+      this->NoiseClippingIterations = StringToInt(attValue);
+      }
+    else if (!strcmp(attName, "noiseClippingSigma"))
+      {
+      this->NoiseClippingSigma = StringToDouble(attValue);
+      }
+    }
+
+  this->EndModify(disabledModify);
+
   this->WriteXML(std::cout,0);
 }
 
@@ -128,6 +579,12 @@ void vtkMRMLAstroVolumeNode::ReadXMLAttributes(const char** atts)
 void vtkMRMLAstroVolumeNode::WriteXML(ostream& of, int nIndent)
 {
   this->Superclass::WriteXML(of, nIndent);
+
+  vtkIndent indent(nIndent);
+  of << indent << " noiseMethod=\"" << this->NoiseMethod << "\"";
+  of << indent << " noiseSampling=\"" << this->NoiseSampling << "\"";
+  of << indent << " noiseClippingIterations=\"" << this->NoiseClippingIterations << "\"";
+  of << indent << " noiseClippingSigma=\"" << this->NoiseClippingSigma << "\"";
 }
 
 //----------------------------------------------------------------------------
@@ -140,12 +597,22 @@ void vtkMRMLAstroVolumeNode::Copy(vtkMRMLNode *anode)
     }
 
   this->Superclass::Copy(astroVolumeNode);
+
+  this->SetNoiseMethod(astroVolumeNode->GetNoiseMethod());
+  this->SetNoiseSampling(astroVolumeNode->GetNoiseSampling());
+  this->SetNoiseClippingIterations(astroVolumeNode->GetNoiseClippingIterations());
+  this->SetNoiseClippingSigma(astroVolumeNode->GetNoiseClippingSigma());
 }
 
 //----------------------------------------------------------------------------
 void vtkMRMLAstroVolumeNode::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "NoiseMethod: " << this->NoiseMethod << "\n";
+  os << indent << "NoiseSampling: " << this->NoiseSampling << "\n";
+  os << indent << "NoiseClippingIterations: " << this->NoiseClippingIterations << "\n";
+  os << indent << "NoiseClippingSigma: " << this->NoiseClippingSigma << "\n";
 }
 
 //---------------------------------------------------------------------------
@@ -155,94 +622,235 @@ vtkMRMLAstroVolumeDisplayNode* vtkMRMLAstroVolumeNode::GetAstroVolumeDisplayNode
 }
 
 //---------------------------------------------------------------------------
-bool vtkMRMLAstroVolumeNode::UpdateRangeAttributes()
+bool vtkMRMLAstroVolumeNode::ComputeStatistics(vtkMRMLAstroVolumeNode::Statistics &statistics,
+                                               bool range)
 {
-  if (this->GetImageData() == NULL)
+  vtkImageData *imageData = this->GetImageData();
+  if (imageData == NULL || imageData->GetPointData()->GetScalars() == NULL)
    {
-   vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateRangeAttributes : "
+   vtkErrorMacro("vtkMRMLAstroVolumeNode::ComputeStatistics : "
                  "imageData not allocated.");
    return false;
    }
-  this->GetImageData()->Modified();
-  int *dims = this->GetImageData()->GetDimensions();
-  int numElements = dims[0] * dims[1] * dims[2];
-  const int DataType = this->GetImageData()->GetPointData()->GetScalars()->GetDataType();
-  double max = this->GetImageData()->GetScalarTypeMin(), min = this->GetImageData()->GetScalarTypeMax();
-  short *outSPixel = NULL;
-  float *outFPixel = NULL;
-  double *outDPixel = NULL;
 
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  int *dims = imageData->GetDimensions();
+  const vtkIdType numElements = static_cast<vtkIdType>(dims[0]) * dims[1] * dims[2];
+  const int DataType = imageData->GetPointData()->GetScalars()->GetDataType();
+  void *pixel = imageData->GetScalarPointer();
+
+  // scaled integers: the statistics are computed on the physical values
+  double bscale = 1., bzero = 0.;
+  this->GetDataScaling(bscale, bzero);
+  const double blank = this->GetDataBlank();
+
+  vtkIdType noiseRanges[2][2];
+  NoiseRanges(dims, StringToInt(this->GetAttribute("SlicerAstro.NAXIS")), noiseRanges);
+
+  StatisticsAccumulator acc;
   switch (DataType)
     {
-  case VTK_SHORT:
-    outSPixel = static_cast<short*> (this->GetImageData()->GetScalarPointer());
-    for (int elementCnt = 0; elementCnt < numElements; elementCnt++)
-      {
-      if (ShortIsNaN(*(outSPixel + elementCnt)))
-        {
-        continue;
-        }
-      if (*(outSPixel + elementCnt) > max)
-        {
-        max =  *(outSPixel + elementCnt);
-        }
-      if (*(outSPixel + elementCnt) < min)
-        {
-        min =  *(outSPixel + elementCnt);
-        }
-      }
-    break;
+    case VTK_UNSIGNED_CHAR:
+      FusedStatistics(static_cast<unsigned char*>(pixel), numElements, blank, range, noiseRanges, acc);
+      break;
+    case VTK_SHORT:
+      FusedStatistics(static_cast<short*>(pixel), numElements, blank, range, noiseRanges, acc);
+      break;
+    case VTK_INT:
+      FusedStatistics(static_cast<int*>(pixel), numElements, blank, range, noiseRanges, acc);
+      break;
     case VTK_FLOAT:
-      outFPixel = static_cast<float*> (this->GetImageData()->GetScalarPointer());
-      for (int elementCnt = 0; elementCnt < numElements; elementCnt++)
-        {
-       if (FloatIsNaN(*(outFPixel + elementCnt)))
-          {
-          continue;
-          }
-        if (*(outFPixel + elementCnt) > max)
-          {
-          max =  *(outFPixel + elementCnt);
-          }
-        if (*(outFPixel + elementCnt) < min)
-          {
-          min =  *(outFPixel + elementCnt);
-          }
-        }
+      FusedStatistics(static_cast<float*>(pixel), numElements, blank, range, noiseRanges, acc);
       break;
     case VTK_DOUBLE:
-      outDPixel = static_cast<double*> (this->GetImageData()->GetScalarPointer());
-      for (int elementCnt = 0; elementCnt < numElements; elementCnt++)
-        {
-        if (DoubleIsNaN(*(outDPixel + elementCnt)))
-          {
-          continue;
-          }
-        if (*(outDPixel + elementCnt) > max)
-          {
-          max =  *(outDPixel + elementCnt);
-          }
-        if (*(outDPixel + elementCnt) < min)
-          {
-          min =  *(outDPixel + elementCnt);
-          }
-        }
+      FusedStatistics(static_cast<double*>(pixel), numElements, blank, range, noiseRanges, acc);
       break;
     default:
-      vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateRangeAttributes() : "
+      vtkErrorMacro("vtkMRMLAstroVolumeNode::ComputeStatistics : "
                     "attempt to allocate scalars of type not allowed");
       return false;
     }
 
-  this->SetAttribute("SlicerAstro.DATAMAX", DoubleToString(max).c_str());
-  this->SetAttribute("SlicerAstro.DATAMIN", DoubleToString(min).c_str());
+  FinishStatistics(acc, noiseRanges, bscale, bzero, imageData->GetScalarTypeMin(),
+                   imageData->GetScalarTypeMax(), statistics);
+
+  gettimeofday(&end, NULL);
+  long mtime = ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000.0) + 0.5;
+  vtkDebugMacro("vtkMRMLAstroVolumeNode::ComputeStatistics : Time : "<<mtime<<" ms /n");
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeNode::ComputeRobustNoise(double &noise, double &median)
+{
+  vtkImageData *imageData = this->GetImageData();
+  if (imageData == NULL || imageData->GetPointData()->GetScalars() == NULL)
+   {
+   vtkErrorMacro("vtkMRMLAstroVolumeNode::ComputeRobustNoise : "
+                 "imageData not allocated.");
+   return false;
+   }
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  int *dims = imageData->GetDimensions();
+  const vtkIdType numElements = static_cast<vtkIdType>(dims[0]) * dims[1] * dims[2];
+  const vtkIdType step = std::max(1, this->NoiseSampling);
+  const int numBins = 65536;
+  void *pixel = imageData->GetScalarPointer();
+  double bscale = 1., bzero = 0.;
+  this->GetDataScaling(bscale, bzero);
+  const double blank = this->GetDataBlank();
+
+  double rawMedian = 0., rawNoise = 0.;
+  bool success = false;
+  switch (imageData->GetPointData()->GetScalars()->GetDataType())
+    {
+    vtkTemplateMacro(success = RobustNoiseEstimate(static_cast<VTK_TT*>(pixel), numElements, step, blank,
+                                           this->NoiseClippingIterations, this->NoiseClippingSigma,
+                                           numBins, true, rawMedian, rawNoise));
+    }
+  if (!success)
+    {
+    vtkErrorMacro("vtkMRMLAstroVolumeNode::ComputeRobustNoise : "
+                  "no valid data.");
+    return false;
+    }
+
+  median = bscale * rawMedian + bzero;
+  noise = fabs(bscale) * rawNoise;
+
+  gettimeofday(&end, NULL);
+  long mtime = ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000.0) + 0.5;
+  vtkDebugMacro("vtkMRMLAstroVolumeNode::ComputeRobustNoise : Time : "<<mtime<<" ms /n");
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeNode::ComputeChannelNoise(vtkDoubleArray *noise)
+{
+  vtkImageData *imageData = this->GetImageData();
+  if (noise == NULL || imageData == NULL || imageData->GetPointData()->GetScalars() == NULL)
+   {
+   vtkErrorMacro("vtkMRMLAstroVolumeNode::ComputeChannelNoise : "
+                 "imageData not allocated.");
+   return false;
+   }
+
+  int *dims = imageData->GetDimensions();
+  const vtkIdType numPlaneElements = static_cast<vtkIdType>(dims[0]) * dims[1];
+  const vtkIdType step = std::max(1, this->NoiseSampling);
+  const int numChannels = dims[2];
+  const int numBins = 4096;
+  const int DataType = imageData->GetPointData()->GetScalars()->GetDataType();
+  const int elementSize = imageData->GetScalarSize();
+  const char *pixel = static_cast<const char*>(imageData->GetScalarPointer());
+  double bscale = 1., bzero = 0.;
+  this->GetDataScaling(bscale, bzero);
+  const double blank = this->GetDataBlank();
+  const double NaN = sqrt(-1);
+
+  noise->SetNumberOfComponents(1);
+  noise->SetNumberOfTuples(numChannels);
+  noise->SetName("ChannelNoise");
+
+  // one channel per thread
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int channel = 0; channel < numChannels; channel++)
+    {
+    const void *plane = pixel + channel * numPlaneElements * elementSize;
+    double rawMedian = 0., rawNoise = 0.;
+    bool success = false;
+    switch (DataType)
+      {
+      vtkTemplateMacro(success = RobustNoiseEstimate(static_cast<const VTK_TT*>(plane), numPlaneElements,
+                                             step, blank, this->NoiseClippingIterations,
+                                             this->NoiseClippingSigma, numBins, false,
+                                             rawMedian, rawNoise));
+      }
+    noise->SetValue(channel, success ? fabs(bscale) * rawNoise : NaN);
+    }
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeNode::UpdateWholeImageData()
+{
+  vtkAlgorithmOutput *connection = this->GetImageDataConnection();
+  vtkAlgorithm *producer = connection ? connection->GetProducer() : NULL;
+  if (producer == NULL)
+    {
+    vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateWholeImageData : "
+                  "imageData not allocated.");
+    return false;
+    }
+
+  producer->UpdateInformation();
+  int wholeExtent[6];
+  producer->GetOutputInformation(connection->GetIndex())->Get
+    (vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+
+  vtkImageData *imageData = this->GetImageData();
+  int extent[6] = {0, -1, 0, -1, 0, -1};
+  if (imageData && imageData->GetPointData()->GetScalars())
+    {
+    imageData->GetExtent(extent);
+    }
+  if (!std::equal(extent, extent + 6, wholeExtent))
+    {
+    producer->UpdateWholeExtent();
+    imageData = this->GetImageData();
+    if (imageData == NULL || imageData->GetPointData()->GetScalars() == NULL)
+      {
+      vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateWholeImageData : "
+                    "could not read the whole volume.");
+      return false;
+      }
+    imageData->GetExtent(extent);
+    if (!std::equal(extent, extent + 6, wholeExtent))
+      {
+      vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateWholeImageData : "
+                    "could not read the whole volume.");
+      return false;
+      }
+    }
+
+  if (this->GetAttribute("AstroVolume.EstimatedRange"))
+    {
+    this->RemoveAttribute("AstroVolume.EstimatedRange");
+    return this->UpdateRangeAttributes();
+    }
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeNode::UpdateRangeAttributes()
+{
+  if (this->GetImageData() == NULL)
+   {
+   vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateRangeAttributes : "
+                 "imageData not allocated.");
+   return false;
+   }
+  this->GetImageData()->Modified();
+
+  Statistics statistics;
+  if (!this->ComputeStatistics(statistics, true))
+    {
+    return false;
+    }
 
-  outSPixel = NULL;
-  outFPixel = NULL;
-  outDPixel = NULL;
-  delete outSPixel;
-  delete outFPixel;
-  delete outDPixel;
+  this->SetAttribute("SlicerAstro.DATAMAX", DoubleToString(statistics.Max).c_str());
+  this->SetAttribute("SlicerAstro.DATAMIN", DoubleToString(statistics.Min).c_str());
 
   return true;
 }
@@ -257,164 +865,160 @@ bool vtkMRMLAstroVolumeNode::UpdateNoiseAttributes()
    return false;
    }
 
-  //We calculate the noise as the std of 6 slices of the datacube.
-  int *dims = this->GetImageData()->GetDimensions();
-  const int DataType = this->GetImageData()->GetPointData()->GetScalars()->GetDataType();
-  float *outFPixel = NULL;
-  double *outDPixel = NULL;
-  switch (DataType)
+  if (this->NoiseMethod == vtkMRMLAstroVolumeNode::RobustNoise)
     {
-    case VTK_FLOAT:
-      outFPixel = static_cast<float*> (this->GetImageData()->GetScalarPointer(0,0,0));
-      break;
-    case VTK_DOUBLE:
-      outDPixel = static_cast<double*> (this->GetImageData()->GetScalarPointer(0,0,0));
-      break;
-    default:
-      vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateNoiseAttributes : "
-                    "attempt to allocate scalars of type not allowed");
+    double noise = 0., median = 0.;
+    if (!this->ComputeRobustNoise(noise, median))
+      {
       return false;
+      }
+    this->SetAttribute("SlicerAstro.RMS", DoubleToString(noise).c_str());
+    this->SetAttribute("SlicerAstro.RMSMEAN", DoubleToString(median).c_str());
+    return true;
     }
-  double sum = 0., noise1 = 0., noise2 = 0, noise = 0., mean1 = 0., mean2 = 0., mean = 0.;
-  int lowBoundary;
-  int highBoundary;
 
-  if (StringToInt(this->GetAttribute("SlicerAstro.NAXIS")) == 3)
+  //We calculate the noise as the std of 6 slices of the datacube.
+  Statistics statistics;
+  if (!this->ComputeStatistics(statistics, false))
     {
-    lowBoundary = dims[0] * dims[1] * 2;
-    highBoundary = dims[0] * dims[1] * 4;
+    return false;
     }
-  else if (StringToInt(this->GetAttribute("SlicerAstro.NAXIS")) == 2)
+
+  this->SetAttribute("SlicerAstro.RMS", DoubleToString(statistics.Noise).c_str());
+  this->SetAttribute("SlicerAstro.RMSMEAN", DoubleToString(statistics.NoiseMean).c_str());
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeNode::UpdateStatisticsAttributes()
+{
+  if (this->GetImageData() == NULL)
+   {
+   vtkErrorMacro("vtkMRMLAstroVolumeNode::UpdateStatisticsAttributes : "
+                 "imageData not allocated.");
+   return false;
+   }
+  this->GetImageData()->Modified();
+
+  Statistics statistics;
+  if (!this->ComputeStatistics(statistics, true))
     {
-    lowBoundary = dims[0] * 2;
-    highBoundary = dims[0] * 4;
+    return false;
     }
-  else
+
+  this->SetAttribute("SlicerAstro.DATAMAX", DoubleToString(statistics.Max).c_str());
+  this->SetAttribute("SlicerAstro.DATAMIN", DoubleToString(statistics.Min).c_str());
+
+  if (this->NoiseMethod == vtkMRMLAstroVolumeNode::RobustNoise)
     {
-    lowBoundary = 2;
-    highBoundary = 4;
+    return this->UpdateNoiseAttributes();
     }
 
-  int cont = highBoundary - lowBoundary;
-  switch (DataType)
+  this->SetAttribute("SlicerAstro.RMS", DoubleToString(statistics.Noise).c_str());
+  this->SetAttribute("SlicerAstro.RMSMEAN", DoubleToString(statistics.NoiseMean).c_str());
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeNode::HasScaledIntegerData()
+{
+  if (this->GetImageData() == NULL ||
+      this->GetImageData()->GetPointData()->GetScalars() == NULL)
     {
-    case VTK_FLOAT:
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (FloatIsNaN(*(outFPixel + elemCnt)))
-           {
-           continue;
-           }
-        sum += *(outFPixel + elemCnt);
-        }
-      sum /= cont;
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (FloatIsNaN(*(outFPixel + elemCnt)))
-           {
-           continue;
-           }
-        noise1 += (*(outFPixel + elemCnt) - sum) * (*(outFPixel+elemCnt) - sum);
-        }
-      noise1 = sqrt(noise1 / cont);
-      break;
-    case VTK_DOUBLE:
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (DoubleIsNaN(*(outDPixel + elemCnt)))
-           {
-           continue;
-           }
-        sum += *(outDPixel + elemCnt);
-        }
-      sum /= cont;
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (DoubleIsNaN(*(outDPixel + elemCnt)))
-           {
-           continue;
-           }
-        noise1 += (*(outDPixel + elemCnt) - sum) * (*(outDPixel+elemCnt) - sum);
-        }
-      noise1 = sqrt(noise1 / cont);
-      break;
+    return false;
     }
 
-  mean1 = sum;
+  const int DataType = this->GetImageData()->GetPointData()->GetScalars()->GetDataType();
+  return DataType == VTK_UNSIGNED_CHAR || DataType == VTK_SHORT || DataType == VTK_INT;
+}
 
-  if (StringToInt(this->GetAttribute("SlicerAstro.NAXIS")) == 3)
+//---------------------------------------------------------------------------
+void vtkMRMLAstroVolumeNode::GetDataScaling(double &bscale, double &bzero)
+{
+  bscale = 1.;
+  bzero = 0.;
+  if (!this->HasScaledIntegerData())
     {
-    lowBoundary = dims[0] * dims[1] * (dims[2] - 4);
-    highBoundary = dims[0] * dims[1] * (dims[2] - 2);
+    return;
     }
-  else if (StringToInt(this->GetAttribute("SlicerAstro.NAXIS")) == 2)
+
+  if (this->GetAttribute("SlicerAstro.BSCALE"))
     {
-    lowBoundary = dims[0] * (dims[1] - 4);
-    highBoundary = dims[0] * (dims[1] - 2);
+    bscale = StringToDouble(this->GetAttribute("SlicerAstro.BSCALE"));
     }
-  else
+  if (bscale == 0.)
     {
-    lowBoundary = dims[0] - 4;
-    highBoundary = dims[0] - 2;
+    bscale = 1.;
     }
+  if (this->GetAttribute("SlicerAstro.BZERO"))
+    {
+    bzero = StringToDouble(this->GetAttribute("SlicerAstro.BZERO"));
+    }
+}
 
-  sum = 0.;
+//---------------------------------------------------------------------------
+double vtkMRMLAstroVolumeNode::GetDataBlank()
+{
+  const double NaN = sqrt(-1);
+  if (!this->HasScaledIntegerData() || !this->GetAttribute("SlicerAstro.BLANK"))
+    {
+    return NaN;
+    }
 
-  switch (DataType)
+  // vtkFITSReader sets BLANK = 0 if the keyword is missing
+  double blank = StringToDouble(this->GetAttribute("SlicerAstro.BLANK"));
+  return blank == 0. ? NaN : blank;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeNode::ConvertScaledIntegerDataToFloat()
+{
+  if (!this->HasScaledIntegerData())
     {
-    case VTK_FLOAT:
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (FloatIsNaN(*(outFPixel + elemCnt)))
-           {
-           continue;
-           }
-        sum += *(outFPixel + elemCnt);
-        }
-      sum /= cont;
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (FloatIsNaN(*(outFPixel + elemCnt)))
-           {
-           continue;
-           }
-        noise2 += (*(outFPixel + elemCnt) - sum) * (*(outFPixel+elemCnt) - sum);
-        }
-      noise2 = sqrt(noise2 / cont);
-      break;
-    case VTK_DOUBLE:
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (DoubleIsNaN(*(outDPixel + elemCnt)))
-           {
-           continue;
-           }
-        sum += *(outDPixel + elemCnt);
-        }
-      sum /= cont;
-      for( int elemCnt = lowBoundary; elemCnt <= highBoundary; elemCnt++)
-        {
-        if (DoubleIsNaN(*(outDPixel + elemCnt)))
-           {
-           continue;
-           }
-        noise2 += (*(outDPixel + elemCnt) - sum) * (*(outDPixel+elemCnt) - sum);
-        }
-      noise2 = sqrt(noise2 / cont);
-      break;
+    return true;
     }
 
-  mean2 = sum;
+  vtkImageData *imageData = this->GetImageData();
+  vtkDataArray *inArray = imageData->GetPointData()->GetScalars();
+  const vtkIdType numElements = inArray->GetNumberOfValues();
+
+  double bscale = 1., bzero = 0.;
+  this->GetDataScaling(bscale, bzero);
+  const double blank = this->GetDataBlank();
 
-  noise = (noise1 + noise2) * 0.5;
-  mean = (mean1 + mean2) * 0.5;
+  vtkNew<vtkFloatArray> outArray;
+  outArray->SetNumberOfComponents(inArray->GetNumberOfComponents());
+  outArray->SetNumberOfTuples(inArray->GetNumberOfTuples());
+  outArray->SetName(inArray->GetName());
+  float *outFPixel = static_cast<float*> (outArray->GetVoidPointer(0));
+
+  switch (inArray->GetDataType())
+    {
+    case VTK_UNSIGNED_CHAR:
+      ScaledIntegerToFloat(static_cast<unsigned char*> (inArray->GetVoidPointer(0)),
+                           outFPixel, numElements, bscale, bzero, blank);
+      break;
+    case VTK_SHORT:
+      ScaledIntegerToFloat(static_cast<short*> (inArray->GetVoidPointer(0)),
+                           outFPixel, numElements, bscale, bzero, blank);
+      break;
+    case VTK_INT:
+      ScaledIntegerToFloat(static_cast<int*> (inArray->GetVoidPointer(0)),
+                           outFPixel, numElements, bscale, bzero, blank);
+      break;
+    default:
+      vtkErrorMacro("vtkMRMLAstroVolumeNode::ConvertScaledIntegerDataToFloat : "
+                    "attempt to convert scalars of type not allowed");
+      return false;
+    }
 
-  this->SetAttribute("SlicerAstro.RMS", DoubleToString(noise).c_str());\
-  this->SetAttribute("SlicerAstro.RMSMEAN", DoubleToString(mean).c_str());
-  outFPixel = NULL;
-  outDPixel = NULL;
-  delete outFPixel;
-  delete outDPixel;
+  // as for the float data loaded by vtkFITSReader, BSCALE/BZERO are kept
+  // and the writer will apply them back
+  imageData->GetPointData()->SetScalars(outArray.GetPointer());
+  imageData->Modified();
+  this->SetAttribute("SlicerAstro.BITPIX", "-32");
 
   return true;
 }
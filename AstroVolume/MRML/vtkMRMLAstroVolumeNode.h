@@ -29,6 +29,10 @@
 // VTK includes
 #include <vtkDoubleArray.h>
 #include <vtkSmartPointer.h>
+#include <vtkType.h>
+
+// STD includes
+#include <limits>
 
 #include <vtkSlicerAstroVolumeModuleMRMLExport.h>
 
@@ -79,6 +83,68 @@ class VTK_MRML_ASTRO_EXPORT vtkMRMLAstroVolumeNode : public vtkMRMLScalarVolumeN
   /// Get AstroVolume display node
   virtual vtkMRMLAstroVolumeDisplayNode* GetAstroVolumeDisplayNode();
 
+  ///
+  /// Statistics of the physical values of the image data
+  struct Statistics
+    {
+    double Min;
+    double Max;
+    vtkIdType NumberOfValues;
+    /// number of NaN (or BLANK) voxels
+    vtkIdType NumberOfBlanks;
+    double Mean;
+    /// noise (std) and mean of the channels at the ends of the cube
+    double Noise;
+    double NoiseMean;
+    };
+
+  ///
+  /// Compute the statistics in a single parallel pass over the data.
+  /// If range is false only the noise channels are visited.
+  bool ComputeStatistics(Statistics &statistics, bool range = true);
+
+  enum NoiseMethods
+    {
+    /// std of the channels at the ends of the cube
+    EdgeChannelsNoise = 0,
+    /// 1.4826 * median absolute deviation, with optional sigma clipping
+    RobustNoise
+    };
+
+  ///
+  /// Estimator used by UpdateNoiseAttributes. Default is EdgeChannelsNoise.
+  vtkSetClampMacro(NoiseMethod, int, EdgeChannelsNoise, RobustNoise);
+  vtkGetMacro(NoiseMethod, int);
+
+  ///
+  /// Robust noise: one voxel out of NoiseSampling is used (1: whole cube)
+  vtkSetClampMacro(NoiseSampling, int, 1, VTK_INT_MAX);
+  vtkGetMacro(NoiseSampling, int);
+
+  ///
+  /// Robust noise: iterations of sigma clipping (values farther than
+  /// NoiseClippingSigma * noise from the median are discarded)
+  vtkSetClampMacro(NoiseClippingIterations, int, 0, 100);
+  vtkGetMacro(NoiseClippingIterations, int);
+  vtkSetMacro(NoiseClippingSigma, double);
+  vtkGetMacro(NoiseClippingSigma, double);
+
+  ///
+  /// Robust noise and median of the data (histogram-based MAD, in parallel)
+  bool ComputeRobustNoise(double &noise, double &median);
+
+  ///
+  /// Robust noise of each channel (NaN for blank channels)
+  bool ComputeChannelNoise(vtkDoubleArray *noise);
+
+  ///
+  /// Volumes loaded on demand (see vtkMRMLAstroVolumeStorageNode::LoadOnDemand)
+  /// hold only the channels requested by the views. Read the whole cube,
+  /// so that the algorithms working on GetImageData() see all the voxels.
+  /// The range estimated on load (attribute "AstroVolume.EstimatedRange")
+  /// is then replaced by the range of the whole cube.
+  bool UpdateWholeImageData();
+
   ///
   /// Update Max and Min Attributes
   virtual bool UpdateRangeAttributes();
@@ -87,6 +153,35 @@ class VTK_MRML_ASTRO_EXPORT vtkMRMLAstroVolumeNode : public vtkMRMLScalarVolumeN
   /// Update Noise Attribute
    virtual bool UpdateNoiseAttributes();
 
+  ///
+  /// Update Max, Min and Noise Attributes with a single pass
+  virtual bool UpdateStatisticsAttributes();
+
+  ///
+  /// True if the image holds the BITPIX = 8/16/32 values of the FITS file
+  /// (see vtkFITSReader::KeepScaledIntegers). The physical values are
+  /// BSCALE * value + BZERO.
+  bool HasScaledIntegerData();
+
+  ///
+  /// Get BSCALE/BZERO of the image data (1 and 0 for floating point data)
+  void GetDataScaling(double &bscale, double &bzero);
+
+  ///
+  /// Get the BLANK value of scaled integer data (NaN if not set)
+  double GetDataBlank();
+
+  ///
+  /// Physical value (BSCALE * value + BZERO) of the voxel pos of scaled
+  /// integer data of type dataType (see GetDataScaling and GetDataBlank),
+  /// NaN for BLANK voxels
+  static inline double GetScaledIntegerValue(const void *pixel, int dataType, vtkIdType pos,
+                                             double bscale, double bzero, double blank);
+
+  ///
+  /// Replace scaled integer data with float physical values
+  bool ConvertScaledIntegerDataToFloat();
+
   ///
   /// Set/Get reference to a Preset Node
   void SetPresetNode(vtkMRMLVolumePropertyNode* node);
@@ -97,6 +192,11 @@ protected:
   vtkMRMLAstroVolumeNode();
   virtual ~vtkMRMLAstroVolumeNode();
 
+  int NoiseMethod;
+  int NoiseSampling;
+  int NoiseClippingIterations;
+  double NoiseClippingSigma;
+
   static const char* PRESET_REFERENCE_ROLE;
   const char *GetPresetNodeReferenceRole();
 
@@ -104,4 +204,24 @@ protected:
   void operator=(const vtkMRMLAstroVolumeNode&);
 };
 
+//---------------------------------------------------------------------------
+double vtkMRMLAstroVolumeNode::GetScaledIntegerValue(const void *pixel, int dataType, vtkIdType pos,
+                                                     double bscale, double bzero, double blank)
+{
+  double value = 0.;
+  switch (dataType)
+    {
+    case VTK_UNSIGNED_CHAR:
+      value = static_cast<const unsigned char*>(pixel)[pos];
+      break;
+    case VTK_SHORT:
+      value = static_cast<const short*>(pixel)[pos];
+      break;
+    case VTK_INT:
+      value = static_cast<const int*>(pixel)[pos];
+      break;
+    }
+  return value == blank ? std::numeric_limits<double>::quiet_NaN() : bscale * value + bzero;
+}
+
 #endif
@@ -17,6 +17,10 @@
 
 ==============================================================================*/
 
+// STD includes
+#include <algorithm>
+#include <sstream>
+
 // MRML includes
 #include <vtkMRMLAstroLabelMapVolumeDisplayNode.h>
 #include <vtkMRMLAstroLabelMapVolumeNode.h>
@@ -26,17 +30,33 @@
 #include <vtkMRMLScene.h>
 #include <vtkMRMLVolumeNode.h>
 
+// Slicer includes
+#include <vtkCacheManager.h>
+
 //vtkFits includes
 #include <vtkFITSReader.h>
+#include <vtkFITSStatisticsCache.h>
 #include <vtkFITSWriter.h>
 
 // VTK includes
+#include <vtkAlgorithm.h>
 #include <vtkDataSetAttributes.h>
+#include <vtkDoubleArray.h>
 #include <vtkImageChangeInformation.h>
 #include <vtkImageData.h>
+#include <vtkInformation.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
 #include <vtkType.h>
+#include <vtksys/SystemTools.hxx>
+
+// OpenMP includes
+#include "vtkSlicerAstroConfigure.h"
+#ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+#include <omp.h>
+#endif
 
 
 //----------------------------------------------------------------------------
@@ -46,6 +66,16 @@ vtkMRMLNodeNewMacro(vtkMRMLAstroVolumeStorageNode);
 vtkMRMLAstroVolumeStorageNode::vtkMRMLAstroVolumeStorageNode()
 {
   this->CenterImage = 2;
+  this->QuantizeLevel = 4.;
+  this->KeepScaledIntegers = 0;
+  this->HalfPrecisionStorage = 0;
+  this->LoadOnDemand = 0;
+  this->PagingMemoryBudget = 1024;
+  this->HDUNumber = 0;
+  this->FourthAxisPlane = 0;
+  this->UseStatisticsCache = 1;
+  this->StatisticsCacheDirectory = NULL;
+  this->ReadImageDataMTime = 0;
   this->DefaultWriteFileExtension = "fits";
   this->UseCompressionOff();
 }
@@ -53,6 +83,7 @@ vtkMRMLAstroVolumeStorageNode::vtkMRMLAstroVolumeStorageNode()
 //----------------------------------------------------------------------------
 vtkMRMLAstroVolumeStorageNode::~vtkMRMLAstroVolumeStorageNode()
 {
+  this->SetStatisticsCacheDirectory(NULL);
 }
 
 namespace
@@ -87,6 +118,112 @@ double StringToDouble(const char* str)
 {
   return StringToNumber<double>(str);
 }
+
+//----------------------------------------------------------------------------
+int StringToInt(const char* str)
+{
+  return StringToNumber<int>(str);
+}
+
+//----------------------------------------------------------------------------
+// Range and noise of an on-demand volume. Only the first and the last
+// channels are paged in (the noise is evaluated on those channels anyway),
+// hence the range is an estimate: it is marked as such with the
+// "AstroVolume.EstimatedRange" attribute (see UpdateWholeImageData).
+bool UpdatePagedStatistics(vtkMRMLAstroVolumeNode *volNode, vtkAlgorithm *source,
+                           bool range, bool noise)
+{
+  if (!volNode || !source)
+    {
+    return false;
+    }
+
+  source->UpdateInformation();
+  int wholeExtent[6];
+  source->GetOutputInformation(0)->Get
+    (vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+  const int numSlices = wholeExtent[5] - wholeExtent[4] + 1;
+  const int numEdgeSlices = 5;
+
+  vtkNew<vtkMRMLAstroVolumeNode> edgeNode;
+  edgeNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  edgeNode->SetAttribute("SlicerAstro.BSCALE", volNode->GetAttribute("SlicerAstro.BSCALE"));
+  edgeNode->SetAttribute("SlicerAstro.BZERO", volNode->GetAttribute("SlicerAstro.BZERO"));
+  edgeNode->SetAttribute("SlicerAstro.BLANK", volNode->GetAttribute("SlicerAstro.BLANK"));
+
+  vtkNew<vtkImageData> edges;
+  if (numSlices <= 2 * numEdgeSlices)
+    {
+    source->UpdateWholeExtent();
+    edges->DeepCopy(vtkImageData::SafeDownCast(source->GetOutputDataObject(0)));
+    }
+  else
+    {
+    edges->SetExtent(wholeExtent[0], wholeExtent[1], wholeExtent[2],
+                     wholeExtent[3], 0, 2 * numEdgeSlices - 1);
+    char *edgesPtr = NULL;
+    size_t numBytes = 0;
+    for (int edge = 0; edge < 2; edge++)
+      {
+      int extent[6] = {wholeExtent[0], wholeExtent[1], wholeExtent[2], wholeExtent[3],
+                       wholeExtent[4], wholeExtent[4] + numEdgeSlices - 1};
+      if (edge == 1)
+        {
+        extent[4] = wholeExtent[5] - numEdgeSlices + 1;
+        extent[5] = wholeExtent[5];
+        }
+      if (!source->UpdateExtent(extent))
+        {
+        return false;
+        }
+      vtkImageData *output = vtkImageData::SafeDownCast(source->GetOutputDataObject(0));
+      if (!output || !output->GetPointData()->GetScalars())
+        {
+        return false;
+        }
+      if (edge == 0)
+        {
+        edges->AllocateScalars(output->GetScalarType(), 1);
+        edgesPtr = static_cast<char*>(edges->GetScalarPointer());
+        numBytes = static_cast<size_t>(edges->GetNumberOfPoints() / 2) * edges->GetScalarSize();
+        }
+      memcpy(edgesPtr + edge * numBytes, output->GetScalarPointer(extent[0], extent[2], extent[4]), numBytes);
+      }
+    }
+  edgeNode->SetAndObserveImageData(edges.GetPointer());
+
+  if (range && noise)
+    {
+    edgeNode->UpdateStatisticsAttributes();
+    }
+  else if (range)
+    {
+    edgeNode->UpdateRangeAttributes();
+    }
+  else if (noise)
+    {
+    edgeNode->UpdateNoiseAttributes();
+    }
+  if (range)
+    {
+    volNode->SetAttribute("SlicerAstro.DATAMIN", edgeNode->GetAttribute("SlicerAstro.DATAMIN"));
+    volNode->SetAttribute("SlicerAstro.DATAMAX", edgeNode->GetAttribute("SlicerAstro.DATAMAX"));
+    if (numSlices > 2 * numEdgeSlices)
+      {
+      volNode->SetAttribute("AstroVolume.EstimatedRange", "1");
+      }
+    else
+      {
+      volNode->RemoveAttribute("AstroVolume.EstimatedRange");
+      }
+    }
+  if (noise)
+    {
+    volNode->SetAttribute("SlicerAstro.RMS", edgeNode->GetAttribute("SlicerAstro.RMS"));
+    volNode->SetAttribute("SlicerAstro.RMSMEAN", edgeNode->GetAttribute("SlicerAstro.RMSMEAN"));
+    }
+  return true;
+}
 }// end namespace
 
 
@@ -99,6 +236,14 @@ void vtkMRMLAstroVolumeStorageNode::WriteXML(ostream& of, int nIndent)
   std::stringstream ss;
   ss << this->CenterImage;
   of << indent << " centerImage=\"" << ss.str() << "\"";
+  of << indent << " quantizeLevel=\"" << this->QuantizeLevel << "\"";
+  of << indent << " keepScaledIntegers=\"" << this->KeepScaledIntegers << "\"";
+  of << indent << " halfPrecisionStorage=\"" << this->HalfPrecisionStorage << "\"";
+  of << indent << " loadOnDemand=\"" << this->LoadOnDemand << "\"";
+  of << indent << " pagingMemoryBudget=\"" << this->PagingMemoryBudget << "\"";
+  of << indent << " hduNumber=\"" << this->HDUNumber << "\"";
+  of << indent << " fourthAxisPlane=\"" << this->FourthAxisPlane << "\"";
+  of << indent << " useStatisticsCache=\"" << this->UseStatisticsCache << "\"";
 }
 
 //----------------------------------------------------------------------------
@@ -120,6 +265,52 @@ void vtkMRMLAstroVolumeStorageNode::ReadXMLAttributes(const char** atts)
       ss << attValue;
       ss >> this->CenterImage;
       }
+    else if (!strcmp(attName, "quantizeLevel"))
+      {
+      this->QuantizeLevel = StringToDouble(attValue);
+      }
+    else if (!strcmp(attName, "keepScaledIntegers"))
+      {
+      std::stringstream ss;
+      ss << attValue;
+      ss >> this->KeepScaledIntegers;
+      }
+    else if (!strcmp(attName, "halfPrecisionStorage"))
+      {
+      std::stringstream ss;
+      ss << attValue;
+      ss >> this->HalfPrecisionStorage;
+      }
+    else if (!strcmp(attName, "loadOnDemand"))
+      {
+      std::stringstream ss;
+      ss << attValue;
+      ss >> this->LoadOnDemand;
+      }
+    else if (!strcmp(attName, "pagingMemoryBudget"))
+      {
+      std::stringstream ss;
+      ss << attValue;
+      ss >> this->PagingMemoryBudget;
+      }
+    else if (!strcmp(attName, "hduNumber"))
+      {
+      std::stringstream ss;
+      ss << attValue;
+      ss >> this->HDUNumber;
+      }
+    else if (!strcmp(attName, "fourthAxisPlane"))
+      {
+      std::stringstream ss;
+      ss << attValue;
+      ss >> this->FourthAxisPlane;
+      }
+    else if (!strcmp(attName, "useStatisticsCache"))
+      {
+      std::stringstream ss;
+      ss << attValue;
+      ss >> this->UseStatisticsCache;
+      }
     }
 
   this->EndModify(disabledModify);
@@ -141,6 +332,15 @@ void vtkMRMLAstroVolumeStorageNode::Copy(vtkMRMLNode *anode)
   vtkMRMLAstroVolumeStorageNode *node = (vtkMRMLAstroVolumeStorageNode *) anode;
 
   this->SetCenterImage(node->CenterImage);
+  this->SetQuantizeLevel(node->QuantizeLevel);
+  this->SetKeepScaledIntegers(node->KeepScaledIntegers);
+  this->SetHalfPrecisionStorage(node->HalfPrecisionStorage);
+  this->SetLoadOnDemand(node->LoadOnDemand);
+  this->SetPagingMemoryBudget(node->PagingMemoryBudget);
+  this->SetHDUNumber(node->HDUNumber);
+  this->SetFourthAxisPlane(node->FourthAxisPlane);
+  this->SetUseStatisticsCache(node->UseStatisticsCache);
+  this->SetStatisticsCacheDirectory(node->StatisticsCacheDirectory);
 
   this->EndModify(disabledModify);
 }
@@ -150,6 +350,16 @@ void vtkMRMLAstroVolumeStorageNode::PrintSelf(ostream& os, vtkIndent indent)
 {
   vtkMRMLStorageNode::PrintSelf(os,indent);
   os << indent << "CenterImage:   " << this->CenterImage << "\n";
+  os << indent << "QuantizeLevel:   " << this->QuantizeLevel << "\n";
+  os << indent << "KeepScaledIntegers:   " << this->KeepScaledIntegers << "\n";
+  os << indent << "HalfPrecisionStorage:   " << this->HalfPrecisionStorage << "\n";
+  os << indent << "LoadOnDemand:   " << this->LoadOnDemand << "\n";
+  os << indent << "PagingMemoryBudget:   " << this->PagingMemoryBudget << "\n";
+  os << indent << "HDUNumber:   " << this->HDUNumber << "\n";
+  os << indent << "FourthAxisPlane:   " << this->FourthAxisPlane << "\n";
+  os << indent << "UseStatisticsCache:   " << this->UseStatisticsCache << "\n";
+  os << indent << "StatisticsCacheDirectory:   " <<
+    (this->StatisticsCacheDirectory ? this->StatisticsCacheDirectory : "(none)") << "\n";
 }
 
 //----------------------------------------------------------------------------
@@ -159,6 +369,312 @@ bool vtkMRMLAstroVolumeStorageNode::CanReadInReferenceNode(vtkMRMLNode *refNode)
          refNode->IsA("vtkMRMLAstroLabelMapVolumeNode");
 }
 
+//----------------------------------------------------------------------------
+void vtkMRMLAstroVolumeStorageNode::ConfigureReader(vtkFITSReader *reader, bool volume)
+{
+  if (!reader)
+    {
+    return;
+    }
+
+  // Set Reader member variables
+  if (this->CenterImage)
+    {
+    reader->SetUseNativeOriginOff();
+    }
+  else
+    {
+    reader->SetUseNativeOriginOn();
+    }
+
+  // masks are always loaded as short
+  reader->SetKeepScaledIntegers(this->KeepScaledIntegers && volume);
+  reader->SetQuantizeToShort(this->HalfPrecisionStorage && volume);
+
+  reader->SetHDUNumber(this->HDUNumber);
+  reader->SetFourthAxisPlane(this->FourthAxisPlane);
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeStorageNode::ConfigurePaging(vtkFITSReader *reader, bool volume)
+{
+  // on-demand cubes: the data are read when requested by the pipeline
+  if (!reader || !this->LoadOnDemand || !volume ||
+      StringToInt(reader->GetHeaderValue("SlicerAstro.NAXIS")) != 3)
+    {
+    return false;
+    }
+
+  reader->PagingOn();
+  reader->SetPagingMemoryBudget(static_cast<vtkIdType>(this->PagingMemoryBudget) * 1024 * 1024);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeStorageNode::ConfigureStatisticsCache(vtkFITSStatisticsCache *cache,
+                                                             const std::string &fileName,
+                                                             vtkFITSReader *reader,
+                                                             vtkMRMLAstroVolumeNode *noiseNode)
+{
+  // the sidecars go in the application cache, not in the data directory
+  std::string cacheDirectory;
+  if (this->StatisticsCacheDirectory && *this->StatisticsCacheDirectory)
+    {
+    cacheDirectory = this->StatisticsCacheDirectory;
+    }
+  else if (this->GetScene() && this->GetScene()->GetCacheManager() &&
+           this->GetScene()->GetCacheManager()->GetRemoteCacheDirectory() &&
+           *this->GetScene()->GetCacheManager()->GetRemoteCacheDirectory())
+    {
+    cacheDirectory = std::string(this->GetScene()->GetCacheManager()->GetRemoteCacheDirectory()) +
+                     "/SlicerAstro";
+    }
+  if (cacheDirectory.empty() || !reader || !noiseNode)
+    {
+    return false;
+    }
+
+  // the statistics depend on the part of the file that is read,
+  // on how it is stored and on the noise estimator
+  std::stringstream selection;
+  selection << "hdu=" << reader->GetHDUNumber()
+            << " plane=" << reader->GetFourthAxisPlane()
+            << " quantized=" << reader->GetQuantizeToShort()
+            << " paged=" << reader->GetPaging()
+            << " noise=" << noiseNode->GetNoiseMethod();
+  if (noiseNode->GetNoiseMethod() == vtkMRMLAstroVolumeNode::RobustNoise)
+    {
+    selection << " sampling=" << noiseNode->GetNoiseSampling()
+              << " clipping=" << noiseNode->GetNoiseClippingIterations()
+              << "x" << noiseNode->GetNoiseClippingSigma();
+    }
+  cache->SetFileName(fileName.c_str());
+  cache->SetSelection(selection.str().c_str());
+  cache->SetCacheDirectory(cacheDirectory.c_str());
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeStorageNode::ReadStatisticsCache(const std::string &fileName,
+                                                        vtkFITSReader *reader,
+                                                        vtkMRMLAstroVolumeNode *noiseNode,
+                                                        std::map<std::string, std::string> &statistics)
+{
+  statistics.clear();
+
+  vtkNew<vtkFITSStatisticsCache> cache;
+  if (!this->ConfigureStatisticsCache(cache.GetPointer(), fileName, reader, noiseNode) ||
+      !cache->Load())
+    {
+    return false;
+    }
+
+  const char* keys[4] = {"SlicerAstro.DATAMIN", "SlicerAstro.DATAMAX",
+                         "SlicerAstro.RMS", "SlicerAstro.RMSMEAN"};
+  for (int ii = 0; ii < 4; ii++)
+    {
+    if (cache->HasValue(keys[ii]))
+      {
+      statistics[keys[ii]] = cache->GetValue(keys[ii]);
+      }
+    }
+
+  // range and noise are stored in pairs
+  if (!statistics.count("SlicerAstro.DATAMAX"))
+    {
+    statistics.erase("SlicerAstro.DATAMIN");
+    }
+  if (!statistics.count("SlicerAstro.RMSMEAN"))
+    {
+    statistics.erase("SlicerAstro.RMS");
+    }
+
+  return !statistics.empty();
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeStorageNode::WriteStatisticsCache(const std::string &fileName,
+                                                         vtkFITSReader *reader,
+                                                         vtkMRMLAstroVolumeNode *node)
+{
+  // keep the other entries of a valid cache
+  vtkNew<vtkFITSStatisticsCache> cache;
+  if (!node || !this->ConfigureStatisticsCache(cache.GetPointer(), fileName, reader, node))
+    {
+    return false;
+    }
+  cache->Load();
+
+  const char* keys[4] = {"SlicerAstro.DATAMIN", "SlicerAstro.DATAMAX",
+                         "SlicerAstro.RMS", "SlicerAstro.RMSMEAN"};
+  for (int ii = 0; ii < 4; ii++)
+    {
+    if (node->GetAttribute(keys[ii]))
+      {
+      cache->SetValue(keys[ii], node->GetAttribute(keys[ii]));
+      }
+    }
+
+  return cache->Save();
+}
+
+//----------------------------------------------------------------------------
+unsigned long vtkMRMLAstroVolumeStorageNode::GetImageDataMTime(vtkMRMLAstroVolumeNode *volumeNode)
+{
+  vtkImageData *imageData = volumeNode ? volumeNode->GetImageData() : NULL;
+  if (!imageData || !imageData->GetPointData() || !imageData->GetPointData()->GetScalars())
+    {
+    return 0;
+    }
+  return std::max(imageData->GetMTime(), imageData->GetPointData()->GetScalars()->GetMTime());
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeStorageNode::ReadHistogramCache(vtkMRMLAstroVolumeNode *volumeNode,
+                                                       vtkDoubleArray *binEdges,
+                                                       vtkDoubleArray *counts)
+{
+  if (!this->UseStatisticsCache || !this->ReadStatistics || !binEdges || !counts ||
+      this->ReadImageDataMTime == 0 ||
+      this->ReadImageDataMTime != GetImageDataMTime(volumeNode))
+    {
+    return false;
+    }
+
+  if (!this->ReadStatistics->Load() ||
+      !this->ReadStatistics->GetArray("Histogram.Edges", binEdges) ||
+      !this->ReadStatistics->GetArray("Histogram.Counts", counts))
+    {
+    return false;
+    }
+
+  return binEdges->GetNumberOfValues() > 1 &&
+         binEdges->GetNumberOfValues() == counts->GetNumberOfValues() + 1;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeStorageNode::WriteHistogramCache(vtkMRMLAstroVolumeNode *volumeNode,
+                                                        vtkDoubleArray *binEdges,
+                                                        vtkDoubleArray *counts)
+{
+  if (!this->UseStatisticsCache || !this->ReadStatistics || !binEdges || !counts ||
+      this->ReadImageDataMTime == 0 ||
+      this->ReadImageDataMTime != GetImageDataMTime(volumeNode))
+    {
+    return false;
+    }
+
+  // keep the range and the noise
+  this->ReadStatistics->Load();
+  this->ReadStatistics->SetArray("Histogram.Edges", binEdges);
+  this->ReadStatistics->SetArray("Histogram.Counts", counts);
+  return this->ReadStatistics->Save();
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLAstroVolumeStorageNode::CanPreloadConcurrently()
+{
+  return fits_is_reentrant() != 0;
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLAstroVolumeStorageNode::PreloadData(bool labelMap, int numberOfThreads)
+{
+  this->PreloadedReader = NULL;
+  this->PreloadedStatistics.clear();
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  if (numberOfThreads > 0)
+    {
+    omp_set_num_threads(numberOfThreads);
+    }
+  #else
+  (void)numberOfThreads;
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+
+  std::string fullName = this->GetFullNameFromFileName();
+  if (fullName.empty())
+    {
+    vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::PreloadData : file name not specified");
+    return 0;
+    }
+
+  vtkSmartPointer<vtkFITSReader> reader = vtkSmartPointer<vtkFITSReader>::New();
+  this->ConfigureReader(reader, !labelMap);
+  reader->SetFileName(fullName.c_str());
+
+  if (!reader->CanReadFile(fullName.c_str()))
+    {
+    vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::PreloadData : this is not a fits file");
+    return 0;
+    }
+
+  reader->UpdateInformation();
+  if (!this->ConfigurePaging(reader, !labelMap))
+    {
+    reader->Update();
+    }
+
+  bool range = !strcmp(reader->GetHeaderValue("SlicerAstro.DATAMAX"), "0.") ||
+               !strcmp(reader->GetHeaderValue("SlicerAstro.DATAMIN"), "0.");
+  bool noise = !strcmp(reader->GetHeaderValue("SlicerAstro.RMS"), "0.");
+
+  // scene-less node holding the header, for the statistics methods
+  vtkNew<vtkMRMLAstroVolumeNode> statNode;
+
+  // ReadData takes the statistics of a previous load from the cache
+  std::map<std::string, std::string> cachedStatistics;
+  if (!labelMap && (range || noise) && this->UseStatisticsCache &&
+      this->ReadStatisticsCache(fullName, reader, statNode.GetPointer(), cachedStatistics))
+    {
+    range = range && !cachedStatistics.count("SlicerAstro.DATAMIN");
+    noise = noise && !cachedStatistics.count("SlicerAstro.RMS");
+    }
+
+  if (!labelMap && (range || noise))
+    {
+    std::vector<std::string> keys = reader->GetHeaderKeysVector();
+    for (std::vector<std::string>::iterator kit = keys.begin(); kit != keys.end(); ++kit)
+      {
+      statNode->SetAttribute((*kit).c_str(), reader->GetHeaderValue((*kit).c_str()));
+      }
+
+    bool success = true;
+    if (reader->GetPaging())
+      {
+      success = UpdatePagedStatistics(statNode.GetPointer(), reader, range, noise);
+      }
+    else
+      {
+      statNode->SetAndObserveImageData(reader->GetOutput());
+      success = range && noise ? statNode->UpdateStatisticsAttributes() :
+                range ? statNode->UpdateRangeAttributes() :
+                statNode->UpdateNoiseAttributes();
+      }
+    if (!success)
+      {
+      vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::PreloadData : "
+                    "could not calculate the statistics.");
+      return 0;
+      }
+
+    if (range)
+      {
+      this->PreloadedStatistics["SlicerAstro.DATAMIN"] = statNode->GetAttribute("SlicerAstro.DATAMIN");
+      this->PreloadedStatistics["SlicerAstro.DATAMAX"] = statNode->GetAttribute("SlicerAstro.DATAMAX");
+      }
+    if (noise)
+      {
+      this->PreloadedStatistics["SlicerAstro.RMS"] = statNode->GetAttribute("SlicerAstro.RMS");
+      this->PreloadedStatistics["SlicerAstro.RMSMEAN"] = statNode->GetAttribute("SlicerAstro.RMSMEAN");
+      }
+    }
+
+  this->PreloadedReader = reader;
+  this->PreloadedFileName = fullName;
+  return 1;
+}
+
 //----------------------------------------------------------------------------
 int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
 {
@@ -184,18 +700,6 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
     return 0;
     }
 
-  vtkNew<vtkFITSReader> reader;
-
-  // Set Reader member variables
-  if (this->CenterImage)
-    {
-    reader->SetUseNativeOriginOff();
-    }
-  else
-    {
-    reader->SetUseNativeOriginOn();
-    }
-
   if (refNode->IsA("vtkMRMLAstroVolumeNode"))
     {
     if (volNode->GetImageData())
@@ -219,17 +723,36 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
     return 0;
     }
 
-  reader->SetFileName(fullName.c_str());
+  this->ReadStatistics = NULL;
+  this->ReadImageDataMTime = 0;
 
-  // Check if this is a FITS file that we can read
-  if (!reader->CanReadFile(fullName.c_str()))
+  // data read by PreloadData
+  const bool preloaded = this->PreloadedReader && this->PreloadedFileName == fullName;
+  vtkSmartPointer<vtkFITSReader> reader = preloaded ?
+    this->PreloadedReader : vtkSmartPointer<vtkFITSReader>::New();
+  std::map<std::string, std::string> preloadedStatistics;
+  if (preloaded)
     {
-    vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::ReadDataInternal : this is not a fits file");
-    return 0;
+    preloadedStatistics.swap(this->PreloadedStatistics);
     }
+  this->PreloadedReader = NULL;
+  this->PreloadedStatistics.clear();
 
-  // Read the header to see if the file corresponds to the MRML Node
-  reader->UpdateInformation();
+  if (!preloaded)
+    {
+    this->ConfigureReader(reader, refNode->IsA("vtkMRMLAstroVolumeNode"));
+    reader->SetFileName(fullName.c_str());
+
+    // Check if this is a FITS file that we can read
+    if (!reader->CanReadFile(fullName.c_str()))
+      {
+      vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::ReadDataInternal : this is not a fits file");
+      return 0;
+      }
+
+    // Read the header to see if the file corresponds to the MRML Node
+    reader->UpdateInformation();
+    }
 
   if(refNode->IsA("vtkMRMLAstroVolumeNode") || refNode->IsA("vtkMRMLAstroLabelMapVolumeNode"))
     {
@@ -242,7 +765,10 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
       }
     }
 
-  reader->Update();
+  if (!preloaded && !this->ConfigurePaging(reader, refNode->IsA("vtkMRMLAstroVolumeNode")))
+    {
+    reader->Update();
+    }
 
   if (reader->GetWCSStruct() == NULL)
     {
@@ -251,6 +777,7 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
     return 0;
     }
 
+  bool convertFlux = false;
   if (refNode->IsA("vtkMRMLAstroVolumeNode"))
     {
     // set volume attributes
@@ -281,7 +808,20 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
       disNode->SetSpaceQuantity(2,"frequency");
       }
 
-    if (!strcmp(reader->GetHeaderValue("SlicerAstro.BUNIT"), "W.U."))
+    // floating point data of on-demand cubes are not in memory
+    // and can not be converted
+    const bool scaledIntegers = reader->GetDataType() == VTK_UNSIGNED_CHAR ||
+                                reader->GetDataType() == VTK_SHORT ||
+                                reader->GetDataType() == VTK_INT;
+    convertFlux = !strcmp(reader->GetHeaderValue("SlicerAstro.BUNIT"), "W.U.") &&
+                             (!reader->GetPaging() || scaledIntegers);
+    if (!strcmp(reader->GetHeaderValue("SlicerAstro.BUNIT"), "W.U.") && !convertFlux)
+      {
+      vtkWarningMacro("vtkMRMLAstroVolumeStorageNode::ReadDataInternal : the flux unit of Volume "<<volNode->GetName()<<
+                      " is in Westerbork Unit. On-demand volumes are not converted in JY/BEAM"<<endl);
+      }
+
+    if (convertFlux)
       {
       volNode->SetAttribute("SlicerAstro.BUNIT", "JY/BEAM");
       vtkWarningMacro("vtkMRMLAstroVolumeStorageNode::ReadDataInternal : the flux unit of Volume "<<volNode->GetName()<<
@@ -289,7 +829,14 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
       }
 
     // rescaling flux
-    if (!strcmp(reader->GetHeaderValue("SlicerAstro.BUNIT"), "W.U."))
+    if (convertFlux && reader->GetPaging())
+      {
+      volNode->SetAttribute("SlicerAstro.BSCALE", DoubleToString
+        (StringToDouble(reader->GetHeaderValue("SlicerAstro.BSCALE")) * 0.005).c_str());
+      volNode->SetAttribute("SlicerAstro.BZERO", DoubleToString
+        (StringToDouble(reader->GetHeaderValue("SlicerAstro.BZERO")) * 0.005).c_str());
+      }
+    else if (convertFlux)
       {
       vtkImageData *imageData = reader->GetOutput();
       if (imageData == NULL)
@@ -328,6 +875,15 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
               }
             }
           break;
+        case VTK_UNSIGNED_CHAR:
+        case VTK_SHORT:
+        case VTK_INT:
+          // scaled integers: rescale BSCALE/BZERO instead of the data
+          volNode->SetAttribute("SlicerAstro.BSCALE", DoubleToString
+            (StringToDouble(reader->GetHeaderValue("SlicerAstro.BSCALE")) * 0.005).c_str());
+          volNode->SetAttribute("SlicerAstro.BZERO", DoubleToString
+            (StringToDouble(reader->GetHeaderValue("SlicerAstro.BZERO")) * 0.005).c_str());
+          break;
         default:
           vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::ReadDataInternal :"
                         "could not get the data pointer. DataType not allowed.");
@@ -376,13 +932,82 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
   ici->SetInputConnection(reader->GetOutputPort());
   ici->SetOutputSpacing( 1, 1, 1 );
   ici->SetOutputOrigin( 0, 0, 0 );
-  ici->Update();
+  if (!reader->GetPaging())
+    {
+    ici->Update();
+    }
 
   if (refNode->IsA("vtkMRMLAstroVolumeNode"))
     {
     volNode->SetImageDataConnection(ici->GetOutputPort());
-    if(!strcmp(reader->GetHeaderValue("SlicerAstro.DATAMAX"), "0.") ||
-       !strcmp(reader->GetHeaderValue("SlicerAstro.DATAMIN"), "0."))
+    bool range = !strcmp(reader->GetHeaderValue("SlicerAstro.DATAMAX"), "0.") ||
+                 !strcmp(reader->GetHeaderValue("SlicerAstro.DATAMIN"), "0.");
+    bool noise = !strcmp(reader->GetHeaderValue("SlicerAstro.RMS"), "0.");
+
+    // statistics of a previous load
+    const bool missingStatistics = range || noise;
+    std::map<std::string, std::string> cachedStatistics;
+    if (missingStatistics && this->UseStatisticsCache &&
+        this->ReadStatisticsCache(fullName, reader, volNode, cachedStatistics))
+      {
+      std::map<std::string, std::string>::iterator cit;
+      for (cit = cachedStatistics.begin(); cit != cachedStatistics.end(); ++cit)
+        {
+        volNode->SetAttribute(cit->first.c_str(), cit->second.c_str());
+        }
+      if (cachedStatistics.count("SlicerAstro.DATAMIN"))
+        {
+        range = false;
+        }
+      if (cachedStatistics.count("SlicerAstro.RMS"))
+        {
+        noise = false;
+        }
+      }
+    const bool updateCache = this->UseStatisticsCache && (range || noise);
+
+    // statistics computed by PreloadData (before the W.U. conversion)
+    std::map<std::string, std::string>::iterator sit;
+    for (sit = preloadedStatistics.begin(); sit != preloadedStatistics.end(); ++sit)
+      {
+      double value = StringToDouble(sit->second.c_str());
+      if (convertFlux)
+        {
+        value *= 0.005;
+        }
+      volNode->SetAttribute(sit->first.c_str(), DoubleToString(value).c_str());
+      }
+    if (preloadedStatistics.count("SlicerAstro.DATAMIN"))
+      {
+      range = false;
+      }
+    if (preloadedStatistics.count("SlicerAstro.RMS"))
+      {
+      noise = false;
+      }
+
+    if (reader->GetPaging())
+      {
+      if ((range || noise) && !UpdatePagedStatistics(volNode, ici.GetPointer(), range, noise))
+        {
+        vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::ReadDataInternal :"
+                      "could not calculate the statistics of the on-demand volume.");
+        return 0;
+        }
+      range = false;
+      noise = false;
+      }
+
+    if (range && noise)
+      {
+      if (!volNode->UpdateStatisticsAttributes())
+        {
+        vtkErrorMacro("vtkMRMLAstroVolumeStorageNode::ReadDataInternal :"
+                      "could not calculate statistics attributes.");
+        return 0;
+        }
+      }
+    else if (range)
       {
       if (!volNode->UpdateRangeAttributes())
         {
@@ -391,7 +1016,7 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
         return 0;
         }
       }
-    if (!strcmp(reader->GetHeaderValue("SlicerAstro.RMS"), "0."))
+    else if (noise)
       {
       if (!volNode->UpdateNoiseAttributes())
         {
@@ -400,9 +1025,39 @@ int vtkMRMLAstroVolumeStorageNode::ReadDataInternal(vtkMRMLNode *refNode)
         return 0;
         }
       }
+
+    if (updateCache)
+      {
+      this->WriteStatisticsCache(fullName, reader, volNode);
+      }
+
+    // sidecar of the histogram of the data as read (see ReadHistogramCache)
+    vtkSmartPointer<vtkFITSStatisticsCache> readStatistics =
+      vtkSmartPointer<vtkFITSStatisticsCache>::New();
+    if (this->UseStatisticsCache && !reader->GetPaging() &&
+        this->ConfigureStatisticsCache(readStatistics, fullName, reader, volNode))
+      {
+      this->ReadStatistics = readStatistics;
+      this->ReadImageDataMTime = GetImageDataMTime(volNode);
+      }
+
     // set range in display
     double min = StringToDouble(volNode->GetAttribute("SlicerAstro.DATAMIN"));
     double max = StringToDouble(volNode->GetAttribute("SlicerAstro.DATAMAX"));
+
+    // the display works on the stored values
+    if (volNode->HasScaledIntegerData())
+      {
+      double bscale = 1., bzero = 0.;
+      volNode->GetDataScaling(bscale, bzero);
+      min = (min - bzero) / bscale;
+      max = (max - bzero) / bscale;
+      if (min > max)
+        {
+        std::swap(min, max);
+        }
+      }
+
     double window = max-min;
     double level = 0.5*(max+min);
 
@@ -481,6 +1136,16 @@ int vtkMRMLAstroVolumeStorageNode::WriteDataInternal(vtkMRMLNode *refNode)
   writer->SetInputConnection(volNode->GetImageDataConnection());
   writer->SetUseCompression(this->GetUseCompression());
 
+  // .fits.fz: tile-compressed (Rice) image instead of a gzipped file
+  std::string extension = vtksys::SystemTools::LowerCase(
+    vtksys::SystemTools::GetFilenameLastExtension(fullName));
+  if (extension == ".fz")
+    {
+    writer->SetUseCompression(0);
+    writer->SetTileCompressionToRice();
+    writer->SetQuantizeLevel(this->QuantizeLevel);
+    }
+
   // pass down all MRML attributes
   std::vector<std::string> attributeNames = volNode->GetAttributeNames();
   std::vector<std::string>::iterator ait = attributeNames.begin();
@@ -509,6 +1174,7 @@ void vtkMRMLAstroVolumeStorageNode::InitializeSupportedReadFileTypes()
 {
   this->SupportedReadFileTypes->InsertNextValue("FITS (.fits)");
   this->SupportedReadFileTypes->InsertNextValue("FITS (.fits.gz)");
+  this->SupportedReadFileTypes->InsertNextValue("FITS (.fits.fz)");
 }
 
 //----------------------------------------------------------------------------
@@ -516,6 +1182,7 @@ void vtkMRMLAstroVolumeStorageNode::InitializeSupportedWriteFileTypes()
 {
   this->SupportedWriteFileTypes->InsertNextValue("FITS (.fits)");
   this->SupportedWriteFileTypes->InsertNextValue("FITS (.fits.gz)");
+  this->SupportedWriteFileTypes->InsertNextValue("FITS (.fits.fz)");
 }
 
 //----------------------------------------------------------------------------
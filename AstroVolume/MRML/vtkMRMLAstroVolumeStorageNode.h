@@ -22,8 +22,20 @@
 
 #include "vtkMRMLStorageNode.h"
 
+// VTK includes
+#include <vtkSmartPointer.h>
+
+// STD includes
+#include <map>
+#include <string>
+
 #include <vtkSlicerAstroVolumeModuleMRMLExport.h>
 
+class vtkDoubleArray;
+class vtkFITSReader;
+class vtkFITSStatisticsCache;
+class vtkMRMLAstroVolumeNode;
+
 /// \brief MRML node for representing a volume storage.
 ///
 /// vtkMRMLAstroVolumeStorageNode nodes describe the archetybe based volume storage
@@ -58,6 +70,89 @@ class VTK_MRML_ASTRO_EXPORT vtkMRMLAstroVolumeStorageNode : public vtkMRMLStorag
   vtkGetMacro(CenterImage, int);
   vtkSetMacro(CenterImage, int);
 
+  ///
+  /// Quantization level used when writing tile-compressed
+  /// (.fits.fz) floating point data. 0 means lossless.
+  vtkGetMacro(QuantizeLevel, double);
+  vtkSetMacro(QuantizeLevel, double);
+
+  ///
+  /// Keep BITPIX = 8/16/32 data as integers on read, with the
+  /// physical values given by the BSCALE/BZERO attributes
+  vtkGetMacro(KeepScaledIntegers, int);
+  vtkSetMacro(KeepScaledIntegers, int);
+  vtkBooleanMacro(KeepScaledIntegers, int);
+
+  ///
+  /// Store floating point data in 16 bits on read. VTK has no half
+  /// float arrays: the data are quantised to short with BSCALE/BZERO
+  /// (see vtkFITSReader::QuantizeToShort).
+  vtkGetMacro(HalfPrecisionStorage, int);
+  vtkSetMacro(HalfPrecisionStorage, int);
+  vtkBooleanMacro(HalfPrecisionStorage, int);
+
+  ///
+  /// On-demand loading of 3-D cubes: only the header and the WCS are read
+  /// on load, the channels are paged in from the file when the slice views
+  /// (or the algorithms) request them (see vtkFITSReader::Paging).
+  vtkGetMacro(LoadOnDemand, int);
+  vtkSetMacro(LoadOnDemand, int);
+  vtkBooleanMacro(LoadOnDemand, int);
+
+  ///
+  /// Memory budget (in MB) of the channel cache of on-demand volumes
+  vtkGetMacro(PagingMemoryBudget, int);
+  vtkSetMacro(PagingMemoryBudget, int);
+
+  ///
+  /// Image HDU (1-based) to read. 0 reads the first HDU with data
+  vtkGetMacro(HDUNumber, int);
+  vtkSetMacro(HDUNumber, int);
+
+  ///
+  /// Plane (0-based) of the 4th (e.g. Stokes) axis to read
+  vtkGetMacro(FourthAxisPlane, int);
+  vtkSetMacro(FourthAxisPlane, int);
+
+  ///
+  /// Keep the range, the noise and the histogram computed after a read
+  /// in a sidecar file, and use them when the file is opened again
+  /// (see vtkFITSStatisticsCache). Default is on.
+  vtkGetMacro(UseStatisticsCache, int);
+  vtkSetMacro(UseStatisticsCache, int);
+  vtkBooleanMacro(UseStatisticsCache, int);
+
+  ///
+  /// Directory of the sidecar statistics. If not set, the SlicerAstro
+  /// subdirectory of the cache directory of the scene is used.
+  /// Without a directory the statistics are not cached.
+  vtkSetStringMacro(StatisticsCacheDirectory);
+  vtkGetStringMacro(StatisticsCacheDirectory);
+
+  ///
+  /// Histogram (physical bin edges and counts) of the data of the
+  /// last ReadData, in the sidecar statistics. They fail if the cache
+  /// is off or if the image data of volumeNode have been modified
+  /// since the read.
+  bool ReadHistogramCache(vtkMRMLAstroVolumeNode *volumeNode,
+                          vtkDoubleArray *binEdges, vtkDoubleArray *counts);
+  bool WriteHistogramCache(vtkMRMLAstroVolumeNode *volumeNode,
+                           vtkDoubleArray *binEdges, vtkDoubleArray *counts);
+
+  ///
+  /// Read the file and compute its missing range and noise without
+  /// accessing the scene, so that it can run on a worker thread.
+  /// The next ReadData of the same file uses the preloaded data.
+  /// If numberOfThreads > 0, it caps the OpenMP threads of the calling
+  /// thread (e.g. when several files are preloaded concurrently).
+  /// \sa qSlicerAstroVolumeReader::loadFiles
+  int PreloadData(bool labelMap, int numberOfThreads = 0);
+
+  ///
+  /// Several files can be preloaded concurrently only if CFITSIO
+  /// has been built reentrant (see fits_is_reentrant).
+  static bool CanPreloadConcurrently();
+
   /// Return true if the node can be read in.
   virtual bool CanReadInReferenceNode(vtkMRMLNode *refNode) VTK_OVERRIDE;
 
@@ -85,7 +180,48 @@ protected:
   /// Write data from a  referenced node
   virtual int WriteDataInternal(vtkMRMLNode *refNode) VTK_OVERRIDE;
 
+  /// Set the reader options that have to be known before UpdateInformation
+  void ConfigureReader(vtkFITSReader *reader, bool volume);
+
+  /// Turn on the paging of the reader for on-demand volumes.
+  /// Returns true if the reader is paging.
+  bool ConfigurePaging(vtkFITSReader *reader, bool volume);
+
+  /// Sidecar statistics of the data read by reader from fileName,
+  /// with the noise estimator of noiseNode. ConfigureStatisticsCache
+  /// returns false if there is no cache directory.
+  bool ConfigureStatisticsCache(vtkFITSStatisticsCache *cache,
+                                const std::string &fileName,
+                                vtkFITSReader *reader,
+                                vtkMRMLAstroVolumeNode *noiseNode);
+  bool ReadStatisticsCache(const std::string &fileName, vtkFITSReader *reader,
+                           vtkMRMLAstroVolumeNode *noiseNode,
+                           std::map<std::string, std::string> &statistics);
+  bool WriteStatisticsCache(const std::string &fileName, vtkFITSReader *reader,
+                            vtkMRMLAstroVolumeNode *node);
+
+  /// Modification time of the image data of volumeNode
+  static unsigned long GetImageDataMTime(vtkMRMLAstroVolumeNode *volumeNode);
+
   int CenterImage;
+  double QuantizeLevel;
+  int KeepScaledIntegers;
+  int HalfPrecisionStorage;
+  int LoadOnDemand;
+  int PagingMemoryBudget;
+  int HDUNumber;
+  int FourthAxisPlane;
+  int UseStatisticsCache;
+  char* StatisticsCacheDirectory;
+
+  vtkSmartPointer<vtkFITSReader> PreloadedReader;
+  std::string PreloadedFileName;
+  std::map<std::string, std::string> PreloadedStatistics;
+
+  /// sidecar of the last ReadData, valid while the image data
+  /// keep the modification time they had after the read
+  vtkSmartPointer<vtkFITSStatisticsCache> ReadStatistics;
+  unsigned long ReadImageDataMTime;
 
 };
 
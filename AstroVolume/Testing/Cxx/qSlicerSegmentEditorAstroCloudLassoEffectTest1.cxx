@@ -0,0 +1,148 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// EditorEffects includes
+#include "qSlicerSegmentEditorAstroCloudLassoEffect.h"
+
+// SegmentationCore includes
+#include <vtkOrientedImageData.h>
+
+// VTK includes
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+// Testing includes
+#include "vtkSlicerAstroTestingUtilities.h"
+
+namespace
+{
+
+const int Dims[3] = {30, 20, 10};
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int qSlicerSegmentEditorAstroCloudLassoEffectTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  const double minimum = -0.2, maximum = 0.5;
+
+  vtkNew<vtkOrientedImageData> masterImage;
+  masterImage->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  masterImage->AllocateScalars(VTK_FLOAT, 1);
+  unsigned int seed = 9;
+  for (int kk = 0; kk < Dims[2]; kk++)
+    {
+    for (int jj = 0; jj < Dims[1]; jj++)
+      {
+      for (int ii = 0; ii < Dims[0]; ii++)
+        {
+        *static_cast<float*>(masterImage->GetScalarPointer(ii, jj, kk)) =
+          static_cast<float>(vtkSlicerAstroTesting::NextValue(seed));
+        }
+      }
+    }
+
+  // selection cropped to its extent, as stored by the lasso
+  const int extent[6] = {5, 20, 3, 15, 2, 7};
+  vtkNew<vtkOrientedImageData> selection;
+  selection->SetExtent(extent[0], extent[1], extent[2], extent[3], extent[4], extent[5]);
+  selection->AllocateScalars(VTK_SHORT, 1);
+  for (int kk = extent[4]; kk <= extent[5]; kk++)
+    {
+    for (int jj = extent[2]; jj <= extent[3]; jj++)
+      {
+      for (int ii = extent[0]; ii <= extent[1]; ii++)
+        {
+        *static_cast<short*>(selection->GetScalarPointer(ii, jj, kk)) = (ii + jj + kk) % 3 ? 1 : 0;
+        }
+      }
+    }
+
+  vtkNew<vtkOrientedImageData> thresholdedSelection;
+  if (!qSlicerSegmentEditorAstroCloudLassoEffect::ThresholdSelection(
+        masterImage.GetPointer(), selection.GetPointer(), minimum, maximum,
+        thresholdedSelection.GetPointer()))
+    {
+    std::cerr << "ThresholdSelection failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the result keeps the extent of the selection
+  int *outExtent = thresholdedSelection->GetExtent();
+  for (int bound = 0; bound < 6; bound++)
+    {
+    if (outExtent[bound] != extent[bound])
+      {
+      std::cerr << "The thresholded selection has not the extent of the selection." << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  vtkIdType numSelected = 0;
+  for (int kk = extent[4]; kk <= extent[5]; kk++)
+    {
+    for (int jj = extent[2]; jj <= extent[3]; jj++)
+      {
+      for (int ii = extent[0]; ii <= extent[1]; ii++)
+        {
+        const double value = *static_cast<float*>(masterImage->GetScalarPointer(ii, jj, kk));
+        const short selected = *static_cast<short*>(selection->GetScalarPointer(ii, jj, kk));
+        const short expected = selected && value >= minimum && value <= maximum ? 1 : 0;
+        const short label = *static_cast<short*>(thresholdedSelection->GetScalarPointer(ii, jj, kk));
+        if (label != expected)
+          {
+          std::cerr << "Wrong label " << label << " at (" << ii << ", " << jj << ", " << kk
+                    << "), expected " << expected << std::endl;
+          return EXIT_FAILURE;
+          }
+        numSelected += label;
+        }
+      }
+    }
+  if (numSelected == 0)
+    {
+    std::cerr << "No voxel has been selected." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the selection has not been modified
+  if (*static_cast<short*>(selection->GetScalarPointer(5, 3, 3)) != 1)
+    {
+    std::cerr << "The selection has been modified." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // a selection outside the master volume is rejected
+  vtkNew<vtkOrientedImageData> outsideSelection;
+  outsideSelection->SetExtent(25, 35, 0, 5, 0, 5);
+  outsideSelection->AllocateScalars(VTK_SHORT, 1);
+  if (qSlicerSegmentEditorAstroCloudLassoEffect::ThresholdSelection(
+        masterImage.GetPointer(), outsideSelection.GetPointer(), minimum, maximum,
+        thresholdedSelection.GetPointer()))
+    {
+    std::cerr << "A selection outside the master volume has been thresholded." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// EditorEffects includes
+#include "qSlicerSegmentEditorAstroContoursEffect.h"
+
+// MRML includes
+#include <vtkMRMLAstroVolumeNode.h>
+
+// SegmentationCore includes
+#include <vtkOrientedImageData.h>
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Testing includes
+#include "vtkSlicerAstroTestingUtilities.h"
+
+namespace
+{
+
+const int Dims[3] = {20, 15, 10};
+
+//-----------------------------------------------------------------------------
+// Each labelmap is 1 exactly on the voxels with physical value in
+// [lowers[contour], highers[contour]] and is cropped to their bounding box
+bool CheckLabelmaps(const char* name, const std::vector<double> &values,
+                    const std::vector<double> &lowers, const std::vector<double> &highers,
+                    const std::vector<vtkSmartPointer<vtkOrientedImageData> > &labelmaps)
+{
+  if (labelmaps.size() != lowers.size())
+    {
+    std::cerr << name << ": " << labelmaps.size() << " labelmaps, expected "
+              << lowers.size() << std::endl;
+    return false;
+    }
+
+  for (size_t contour = 0; contour < lowers.size(); contour++)
+    {
+    int expectedExtent[6] = {INT_MAX, INT_MIN, INT_MAX, INT_MIN, INT_MAX, INT_MIN};
+    for (int kk = 0; kk < Dims[2]; kk++)
+      {
+      for (int jj = 0; jj < Dims[1]; jj++)
+        {
+        for (int ii = 0; ii < Dims[0]; ii++)
+          {
+          const double value = values[(kk * Dims[1] + jj) * Dims[0] + ii];
+          if (value >= lowers[contour] && value <= highers[contour])
+            {
+            const int ijk[3] = {ii, jj, kk};
+            for (int axis = 0; axis < 3; axis++)
+              {
+              expectedExtent[2 * axis] = std::min(expectedExtent[2 * axis], ijk[axis]);
+              expectedExtent[2 * axis + 1] = std::max(expectedExtent[2 * axis + 1], ijk[axis]);
+              }
+            }
+          }
+        }
+      }
+
+    vtkOrientedImageData *labelmap = labelmaps[contour];
+    int *extent = labelmap->GetExtent();
+    if (expectedExtent[0] > expectedExtent[1])
+      {
+      // empty contour: a single background voxel
+      if (labelmap->GetNumberOfPoints() != 1 ||
+          *static_cast<short*>(labelmap->GetScalarPointer()) != 0)
+        {
+        std::cerr << name << ": contour " << contour << " is not empty." << std::endl;
+        return false;
+        }
+      continue;
+      }
+
+    for (int axis = 0; axis < 6; axis++)
+      {
+      if (extent[axis] != expectedExtent[axis])
+        {
+        std::cerr << name << ": contour " << contour << " has extent " << extent[0] << " "
+                  << extent[1] << " " << extent[2] << " " << extent[3] << " " << extent[4]
+                  << " " << extent[5] << ", expected " << expectedExtent[0] << " "
+                  << expectedExtent[1] << " " << expectedExtent[2] << " " << expectedExtent[3]
+                  << " " << expectedExtent[4] << " " << expectedExtent[5] << std::endl;
+        return false;
+        }
+      }
+
+    for (int kk = extent[4]; kk <= extent[5]; kk++)
+      {
+      for (int jj = extent[2]; jj <= extent[3]; jj++)
+        {
+        for (int ii = extent[0]; ii <= extent[1]; ii++)
+          {
+          const double value = values[(kk * Dims[1] + jj) * Dims[0] + ii];
+          const short expected = value >= lowers[contour] && value <= highers[contour] ? 1 : 0;
+          if (*static_cast<short*>(labelmap->GetScalarPointer(ii, jj, kk)) != expected)
+            {
+            std::cerr << name << ": contour " << contour << " has a wrong label at ("
+                      << ii << ", " << jj << ", " << kk << ")" << std::endl;
+            return false;
+            }
+          }
+        }
+      }
+    }
+
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int qSlicerSegmentEditorAstroContoursEffectTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+  const double NaN = sqrt(-1);
+
+  // positive and negative levels, an interval overlapping both,
+  // a level between two others and an empty contour
+  std::vector<double> lowers, highers;
+  lowers.push_back(0.5);   highers.push_back(1.);
+  lowers.push_back(-1.);   highers.push_back(-0.5);
+  lowers.push_back(-0.25); highers.push_back(0.75);
+  lowers.push_back(0.75);  highers.push_back(1.);
+  lowers.push_back(2.);    highers.push_back(3.);
+
+  // float data, with NaNs and voxels exactly on the bounds
+  vtkNew<vtkImageData> floatData;
+  floatData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  floatData->AllocateScalars(VTK_FLOAT, 1);
+  float *floatPtr = static_cast<float*>(floatData->GetScalarPointer());
+  std::vector<double> values(numElements);
+  unsigned int seed = 5;
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    floatPtr[ii] = static_cast<float>(vtkSlicerAstroTesting::NextValue(seed));
+    if (ii % 53 == 0)
+      {
+      floatPtr[ii] = 0.75f;
+      }
+    if (ii % 71 == 0)
+      {
+      floatPtr[ii] = static_cast<float>(NaN);
+      }
+    values[ii] = floatPtr[ii];
+    }
+
+  vtkNew<vtkMRMLAstroVolumeNode> floatNode;
+  floatNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  floatNode->SetAndObserveImageData(floatData.GetPointer());
+
+  std::vector<vtkSmartPointer<vtkOrientedImageData> > labelmaps;
+  if (!qSlicerSegmentEditorAstroContoursEffect::CreateContourLabelmaps(
+        floatNode.GetPointer(), lowers, highers, labelmaps) ||
+      !CheckLabelmaps("float", values, lowers, highers, labelmaps))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // scaled integers: the levels are compared with the physical values
+  // and the BLANK voxels are not labelled
+  const double bscale = 0.125, bzero = 0.25;
+  const short blank = -32768;
+  vtkNew<vtkImageData> shortData;
+  shortData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  shortData->AllocateScalars(VTK_SHORT, 1);
+  short *shortPtr = static_cast<short*>(shortData->GetScalarPointer());
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    shortPtr[ii] = static_cast<short>(floor(vtkSlicerAstroTesting::NextValue(seed) * 12.));
+    if (ii % 61 == 0)
+      {
+      shortPtr[ii] = blank;
+      }
+    values[ii] = shortPtr[ii] == blank ? NaN : bscale * shortPtr[ii] + bzero;
+    }
+
+  vtkNew<vtkMRMLAstroVolumeNode> shortNode;
+  shortNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  shortNode->SetAttribute("SlicerAstro.BSCALE", "0.125");
+  shortNode->SetAttribute("SlicerAstro.BZERO", "0.25");
+  shortNode->SetAttribute("SlicerAstro.BLANK", "-32768");
+  shortNode->SetAndObserveImageData(shortData.GetPointer());
+
+  if (!qSlicerSegmentEditorAstroContoursEffect::CreateContourLabelmaps(
+        shortNode.GetPointer(), lowers, highers, labelmaps) ||
+      !CheckLabelmaps("short", values, lowers, highers, labelmaps))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// EditorEffects includes
+#include "qSlicerSegmentEditorAstroUndoStore.h"
+
+// Segmentations includes
+#include <vtkMRMLSegmentationNode.h>
+#include <vtkSlicerSegmentationsModuleLogic.h>
+
+// SegmentationCore includes
+#include <vtkOrientedImageData.h>
+#include <vtkSegment.h>
+#include <vtkSegmentation.h>
+#include <vtkSegmentationConverter.h>
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+#include <list>
+
+namespace
+{
+
+// 3 x 2 x 1 bricks, the last ones partial
+const int Dims[3] = {70, 40, 10};
+const char SegmentID[] = "Segment_1";
+const char ContourSegmentID[] = "Contour_1";
+
+//-----------------------------------------------------------------------------
+class UndoStoreTester : public qSlicerSegmentEditorAstroUndoStore
+{
+public:
+  int numberOfUndoSteps() const
+    {
+    return static_cast<int>(this->UndoSteps.size());
+    }
+
+  int numberOfBricks() const
+    {
+    int bricks = 0;
+    std::list<Step>::const_iterator it;
+    for (it = this->UndoSteps.begin(); it != this->UndoSteps.end(); ++it)
+      {
+      for (size_t ii = 0; ii < it->Segments.size(); ii++)
+        {
+        bricks += static_cast<int>(it->Segments[ii].Bricks.size());
+        }
+      }
+    return bricks;
+    }
+};
+
+//-----------------------------------------------------------------------------
+vtkOrientedImageData* GetLabelmap(vtkMRMLSegmentationNode* segmentationNode,
+                                  const char* segmentID = SegmentID)
+{
+  return vtkOrientedImageData::SafeDownCast(
+    segmentationNode->GetSegmentation()->GetSegment(segmentID)->GetRepresentation(
+      vtkSegmentationConverter::GetSegmentationBinaryLabelmapRepresentationName()));
+}
+
+//-----------------------------------------------------------------------------
+// voxel of the segment (zero outside of the extent of its labelmap)
+int GetVoxel(vtkMRMLSegmentationNode* segmentationNode, int ii, int jj, int kk,
+             const char* segmentID = SegmentID)
+{
+  vtkOrientedImageData* labelmap = GetLabelmap(segmentationNode, segmentID);
+  const int *extent = labelmap->GetExtent();
+  if (ii < extent[0] || ii > extent[1] || jj < extent[2] || jj > extent[3] ||
+      kk < extent[4] || kk > extent[5])
+    {
+    return 0;
+    }
+  return static_cast<int>(labelmap->GetScalarComponentAsDouble(ii, jj, kk, 0));
+}
+
+//-----------------------------------------------------------------------------
+// replace the voxels of extent, as the effects do
+void SetVoxels(vtkMRMLSegmentationNode* segmentationNode, const int extent[6], int value,
+               const char* segmentID = SegmentID)
+{
+  vtkNew<vtkOrientedImageData> modifierLabelmap;
+  modifierLabelmap->SetExtent(extent[0], extent[1], extent[2], extent[3], extent[4], extent[5]);
+  modifierLabelmap->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+  modifierLabelmap->GetPointData()->GetScalars()->FillComponent(0, value);
+  vtkSlicerSegmentationsModuleLogic::SetBinaryLabelmapToSegment(
+    modifierLabelmap.GetPointer(), segmentationNode, segmentID,
+    vtkSlicerSegmentationsModuleLogic::MODE_REPLACE, modifierLabelmap->GetExtent());
+}
+
+//-----------------------------------------------------------------------------
+// an edit of the voxels of extent within an undo step
+void Edit(UndoStoreTester& undoStore, vtkMRMLSegmentationNode* segmentationNode,
+          vtkOrientedImageData* referenceGeometry, const int extent[6], int value,
+          bool mergeWithLastStep = false)
+{
+  undoStore.beginStep(segmentationNode, referenceGeometry);
+  undoStore.saveSegment(SegmentID, extent);
+  SetVoxels(segmentationNode, extent, value);
+  undoStore.endStep(mergeWithLastStep);
+}
+
+//-----------------------------------------------------------------------------
+// the voxels of extent (and the voxel next to it) have the expected values
+bool CheckVoxels(const char* name, vtkMRMLSegmentationNode* segmentationNode,
+                 const int extent[6], int value)
+{
+  if (GetVoxel(segmentationNode, extent[0], extent[2], extent[4]) != value ||
+      GetVoxel(segmentationNode, extent[1], extent[3], extent[5]) != value ||
+      GetVoxel(segmentationNode, extent[1] + 1, extent[3], extent[5]) != 0)
+    {
+    std::cerr << name << ": the voxels are "
+              << GetVoxel(segmentationNode, extent[0], extent[2], extent[4]) << ", "
+              << GetVoxel(segmentationNode, extent[1], extent[3], extent[5]) << " and "
+              << GetVoxel(segmentationNode, extent[1] + 1, extent[3], extent[5])
+              << ", expected " << value << ", " << value << " and 0" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CheckHistory(const char* name, const UndoStoreTester& undoStore,
+                  int undoSteps, int bricks, bool canRedo)
+{
+  if (undoStore.numberOfUndoSteps() != undoSteps || undoStore.numberOfBricks() != bricks ||
+      undoStore.canUndo() != (undoSteps > 0) || undoStore.canRedo() != canRedo)
+    {
+    std::cerr << name << ": " << undoStore.numberOfUndoSteps() << " undo steps of "
+              << undoStore.numberOfBricks() << " bricks, redo " << undoStore.canRedo()
+              << ", expected " << undoSteps << " undo steps of " << bricks
+              << " bricks, redo " << canRedo << std::endl;
+    return false;
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int qSlicerSegmentEditorAstroUndoStoreTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  vtkNew<vtkOrientedImageData> labelmap;
+  labelmap->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  labelmap->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+  labelmap->GetPointData()->GetScalars()->FillComponent(0, 0.);
+
+  vtkNew<vtkMRMLSegmentationNode> segmentationNode;
+  vtkSegmentation* segmentation = segmentationNode->GetSegmentation();
+  segmentation->SetMasterRepresentationName(
+    vtkSegmentationConverter::GetSegmentationBinaryLabelmapRepresentationName());
+  vtkNew<vtkSegment> segment;
+  segment->AddRepresentation(
+    vtkSegmentationConverter::GetSegmentationBinaryLabelmapRepresentationName(), labelmap.GetPointer());
+  segmentation->AddSegment(segment.GetPointer(), SegmentID);
+
+  // the brick grid of the master volume
+  vtkNew<vtkOrientedImageData> referenceGeometry;
+  referenceGeometry->SetExtent(labelmap->GetExtent());
+
+  UndoStoreTester undoStore;
+  vtkMRMLSegmentationNode* node = segmentationNode.GetPointer();
+  vtkOrientedImageData* geometry = referenceGeometry.GetPointer();
+
+  // two edits in two bricks, merged in a single step,
+  // and a third edit in the first brick
+  const int box1[6] = {2, 5, 2, 5, 2, 5};
+  const int box2[6] = {40, 45, 35, 38, 3, 6};
+  const int box3[6] = {6, 8, 6, 8, 6, 8};
+  Edit(undoStore, node, geometry, box1, 1);
+  if (!CheckHistory("first edit", undoStore, 1, 1, false))
+    {
+    return EXIT_FAILURE;
+    }
+  Edit(undoStore, node, geometry, box2, 1, true);
+  if (!CheckHistory("merged edit", undoStore, 1, 2, false))
+    {
+    return EXIT_FAILURE;
+    }
+  Edit(undoStore, node, geometry, box3, 2);
+  if (!CheckHistory("third edit", undoStore, 2, 3, false))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // only the modified bricks are stored, compressed
+  if (undoStore.memorySize() >= static_cast<size_t>(qSlicerSegmentEditorAstroUndoStore::BrickSize) *
+                                qSlicerSegmentEditorAstroUndoStore::BrickSize *
+                                qSlicerSegmentEditorAstroUndoStore::BrickSize)
+    {
+    std::cerr << "The undo steps use " << undoStore.memorySize() << " bytes." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // undo the third edit, then the merged step
+  if (!undoStore.undo() || !CheckVoxels("undo of the third edit", node, box3, 1) ||
+      !CheckHistory("undo of the third edit", undoStore, 1, 2, true))
+    {
+    return EXIT_FAILURE;
+    }
+  if (!undoStore.undo() || !CheckVoxels("undo of the merged step", node, box1, 0) ||
+      !CheckVoxels("undo of the merged step", node, box2, 0) ||
+      !CheckHistory("undo of the merged step", undoStore, 0, 0, true) || undoStore.undo())
+    {
+    return EXIT_FAILURE;
+    }
+
+  // redo both
+  if (!undoStore.redo() || !CheckVoxels("redo of the merged step", node, box1, 1) ||
+      !CheckVoxels("redo of the merged step", node, box2, 1) ||
+      !CheckHistory("redo of the merged step", undoStore, 1, 2, true))
+    {
+    return EXIT_FAILURE;
+    }
+  if (!undoStore.redo() || !CheckVoxels("redo of the third edit", node, box3, 2) ||
+      !CheckHistory("redo of the third edit", undoStore, 2, 3, false) || undoStore.redo())
+    {
+    return EXIT_FAILURE;
+    }
+
+  // a new edit after an undo discards the redo steps
+  const int box4[6] = {50, 52, 10, 12, 1, 2};
+  undoStore.undo();
+  Edit(undoStore, node, geometry, box4, 3);
+  if (!CheckVoxels("new edit", node, box4, 3) ||
+      !CheckHistory("new edit", undoStore, 2, 3, false))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // beyond the maximum memory the redo steps go first,
+  // and the last undo step is kept
+  undoStore.undo();
+  undoStore.setMaximumMemorySize(0);
+  if (!CheckHistory("trimmed history", undoStore, 1, 2, false) || undoStore.memorySize() == 0)
+    {
+    return EXIT_FAILURE;
+    }
+  undoStore.setMaximumMemorySize(static_cast<size_t>(512) * 1024 * 1024);
+  if (!undoStore.hasSteps(node))
+    {
+    std::cerr << "The undo store has no steps." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // a segment added within a step (as the contours) is removed by
+  // the undo and added again, with its content, by the redo
+  const int box6[6] = {20, 24, 20, 24, 0, 3};
+  undoStore.beginStep(node, geometry);
+  segmentation->AddEmptySegment(ContourSegmentID, ContourSegmentID);
+  undoStore.saveAddedSegment(ContourSegmentID);
+  undoStore.saveSegment(ContourSegmentID, box6, true);
+  SetVoxels(node, box6, 1, ContourSegmentID);
+  undoStore.endStep();
+  if (!CheckHistory("added segment", undoStore, 2, 3, false))
+    {
+    return EXIT_FAILURE;
+    }
+  if (!undoStore.undo() || segmentation->GetSegment(ContourSegmentID) ||
+      !CheckHistory("undo of the added segment", undoStore, 1, 2, true))
+    {
+    std::cerr << "undo of the added segment: the segment has not been removed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!undoStore.redo() || !segmentation->GetSegment(ContourSegmentID) ||
+      GetVoxel(node, box6[0], box6[2], box6[4], ContourSegmentID) != 1 ||
+      GetVoxel(node, box6[1], box6[3], box6[5], ContourSegmentID) != 1 ||
+      !CheckHistory("redo of the added segment", undoStore, 2, 3, false))
+    {
+    std::cerr << "redo of the added segment: the segment has not been restored." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // a modification outside of the undo store clears the history
+  const int box5[6] = {10, 12, 10, 12, 8, 9};
+  SetVoxels(node, box5, 1);
+  if (!CheckHistory("external edit", undoStore, 0, 0, false) || undoStore.memorySize() != 0 ||
+      undoStore.hasSteps(node))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
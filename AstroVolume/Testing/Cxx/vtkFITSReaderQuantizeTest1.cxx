@@ -0,0 +1,108 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// vtkFits includes
+#include "vtkFITSReader.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+
+//-----------------------------------------------------------------------------
+int vtkFITSReaderQuantizeTest1( int argc, char * argv[] )
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: vtkFITSReaderQuantizeTest1 volumeName" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkFITSReader> floatReader;
+  floatReader->SetFileName(argv[1]);
+  if (!floatReader->CanReadFile(argv[1]))
+    {
+    std::cerr << "Can not read file:" << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  floatReader->Update();
+  vtkDataArray* floatValues = floatReader->GetOutput()->GetPointData()->GetScalars();
+
+  vtkNew<vtkFITSReader> shortReader;
+  shortReader->SetFileName(argv[1]);
+  shortReader->QuantizeToShortOn();
+  shortReader->Update();
+  vtkDataArray* shortValues = shortReader->GetOutput()->GetPointData()->GetScalars();
+
+  if (!shortValues || shortValues->GetDataType() != VTK_SHORT ||
+      shortValues->GetNumberOfTuples() != floatValues->GetNumberOfTuples())
+    {
+    std::cerr << "Floating point data not quantized to short." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the node attributes must describe the stored integers
+  if (!shortReader->GetScaledIntegerData() ||
+      atoi(shortReader->GetHeaderValue("SlicerAstro.BITPIX")) != 16 ||
+      atoi(shortReader->GetHeaderValue("SlicerAstro.BLANK")) != -32768)
+    {
+    std::cerr << "BITPIX/BLANK attributes do not describe the quantized data." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const double bscale = atof(shortReader->GetHeaderValue("SlicerAstro.BSCALE"));
+  const double bzero = atof(shortReader->GetHeaderValue("SlicerAstro.BZERO"));
+  if (!(bscale > 0.))
+    {
+    std::cerr << "Invalid quantization step " << bscale << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // every value is within half a quantization step,
+  // NaNs are stored as BLANK
+  const float *floatPtr = static_cast<float*>(floatValues->GetVoidPointer(0));
+  const short *shortPtr = static_cast<short*>(shortValues->GetVoidPointer(0));
+  for (vtkIdType ii = 0; ii < floatValues->GetNumberOfTuples(); ii++)
+    {
+    if (std::isnan(floatPtr[ii]))
+      {
+      if (shortPtr[ii] != -32768)
+        {
+        std::cerr << "NaN voxel " << ii << " stored as " << shortPtr[ii] << std::endl;
+        return EXIT_FAILURE;
+        }
+      continue;
+      }
+
+    const double value = shortPtr[ii] * bscale + bzero;
+    if (shortPtr[ii] == -32768 || std::fabs(value - floatPtr[ii]) > 0.501 * bscale)
+      {
+      std::cerr << "Voxel " << ii << " quantized to " << value
+                << ", expected " << floatPtr[ii] << " (step " << bscale << ")" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  return EXIT_SUCCESS;
+}
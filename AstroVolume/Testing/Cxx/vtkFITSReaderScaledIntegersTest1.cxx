@@ -0,0 +1,209 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// vtkFits includes
+#include "vtkFITSReader.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const double TestBScale = 0.5;
+const double TestBZero = 10.;
+const short TestBlank = -32768;
+
+//-----------------------------------------------------------------------------
+// Write a BITPIX = 16 copy of the template cube (same header, same axes)
+// with BSCALE/BZERO/BLANK and known stored values. One voxel is blank.
+bool WriteScaledCube(const char* templateName, const std::string& fileName,
+                     std::vector<short>& stored)
+{
+  int status = 0;
+  fitsfile *in = NULL, *out = NULL;
+  if (fits_open_file(&in, templateName, READONLY, &status))
+    {
+    return false;
+    }
+
+  long naxes[3] = {1, 1, 1};
+  int nkeys = 0;
+  fits_get_img_size(in, 3, naxes, &status);
+  fits_get_hdrspace(in, &nkeys, NULL, &status);
+
+  remove(fileName.c_str());
+  fits_create_file(&out, fileName.c_str(), &status);
+  fits_create_img(out, SHORT_IMG, 3, naxes, &status);
+
+  const char* skippedKeys[] =
+    {"SIMPLE", "BITPIX", "NAXIS", "EXTEND", "BSCALE", "BZERO", "BLANK", "DATAMIN", "DATAMAX"};
+  char card[FLEN_CARD];
+  for (int ii = 1; ii <= nkeys && !status; ii++)
+    {
+    fits_read_record(in, ii, card, &status);
+    bool skip = false;
+    for (size_t jj = 0; jj < sizeof(skippedKeys) / sizeof(skippedKeys[0]); jj++)
+      {
+      skip |= !strncmp(card, skippedKeys[jj], strlen(skippedKeys[jj]));
+      }
+    if (!skip)
+      {
+      fits_write_record(out, card, &status);
+      }
+    }
+
+  const size_t numElements = naxes[0] * naxes[1] * naxes[2];
+  stored.resize(numElements);
+  for (size_t ii = 0; ii < numElements; ii++)
+    {
+    stored[ii] = static_cast<short>(static_cast<long>(ii % 20001) - 10000);
+    }
+  stored[numElements / 2] = TestBlank;
+
+  double bscale = TestBScale, bzero = TestBZero;
+  long blank = TestBlank;
+  double datamin = -10000 * TestBScale + TestBZero;
+  double datamax = 10000 * TestBScale + TestBZero;
+  fits_update_key(out, TDOUBLE, "BSCALE", &bscale, NULL, &status);
+  fits_update_key(out, TDOUBLE, "BZERO", &bzero, NULL, &status);
+  fits_update_key(out, TLONG, "BLANK", &blank, NULL, &status);
+  fits_update_key(out, TDOUBLE, "DATAMIN", &datamin, NULL, &status);
+  fits_update_key(out, TDOUBLE, "DATAMAX", &datamax, NULL, &status);
+
+  // write the stored integers as they are
+  fits_set_bscale(out, 1., 0., &status);
+  fits_write_img(out, TSHORT, 1, numElements, &stored[0], &status);
+
+  int closeStatus = 0;
+  fits_close_file(in, &closeStatus);
+  fits_close_file(out, &status);
+
+  return status == 0;
+}
+
+//-----------------------------------------------------------------------------
+vtkDataArray* ReadCube(vtkFITSReader* reader, const std::string& fileName, bool keepScaledIntegers)
+{
+  reader->SetFileName(fileName.c_str());
+  reader->SetKeepScaledIntegers(keepScaledIntegers);
+  if (!reader->CanReadFile(fileName.c_str()))
+    {
+    std::cerr << "Can not read file:" << fileName << std::endl;
+    return NULL;
+    }
+  reader->Update();
+  return reader->GetOutput()->GetPointData()->GetScalars();
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkFITSReaderScaledIntegersTest1( int argc, char * argv[] )
+{
+  if (argc < 3)
+    {
+    std::cerr << "Usage: vtkFITSReaderScaledIntegersTest1 volumeName temporaryDirectory" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::string fileName = std::string(argv[2]) + "/vtkFITSReaderScaledIntegersTest1.fits";
+  std::vector<short> stored;
+  if (!WriteScaledCube(argv[1], fileName, stored))
+    {
+    std::cerr << "Error writing " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // native integers: the stored values (and BLANK) are kept,
+  // the attributes give the physical values
+  vtkNew<vtkFITSReader> nativeReader;
+  vtkDataArray* nativeValues = ReadCube(nativeReader.GetPointer(), fileName, true);
+  if (!nativeValues || nativeValues->GetDataType() != VTK_SHORT ||
+      !nativeReader->GetScaledIntegerData() ||
+      nativeValues->GetNumberOfTuples() != static_cast<vtkIdType>(stored.size()))
+    {
+    std::cerr << "Scaled integers not kept as short." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  if (atof(nativeReader->GetHeaderValue("SlicerAstro.BSCALE")) != TestBScale ||
+      atof(nativeReader->GetHeaderValue("SlicerAstro.BZERO")) != TestBZero ||
+      atoi(nativeReader->GetHeaderValue("SlicerAstro.BLANK")) != TestBlank)
+    {
+    std::cerr << "BSCALE/BZERO/BLANK attributes not read." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const short *nativePtr = static_cast<short*>(nativeValues->GetVoidPointer(0));
+  for (size_t ii = 0; ii < stored.size(); ii++)
+    {
+    if (nativePtr[ii] != stored[ii])
+      {
+      std::cerr << "Stored value " << ii << " is " << nativePtr[ii]
+                << ", expected " << stored[ii] << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // float conversion: physical values, BLANK is NaN
+  vtkNew<vtkFITSReader> floatReader;
+  vtkDataArray* floatValues = ReadCube(floatReader.GetPointer(), fileName, false);
+  if (!floatValues || floatValues->GetDataType() != VTK_FLOAT ||
+      floatValues->GetNumberOfTuples() != static_cast<vtkIdType>(stored.size()))
+    {
+    std::cerr << "Scaled integers not converted to float." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const float *floatPtr = static_cast<float*>(floatValues->GetVoidPointer(0));
+  for (size_t ii = 0; ii < stored.size(); ii++)
+    {
+    if (stored[ii] == TestBlank)
+      {
+      if (!std::isnan(floatPtr[ii]))
+        {
+        std::cerr << "Blank voxel " << ii << " read as " << floatPtr[ii] << std::endl;
+        return EXIT_FAILURE;
+        }
+      continue;
+      }
+
+    const double expected = stored[ii] * TestBScale + TestBZero;
+    if (std::fabs(floatPtr[ii] - expected) > 1.e-4)
+      {
+      std::cerr << "Physical value " << ii << " is " << floatPtr[ii]
+                << ", expected " << expected << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// vtkFits includes
+#include "vtkFITSReader.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkInformation.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
+
+//-----------------------------------------------------------------------------
+int vtkFITSReaderTest1( int argc, char * argv[] )
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: vtkFITSReaderTest1 volumeName" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkFITSReader> reader;
+  reader->SetFileName(argv[1]);
+
+  if (!reader->CanReadFile(argv[1]))
+    {
+    std::cerr << "Can not read file:" << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  reader->UpdateInformation();
+
+  if (!reader->GetRasToIjkMatrix() || !reader->GetWCSStruct())
+    {
+    std::cerr << "Header of " << argv[1] << " not parsed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  int wholeExtent[6];
+  reader->GetOutputInformation(0)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+  int center[3];
+  for (int ii = 0; ii < 3; ii++)
+    {
+    center[ii] = (wholeExtent[2 * ii] + wholeExtent[2 * ii + 1]) / 2;
+    }
+
+  // a streamed (partial) UPDATE_EXTENT: the header is cached and
+  // the handle is kept open for the next requests
+  int subExtent[6];
+  for (int ii = 0; ii < 3; ii++)
+    {
+    subExtent[2 * ii] = center[ii];
+    subExtent[2 * ii + 1] = wholeExtent[2 * ii + 1];
+    }
+  reader->UpdateExtent(subExtent);
+
+  int outputExtent[6];
+  reader->GetOutput()->GetExtent(outputExtent);
+  for (int ii = 0; ii < 6; ii++)
+    {
+    if (outputExtent[ii] != subExtent[ii])
+      {
+      std::cerr << "Streamed extent not read: extent[" << ii << "] = "
+                << outputExtent[ii] << ", expected " << subExtent[ii] << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  const double subCenterValue = reader->GetOutput()->GetScalarComponentAsDouble(center[0], center[1], center[2], 0);
+
+  // CanReadFile, UpdateInformation and the streamed update share one CFITSIO handle
+  if (reader->GetNumberOfFileOpens() != 1 || !reader->IsFileOpen())
+    {
+    std::cerr << "File opened " << reader->GetNumberOfFileOpens()
+              << " times, expected 1 (and still open)." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the whole cube: read with the same handle, which is then closed
+  reader->UpdateExtent(wholeExtent);
+
+  if (!reader->GetOutput() || !reader->GetOutput()->GetPointData()->GetScalars())
+    {
+    std::cerr << "No data read from " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  if (reader->GetNumberOfFileOpens() != 1 || reader->IsFileOpen())
+    {
+    std::cerr << "File opened " << reader->GetNumberOfFileOpens()
+              << " times, expected 1 (and closed after the whole read)." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const double centerValue = reader->GetOutput()->GetScalarComponentAsDouble(center[0], center[1], center[2], 0);
+  if (!(subCenterValue == centerValue) && !(centerValue != centerValue && subCenterValue != subCenterValue))
+    {
+    std::cerr << "Streamed value " << subCenterValue << " differs from "
+              << centerValue << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
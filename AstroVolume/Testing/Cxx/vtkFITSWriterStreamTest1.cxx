@@ -0,0 +1,198 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// vtkFits includes
+#include "vtkFITSReader.h"
+#include "vtkFITSWriter.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//-----------------------------------------------------------------------------
+bool WriteStream(vtkFITSReader* input, const std::string& fileName, bool gzip)
+{
+  vtkNew<vtkFITSWriter> writer;
+  writer->SetFileName(fileName.c_str());
+  writer->SetInputConnection(input->GetOutputPort());
+  writer->SetUseCompression(gzip);
+
+  std::vector<std::string> keys = input->GetHeaderKeysVector();
+  for (size_t ii = 0; ii < keys.size(); ii++)
+    {
+    writer->SetAttribute(keys[ii], input->GetHeaderValue(keys[ii].c_str()));
+    }
+
+  writer->Write();
+  return !writer->GetWriteError();
+}
+
+//-----------------------------------------------------------------------------
+bool ReadFile(const std::string& fileName, std::vector<unsigned char>& content)
+{
+  std::ifstream file(fileName.c_str(), std::ios::binary);
+  if (!file)
+    {
+    return false;
+    }
+  content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// the values of a read of fileName must be identical to the reference
+bool CompareReads(vtkImageData* reference, const std::string& fileName)
+{
+  vtkNew<vtkFITSReader> reader;
+  reader->SetFileName(fileName.c_str());
+  if (!reader->CanReadFile(fileName.c_str()))
+    {
+    std::cerr << "Can not read file:" << fileName << std::endl;
+    return false;
+    }
+  reader->Update();
+
+  vtkDataArray* expected = reference->GetPointData()->GetScalars();
+  vtkDataArray* values = reader->GetOutput()->GetPointData()->GetScalars();
+  if (!values || values->GetNumberOfTuples() != expected->GetNumberOfTuples())
+    {
+    std::cerr << fileName << ": wrong number of voxels." << std::endl;
+    return false;
+    }
+
+  for (vtkIdType ii = 0; ii < values->GetNumberOfTuples(); ii++)
+    {
+    const double expectedValue = expected->GetTuple1(ii);
+    const double value = values->GetTuple1(ii);
+    if (value != expectedValue && !(std::isnan(value) && std::isnan(expectedValue)))
+      {
+      std::cerr << fileName << ": voxel " << ii << " is " << value
+                << ", expected " << expectedValue << std::endl;
+      return false;
+      }
+    }
+
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkFITSWriterStreamTest1( int argc, char * argv[] )
+{
+  if (argc < 3)
+    {
+    std::cerr << "Usage: vtkFITSWriterStreamTest1 volumeName temporaryDirectory" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkFITSReader> reader;
+  reader->SetFileName(argv[1]);
+  if (!reader->CanReadFile(argv[1]))
+    {
+    std::cerr << "Can not read file:" << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  reader->Update();
+  vtkImageData* reference = reader->GetOutput();
+
+  // uncompressed, double-buffered stream
+  std::string rawFileName = std::string(argv[2]) + "/vtkFITSWriterStreamTest1.fits";
+  if (!WriteStream(reader.GetPointer(), rawFileName, false) ||
+      !CompareReads(reference, rawFileName))
+    {
+    std::cerr << "Uncompressed stream round trip failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::vector<unsigned char> rawContent;
+  if (!ReadFile(rawFileName, rawContent) || rawContent.size() % 2880)
+    {
+    std::cerr << rawFileName << " is not made of 2880 bytes records." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // block-gzip stream
+  std::string gzipFileName = std::string(argv[2]) + "/vtkFITSWriterStreamTest1.fits.gz";
+  if (!WriteStream(reader.GetPointer(), gzipFileName, true) ||
+      !CompareReads(reference, gzipFileName))
+    {
+    std::cerr << "Block-gzip stream round trip failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // every member is a BGZF block (gzip header with the 'BC' subfield
+  // holding the member size), and the members hold the same bytes
+  // as the uncompressed stream
+  std::vector<unsigned char> gzipContent;
+  if (!ReadFile(gzipFileName, gzipContent))
+    {
+    std::cerr << "Can not open " << gzipFileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  size_t offset = 0;
+  size_t numMembers = 0;
+  size_t uncompressedSize = 0;
+  while (offset < gzipContent.size())
+    {
+    const unsigned char* member = &gzipContent[offset];
+    if (gzipContent.size() - offset < 26 ||
+        member[0] != 0x1f || member[1] != 0x8b || member[3] != 4 ||
+        member[12] != 'B' || member[13] != 'C')
+      {
+      std::cerr << "Member " << numMembers << " is not a BGZF block." << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const size_t blockSize = (member[16] | (member[17] << 8)) + 1;
+    if (offset + blockSize > gzipContent.size())
+      {
+      std::cerr << "Member " << numMembers << " is truncated." << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const unsigned char* footer = member + blockSize - 4;
+    uncompressedSize += footer[0] | (footer[1] << 8) | (footer[2] << 16) |
+                        (static_cast<size_t>(footer[3]) << 24);
+    offset += blockSize;
+    numMembers++;
+    }
+
+  if (uncompressedSize != rawContent.size())
+    {
+    std::cerr << "The BGZF members hold " << uncompressedSize
+              << " bytes, expected " << rawContent.size() << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// vtkFits includes
+#include "vtkFITSReader.h"
+#include "vtkFITSWriter.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//-----------------------------------------------------------------------------
+bool WriteTileCompressed(vtkFITSReader* input, const std::string& fileName,
+                         int compression, float quantizeLevel)
+{
+  vtkNew<vtkFITSWriter> writer;
+  writer->SetFileName(fileName.c_str());
+  writer->SetInputConnection(input->GetOutputPort());
+  writer->SetTileCompression(compression);
+  writer->SetQuantizeLevel(quantizeLevel);
+
+  std::vector<std::string> keys = input->GetHeaderKeysVector();
+  for (size_t ii = 0; ii < keys.size(); ii++)
+    {
+    writer->SetAttribute(keys[ii], input->GetHeaderValue(keys[ii].c_str()));
+    }
+
+  writer->Write();
+  return !writer->GetWriteError();
+}
+
+//-----------------------------------------------------------------------------
+// maximum absolute difference between two reads, -1 if they do not match
+// in size or in the position of the blanks
+double CompareReads(vtkImageData* reference, const std::string& fileName)
+{
+  vtkNew<vtkFITSReader> reader;
+  reader->SetFileName(fileName.c_str());
+  if (!reader->CanReadFile(fileName.c_str()))
+    {
+    std::cerr << "Can not read file:" << fileName << std::endl;
+    return -1.;
+    }
+  reader->Update();
+
+  vtkDataArray* expected = reference->GetPointData()->GetScalars();
+  vtkDataArray* values = reader->GetOutput()->GetPointData()->GetScalars();
+  if (!values || values->GetNumberOfTuples() != expected->GetNumberOfTuples())
+    {
+    std::cerr << fileName << ": wrong number of voxels." << std::endl;
+    return -1.;
+    }
+
+  double maxDifference = 0.;
+  for (vtkIdType ii = 0; ii < values->GetNumberOfTuples(); ii++)
+    {
+    const double expectedValue = expected->GetTuple1(ii);
+    const double value = values->GetTuple1(ii);
+    if (std::isnan(expectedValue) != std::isnan(value))
+      {
+      std::cerr << fileName << ": blank mismatch at voxel " << ii << std::endl;
+      return -1.;
+      }
+    if (!std::isnan(value))
+      {
+      maxDifference = std::max(maxDifference, std::fabs(value - expectedValue));
+      }
+    }
+
+  return maxDifference;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkFITSWriterTileCompressionTest1( int argc, char * argv[] )
+{
+  if (argc < 3)
+    {
+    std::cerr << "Usage: vtkFITSWriterTileCompressionTest1 volumeName temporaryDirectory" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // uncompressed read of the reference cube
+  vtkNew<vtkFITSReader> reader;
+  reader->SetFileName(argv[1]);
+  if (!reader->CanReadFile(argv[1]))
+    {
+    std::cerr << "Can not read file:" << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  reader->Update();
+  vtkImageData* reference = reader->GetOutput();
+
+  double range[2];
+  reference->GetPointData()->GetScalars()->GetRange(range);
+
+  // GZIP without quantization is lossless
+  std::string gzipFileName = std::string(argv[2]) + "/vtkFITSWriterTileCompressionTest1_gzip.fits.fz";
+  if (!WriteTileCompressed(reader.GetPointer(), gzipFileName,
+                           vtkFITSWriter::GzipTileCompression, 0.))
+    {
+    std::cerr << "Error writing " << gzipFileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  double difference = CompareReads(reference, gzipFileName);
+  if (difference != 0.)
+    {
+    std::cerr << "GZIP tile-compressed cube differs from the uncompressed read: "
+              << difference << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Rice compression quantizes the floating point values: the error is a
+  // fraction of the noise of each tile, well below 1% of the data range
+  std::string riceFileName = std::string(argv[2]) + "/vtkFITSWriterTileCompressionTest1_rice.fits.fz";
+  if (!WriteTileCompressed(reader.GetPointer(), riceFileName,
+                           vtkFITSWriter::RiceTileCompression, 16.))
+    {
+    std::cerr << "Error writing " << riceFileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  difference = CompareReads(reference, riceFileName);
+  if (difference < 0. || difference > 0.01 * (range[1] - range[0]))
+    {
+    std::cerr << "Rice tile-compressed cube differs from the uncompressed read: "
+              << difference << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// MRML includes
+#include <vtkMRMLAstroVolumeNode.h>
+
+// VTK includes
+#include <vtkDoubleArray.h>
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// Testing includes
+#include "vtkSlicerAstroTestingUtilities.h"
+
+namespace
+{
+
+const int Dims[3] = {128, 128, 20};
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkMRMLAstroVolumeNodeRobustNoiseTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  const vtkIdType plane = static_cast<vtkIdType>(Dims[0]) * Dims[1];
+  const double NaN = sqrt(-1);
+
+  // gaussian noise of sigma 1 + 0.1 * channel around 0.5, a bright
+  // source in 1% of each channel, and a blank last channel
+  vtkNew<vtkImageData> imageData;
+  imageData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  imageData->AllocateScalars(VTK_FLOAT, 1);
+  float *pixel = static_cast<float*>(imageData->GetScalarPointer());
+  unsigned int seed = 7;
+  for (int channel = 0; channel < Dims[2]; channel++)
+    {
+    const double sigma = 1. + 0.1 * channel;
+    for (vtkIdType ii = 0; ii < plane; ii++)
+      {
+      float &value = pixel[channel * plane + ii];
+      value = static_cast<float>(0.5 + sigma * vtkSlicerAstroTesting::NextGaussian(seed));
+      if (ii % 100 == 0)
+        {
+        value = 100.f;
+        }
+      if (channel == Dims[2] - 1)
+        {
+        value = NaN;
+        }
+      }
+    }
+
+  vtkNew<vtkMRMLAstroVolumeNode> volumeNode;
+  volumeNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  volumeNode->SetAndObserveImageData(imageData.GetPointer());
+
+  // per-channel noise: the source does not bias the MAD
+  vtkNew<vtkDoubleArray> channelNoise;
+  if (!volumeNode->ComputeChannelNoise(channelNoise.GetPointer()) ||
+      channelNoise->GetNumberOfTuples() != Dims[2])
+    {
+    std::cerr << "ComputeChannelNoise failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  for (int channel = 0; channel < Dims[2] - 1; channel++)
+    {
+    const double sigma = 1. + 0.1 * channel;
+    if (!vtkSlicerAstroTesting::Within("Noise of channel", channelNoise->GetValue(channel), sigma, 0.06 * sigma))
+      {
+      std::cerr << "channel " << channel << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  if (!vtkMath::IsNan(channelNoise->GetValue(Dims[2] - 1)))
+    {
+    std::cerr << "The noise of the blank channel is "
+              << channelNoise->GetValue(Dims[2] - 1) << ", expected NaN" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // whole cube: the MAD of the mixture of the channels
+  double noise = 0., median = 0.;
+  if (!volumeNode->ComputeRobustNoise(noise, median) ||
+      !vtkSlicerAstroTesting::Within("Median", median, 0.5, 0.05) ||
+      !vtkSlicerAstroTesting::Within("Noise", noise, 1.8, 0.1))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // sigma clipping of a single channel cube converges to the
+  // (truncated) gaussian noise
+  vtkNew<vtkImageData> channelData;
+  channelData->SetDimensions(Dims[0], Dims[1], 1);
+  channelData->AllocateScalars(VTK_FLOAT, 1);
+  float *channelPixel = static_cast<float*>(channelData->GetScalarPointer());
+  for (vtkIdType ii = 0; ii < plane; ii++)
+    {
+    channelPixel[ii] = pixel[ii];
+    }
+  vtkNew<vtkMRMLAstroVolumeNode> channelNode;
+  channelNode->SetAttribute("SlicerAstro.NAXIS", "2");
+  channelNode->SetAndObserveImageData(channelData.GetPointer());
+  channelNode->SetNoiseClippingIterations(3);
+  channelNode->SetNoiseClippingSigma(3.);
+  if (!channelNode->ComputeRobustNoise(noise, median) ||
+      !vtkSlicerAstroTesting::Within("Clipped median", median, 0.5, 0.05) ||
+      !vtkSlicerAstroTesting::Within("Clipped noise", noise, 1., 0.06))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // the attributes follow the selected estimator
+  channelNode->SetNoiseMethod(vtkMRMLAstroVolumeNode::RobustNoise);
+  if (!channelNode->UpdateNoiseAttributes() ||
+      !vtkSlicerAstroTesting::Within("RMS attribute", atof(channelNode->GetAttribute("SlicerAstro.RMS")), noise, 1.e-5 * noise) ||
+      !vtkSlicerAstroTesting::Within("RMSMEAN attribute", atof(channelNode->GetAttribute("SlicerAstro.RMSMEAN")), median, 1.e-5))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // subsampling gives a close estimate
+  channelNode->SetNoiseSampling(3);
+  double sampledNoise = 0., sampledMedian = 0.;
+  if (!channelNode->ComputeRobustNoise(sampledNoise, sampledMedian) ||
+      !vtkSlicerAstroTesting::Within("Subsampled noise", sampledNoise, noise, 0.08))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
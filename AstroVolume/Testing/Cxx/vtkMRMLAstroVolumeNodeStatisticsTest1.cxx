@@ -0,0 +1,241 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// MRML includes
+#include <vtkMRMLAstroVolumeNode.h>
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// Testing includes
+#include "vtkSlicerAstroTestingUtilities.h"
+
+namespace
+{
+
+// 140000 voxels: several blocks of the parallel kernel
+const int Dims[3] = {70, 50, 40};
+
+//-----------------------------------------------------------------------------
+// Reference statistics, computed serially on the physical values.
+// The noise is the std of the channels [2, 4] and [n - 4, n - 2]
+// (the first voxel of the last channel included), normalised by the
+// number of voxels of two channels.
+template <typename T> void ReferenceStatistics(const T *pixel, double bscale, double bzero,
+                                               double blank,
+                                               vtkMRMLAstroVolumeNode::Statistics &statistics)
+{
+  const vtkIdType plane = static_cast<vtkIdType>(Dims[0]) * Dims[1];
+  const vtkIdType numElements = plane * Dims[2];
+
+  statistics.Min = VTK_DOUBLE_MAX;
+  statistics.Max = -VTK_DOUBLE_MAX;
+  statistics.NumberOfValues = 0;
+  statistics.NumberOfBlanks = 0;
+  double sum = 0.;
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    if (pixel[ii] != pixel[ii] || pixel[ii] == blank)
+      {
+      statistics.NumberOfBlanks++;
+      continue;
+      }
+    const double value = bscale * pixel[ii] + bzero;
+    statistics.Min = std::min(statistics.Min, value);
+    statistics.Max = std::max(statistics.Max, value);
+    sum += value;
+    statistics.NumberOfValues++;
+    }
+  statistics.Mean = sum / statistics.NumberOfValues;
+
+  const vtkIdType first[2] = {2 * plane, (Dims[2] - 4) * plane};
+  const double cont = 2. * plane;
+  statistics.Noise = 0.;
+  statistics.NoiseMean = 0.;
+  for (int range = 0; range < 2; range++)
+    {
+    double rangeSum = 0.;
+    for (vtkIdType ii = first[range]; ii <= first[range] + 2 * plane; ii++)
+      {
+      if (pixel[ii] == pixel[ii] && pixel[ii] != blank)
+        {
+        rangeSum += pixel[ii];
+        }
+      }
+    const double mean = rangeSum / cont;
+    double variance = 0.;
+    for (vtkIdType ii = first[range]; ii <= first[range] + 2 * plane; ii++)
+      {
+      if (pixel[ii] == pixel[ii] && pixel[ii] != blank)
+        {
+        variance += (pixel[ii] - mean) * (pixel[ii] - mean);
+        }
+      }
+    statistics.Noise += 0.5 * std::fabs(bscale) * sqrt(variance / cont);
+    statistics.NoiseMean += 0.5 * (bscale * mean + bzero);
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool CompareStatistics(const char* name,
+                       const vtkMRMLAstroVolumeNode::Statistics &statistics,
+                       const vtkMRMLAstroVolumeNode::Statistics &expected)
+{
+  if (statistics.NumberOfValues != expected.NumberOfValues ||
+      statistics.NumberOfBlanks != expected.NumberOfBlanks ||
+      !vtkSlicerAstroTesting::Close(statistics.Min, expected.Min) ||
+      !vtkSlicerAstroTesting::Close(statistics.Max, expected.Max) ||
+      !vtkSlicerAstroTesting::Close(statistics.Mean, expected.Mean) ||
+      !vtkSlicerAstroTesting::Close(statistics.Noise, expected.Noise) ||
+      !vtkSlicerAstroTesting::Close(statistics.NoiseMean, expected.NoiseMean))
+    {
+    std::cerr << name << ": statistics" << std::endl
+              << "  values " << statistics.NumberOfValues << " blanks " << statistics.NumberOfBlanks
+              << " min " << statistics.Min << " max " << statistics.Max
+              << " mean " << statistics.Mean << " noise " << statistics.Noise
+              << " noise mean " << statistics.NoiseMean << std::endl << "expected" << std::endl
+              << "  values " << expected.NumberOfValues << " blanks " << expected.NumberOfBlanks
+              << " min " << expected.Min << " max " << expected.Max
+              << " mean " << expected.Mean << " noise " << expected.Noise
+              << " noise mean " << expected.NoiseMean << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// the attributes set by UpdateStatisticsAttributes match ComputeStatistics
+bool CompareAttributes(const char* name, vtkMRMLAstroVolumeNode* volumeNode,
+                       const vtkMRMLAstroVolumeNode::Statistics &expected)
+{
+  if (!volumeNode->UpdateStatisticsAttributes())
+    {
+    std::cerr << name << ": UpdateStatisticsAttributes failed." << std::endl;
+    return false;
+    }
+
+  // the attributes hold 6 significant digits
+  const char* keys[4] = {"SlicerAstro.DATAMIN", "SlicerAstro.DATAMAX",
+                         "SlicerAstro.RMS", "SlicerAstro.RMSMEAN"};
+  const double values[4] = {expected.Min, expected.Max, expected.Noise, expected.NoiseMean};
+  bool success = true;
+  for (int ii = 0; ii < 4; ii++)
+    {
+    success &= vtkSlicerAstroTesting::Close(atof(volumeNode->GetAttribute(keys[ii])), values[ii], 1.e-5);
+    }
+  if (!success)
+    {
+    std::cerr << name << ": wrong DATAMIN/DATAMAX/RMS/RMSMEAN attributes." << std::endl;
+    return false;
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkMRMLAstroVolumeNodeStatisticsTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+  const double NaN = sqrt(-1);
+
+  // floating point data, with NaNs in the data and in the noise channels
+  vtkNew<vtkImageData> floatData;
+  floatData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  floatData->AllocateScalars(VTK_FLOAT, 1);
+  float *floatPtr = static_cast<float*>(floatData->GetScalarPointer());
+  unsigned int seed = 1;
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    floatPtr[ii] = static_cast<float>(vtkSlicerAstroTesting::NextValue(seed));
+    }
+  floatPtr[12345] = NaN;
+  floatPtr[2 * Dims[0] * Dims[1] + 7] = NaN;
+  floatPtr[numElements - 1] = NaN;
+  floatPtr[77777] = 5.f;
+  floatPtr[99999] = -3.f;
+
+  vtkNew<vtkMRMLAstroVolumeNode> floatNode;
+  floatNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  floatNode->SetAndObserveImageData(floatData.GetPointer());
+
+  vtkMRMLAstroVolumeNode::Statistics expected;
+  ReferenceStatistics(floatPtr, 1., 0., NaN, expected);
+  if (expected.NumberOfBlanks != 3 || expected.Min != -3. || expected.Max != 5.)
+    {
+    std::cerr << "Wrong reference statistics." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkMRMLAstroVolumeNode::Statistics statistics;
+  if (!floatNode->ComputeStatistics(statistics) ||
+      !CompareStatistics("float", statistics, expected) ||
+      !CompareAttributes("float", floatNode.GetPointer(), expected))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // the noise-only pass gives the same noise
+  vtkMRMLAstroVolumeNode::Statistics noiseStatistics;
+  if (!floatNode->ComputeStatistics(noiseStatistics, false) ||
+      !vtkSlicerAstroTesting::Close(noiseStatistics.Noise, expected.Noise) ||
+      !vtkSlicerAstroTesting::Close(noiseStatistics.NoiseMean, expected.NoiseMean))
+    {
+    std::cerr << "float: the noise-only pass differs from the full pass." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // scaled integers: negative BSCALE, BLANK values skipped
+  const double bscale = -0.25, bzero = 3., blank = -32768.;
+  vtkNew<vtkImageData> shortData;
+  shortData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  shortData->AllocateScalars(VTK_SHORT, 1);
+  short *shortPtr = static_cast<short*>(shortData->GetScalarPointer());
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    shortPtr[ii] = static_cast<short>(vtkSlicerAstroTesting::NextValue(seed) * 1000.);
+    }
+  shortPtr[0] = static_cast<short>(blank);
+  shortPtr[3 * Dims[0] * Dims[1]] = static_cast<short>(blank);
+
+  vtkNew<vtkMRMLAstroVolumeNode> shortNode;
+  shortNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  shortNode->SetAttribute("SlicerAstro.BSCALE", "-0.25");
+  shortNode->SetAttribute("SlicerAstro.BZERO", "3.");
+  shortNode->SetAttribute("SlicerAstro.BLANK", "-32768");
+  shortNode->SetAndObserveImageData(shortData.GetPointer());
+
+  ReferenceStatistics(shortPtr, bscale, bzero, blank, expected);
+  if (!shortNode->ComputeStatistics(statistics) ||
+      !CompareStatistics("short", statistics, expected) ||
+      !CompareAttributes("short", shortNode.GetPointer(), expected))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
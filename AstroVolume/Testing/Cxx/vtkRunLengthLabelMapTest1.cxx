@@ -0,0 +1,206 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// vtkFits includes
+#include <vtkRunLengthLabelMap.h>
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+
+const int Dims[3] = {24, 16, 30};
+
+//-----------------------------------------------------------------------------
+// label of the voxel (i, j, k): two sources of labels 1 and 2 (the second
+// one with a gap along the spectral axis) and a negative label
+short Label(int ii, int jj, int kk)
+{
+  if (ii >= 3 && ii <= 10 && jj >= 2 && jj <= 7 && kk >= 5 + (ii % 3) && kk <= 12)
+    {
+    return 1;
+    }
+  if (ii >= 12 && ii <= 20 && jj >= 9 && jj <= 14 && kk >= 10 && kk <= 25 && kk != 18)
+    {
+    return 2;
+    }
+  if (ii == 0 && kk >= 27)
+    {
+    return -1;
+    }
+  return 0;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkRunLengthLabelMapTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  vtkNew<vtkImageData> labelData;
+  labelData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  labelData->AllocateScalars(VTK_SHORT, 1);
+
+  // reference numbers of runs and of labelled voxels
+  vtkIdType expectedRuns = 0, expectedVoxels = 0;
+  for (int jj = 0; jj < Dims[1]; jj++)
+    {
+    for (int ii = 0; ii < Dims[0]; ii++)
+      {
+      short previous = 0;
+      for (int kk = 0; kk < Dims[2]; kk++)
+        {
+        const short label = Label(ii, jj, kk);
+        *static_cast<short*>(labelData->GetScalarPointer(ii, jj, kk)) = label;
+        if (label != 0)
+          {
+          expectedVoxels++;
+          expectedRuns += label != previous ? 1 : 0;
+          }
+        previous = label;
+        }
+      }
+    }
+
+  vtkNew<vtkRunLengthLabelMap> runLengthLabelMap;
+  if (!runLengthLabelMap->Encode(labelData.GetPointer()))
+    {
+    std::cerr << "Encode failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (runLengthLabelMap->GetNumberOfRuns() != expectedRuns ||
+      runLengthLabelMap->GetNumberOfLabelledVoxels() != expectedVoxels)
+    {
+    std::cerr << runLengthLabelMap->GetNumberOfRuns() << " runs and "
+              << runLengthLabelMap->GetNumberOfLabelledVoxels() << " labelled voxels, expected "
+              << expectedRuns << " and " << expectedVoxels << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the runs of a pixel of the second source: the gap splits them
+  int numberOfRuns = 0;
+  const vtkRunLengthLabelMap::Run *runs =
+    runLengthLabelMap->GetPixelRuns(15 + 10 * Dims[0], numberOfRuns);
+  if (numberOfRuns != 2 || runs[0].First != 10 || runs[0].Last != 17 || runs[0].Label != 2 ||
+      runs[1].First != 19 || runs[1].Last != 25 || runs[1].Label != 2)
+    {
+    std::cerr << "Wrong runs of the pixel (15, 10)." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the whole volume is decoded back
+  vtkNew<vtkImageData> decodedData;
+  if (!runLengthLabelMap->Decode(decodedData.GetPointer(), VTK_INT))
+    {
+    std::cerr << "Decode failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  for (int kk = 0; kk < Dims[2]; kk++)
+    {
+    for (int jj = 0; jj < Dims[1]; jj++)
+      {
+      for (int ii = 0; ii < Dims[0]; ii++)
+        {
+        if (*static_cast<int*>(decodedData->GetScalarPointer(ii, jj, kk)) != Label(ii, jj, kk))
+          {
+          std::cerr << "Decode: wrong label of the voxel (" << ii << ", " << jj << ", "
+                    << kk << ")" << std::endl;
+          return EXIT_FAILURE;
+          }
+        }
+      }
+    }
+
+  // a sub-volume cutting both sources
+  const int extent[6] = {5, 15, 4, 12, 8, 20};
+  const int nx = extent[1] - extent[0] + 1;
+  const int ny = extent[3] - extent[2] + 1;
+  const int nz = extent[5] - extent[4] + 1;
+  std::vector<short> buffer(nx * ny * nz, -5);
+  if (!runLengthLabelMap->DecodeExtent(extent, &buffer[0]))
+    {
+    std::cerr << "DecodeExtent failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  for (int kk = 0; kk < nz; kk++)
+    {
+    for (int jj = 0; jj < ny; jj++)
+      {
+      for (int ii = 0; ii < nx; ii++)
+        {
+        if (buffer[(kk * ny + jj) * nx + ii] != Label(ii + extent[0], jj + extent[2], kk + extent[4]))
+          {
+          std::cerr << "DecodeExtent: wrong label of the voxel (" << ii + extent[0] << ", "
+                    << jj + extent[2] << ", " << kk + extent[4] << ")" << std::endl;
+          return EXIT_FAILURE;
+          }
+        }
+      }
+    }
+
+  // the mask holds the positive labels only
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+  bool *mask = new bool[numElements];
+  runLengthLabelMap->DecodeMask(mask);
+  vtkIdType wrongMaskValues = 0;
+  for (int kk = 0; kk < Dims[2]; kk++)
+    {
+    for (int jj = 0; jj < Dims[1]; jj++)
+      {
+      for (int ii = 0; ii < Dims[0]; ii++)
+        {
+        const vtkIdType index = (static_cast<vtkIdType>(kk) * Dims[1] + jj) * Dims[0] + ii;
+        wrongMaskValues += mask[index] != (Label(ii, jj, kk) > 0) ? 1 : 0;
+        }
+      }
+    }
+  delete [] mask;
+  if (wrongMaskValues)
+    {
+    std::cerr << "DecodeMask: " << wrongMaskValues << " wrong values." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // an unsigned char label map gives the same encoding
+  vtkNew<vtkImageData> charData;
+  charData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  charData->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    const short label = static_cast<short*>(labelData->GetScalarPointer())[ii];
+    static_cast<unsigned char*>(charData->GetScalarPointer())[ii] =
+      static_cast<unsigned char>(label > 0 ? label : 0);
+    }
+  vtkNew<vtkRunLengthLabelMap> charRunLengthLabelMap;
+  if (!charRunLengthLabelMap->Encode(charData.GetPointer()) ||
+      charRunLengthLabelMap->GetNumberOfLabelledVoxels() != expectedVoxels - 3 * Dims[1])
+    {
+    std::cerr << "Encode of the unsigned char label map failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+#ifndef __vtkSlicerAstroTestingUtilities_h
+#define __vtkSlicerAstroTestingUtilities_h
+
+// VTK includes
+#include <vtkMath.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+/// Helpers shared by the AstroVolume tests
+namespace vtkSlicerAstroTesting
+{
+
+//-----------------------------------------------------------------------------
+/// Deterministic values in [-1, 1)
+inline double NextValue(unsigned int &seed)
+{
+  seed = seed * 1103515245u + 12345u;
+  return ((seed >> 8) & 0xFFFF) / 32768. - 1.;
+}
+
+//-----------------------------------------------------------------------------
+/// Deterministic values in (0, 1]
+inline double NextUniform(unsigned int &seed)
+{
+  seed = seed * 1103515245u + 12345u;
+  return (((seed >> 8) & 0xFFFFFF) + 1.) / 16777217.;
+}
+
+//-----------------------------------------------------------------------------
+/// Deterministic gaussian values (Box-Muller)
+inline double NextGaussian(unsigned int &seed)
+{
+  const double u1 = NextUniform(seed);
+  const double u2 = NextUniform(seed);
+  return sqrt(-2. * log(u1)) * cos(2. * vtkMath::Pi() * u2);
+}
+
+//-----------------------------------------------------------------------------
+/// True if value matches expected within a relative tolerance
+inline bool Close(double value, double expected, double tolerance = 1.e-9)
+{
+  return std::fabs(value - expected) <= tolerance * std::max(1., std::fabs(expected));
+}
+
+//-----------------------------------------------------------------------------
+/// As Close, reporting the mismatch of name
+inline bool Close(const char* name, double value, double expected, double tolerance = 1.e-9)
+{
+  if (!Close(value, expected, tolerance))
+    {
+    std::cerr << name << " is " << value << ", expected " << expected << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+/// True if value is within an absolute tolerance of expected,
+/// reporting the mismatch of name
+inline bool Within(const char* name, double value, double expected, double tolerance)
+{
+  if (!(std::fabs(value - expected) <= tolerance))
+    {
+    std::cerr << name << " is " << value << ", expected " << expected
+              << " +- " << tolerance << std::endl;
+    return false;
+    }
+  return true;
+}
+
+} // end namespace vtkSlicerAstroTesting
+
+#endif
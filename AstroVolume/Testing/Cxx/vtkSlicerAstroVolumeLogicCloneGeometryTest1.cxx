@@ -0,0 +1,152 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Logic includes
+#include <vtkSlicerAstroVolumeLogic.h>
+
+// MRML includes
+#include <vtkMRMLAstroLabelMapVolumeNode.h>
+#include <vtkMRMLAstroVolumeDisplayNode.h>
+#include <vtkMRMLAstroVolumeNode.h>
+#include <vtkMRMLScene.h>
+
+// vtkFits includes
+#include "vtkFITSReader.h"
+
+// VTK includes
+#include <vtkImageChangeInformation.h>
+#include <vtkImageData.h>
+#include <vtkInformation.h>
+#include <vtkNew.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+//-----------------------------------------------------------------------------
+bool CheckExtent(const char* name, vtkImageData* imageData, const int expected[6])
+{
+  if (!imageData)
+    {
+    std::cerr << name << ": no image data." << std::endl;
+    return false;
+    }
+  int extent[6];
+  imageData->GetExtent(extent);
+  for (int ii = 0; ii < 6; ii++)
+    {
+    if (extent[ii] != expected[ii])
+      {
+      std::cerr << name << ": extent[" << ii << "] is " << extent[ii]
+                << ", expected " << expected[ii] << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkSlicerAstroVolumeLogicCloneGeometryTest1( int argc, char * argv[] )
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: vtkSlicerAstroVolumeLogicCloneGeometryTest1 volumeName" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // an on-demand volume, as set up by vtkMRMLAstroVolumeStorageNode
+  vtkNew<vtkFITSReader> reader;
+  reader->SetFileName(argv[1]);
+  if (!reader->CanReadFile(argv[1]))
+    {
+    std::cerr << "Can not read file:" << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  reader->PagingOn();
+  reader->UpdateInformation();
+
+  vtkNew<vtkImageChangeInformation> ici;
+  ici->SetInputConnection(reader->GetOutputPort());
+  ici->SetOutputSpacing(1, 1, 1);
+  ici->SetOutputOrigin(0, 0, 0);
+
+  int wholeExtent[6];
+  reader->GetOutputInformation(0)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+  int channelExtent[6] = {wholeExtent[0], wholeExtent[1], wholeExtent[2],
+                          wholeExtent[3], wholeExtent[4], wholeExtent[4]};
+
+  vtkNew<vtkMRMLScene> scene;
+  vtkNew<vtkMRMLAstroVolumeDisplayNode> displayNode;
+  scene->AddNode(displayNode.GetPointer());
+  displayNode->SetWCSStruct(reader->GetWCSStruct());
+
+  vtkNew<vtkMRMLAstroVolumeNode> volumeNode;
+  volumeNode->SetName("OnDemand");
+  volumeNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  volumeNode->SetAttribute("SlicerAstro.DATAMODEL", "DATA");
+  volumeNode->SetImageDataConnection(ici->GetOutputPort());
+  scene->AddNode(volumeNode.GetPointer());
+  volumeNode->SetAndObserveDisplayNodeID(displayNode->GetID());
+
+  // only the first channel is in memory
+  ici->UpdateExtent(channelExtent);
+  if (!CheckExtent("Paged volume", volumeNode->GetImageData(), channelExtent))
+    {
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkSlicerAstroVolumeLogic> logic;
+  logic->SetMRMLScene(scene.GetPointer());
+
+  // the clone and the label have the whole extent of the volume
+  vtkMRMLAstroVolumeNode* cloneNode =
+    logic->CloneVolumeGeometry(scene.GetPointer(), volumeNode.GetPointer(), "Clone", VTK_FLOAT);
+  if (!cloneNode || !CheckExtent("Clone", cloneNode->GetImageData(), wholeExtent) ||
+      cloneNode->GetImageData()->GetScalarType() != VTK_FLOAT)
+    {
+    std::cerr << "CloneVolumeGeometry failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> labelNode;
+  labelNode->SetName("Label");
+  scene->AddNode(labelNode.GetPointer());
+  if (!logic->CreateLabelVolumeFromVolume(scene.GetPointer(), labelNode.GetPointer(),
+                                          volumeNode.GetPointer()) ||
+      !CheckExtent("Label", labelNode->GetImageData(), wholeExtent) ||
+      labelNode->GetImageData()->GetScalarType() != VTK_SHORT)
+    {
+    std::cerr << "CreateLabelVolumeFromVolume failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the voxels of the volume have not been read in full
+  if (!CheckExtent("Paged volume after the clones", volumeNode->GetImageData(), channelExtent))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
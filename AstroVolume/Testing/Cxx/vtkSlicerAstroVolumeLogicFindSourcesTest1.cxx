@@ -0,0 +1,288 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Logic includes
+#include <vtkSlicerAstroVolumeLogic.h>
+
+// MRML includes
+#include <vtkMRMLAstroLabelMapVolumeNode.h>
+#include <vtkMRMLAstroVolumeNode.h>
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+#include <vtkTable.h>
+#include <vtkVariant.h>
+
+// STD includes
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Testing includes
+#include "vtkSlicerAstroTestingUtilities.h"
+
+namespace
+{
+
+const int Dims[3] = {40, 30, 24};
+
+//-----------------------------------------------------------------------------
+// Fill the box [extent] with values above the threshold (1)
+void FillBox(float *pixel, const int extent[6], double base)
+{
+  for (int kk = extent[4]; kk <= extent[5]; kk++)
+    {
+    for (int jj = extent[2]; jj <= extent[3]; jj++)
+      {
+      for (int ii = extent[0]; ii <= extent[1]; ii++)
+        {
+        pixel[(kk * Dims[1] + jj) * Dims[0] + ii] =
+          static_cast<float>(base + 0.01 * (ii + 2 * jj + 3 * kk));
+        }
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The catalogue matches the properties of the labelled voxels
+bool CheckCatalogue(const char* name, const float *pixel, const int dims[3],
+                    vtkMRMLAstroLabelMapVolumeNode *labelVolume, vtkTable *catalogue)
+{
+  const int numSources = catalogue->GetNumberOfRows();
+  const short *labelPixel = static_cast<short*>(labelVolume->GetImageData()->GetScalarPointer());
+  for (int source = 0; source < numSources; source++)
+    {
+    const int label = catalogue->GetValueByName(source, "ID").ToInt();
+    vtkIdType numVoxels = 0;
+    double sum = 0., peak = -VTK_DOUBLE_MAX;
+    double weighted[3] = {0., 0., 0.}, position[3] = {0., 0., 0.};
+    int extent[6] = {INT_MAX, INT_MIN, INT_MAX, INT_MIN, INT_MAX, INT_MIN};
+    for (int kk = 0; kk < dims[2]; kk++)
+      {
+      for (int jj = 0; jj < dims[1]; jj++)
+        {
+        for (int ii = 0; ii < dims[0]; ii++)
+          {
+          const vtkIdType index = (static_cast<vtkIdType>(kk) * dims[1] + jj) * dims[0] + ii;
+          if (labelPixel[index] != label)
+            {
+            continue;
+            }
+          const int ijk[3] = {ii, jj, kk};
+          numVoxels++;
+          sum += pixel[index];
+          peak = std::max(peak, static_cast<double>(pixel[index]));
+          for (int axis = 0; axis < 3; axis++)
+            {
+            weighted[axis] += pixel[index] * ijk[axis];
+            position[axis] += ijk[axis];
+            extent[2 * axis] = std::min(extent[2 * axis], ijk[axis]);
+            extent[2 * axis + 1] = std::max(extent[2 * axis + 1], ijk[axis]);
+            }
+          }
+        }
+      }
+
+    if (label != source + 1 || numVoxels == 0 ||
+        catalogue->GetValueByName(source, "N").ToTypeInt64() != numVoxels ||
+        catalogue->GetValueByName(source, "NChannels").ToInt() != extent[5] - extent[4] + 1)
+      {
+      std::cerr << name << ": source " << label << " has "
+                << catalogue->GetValueByName(source, "N").ToTypeInt64()
+                << " voxels, " << numVoxels << " are labelled." << std::endl;
+      return false;
+      }
+
+    const char* bounds[6] = {"XMin", "XMax", "YMin", "YMax", "ZMin", "ZMax"};
+    for (int bound = 0; bound < 6; bound++)
+      {
+      if (catalogue->GetValueByName(source, bounds[bound]).ToInt() != extent[bound])
+        {
+        std::cerr << name << ": source " << label << " has " << bounds[bound] << " "
+                  << catalogue->GetValueByName(source, bounds[bound]).ToInt()
+                  << ", expected " << extent[bound] << std::endl;
+        return false;
+        }
+      }
+
+    // flux weighted centroid, geometric if the flux is not positive
+    const char* axes[3] = {"X", "Y", "Z"};
+    for (int axis = 0; axis < 3; axis++)
+      {
+      const double centroid = sum > 0. ? weighted[axis] / sum : position[axis] / numVoxels;
+      if (!vtkSlicerAstroTesting::Close(axes[axis], catalogue->GetValueByName(source, axes[axis]).ToDouble(), centroid))
+        {
+        std::cerr << name << ": wrong centroid of the source " << label << std::endl;
+        return false;
+        }
+      }
+
+    if (!vtkSlicerAstroTesting::Close("Peak", catalogue->GetValueByName(source, "Peak").ToDouble(), peak) ||
+        !vtkSlicerAstroTesting::Close("FluxSum", catalogue->GetValueByName(source, "FluxSum").ToDouble(), sum))
+      {
+      std::cerr << name << ": wrong fluxes of the source " << label << std::endl;
+      return false;
+      }
+    }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+int Label(vtkMRMLAstroLabelMapVolumeNode *labelVolume, int ii, int jj, int kk)
+{
+  return *static_cast<short*>(labelVolume->GetImageData()->GetScalarPointer(ii, jj, kk));
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkSlicerAstroVolumeLogicFindSourcesTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+
+  // A and B are 2 pixels apart along X, A and C 3 channels apart,
+  // E is made of two boxes touching at a corner and D is a single voxel
+  vtkNew<vtkImageData> imageData;
+  imageData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  imageData->AllocateScalars(VTK_FLOAT, 1);
+  float *pixel = static_cast<float*>(imageData->GetScalarPointer());
+  std::fill(pixel, pixel + numElements, 0.f);
+  const int boxA[6] = {2, 5, 2, 5, 2, 5};
+  const int boxB[6] = {7, 9, 2, 5, 2, 5};
+  const int boxC[6] = {2, 5, 2, 5, 8, 10};
+  const int boxD[6] = {30, 30, 20, 20, 15, 15};
+  const int boxE1[6] = {20, 22, 20, 22, 2, 3};
+  const int boxE2[6] = {23, 25, 23, 25, 4, 5};
+  FillBox(pixel, boxA, 2.);
+  FillBox(pixel, boxB, 3.);
+  FillBox(pixel, boxC, 2.);
+  FillBox(pixel, boxD, 5.);
+  FillBox(pixel, boxE1, 1.5);
+  FillBox(pixel, boxE2, 1.5);
+  // a blank voxel inside A
+  pixel[(3 * Dims[1] + 3) * Dims[0] + 3] = sqrt(-1);
+
+  vtkNew<vtkMRMLAstroVolumeNode> volumeNode;
+  volumeNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  volumeNode->SetAndObserveImageData(imageData.GetPointer());
+
+  vtkNew<vtkSlicerAstroVolumeLogic> logic;
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> labelVolume;
+  vtkNew<vtkTable> catalogue;
+
+  // 26-connected components
+  vtkSlicerAstroVolumeLogic::SourceFinderParameters parameters;
+  parameters.Threshold = 1.;
+  int numSources = logic->FindSources(volumeNode.GetPointer(), parameters,
+                                      labelVolume.GetPointer(), catalogue.GetPointer());
+  if (numSources != 5 || catalogue->GetNumberOfRows() != 5 ||
+      !CheckCatalogue("radius 1", pixel, Dims, labelVolume.GetPointer(), catalogue.GetPointer()))
+    {
+    std::cerr << "radius 1: " << numSources << " sources, expected 5" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (Label(labelVolume.GetPointer(), 20, 20, 2) != Label(labelVolume.GetPointer(), 25, 25, 5) ||
+      catalogue->GetValueByName(0, "N").ToTypeInt64() != 63)
+    {
+    std::cerr << "radius 1: wrong components." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // merge radius along X and Y: A and B are one source
+  parameters.MergeRadiusXY = 2;
+  numSources = logic->FindSources(volumeNode.GetPointer(), parameters,
+                                  labelVolume.GetPointer(), catalogue.GetPointer());
+  if (numSources != 4 ||
+      !CheckCatalogue("radius XY 2", pixel, Dims, labelVolume.GetPointer(), catalogue.GetPointer()) ||
+      Label(labelVolume.GetPointer(), 2, 2, 2) != Label(labelVolume.GetPointer(), 9, 5, 5) ||
+      Label(labelVolume.GetPointer(), 2, 2, 2) == Label(labelVolume.GetPointer(), 2, 2, 8))
+    {
+    std::cerr << "radius XY 2: " << numSources << " sources, expected 4" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // merge radius along Z: A and C are one source
+  parameters.MergeRadiusXY = 1;
+  parameters.MergeRadiusZ = 3;
+  numSources = logic->FindSources(volumeNode.GetPointer(), parameters,
+                                  labelVolume.GetPointer(), catalogue.GetPointer());
+  if (numSources != 4 ||
+      !CheckCatalogue("radius Z 3", pixel, Dims, labelVolume.GetPointer(), catalogue.GetPointer()) ||
+      Label(labelVolume.GetPointer(), 2, 2, 2) != Label(labelVolume.GetPointer(), 5, 5, 10) ||
+      Label(labelVolume.GetPointer(), 2, 2, 2) == Label(labelVolume.GetPointer(), 7, 2, 2))
+    {
+    std::cerr << "radius Z 3: " << numSources << " sources, expected 4" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // size filters: D (1 voxel), then C (3 channels) are discarded
+  parameters.MergeRadiusZ = 1;
+  parameters.MinimumSize = 2;
+  numSources = logic->FindSources(volumeNode.GetPointer(), parameters,
+                                  labelVolume.GetPointer(), catalogue.GetPointer());
+  if (numSources != 4 || Label(labelVolume.GetPointer(), 30, 20, 15) != 0 ||
+      !CheckCatalogue("minimum size", pixel, Dims, labelVolume.GetPointer(), catalogue.GetPointer()))
+    {
+    std::cerr << "minimum size: " << numSources << " sources, expected 4" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  parameters.MinimumChannels = 4;
+  numSources = logic->FindSources(volumeNode.GetPointer(), parameters,
+                                  labelVolume.GetPointer(), catalogue.GetPointer());
+  if (numSources != 3 || Label(labelVolume.GetPointer(), 2, 2, 8) != 0 ||
+      !CheckCatalogue("minimum channels", pixel, Dims, labelVolume.GetPointer(), catalogue.GetPointer()))
+    {
+    std::cerr << "minimum channels: " << numSources << " sources, expected 3" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // a zero threshold on a blank field: one source with no flux,
+  // at the geometric centre of the cube
+  const int zeroDims[3] = {5, 4, 3};
+  vtkNew<vtkImageData> zeroData;
+  zeroData->SetDimensions(zeroDims[0], zeroDims[1], zeroDims[2]);
+  zeroData->AllocateScalars(VTK_FLOAT, 1);
+  float *zeroPixel = static_cast<float*>(zeroData->GetScalarPointer());
+  std::fill(zeroPixel, zeroPixel + zeroDims[0] * zeroDims[1] * zeroDims[2], 0.f);
+  vtkNew<vtkMRMLAstroVolumeNode> zeroNode;
+  zeroNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  zeroNode->SetAndObserveImageData(zeroData.GetPointer());
+
+  vtkSlicerAstroVolumeLogic::SourceFinderParameters zeroParameters;
+  numSources = logic->FindSources(zeroNode.GetPointer(), zeroParameters,
+                                  labelVolume.GetPointer(), catalogue.GetPointer());
+  if (numSources != 1 ||
+      !CheckCatalogue("zero flux", zeroPixel, zeroDims, labelVolume.GetPointer(), catalogue.GetPointer()) ||
+      !vtkSlicerAstroTesting::Close("X", catalogue->GetValueByName(0, "X").ToDouble(), 2.) ||
+      !vtkSlicerAstroTesting::Close("Y", catalogue->GetValueByName(0, "Y").ToDouble(), 1.5) ||
+      !vtkSlicerAstroTesting::Close("Z", catalogue->GetValueByName(0, "Z").ToDouble(), 1.))
+    {
+    std::cerr << "zero flux: " << numSources << " sources, expected 1" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
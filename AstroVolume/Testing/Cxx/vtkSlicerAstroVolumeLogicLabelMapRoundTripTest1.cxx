@@ -0,0 +1,200 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Logic includes
+#include <vtkSlicerAstroVolumeLogic.h>
+
+// MRML includes
+#include <vtkMRMLAstroLabelMapVolumeNode.h>
+#include <vtkMRMLAstroVolumeDisplayNode.h>
+#include <vtkMRMLAstroVolumeNode.h>
+#include <vtkMRMLAstroVolumeStorageNode.h>
+#include <vtkMRMLScene.h>
+
+// vtkFits includes
+#include "vtkFITSReader.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace
+{
+
+const int Dims[3] = {20, 15, 8};
+
+//-----------------------------------------------------------------------------
+// label values, including one above the range of the scaled cube
+short LabelValue(vtkIdType index)
+{
+  return index == 100 ? 30000 : static_cast<short>(index % 7);
+}
+
+//-----------------------------------------------------------------------------
+// write labelNode to fileName, read it back and compare the labels
+bool RoundTrip(vtkMRMLAstroLabelMapVolumeNode* labelNode, const std::string& fileName)
+{
+  vtkNew<vtkMRMLAstroVolumeStorageNode> storageNode;
+  storageNode->SetFileName(fileName.c_str());
+  if (!storageNode->WriteData(labelNode))
+    {
+    std::cerr << "Can not write " << fileName << std::endl;
+    return false;
+    }
+
+  vtkNew<vtkFITSReader> reader;
+  reader->SetFileName(fileName.c_str());
+  if (!reader->CanReadFile(fileName.c_str()))
+    {
+    std::cerr << "Can not read file:" << fileName << std::endl;
+    return false;
+    }
+  reader->Update();
+
+  // the labels are stored unscaled (the reader sets the defaults
+  // BSCALE = 1, BZERO = 0 and BLANK = 0 of missing keys)
+  if (atof(reader->GetHeaderValue("SlicerAstro.BSCALE")) != 1. ||
+      atof(reader->GetHeaderValue("SlicerAstro.BZERO")) != 0. ||
+      atof(reader->GetHeaderValue("SlicerAstro.BLANK")) != 0.)
+    {
+    std::cerr << fileName << ": the header has the scaling of the volume." << std::endl;
+    return false;
+    }
+
+  vtkDataArray* values = reader->GetOutput()->GetPointData()->GetScalars();
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+  if (!values || values->GetNumberOfTuples() != numElements)
+    {
+    std::cerr << fileName << ": wrong number of voxels." << std::endl;
+    return false;
+    }
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    if (values->GetTuple1(ii) != LabelValue(ii))
+      {
+      std::cerr << fileName << ": label " << ii << " is " << values->GetTuple1(ii)
+                << ", expected " << LabelValue(ii) << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkSlicerAstroVolumeLogicLabelMapRoundTripTest1( int argc, char * argv[] )
+{
+  if (argc < 3)
+    {
+    std::cerr << "Usage: vtkSlicerAstroVolumeLogicLabelMapRoundTripTest1 volumeName temporaryDirectory" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the WCS of the volume
+  vtkNew<vtkFITSReader> headerReader;
+  headerReader->SetFileName(argv[1]);
+  if (!headerReader->CanReadFile(argv[1]))
+    {
+    std::cerr << "Can not read file:" << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  headerReader->UpdateInformation();
+
+  vtkNew<vtkMRMLScene> scene;
+  vtkNew<vtkMRMLAstroVolumeDisplayNode> displayNode;
+  scene->AddNode(displayNode.GetPointer());
+  displayNode->SetWCSStruct(headerReader->GetWCSStruct());
+
+  // a scaled integer cube: BSCALE != 1, BZERO and BLANK
+  vtkNew<vtkImageData> imageData;
+  imageData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  imageData->AllocateScalars(VTK_SHORT, 1);
+  imageData->GetPointData()->GetScalars()->FillComponent(0, 10.);
+
+  vtkNew<vtkMRMLAstroVolumeNode> volumeNode;
+  volumeNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  volumeNode->SetAttribute("SlicerAstro.BITPIX", "16");
+  volumeNode->SetAttribute("SlicerAstro.BSCALE", "0.25");
+  volumeNode->SetAttribute("SlicerAstro.BZERO", "3.");
+  volumeNode->SetAttribute("SlicerAstro.BLANK", "-32768");
+  volumeNode->SetAttribute("SlicerAstro.DATAMODEL", "DATA");
+  volumeNode->SetAndObserveImageData(imageData.GetPointer());
+  scene->AddNode(volumeNode.GetPointer());
+  volumeNode->SetAndObserveDisplayNodeID(displayNode->GetID());
+
+  vtkNew<vtkSlicerAstroVolumeLogic> logic;
+  logic->SetMRMLScene(scene.GetPointer());
+
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> labelNode;
+  labelNode->SetName("Label");
+  scene->AddNode(labelNode.GetPointer());
+  if (!logic->CreateLabelVolumeFromVolume(scene.GetPointer(), labelNode.GetPointer(),
+                                          volumeNode.GetPointer()) ||
+      !labelNode->GetImageData())
+    {
+    std::cerr << "CreateLabelVolumeFromVolume failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the label does not inherit the scaling of the volume
+  if (strcmp(labelNode->GetAttribute("SlicerAstro.DATAMODEL"), "MASK") ||
+      atof(labelNode->GetAttribute("SlicerAstro.BSCALE")) != 1. ||
+      atof(labelNode->GetAttribute("SlicerAstro.BZERO")) != 0. ||
+      labelNode->GetAttribute("SlicerAstro.BLANK"))
+    {
+    std::cerr << "The label has the scaling attributes of the volume." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  short* labels = static_cast<short*>(labelNode->GetImageData()->GetScalarPointer());
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    labels[ii] = LabelValue(ii);
+    }
+  labelNode->GetImageData()->Modified();
+
+  // the file name marks it as a mask on read
+  const std::string fileName = std::string(argv[2]) + "/vtkSlicerAstroVolumeLogicLabelMapRoundTripTest1_mask.fits";
+  if (!RoundTrip(labelNode.GetPointer(), fileName))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // a label which still has the scaling attributes (e.g. from
+  // an older scene) is written unscaled as well
+  labelNode->SetAttribute("SlicerAstro.BSCALE", "0.25");
+  labelNode->SetAttribute("SlicerAstro.BZERO", "3.");
+  labelNode->SetAttribute("SlicerAstro.BLANK", "-32768");
+  if (!RoundTrip(labelNode.GetPointer(), fileName))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
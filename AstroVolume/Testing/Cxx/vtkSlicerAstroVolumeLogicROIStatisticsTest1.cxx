@@ -0,0 +1,239 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Logic includes
+#include <vtkSlicerAstroVolumeLogic.h>
+
+// MRML includes
+#include <vtkMRMLAnnotationROINode.h>
+#include <vtkMRMLAstroVolumeNode.h>
+#include <vtkMRMLScalarVolumeNode.h>
+
+// VTK includes
+#include <vtkCollection.h>
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+#include <vtkTable.h>
+#include <vtkVariant.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Testing includes
+#include "vtkSlicerAstroTestingUtilities.h"
+
+namespace
+{
+
+const int Dims[3] = {30, 20, 10};
+
+//-----------------------------------------------------------------------------
+// ROI of the voxels [extent] (IJK and RAS coincide)
+void SetROIExtent(vtkMRMLAnnotationROINode* roiNode, const int extent[6])
+{
+  roiNode->SetXYZ(0.5 * (extent[0] + extent[1]), 0.5 * (extent[2] + extent[3]),
+                  0.5 * (extent[4] + extent[5]));
+  roiNode->SetRadiusXYZ(0.5 * (extent[1] - extent[0]), 0.5 * (extent[3] - extent[2]),
+                        0.5 * (extent[5] - extent[4]));
+}
+
+//-----------------------------------------------------------------------------
+// Serial reference of the valid voxels of extent where mask is not zero.
+// The robust sigma is from the exact quartiles.
+void ReferenceStatistics(const float *pixel, const short *mask, const int extent[6],
+                         vtkSlicerAstroVolumeLogic::ROIStatistics &statistics)
+{
+  std::vector<double> values;
+  for (int kk = extent[4]; kk <= extent[5]; kk++)
+    {
+    for (int jj = extent[2]; jj <= extent[3]; jj++)
+      {
+      for (int ii = extent[0]; ii <= extent[1]; ii++)
+        {
+        const vtkIdType index = (static_cast<vtkIdType>(kk) * Dims[1] + jj) * Dims[0] + ii;
+        if (!vtkMath::IsNan(pixel[index]) && (!mask || mask[index]))
+          {
+          values.push_back(pixel[index]);
+          }
+        }
+      }
+    }
+
+  statistics.NumberOfValues = static_cast<vtkIdType>(values.size());
+  double sum = 0., sum2 = 0.;
+  for (size_t ii = 0; ii < values.size(); ii++)
+    {
+    sum += values[ii];
+    sum2 += values[ii] * values[ii];
+    }
+  std::sort(values.begin(), values.end());
+  statistics.FluxSum = sum;
+  statistics.Mean = sum / values.size();
+  statistics.RMS = sqrt(sum2 / values.size() - statistics.Mean * statistics.Mean);
+  statistics.Min = values.front();
+  statistics.Max = values.back();
+  statistics.RobustSigma = (values[3 * values.size() / 4] - values[values.size() / 4]) / 1.349;
+}
+
+//-----------------------------------------------------------------------------
+bool CompareStatistics(const char* name,
+                       const vtkSlicerAstroVolumeLogic::ROIStatistics &statistics,
+                       const vtkSlicerAstroVolumeLogic::ROIStatistics &expected)
+{
+  if (statistics.NumberOfValues != expected.NumberOfValues)
+    {
+    std::cerr << name << ": " << statistics.NumberOfValues << " values, expected "
+              << expected.NumberOfValues << std::endl;
+    return false;
+    }
+  // the robust sigma comes from a histogram of the values
+  if (!vtkSlicerAstroTesting::Within("Mean", statistics.Mean, expected.Mean, 1.e-9) ||
+      !vtkSlicerAstroTesting::Within("RMS", statistics.RMS, expected.RMS, 1.e-9) ||
+      !vtkSlicerAstroTesting::Within("Min", statistics.Min, expected.Min, 0.) ||
+      !vtkSlicerAstroTesting::Within("Max", statistics.Max, expected.Max, 0.) ||
+      !vtkSlicerAstroTesting::Within("FluxSum", statistics.FluxSum, expected.FluxSum, 1.e-9 * statistics.NumberOfValues) ||
+      !vtkSlicerAstroTesting::Within("RobustSigma", statistics.RobustSigma, expected.RobustSigma, 0.02))
+    {
+    std::cerr << name << ": wrong statistics." << std::endl;
+    return false;
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkSlicerAstroVolumeLogicROIStatisticsTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+  const double NaN = sqrt(-1);
+
+  vtkNew<vtkImageData> imageData;
+  imageData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  imageData->AllocateScalars(VTK_FLOAT, 1);
+  float *pixel = static_cast<float*>(imageData->GetScalarPointer());
+  unsigned int seed = 11;
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    pixel[ii] = ii % 37 ? static_cast<float>(vtkSlicerAstroTesting::NextValue(seed)) : static_cast<float>(NaN);
+    }
+
+  vtkNew<vtkMRMLAstroVolumeNode> volumeNode;
+  volumeNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  volumeNode->SetAndObserveImageData(imageData.GetPointer());
+
+  // mask of the even columns
+  vtkNew<vtkImageData> maskData;
+  maskData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  maskData->AllocateScalars(VTK_SHORT, 1);
+  short *mask = static_cast<short*>(maskData->GetScalarPointer());
+  for (vtkIdType ii = 0; ii < numElements; ii++)
+    {
+    mask[ii] = (ii % Dims[0]) % 2 ? 0 : 1;
+    }
+  vtkNew<vtkMRMLScalarVolumeNode> maskVolume;
+  maskVolume->SetAndObserveImageData(maskData.GetPointer());
+
+  vtkNew<vtkSlicerAstroVolumeLogic> logic;
+
+  // single ROI
+  const int extent[6] = {5, 14, 2, 9, 1, 4};
+  vtkNew<vtkMRMLAnnotationROINode> roiNode;
+  roiNode->SetName("ROI1");
+  SetROIExtent(roiNode.GetPointer(), extent);
+
+  vtkSlicerAstroVolumeLogic::ROIStatistics statistics, expected;
+  ReferenceStatistics(pixel, NULL, extent, expected);
+  if (!logic->CalculateROIStatistics(roiNode.GetPointer(), volumeNode.GetPointer(), statistics) ||
+      !CompareStatistics("ROI", statistics, expected))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // masked ROI
+  vtkSlicerAstroVolumeLogic::ROIStatistics maskedStatistics, maskedExpected;
+  ReferenceStatistics(pixel, mask, extent, maskedExpected);
+  if (!logic->CalculateROIStatistics(roiNode.GetPointer(), volumeNode.GetPointer(),
+                                     maskedStatistics, maskVolume.GetPointer()) ||
+      !CompareStatistics("masked ROI", maskedStatistics, maskedExpected))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // batch: the same ROI, a second one over the whole volume and
+  // one outside the volume (a row of NaNs)
+  const int wholeExtent[6] = {0, Dims[0] - 1, 0, Dims[1] - 1, 0, Dims[2] - 1};
+  vtkNew<vtkMRMLAnnotationROINode> wholeROINode;
+  wholeROINode->SetName("ROI2");
+  SetROIExtent(wholeROINode.GetPointer(), wholeExtent);
+  vtkNew<vtkMRMLAnnotationROINode> outsideROINode;
+  outsideROINode->SetName("ROI3");
+  outsideROINode->SetXYZ(100., 100., 100.);
+  outsideROINode->SetRadiusXYZ(1., 1., 1.);
+
+  vtkNew<vtkCollection> roiNodes;
+  roiNodes->AddItem(roiNode.GetPointer());
+  roiNodes->AddItem(wholeROINode.GetPointer());
+  roiNodes->AddItem(outsideROINode.GetPointer());
+
+  vtkNew<vtkTable> table;
+  if (!logic->CalculateROIStatistics(roiNodes.GetPointer(), volumeNode.GetPointer(),
+                                     table.GetPointer()) ||
+      table->GetNumberOfRows() != 3 || table->GetNumberOfColumns() != 8)
+    {
+    std::cerr << "CalculateROIStatistics (batch) failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkSlicerAstroVolumeLogic::ROIStatistics wholeExpected;
+  ReferenceStatistics(pixel, NULL, wholeExtent, wholeExpected);
+  const vtkSlicerAstroVolumeLogic::ROIStatistics* rowExpected[2] = {&expected, &wholeExpected};
+  for (int row = 0; row < 2; row++)
+    {
+    vtkSlicerAstroVolumeLogic::ROIStatistics rowStatistics;
+    rowStatistics.NumberOfValues = table->GetValueByName(row, "N").ToTypeInt64();
+    rowStatistics.Mean = table->GetValueByName(row, "Mean").ToDouble();
+    rowStatistics.RMS = table->GetValueByName(row, "RMS").ToDouble();
+    rowStatistics.RobustSigma = table->GetValueByName(row, "RobustSigma").ToDouble();
+    rowStatistics.Min = table->GetValueByName(row, "Min").ToDouble();
+    rowStatistics.Max = table->GetValueByName(row, "Max").ToDouble();
+    rowStatistics.FluxSum = table->GetValueByName(row, "FluxSum").ToDouble();
+    if (!CompareStatistics(table->GetValueByName(row, "ROI").ToString().c_str(),
+                           rowStatistics, *rowExpected[row]))
+      {
+      return EXIT_FAILURE;
+      }
+    }
+
+  if (table->GetValueByName(2, "ROI").ToString() != "ROI3" ||
+      table->GetValueByName(2, "N").ToTypeInt64() != 0 ||
+      !vtkMath::IsNan(table->GetValueByName(2, "Mean").ToDouble()))
+    {
+    std::cerr << "The ROI outside the volume does not give an empty row." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
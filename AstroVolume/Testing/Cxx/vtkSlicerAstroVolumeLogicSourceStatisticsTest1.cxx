@@ -0,0 +1,206 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// Logic includes
+#include <vtkSlicerAstroVolumeLogic.h>
+
+// MRML includes
+#include <vtkMRMLAstroLabelMapVolumeNode.h>
+#include <vtkMRMLAstroVolumeNode.h>
+#include <vtkMRMLTableNode.h>
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+#include <vtkTable.h>
+#include <vtkVariant.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// Testing includes
+#include "vtkSlicerAstroTestingUtilities.h"
+
+namespace
+{
+
+const int Dims[3] = {20, 20, 30};
+
+//-----------------------------------------------------------------------------
+// Row of the table: Label, N, FluxSum, Peak, X, Y, Z and XMin ... ZMax
+bool CheckRow(vtkTable *table, int row, int label, vtkIdType numVoxels,
+              const double values[5], const int extent[6])
+{
+  if (table->GetValueByName(row, "Label").ToInt() != label ||
+      table->GetValueByName(row, "N").ToTypeInt64() != numVoxels)
+    {
+    std::cerr << "row " << row << ": label " << table->GetValueByName(row, "Label").ToInt()
+              << " with " << table->GetValueByName(row, "N").ToTypeInt64()
+              << " voxels, expected " << label << " with " << numVoxels << std::endl;
+    return false;
+    }
+  const char* names[5] = {"FluxSum", "Peak", "X", "Y", "Z"};
+  for (int column = 0; column < 5; column++)
+    {
+    if (!vtkSlicerAstroTesting::Close(names[column], table->GetValueByName(row, names[column]).ToDouble(), values[column]))
+      {
+      std::cerr << "row " << row << ": wrong " << names[column] << std::endl;
+      return false;
+      }
+    }
+  const char* bounds[6] = {"XMin", "XMax", "YMin", "YMax", "ZMin", "ZMax"};
+  for (int bound = 0; bound < 6; bound++)
+    {
+    if (table->GetValueByName(row, bounds[bound]).ToInt() != extent[bound])
+      {
+      std::cerr << "row " << row << ": " << bounds[bound] << " is "
+                << table->GetValueByName(row, bounds[bound]).ToInt()
+                << ", expected " << extent[bound] << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
+
+} // end namespace
+
+//-----------------------------------------------------------------------------
+int vtkSlicerAstroVolumeLogicSourceStatisticsTest1( int vtkNotUsed(argc), char * vtkNotUsed(argv)[] )
+{
+  const vtkIdType numElements = static_cast<vtkIdType>(Dims[0]) * Dims[1] * Dims[2];
+  const double NaN = sqrt(-1);
+
+  // label 1: 3 x 3 spectra with a triangular profile 10 - 2 |k - 15|
+  // over the channels [10, 20] (the linear interpolation of the widths
+  // is exact). Label 32000: a single channel source with a blank voxel
+  // (the labels are sparse). The negative label is not measured.
+  vtkNew<vtkImageData> imageData;
+  imageData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  imageData->AllocateScalars(VTK_FLOAT, 1);
+  float *pixel = static_cast<float*>(imageData->GetScalarPointer());
+  vtkNew<vtkImageData> labelData;
+  labelData->SetDimensions(Dims[0], Dims[1], Dims[2]);
+  labelData->AllocateScalars(VTK_SHORT, 1);
+  short *labelPixel = static_cast<short*>(labelData->GetScalarPointer());
+  std::fill(pixel, pixel + numElements, 0.5f);
+  std::fill(labelPixel, labelPixel + numElements, 0);
+
+  for (int kk = 10; kk <= 20; kk++)
+    {
+    for (int jj = 7; jj <= 9; jj++)
+      {
+      for (int ii = 4; ii <= 6; ii++)
+        {
+        const vtkIdType index = (kk * Dims[1] + jj) * Dims[0] + ii;
+        pixel[index] = static_cast<float>(10 - 2 * std::abs(kk - 15));
+        labelPixel[index] = 1;
+        }
+      }
+    }
+  for (int jj = 2; jj <= 3; jj++)
+    {
+    for (int ii = 12; ii <= 13; ii++)
+      {
+      const vtkIdType index = (5 * Dims[1] + jj) * Dims[0] + ii;
+      pixel[index] = 4.f;
+      labelPixel[index] = 32000;
+      }
+    }
+  pixel[(5 * Dims[1] + 3) * Dims[0] + 13] = static_cast<float>(NaN);
+  labelPixel[(25 * Dims[1] + 15) * Dims[0] + 15] = -1;
+
+  vtkNew<vtkMRMLAstroVolumeNode> volumeNode;
+  volumeNode->SetAttribute("SlicerAstro.NAXIS", "3");
+  volumeNode->SetAndObserveImageData(imageData.GetPointer());
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> labelVolume;
+  labelVolume->SetAndObserveImageData(labelData.GetPointer());
+
+  vtkNew<vtkSlicerAstroVolumeLogic> logic;
+  vtkNew<vtkMRMLTableNode> tableNode;
+  if (!logic->CalculateSourceStatistics(volumeNode.GetPointer(), labelVolume.GetPointer(),
+                                        tableNode.GetPointer()))
+    {
+    std::cerr << "CalculateSourceStatistics failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // no WCS: the widths are in channels
+  vtkTable *table = tableNode->GetTable();
+  const double values1[5] = {450., 10., 5., 8., 15.};
+  const int extent1[6] = {4, 6, 7, 9, 10, 20};
+  const double values32000[5] = {12., 4., 37. / 3., 7. / 3., 5.};
+  const int extent32000[6] = {12, 13, 2, 3, 5, 5};
+  if (table->GetNumberOfRows() != 2 ||
+      !CheckRow(table, 0, 1, 99, values1, extent1) ||
+      !CheckRow(table, 1, 32000, 3, values32000, extent32000) ||
+      !vtkSlicerAstroTesting::Close("W50", table->GetValueByName(0, "W50").ToDouble(), 5.) ||
+      !vtkSlicerAstroTesting::Close("W20", table->GetValueByName(0, "W20").ToDouble(), 8.) ||
+      !vtkSlicerAstroTesting::Close("VSys", table->GetValueByName(0, "VSys").ToDouble(), 15.) ||
+      !vtkSlicerAstroTesting::Close("W50", table->GetValueByName(1, "W50").ToDouble(), 0.) ||
+      !vtkSlicerAstroTesting::Close("VSys", table->GetValueByName(1, "VSys").ToDouble(), 5.))
+    {
+    std::cerr << "3-D: wrong source statistics." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // 2-D data (the channel 15): no spectral widths
+  vtkNew<vtkImageData> planeData;
+  planeData->SetDimensions(Dims[0], Dims[1], 1);
+  planeData->AllocateScalars(VTK_FLOAT, 1);
+  vtkNew<vtkImageData> planeLabelData;
+  planeLabelData->SetDimensions(Dims[0], Dims[1], 1);
+  planeLabelData->AllocateScalars(VTK_SHORT, 1);
+  const vtkIdType plane = static_cast<vtkIdType>(Dims[0]) * Dims[1];
+  std::copy(pixel + 15 * plane, pixel + 16 * plane,
+            static_cast<float*>(planeData->GetScalarPointer()));
+  std::copy(labelPixel + 15 * plane, labelPixel + 16 * plane,
+            static_cast<short*>(planeLabelData->GetScalarPointer()));
+
+  vtkNew<vtkMRMLAstroVolumeNode> planeNode;
+  planeNode->SetAttribute("SlicerAstro.NAXIS", "2");
+  planeNode->SetAndObserveImageData(planeData.GetPointer());
+  vtkNew<vtkMRMLAstroLabelMapVolumeNode> planeLabelVolume;
+  planeLabelVolume->SetAndObserveImageData(planeLabelData.GetPointer());
+
+  if (!logic->CalculateSourceStatistics(planeNode.GetPointer(), planeLabelVolume.GetPointer(),
+                                        tableNode.GetPointer()))
+    {
+    std::cerr << "CalculateSourceStatistics (2-D) failed." << std::endl;
+    return EXIT_FAILURE;
+    }
+  table = tableNode->GetTable();
+  const double planeValues[5] = {90., 10., 5., 8., 0.};
+  const int planeExtent[6] = {4, 6, 7, 9, 0, 0};
+  if (table->GetNumberOfRows() != 1 ||
+      !CheckRow(table, 0, 1, 9, planeValues, planeExtent) ||
+      !vtkMath::IsNan(table->GetValueByName(0, "W50").ToDouble()) ||
+      !vtkMath::IsNan(table->GetValueByName(0, "W20").ToDouble()) ||
+      !vtkMath::IsNan(table->GetValueByName(0, "VSys").ToDouble()))
+    {
+    std::cerr << "2-D: wrong source statistics." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
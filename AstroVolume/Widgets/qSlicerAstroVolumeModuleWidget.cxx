@@ -368,6 +368,12 @@ void qSlicerAstroVolumeModuleWidgetPrivate::setupUi(qSlicerAstroVolumeModuleWidg
   QObject::connect(this->RMSDoubleSpinBox, SIGNAL(valueChanged(double)),
                    q, SLOT(onRMSValueChanged(double)));
 
+  QObject::connect(q, SIGNAL(astroVolumeNodeChanged(bool)),
+                   this->NoiseMethodComboBox, SLOT(setEnabled(bool)));
+
+  QObject::connect(this->NoiseMethodComboBox, SIGNAL(currentIndexChanged(int)),
+                   q, SLOT(onNoiseMethodChanged(int)));
+
   QObject::connect(q, SIGNAL(astroVolumeNodeChanged(bool)),
                    this->CalculateRMSPushButton, SLOT(setEnabled(bool)));
 
@@ -1458,6 +1464,26 @@ void qSlicerAstroVolumeModuleWidget::onRMSValueChanged(double RMS)
   d->astroVolumeNode->SetAttribute("SlicerAstro.RMS", DoubleToString(RMS).c_str());
 }
 
+//---------------------------------------------------------------------------
+void qSlicerAstroVolumeModuleWidget::onNoiseMethodChanged(int method)
+{
+  Q_D(qSlicerAstroVolumeModuleWidget);
+
+  if (!d->astroVolumeNode || d->astroVolumeNode->GetNoiseMethod() == method)
+    {
+    return;
+    }
+
+  // re-estimate the RMS (the spin box is updated by onMRMLVolumeNodeModified)
+  d->astroVolumeNode->SetNoiseMethod(method);
+  if (!d->astroVolumeNode->UpdateWholeImageData() ||
+      !d->astroVolumeNode->UpdateNoiseAttributes())
+    {
+    qCritical() << "qSlicerAstroVolumeModuleWidget::onNoiseMethodChanged : "
+                   "could not estimate the noise of "<<d->astroVolumeNode->GetName();
+    }
+}
+
 //---------------------------------------------------------------------------
 void qSlicerAstroVolumeModuleWidget::onVisibilityChanged(bool visibility)
 {
@@ -3008,6 +3034,8 @@ void qSlicerAstroVolumeModuleWidget::onMRMLSelectionNodeModified(vtkObject* send
       d->astroVolumeNode = vtkMRMLAstroVolumeNode::SafeDownCast(activeVolumeNode);
       this->qvtkReconnect(d->astroVolumeNode, vtkCommand::ModifiedEvent,
                           this, SLOT(onMRMLVolumeNodeModified()));
+      this->qvtkReconnect(d->astroVolumeNode, vtkMRMLDisplayableNode::DisplayModifiedEvent,
+                          this, SLOT(onMRMLVolumeDisplayNodeModified()));
       this->onMRMLVolumeNodeModified();
       }
     else
@@ -3026,6 +3054,8 @@ void qSlicerAstroVolumeModuleWidget::onMRMLSelectionNodeModified(vtkObject* send
     d->astroVolumeNode = vtkMRMLAstroVolumeNode::SafeDownCast(activeVolumeNode);
     this->qvtkReconnect(d->astroVolumeNode, vtkCommand::ModifiedEvent,
                         this, SLOT(onMRMLVolumeNodeModified()));
+    this->qvtkReconnect(d->astroVolumeNode, vtkMRMLDisplayableNode::DisplayModifiedEvent,
+                        this, SLOT(onMRMLVolumeDisplayNodeModified()));
     this->onMRMLVolumeNodeModified();
     }
   else if (activeLabelMapVolumeNode)
@@ -3118,6 +3148,9 @@ void qSlicerAstroVolumeModuleWidget::onMRMLVolumeNodeModified()
 
   double RMS = StringToDouble(d->astroVolumeNode->GetAttribute("SlicerAstro.RMS"));
   d->RMSDoubleSpinBox->setValue(RMS);
+  bool wasBlocked = d->NoiseMethodComboBox->blockSignals(true);
+  d->NoiseMethodComboBox->setCurrentIndex(d->astroVolumeNode->GetNoiseMethod());
+  d->NoiseMethodComboBox->blockSignals(wasBlocked);
   double max = StringToDouble(d->astroVolumeNode->GetAttribute("SlicerAstro.DATAMAX"));
   d->RMSDoubleSpinBox->setMaximum(max);
   double min = StringToDouble(d->astroVolumeNode->GetAttribute("SlicerAstro.DATAMIN"));
@@ -3164,6 +3197,34 @@ void qSlicerAstroVolumeModuleWidget::onMRMLVolumeNodeModified()
   d->OpticalVelocityButton->blockSignals(opticalState);
 }
 
+//--------------------------------------------------------------------------
+void qSlicerAstroVolumeModuleWidget::onMRMLVolumeDisplayNodeModified()
+{
+  Q_D(qSlicerAstroVolumeModuleWidget);
+
+  if (!d->astroVolumeNode)
+    {
+    return;
+    }
+
+  vtkMRMLAstroVolumeDisplayNode* astroVolumeDisplayNode =
+    d->astroVolumeNode->GetAstroVolumeDisplayNode();
+  if (!astroVolumeDisplayNode || !astroVolumeDisplayNode->GetAutoWindowLevel())
+    {
+    return;
+    }
+
+  // automatic window/level from the cached histogram of the volume
+  vtkSlicerAstroVolumeLogic* astroVolumeLogic =
+    vtkSlicerAstroVolumeLogic::SafeDownCast(this->logic());
+  if (!astroVolumeLogic ||
+      !astroVolumeLogic->UpdateWindowLevelFromHistogram(d->astroVolumeNode))
+    {
+    qWarning() << "qSlicerAstroVolumeModuleWidget::onMRMLVolumeDisplayNodeModified error : "
+                  "UpdateWindowLevelFromHistogram failed.";
+    }
+}
+
 //--------------------------------------------------------------------------
 void qSlicerAstroVolumeModuleWidget::setMRMLVolumeNode(vtkMRMLNode* node)
 {
@@ -110,12 +110,14 @@ protected slots:
   void onMRMLSelectionNodeModified(vtkObject* sender);
   void onMRMLSelectionNodeReferenceAdded(vtkObject* sender);
   void onMRMLSelectionNodeReferenceRemoved(vtkObject* sender);
+  void onMRMLVolumeDisplayNodeModified();
   void onMRMLVolumeNodeModified();
   void onMRMLVolumeRenderingDisplayNodeModified(vtkObject* sender);
   void onPresetsNodeChanged(vtkMRMLNode*);
   void onPushButtonCovertLabelMapToSegmentationClicked();
   void onPushButtonConvertSegmentationToLabelMapClicked();
   void onRMSValueChanged(double RMS);
+  void onNoiseMethodChanged(int method);
   void onROICropDisplayCheckBoxToggled(bool toggle);
   void onSegmentEditorNodeModified(vtkObject* sender);
   void resetStretch(vtkMRMLNode* node);
@@ -18,7 +18,13 @@
 ==============================================================================*/
 
 // Qt includes
+#include <QCoreApplication>
+#include <QDebug>
 #include <QFileInfo>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
 
 // SlicerQt includes
 #include "qSlicerAstroVolumeIOOptionsWidget.h"
@@ -29,12 +35,18 @@
 #include <vtkSlicerVolumesLogic.h>
 
 // MRML includes
+#include <vtkCacheManager.h>
 #include <vtkMRMLAstroVolumeNode.h>
 #include <vtkMRMLAstroLabelMapVolumeNode.h>
 #include <vtkMRMLAstroVolumeDisplayNode.h>
+#include <vtkMRMLAstroVolumeStorageNode.h>
+#include <vtkMRMLAstroLabelMapVolumeDisplayNode.h>
+#include <vtkMRMLScene.h>
 #include <vtkMRMLSelectionNode.h>
+#include <vtkMRMLVolumeDisplayNode.h>
 
 // VTK includes
+#include <vtkNew.h>
 #include <vtkSmartPointer.h>
 #include <vtkStringArray.h>
 
@@ -43,7 +55,62 @@ class qSlicerAstroVolumeReaderPrivate
 {
   public:
   vtkSmartPointer<vtkSlicerVolumesLogic> Logic;
+
+  void setActiveVolume(vtkMRMLVolumeNode* node);
+};
+
+//-----------------------------------------------------------------------------
+void qSlicerAstroVolumeReaderPrivate::setActiveVolume(vtkMRMLVolumeNode* node)
+{
+  vtkSlicerApplicationLogic* appLogic =
+    this->Logic->GetApplicationLogic();
+  vtkMRMLSelectionNode* selectionNode =
+    appLogic ? appLogic->GetSelectionNode() : 0;
+  if (selectionNode)
+    {
+    if (vtkMRMLAstroLabelMapVolumeNode::SafeDownCast(node))
+      {
+      selectionNode->SetReferenceActiveLabelVolumeID(node->GetID());
+      }
+    else
+      {
+      selectionNode->SetReferenceActiveVolumeID(node->GetID());
+      }
+    if (appLogic)
+      {
+      appLogic->PropagateVolumeSelection(); // includes FitSliceToAll by default
+      }
+    }
+}
+
+namespace
+{
+//-----------------------------------------------------------------------------
+// Reads one file of a batch on a worker thread (see loadFiles)
+class qSlicerAstroVolumePreloadTask : public QRunnable
+{
+public:
+  qSlicerAstroVolumePreloadTask(vtkMRMLAstroVolumeStorageNode* storageNode,
+                                bool labelMap, int numberOfThreads, int* status)
+    : StorageNode(storageNode)
+    , LabelMap(labelMap)
+    , NumberOfThreads(numberOfThreads)
+    , Status(status)
+  {
+  }
+
+  virtual void run()
+  {
+    *this->Status = this->StorageNode->PreloadData(this->LabelMap, this->NumberOfThreads);
+  }
+
+private:
+  vtkMRMLAstroVolumeStorageNode* StorageNode;
+  bool LabelMap;
+  int NumberOfThreads;
+  int* Status;
 };
+}// end namespace
 
 //-----------------------------------------------------------------------------
 qSlicerAstroVolumeReader::qSlicerAstroVolumeReader(QObject* _parent)
@@ -97,8 +164,10 @@ QStringList qSlicerAstroVolumeReader::extensions()const
   return QStringList()
     << "Volume (*.fits)"
     << "Volume (*.fits.gz)"
+    << "Volume (*.fits.fz)"
     << "Image (*.fits)"
     << "Image (*.fits.gz)"
+    << "Image (*.fits.fz)"
     << "All Files (*)";
 }
 
@@ -115,6 +184,20 @@ qSlicerIOOptions* qSlicerAstroVolumeReader::options()const
 bool qSlicerAstroVolumeReader::load(const IOProperties& properties)
 {
   Q_D(qSlicerAstroVolumeReader);
+  // the HDU and the 4th axis plane are storage node options:
+  // such files are loaded with loadFiles, which creates the storage nodes
+  if (properties.contains("batchFileNames") ||
+      properties.contains("hdu") ||
+      properties.contains("plane"))
+    {
+    QStringList fileNames = properties.contains("batchFileNames") ?
+      properties["batchFileNames"].toStringList() :
+      QStringList(properties["fileName"].toString());
+    QStringList loadedNodes = this->loadFiles(fileNames, properties);
+    this->setLoadedNodes(loadedNodes);
+    return !loadedNodes.isEmpty();
+    }
+
   Q_ASSERT(properties.contains("fileName"));
   QString fileName = properties["fileName"].toString();
 
@@ -168,25 +251,7 @@ bool qSlicerAstroVolumeReader::load(const IOProperties& properties)
         node->GetDisplayNode()->SetAndObserveColorNodeID(colorNodeID.toLatin1());
         }
       }
-    vtkSlicerApplicationLogic* appLogic =
-      d->Logic->GetApplicationLogic();
-    vtkMRMLSelectionNode* selectionNode =
-      appLogic ? appLogic->GetSelectionNode() : 0;
-    if (selectionNode)
-      {
-      if (vtkMRMLAstroLabelMapVolumeNode::SafeDownCast(node))
-        {
-        selectionNode->SetReferenceActiveLabelVolumeID(node->GetID());
-        }
-      else
-        {
-        selectionNode->SetReferenceActiveVolumeID(node->GetID());
-        }
-      if (appLogic)
-        {
-        appLogic->PropagateVolumeSelection(); // includes FitSliceToAll by default
-        }
-      }
+    d->setActiveVolume(node);
     this->setLoadedNodes(QStringList(QString(node->GetID())));
     }
   else
@@ -196,3 +261,135 @@ bool qSlicerAstroVolumeReader::load(const IOProperties& properties)
 
   return node != 0;
 }
+
+//-----------------------------------------------------------------------------
+QStringList qSlicerAstroVolumeReader::loadFiles(const QStringList& fileNames,
+                                                const IOProperties& properties)
+{
+  Q_D(qSlicerAstroVolumeReader);
+  QStringList loadedNodes;
+  vtkMRMLScene* scene = this->mrmlScene();
+  if (!scene || fileNames.isEmpty())
+    {
+    return loadedNodes;
+    }
+
+  bool labelMap = properties.contains("labelmap") && properties["labelmap"].toBool();
+  bool center = properties.contains("center") && properties["center"].toBool();
+
+  // read the files and compute the statistics on the thread pool.
+  // The storage nodes are not in the scene yet. A non reentrant CFITSIO
+  // can not be used from several threads: the files are then read
+  // one after the other on the main thread.
+  const bool concurrent = fileNames.size() > 1 &&
+    vtkMRMLAstroVolumeStorageNode::CanPreloadConcurrently();
+  const int idealThreadCount = qMax(1, QThread::idealThreadCount());
+  const int numberOfWorkers = qMin(idealThreadCount, fileNames.size());
+  // the OpenMP threads of the readers are shared among the workers
+  const int numberOfThreads = qMax(1, idealThreadCount / numberOfWorkers);
+
+  // the storage nodes keep the statistics in the application cache
+  QString statisticsCacheDirectory;
+  if (scene->GetCacheManager() && scene->GetCacheManager()->GetRemoteCacheDirectory() &&
+      *scene->GetCacheManager()->GetRemoteCacheDirectory())
+    {
+    statisticsCacheDirectory =
+      QString(scene->GetCacheManager()->GetRemoteCacheDirectory()) + "/SlicerAstro";
+    }
+
+  QList<vtkSmartPointer<vtkMRMLAstroVolumeStorageNode> > storageNodes;
+  QVector<int> status(fileNames.size(), 0);
+  QThreadPool pool;
+  pool.setMaxThreadCount(numberOfWorkers);
+  for (int fileIndex = 0; fileIndex < fileNames.size(); fileIndex++)
+    {
+    vtkSmartPointer<vtkMRMLAstroVolumeStorageNode> storageNode =
+      vtkSmartPointer<vtkMRMLAstroVolumeStorageNode>::New();
+    storageNode->SetFileName(fileNames[fileIndex].toLatin1());
+    storageNode->SetCenterImage(center);
+    storageNode->SetHDUNumber(properties.value("hdu", 0).toInt());
+    storageNode->SetFourthAxisPlane(properties.value("plane", 0).toInt());
+    if (!statisticsCacheDirectory.isEmpty())
+      {
+      storageNode->SetStatisticsCacheDirectory(statisticsCacheDirectory.toLatin1());
+      }
+    storageNodes.append(storageNode);
+    if (concurrent)
+      {
+      pool.start(new qSlicerAstroVolumePreloadTask(storageNode, labelMap,
+                                                   numberOfThreads, &status[fileIndex]));
+      }
+    else
+      {
+      status[fileIndex] = storageNode->PreloadData(labelMap);
+      }
+    }
+  while (!pool.waitForDone(50))
+    {
+    QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
+
+  // build the nodes on the main thread: ReadData uses the preloaded data
+  vtkMRMLVolumeNode* lastNode = 0;
+  for (int fileIndex = 0; fileIndex < fileNames.size(); fileIndex++)
+    {
+    if (!status[fileIndex])
+      {
+      qCritical() << "qSlicerAstroVolumeReader::loadFiles : could not read "
+                  << fileNames[fileIndex];
+      continue;
+      }
+
+    QString name = QFileInfo(fileNames[fileIndex]).baseName();
+    if (fileNames.size() == 1 && properties.contains("name"))
+      {
+      name = properties["name"].toString();
+      }
+    vtkSmartPointer<vtkMRMLVolumeNode> node;
+    vtkSmartPointer<vtkMRMLVolumeDisplayNode> displayNode;
+    if (labelMap)
+      {
+      node = vtkSmartPointer<vtkMRMLAstroLabelMapVolumeNode>::New();
+      displayNode = vtkSmartPointer<vtkMRMLAstroLabelMapVolumeDisplayNode>::New();
+      }
+    else
+      {
+      node = vtkSmartPointer<vtkMRMLAstroVolumeNode>::New();
+      vtkSmartPointer<vtkMRMLAstroVolumeDisplayNode> astroDisplayNode =
+        vtkSmartPointer<vtkMRMLAstroVolumeDisplayNode>::New();
+      astroDisplayNode->SetAutoWindowLevel(0);
+      displayNode = astroDisplayNode;
+      }
+    node->SetName(scene->GetUniqueNameByString(name.toLatin1()).c_str());
+    scene->AddNode(node);
+    scene->AddNode(displayNode);
+    displayNode->SetDefaultColorMap();
+    node->SetAndObserveDisplayNodeID(displayNode->GetID());
+    scene->AddNode(storageNodes[fileIndex]);
+    node->SetAndObserveStorageNodeID(storageNodes[fileIndex]->GetID());
+
+    if (!storageNodes[fileIndex]->ReadData(node))
+      {
+      qCritical() << "qSlicerAstroVolumeReader::loadFiles : could not load "
+                  << fileNames[fileIndex];
+      scene->RemoveNode(storageNodes[fileIndex]);
+      scene->RemoveNode(displayNode);
+      scene->RemoveNode(node);
+      continue;
+      }
+
+    if (properties.contains("colorNodeID"))
+      {
+      displayNode->SetAndObserveColorNodeID(properties["colorNodeID"].toString().toLatin1());
+      }
+    loadedNodes << QString(node->GetID());
+    lastNode = node;
+    }
+
+  if (lastNode && d->Logic)
+    {
+    d->setActiveVolume(lastNode);
+    }
+
+  return loadedNodes;
+}
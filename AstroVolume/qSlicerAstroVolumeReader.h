@@ -47,7 +47,16 @@ public:
   virtual QStringList extensions()const;
   virtual qSlicerIOOptions* options()const;
 
+  /// Load the file "fileName". If the property "batchFileNames" is set,
+  /// all the listed files are loaded with loadFiles. The properties "hdu"
+  /// and "plane" select the image HDU and the plane of the 4th axis.
   virtual bool load(const IOProperties& properties);
+
+  /// Load many files at once. The files are read, and their statistics
+  /// calculated, concurrently on a thread pool. The nodes are created
+  /// and added to the scene on the main thread afterwards.
+  /// Returns the IDs of the loaded nodes.
+  QStringList loadFiles(const QStringList& fileNames, const IOProperties& properties);
 protected:
   QScopedPointer<qSlicerAstroVolumeReaderPrivate> d_ptr;
 
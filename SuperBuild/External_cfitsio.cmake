@@ -27,6 +27,13 @@ if((NOT DEFINED CFITSIO_INCLUDE_DIR OR NOT DEFINED CFITSIO_LIBRARY_DIR) AND NOT
   set(${proj}_BINARY_DIR ${CMAKE_BINARY_DIR}/${proj}-build)
   set(${proj}_INSTALL_DIR ${CMAKE_BINARY_DIR}/${proj}-install)
 
+  # Reentrant build: the FITS reader decodes tile-compressed images
+  # and loads files from several threads (see fits_is_reentrant)
+  set(${proj}_USE_PTHREADS ON)
+  if(WIN32)
+    set(${proj}_USE_PTHREADS OFF)
+  endif()
+
   ExternalProject_Add(${proj}
     ${${proj}_EP_ARGS}
     GIT_REPOSITORY "${git_protocol}://github.com/Punzo/CFITSIO.git"
@@ -40,6 +47,7 @@ if((NOT DEFINED CFITSIO_INCLUDE_DIR OR NOT DEFINED CFITSIO_LIBRARY_DIR) AND NOT
       -DCMAKE_C_FLAGS:STRING=${ep_common_c_flags}
       -DCMAKE_BUILD_TYPE:STRING=${CMAKE_BUILD_TYPE}
       -DBUILD_TESTING:BOOL=OFF
+      -DUSE_PTHREADS:BOOL=${${proj}_USE_PTHREADS}
       -DCMAKE_INSTALL_PREFIX:PATH=${${proj}_INSTALL_DIR}
       -DCMAKE_RUNTIME_OUTPUT_DIRECTORY:PATH=${CMAKE_BINARY_DIR}/${Slicer_THIRDPARTY_BIN_DIR}
       -DCMAKE_LIBRARY_OUTPUT_DIRECTORY:PATH=${CMAKE_BINARY_DIR}/${Slicer_THIRDPARTY_LIB_DIR}
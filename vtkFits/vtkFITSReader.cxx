@@ -20,11 +20,17 @@
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <list>
+#include <map>
+#include <math.h>
 #include <stdio.h>
 #include <string>
+#include <unistd.h>
 #include <zlib.h>
 
 // vtkASTRO includes
+#include "vtkSlicerAstroConfigure.h"
 #include <vtkFITSReader.h>
 
 // Qt includes
@@ -32,10 +38,12 @@
 #include <QRegExp>
 
 // VTK includes
+#include <vtkByteSwap.h>
 #include <vtkDoubleArray.h>
 #include <vtkFloatArray.h>
 #include <vtkImageData.h>
 #include <vtkInformation.h>
+#include <vtkIntArray.h>
 #include <vtkMatrix4x4.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
@@ -43,6 +51,7 @@
 #include <vtkShortArray.h>
 #include <vtksys/SystemTools.hxx>
 #include <vtkStreamingDemandDrivenPipeline.h>
+#include <vtkUnsignedCharArray.h>
 
 // Slicer includes
 #include "vtkMRMLVolumeArchetypeStorageNode.h"
@@ -50,8 +59,53 @@
 // STD includes
 #include <sstream>
 
+// OpenMP includes
+#ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+#include <omp.h>
+#endif
+
 vtkStandardNewMacro(vtkFITSReader);
 
+//----------------------------------------------------------------------------
+class vtkFITSReader::vtkSlabCache
+{
+public:
+  vtkSlabCache();
+  void Clear();
+  void Touch(int slab);
+
+  /// slab index -> data of the slab
+  std::map<int, std::vector<char> > Slabs;
+  /// slab indexes, most recently used first
+  std::list<int> Recent;
+  size_t Size;
+  int LastSlab;
+  int Direction;
+};
+
+//----------------------------------------------------------------------------
+vtkFITSReader::vtkSlabCache::vtkSlabCache()
+{
+  this->Clear();
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSReader::vtkSlabCache::Clear()
+{
+  this->Slabs.clear();
+  this->Recent.clear();
+  this->Size = 0;
+  this->LastSlab = -1;
+  this->Direction = 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSReader::vtkSlabCache::Touch(int slab)
+{
+  this->Recent.remove(slab);
+  this->Recent.push_front(slab);
+}
+
 vtkFITSReader::vtkFITSReader()
 {
   RasToIjkMatrix = NULL;
@@ -66,10 +120,37 @@ vtkFITSReader::vtkFITSReader()
   WCSStatus = 0;
   wcserr_enable(1);
   FixGipsyHeaderOn = false;
+  NumberOfFileOpens = 0;
+  MemoryBuffer = NULL;
+  MemoryBufferSize = 0;
+  KeepScaledIntegers = false;
+  ScaledIntegerData = false;
+  QuantizeToShort = false;
+  QuantizedData = false;
+  QuantizeRangeSet = false;
+  QuantizeScale = 1.;
+  QuantizeZero = 0.;
+  Paging = false;
+  PagingMemoryBudget = 1024 * 1024 * 1024;
+  PagingSlabThickness = 8;
+  PagingPrefetch = 1;
+  NumberOfPagedSlabReads = 0;
+  SlabCache = new vtkSlabCache;
+  HDUNumber = 0;
+  FourthAxisPlane = 0;
+  CurrentHDUNumber = 0;
+  CurrentFourthAxisPlane = 0;
+  SelectedPlane = 0;
+  DefaultHDUNumber = 1;
 }
 
 vtkFITSReader::~vtkFITSReader()
 {
+  this->CloseFile();
+
+  delete this->SlabCache;
+  this->SlabCache = NULL;
+
   if (RasToIjkMatrix)
     {
     RasToIjkMatrix->Delete();
@@ -214,31 +295,348 @@ struct wcsprm* vtkFITSReader::GetWCSStruct()
   return this->WCS;
 }
 
-// Utility function to decompress files with zlib
+namespace
+{
+// size of the zlib input/output windows
+const size_t GZIP_CHUNK = 4 * 1024 * 1024;
+
+//----------------------------------------------------------------------------
+struct GzipMember
+{
+  size_t InOffset;
+  size_t InSize;
+  size_t OutOffset;
+  size_t OutSize;
+};
+
+//----------------------------------------------------------------------------
+size_t ReadLittleEndian32(const unsigned char* p)
+{
+  return static_cast<size_t>(p[0]) |
+         (static_cast<size_t>(p[1]) << 8) |
+         (static_cast<size_t>(p[2]) << 16) |
+         (static_cast<size_t>(p[3]) << 24);
+}
+
+//----------------------------------------------------------------------------
+// Compressed size of the block-gzip (BGZF) member starting at offset,
+// read from its 'BC' extra subfield. Returns 0 for any other gzip member.
+size_t BlockGzipMemberSize(const unsigned char* in, size_t offset, size_t size)
+{
+  if (offset + 18 > size)
+    {
+    return 0;
+    }
+
+  const unsigned char* p = in + offset;
+  if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4))
+    {
+    return 0;
+    }
+
+  size_t xlen = p[10] | (p[11] << 8);
+  size_t pos = 12;
+  while (pos + 4 <= 12 + xlen && offset + pos + 4 <= size)
+    {
+    size_t slen = p[pos + 2] | (p[pos + 3] << 8);
+    if (p[pos] == 'B' && p[pos + 1] == 'C' && slen == 2 &&
+        pos + 6 <= 12 + xlen && offset + pos + 6 <= size)
+      {
+      size_t bsize = (p[pos + 4] | (p[pos + 5] << 8)) + 1;
+      return (offset + bsize <= size) ? bsize : 0;
+      }
+    pos += 4 + slen;
+    }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// Inflate a single gzip member whose uncompressed size is known.
+bool InflateMember(const unsigned char* in, size_t inSize,
+                   unsigned char* out, size_t outSize)
+{
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 15 + 16) != Z_OK)
+    {
+    return false;
+    }
+
+  strm.next_in = const_cast<Bytef*>(in);
+  strm.avail_in = static_cast<uInt>(inSize);
+  strm.next_out = out;
+  strm.avail_out = static_cast<uInt>(outSize);
+
+  int ret = inflate(&strm, Z_FINISH);
+  bool success = (ret == Z_STREAM_END && strm.total_out == outSize);
+  inflateEnd(&strm);
+  return success;
+}
+
+//----------------------------------------------------------------------------
+// Streaming inflate of a (possibly multi-member) gzip buffer.
+bool InflateStream(const unsigned char* in, size_t inSize,
+                   unsigned char** outBuffer, size_t* outSize)
+{
+  // ISIZE of the last member is a good first guess for single-member files
+  size_t capacity = inSize >= 4 ? ReadLittleEndian32(in + inSize - 4) : 0;
+  if (capacity < inSize)
+    {
+    capacity = 4 * inSize;
+    }
+  if (capacity < GZIP_CHUNK)
+    {
+    capacity = GZIP_CHUNK;
+    }
+
+  unsigned char* out = static_cast<unsigned char*>(malloc(capacity));
+  if (!out)
+    {
+    return false;
+    }
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 15 + 32) != Z_OK)
+    {
+    free(out);
+    return false;
+    }
+
+  size_t inPos = 0, outPos = 0;
+  bool done = false, success = true;
+  while (!done)
+    {
+    if (outPos == capacity)
+      {
+      unsigned char* grown = static_cast<unsigned char*>(realloc(out, 2 * capacity));
+      if (!grown)
+        {
+        success = false;
+        break;
+        }
+      out = grown;
+      capacity *= 2;
+      }
+
+    uInt availIn = static_cast<uInt>(std::min(inSize - inPos, GZIP_CHUNK));
+    uInt availOut = static_cast<uInt>(std::min(capacity - outPos, GZIP_CHUNK));
+    strm.next_in = const_cast<Bytef*>(in + inPos);
+    strm.avail_in = availIn;
+    strm.next_out = out + outPos;
+    strm.avail_out = availOut;
+
+    int ret = inflate(&strm, Z_NO_FLUSH);
+    inPos += availIn - strm.avail_in;
+    outPos += availOut - strm.avail_out;
+
+    if (ret == Z_STREAM_END)
+      {
+      // concatenated members (gzip -c a b, pigz, bgzip): keep going
+      if (inPos + 1 < inSize && in[inPos] == 0x1f && in[inPos + 1] == 0x8b)
+        {
+        inflateReset(&strm);
+        }
+      else
+        {
+        done = true;
+        }
+      }
+    else if (ret == Z_BUF_ERROR)
+      {
+      // no progress with free output space left: the input is truncated
+      if (strm.avail_out != 0)
+        {
+        success = false;
+        break;
+        }
+      }
+    else if (ret != Z_OK)
+      {
+      success = false;
+      break;
+      }
+    }
+
+  inflateEnd(&strm);
+
+  if (!success)
+    {
+    free(out);
+    return false;
+    }
+
+  *outBuffer = out;
+  *outSize = outPos;
+  return true;
+}
+
+} // end namespace
+
+// Utility function to load a whole file in memory
+//----------------------------------------------------------------------------
+bool vtkFITSReader::read_to_memory(const char *infilename, void **buffer, size_t *size)
+{
+  *buffer = NULL;
+  *size = 0;
+
+  size_t inSize = static_cast<size_t>(vtksys::SystemTools::FileLength(infilename));
+  FILE *infile = fopen(infilename, "rb");
+  if (!infile || inSize == 0)
+    {
+    if (infile)
+      {
+      fclose(infile);
+      }
+    return false;
+    }
+
+  unsigned char* in = static_cast<unsigned char*>(malloc(inSize));
+  if (!in)
+    {
+    fclose(infile);
+    return false;
+    }
+
+  size_t read = 0;
+  while (read < inSize)
+    {
+    size_t num_read = fread(in + read, 1, std::min(inSize - read, GZIP_CHUNK), infile);
+    if (num_read == 0)
+      {
+      break;
+      }
+    read += num_read;
+    }
+  fclose(infile);
+
+  if (read != inSize)
+    {
+    free(in);
+    return false;
+    }
+
+  *buffer = in;
+  *size = inSize;
+  return true;
+}
+
+// Utility function to decompress gzip files in memory with zlib.
+// Block-gzip files (bgzip, multi-member with the member sizes stored
+// in the 'BC' extra field) are inflated in parallel.
 //----------------------------------------------------------------------------
-bool vtkFITSReader::decompress_one_file(const char *infilename, const char *outfilename)
+bool vtkFITSReader::decompress_to_memory(const char *infilename, void **buffer, size_t *size)
 {
-  gzFile infile = gzopen(infilename, "rb");
-  FILE *outfile = fopen(outfilename, "wb");
+  *buffer = NULL;
+  *size = 0;
 
-  if (!infile || !outfile)
+  void *inBuffer = NULL;
+  size_t inSize = 0;
+  if (!vtkFITSReader::read_to_memory(infilename, &inBuffer, &inSize))
     {
     return false;
     }
+  unsigned char* in = static_cast<unsigned char*>(inBuffer);
 
-  char buffer[128];
-  int num_read = 0;
-  while ((num_read = gzread(infile, buffer, sizeof(buffer))) > 0)
+  // index the members when every one of them carries its compressed size
+  std::vector<GzipMember> members;
+  size_t offset = 0, outTotal = 0;
+  while (offset < inSize)
     {
-    fwrite(buffer, 1, num_read, outfile);
+    size_t bsize = BlockGzipMemberSize(in, offset, inSize);
+    if (bsize < 18)
+      {
+      members.clear();
+      break;
+      }
+    GzipMember member;
+    member.InOffset = offset;
+    member.InSize = bsize;
+    member.OutOffset = outTotal;
+    member.OutSize = ReadLittleEndian32(in + offset + bsize - 4);
+    members.push_back(member);
+    outTotal += member.OutSize;
+    offset += bsize;
+    }
+
+  bool success = true;
+  unsigned char* out = NULL;
+  size_t outSize = 0;
+
+  if (members.size() > 1)
+    {
+    out = static_cast<unsigned char*>(malloc(outTotal > 0 ? outTotal : 1));
+    if (!out)
+      {
+      free(in);
+      return false;
+      }
+    outSize = outTotal;
+
+    const int numberOfMembers = static_cast<int>(members.size());
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp parallel for schedule(dynamic, 64) shared(members, success)
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    for (int ii = 0; ii < numberOfMembers; ii++)
+      {
+      const GzipMember& member = members[ii];
+      if (member.OutSize == 0)
+        {
+        continue;
+        }
+      if (!InflateMember(in + member.InOffset, member.InSize,
+                         out + member.OutOffset, member.OutSize))
+        {
+        success = false;
+        }
+      }
+
+    if (!success)
+      {
+      free(out);
+      }
     }
+  else
+    {
+    success = InflateStream(in, inSize, &out, &outSize);
+    }
+
+  free(in);
 
-  gzclose(infile);
-  fclose(outfile);
+  if (!success)
+    {
+    return false;
+    }
 
+  *buffer = out;
+  *size = outSize;
   return true;
 }
 
+namespace
+{
+//----------------------------------------------------------------------------
+// Check the first (2880 bytes) header block of a gzipped file:
+// a FITS file starts with the SIMPLE keyword.
+bool IsGzippedFITSFile(const char* filename)
+{
+  gzFile file = gzopen(filename, "rb");
+  if (!file)
+    {
+    return false;
+    }
+
+  char block[2880];
+  const int num_read = gzread(file, block, sizeof(block));
+  gzclose(file);
+
+  return num_read == static_cast<int>(sizeof(block)) &&
+         !strncmp(block, "SIMPLE  =", 9);
+}
+
+} // end namespace
+
 //----------------------------------------------------------------------------
 int vtkFITSReader::CanReadFile(const char* filename)
 {
@@ -254,52 +652,128 @@ int vtkFITSReader::CanReadFile(const char* filename)
     }
 
   std::string extension = vtksys::SystemTools::LowerCase( vtksys::SystemTools::GetFilenameLastExtension(fname) );
-  if (extension != ".fits" && extension != ".gz")
+  if (extension != ".fits" && extension != ".gz" && extension != ".fz")
     {
     vtkDebugMacro(<<"vtkFITSReader::CanReadFile: The filename extension is not recognized.");
     return false;
     }
 
-  std::string FileName = filename;
-  std::string gz = ".gz";
-  std::size_t found =  FileName.find(gz);
-  if (found != std::string::npos)
+  // gzipped files are decompressed in memory by OpenFile
+  this->SetCompression(extension == ".gz");
+
+  // do not inflate the whole file here: only the first header block
+  // is checked, the file is decompressed on read
+  if (this->Compression)
     {
-    FileName.replace(FileName.find(gz),gz.length(),"");
-    if (!vtkFITSReader::decompress_one_file(filename, FileName.c_str()))
+    if (!IsGzippedFITSFile(filename))
       {
-      vtkErrorMacro(<<"vtkFITSReader::CanReadFile: Decompression failed.");
+      vtkDebugMacro(<<"vtkFITSReader::CanReadFile: "<<fname<<" is not a FITS file.");
+      return false;
       }
-    this->SetFileName(FileName.c_str());
-    this->SetCompression(true);
+    return true;
     }
-  // We have the correct extension, so now check for the Fits magic.
-  std::ifstream inputStream;
-
-  inputStream.open(FileName.c_str(), std::ios::in | std::ios::binary );
 
-  if (inputStream.fail())
+  // We have the correct extension, so now let CFITSIO check the file.
+  // The handle is kept open and reused by ExecuteInformation and
+  // ExecuteDataWithInformation.
+  if (!this->OpenFile(filename))
     {
+    vtkDebugMacro(<<"vtkFITSReader::CanReadFile: "<<fname<<" is not a FITS file.");
     return false;
     }
 
-  char magic[5] = {'\0','\0','\0','\0','\0'};
-  inputStream.read(magic,4*sizeof(char));
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSReader::SetFileName(const char* filename)
+{
+  if (!filename || this->OpenedFileName != filename)
+    {
+    this->CloseFile();
+    }
+
+  this->Superclass::SetFileName(filename);
+}
 
-  if (inputStream.eof())
+//----------------------------------------------------------------------------
+bool vtkFITSReader::OpenFile(const char* filename)
+{
+  if (!filename)
     {
-    inputStream.close();
     return false;
     }
 
-  if (strcmp(magic,"SIMP")==0)
+  if (this->fptr && this->OpenedFileName == filename)
     {
-    inputStream.close();
     return true;
     }
 
-  inputStream.close();
-  return false;
+  this->CloseFile();
+
+  int status = 0;
+  std::string extension = vtksys::SystemTools::LowerCase(
+    vtksys::SystemTools::GetFilenameLastExtension(filename));
+  if (extension == ".gz")
+    {
+    // no temporary file: CFITSIO reads the inflated buffer directly
+    if (!vtkFITSReader::decompress_to_memory(filename, &this->MemoryBuffer, &this->MemoryBufferSize))
+      {
+      vtkErrorMacro(<<"vtkFITSReader::OpenFile: Decompression of "<<filename<<" failed.");
+      return false;
+      }
+
+    int naxis = 0;
+    if (fits_open_memfile(&this->fptr, filename, READONLY, &this->MemoryBuffer,
+                          &this->MemoryBufferSize, 0, NULL, &status) ||
+        fits_get_img_dim(this->fptr, &naxis, &status) ||
+        // as fits_open_data: skip an empty primary HDU
+        (naxis == 0 && fits_movrel_hdu(this->fptr, 1, NULL, &status)))
+      {
+      this->ReadStatus = status;
+      this->CloseFile();
+      fits_clear_errmsg();
+      return false;
+      }
+    }
+  else if (fits_open_data(&this->fptr, filename, READONLY, &status))
+    {
+    this->ReadStatus = status;
+    this->fptr = NULL;
+    fits_clear_errmsg();
+    return false;
+    }
+
+  fits_get_hdu_num(this->fptr, &this->DefaultHDUNumber);
+  this->OpenedFileName = filename;
+  this->NumberOfFileOpens++;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSReader::CloseFile()
+{
+  if (this->fptr)
+    {
+    int status = 0;
+    if (fits_close_file(this->fptr, &status))
+      {
+      vtkErrorMacro("vtkFITSReader::CloseFile: ERROR IN CFITSIO! Error closing "
+                    << this->OpenedFileName << ":\n");
+      fits_report_error(stderr, status);
+      }
+    }
+
+  // CFITSIO does not own the buffer of a READONLY memory file
+  if (this->MemoryBuffer)
+    {
+    free(this->MemoryBuffer);
+    }
+
+  this->MemoryBuffer = NULL;
+  this->MemoryBufferSize = 0;
+  this->fptr = NULL;
+  this->OpenedFileName.clear();
 }
 
 //----------------------------------------------------------------------------
@@ -321,7 +795,9 @@ void vtkFITSReader::ExecuteInformation()
   // save the Fits struct for the current file and
   // don't re-execute the read unless the filename changes
   if (this->CurrentFileName != NULL &&
-       !strcmp (this->CurrentFileName, this->GetFileName()))
+       !strcmp (this->CurrentFileName, this->GetFileName()) &&
+       this->CurrentHDUNumber == this->HDUNumber &&
+       this->CurrentFourthAxisPlane == this->FourthAxisPlane)
     {
     // filename hasn't changed, don't re-execute
     return;
@@ -335,8 +811,10 @@ void vtkFITSReader::ExecuteInformation()
   this->CurrentFileName = new char[1 + strlen(this->GetFileName())];
   strcpy (this->CurrentFileName, this->GetFileName());
 
+  this->SlabCache->Clear();
 
-  if(fits_open_data(&fptr, this->GetFileName(), READONLY, &ReadStatus))
+  // reuse the handle opened by CanReadFile, if any
+  if (!this->OpenFile(this->GetFileName()))
     {
     vtkErrorMacro("vtkFITSReader::ExecuteInformation: ERROR IN CFITSIO! Error reading"
                   " "<< this->GetFileName() << ": \n");
@@ -344,6 +822,39 @@ void vtkFITSReader::ExecuteInformation()
     return;
     }
 
+  this->CurrentHDUNumber = this->HDUNumber;
+  this->CurrentFourthAxisPlane = this->FourthAxisPlane;
+  this->SelectedPlane = 0;
+
+  int hdu = this->HDUNumber > 0 ? this->HDUNumber : this->DefaultHDUNumber;
+  int hduType = IMAGE_HDU, naxis = 0, status = 0;
+  if (fits_movabs_hdu(this->fptr, hdu, &hduType, &status) ||
+      fits_get_img_dim(this->fptr, &naxis, &status))
+    {
+    this->ReadStatus = status;
+    vtkErrorMacro("vtkFITSReader::ExecuteInformation: ERROR IN CFITSIO! Could not move to HDU "
+                  << hdu << " of " << this->GetFileName() << ": \n");
+    fits_report_error(stderr, ReadStatus);
+    return;
+    }
+  if (hduType != IMAGE_HDU || naxis < 1)
+    {
+    vtkErrorMacro("vtkFITSReader::ExecuteInformation: HDU " << hdu << " of "
+                  << this->GetFileName() << " has no image data. \n");
+    return;
+    }
+
+  // the file changed: drop the WCS parsed from the previous one
+  if (this->WCS)
+    {
+    if ((WCSStatus = wcsvfree(&NWCS, &WCS)))
+      {
+      vtkErrorMacro("vtkFITSReader::ExecuteInformation: wcsfree ERROR "<<WCSStatus<<": "<<wcshdr_errmsg[WCSStatus]<<"\n");
+      }
+    this->WCS = NULL;
+    this->NWCS = 0;
+    }
+
   HeaderKeyValue.clear();
 
   if (this->RasToIjkMatrix)
@@ -379,6 +890,9 @@ void vtkFITSReader::ExecuteInformation()
   // Set type information
   std::string dataModel = this->GetHeaderValue("SlicerAstro.DATAMODEL");
 
+  this->ScaledIntegerData = false;
+  this->QuantizedData = false;
+  this->QuantizeRangeSet = false;
   if (!dataModel.compare("MASK"))
     {
     this->SetDataType( VTK_SHORT );
@@ -390,30 +904,39 @@ void vtkFITSReader::ExecuteInformation()
            !dataModel.compare("FIRSTMOMENTMAP") ||
            !dataModel.compare("SECONDMOMENTMAP"))
     {
+    // integer data are either kept as they are stored in the file
+    // (the BSCALE/BZERO attributes give the physical values),
+    // or converted to float by CFITSIO
     switch(StringToInt(this->GetHeaderValue("SlicerAstro.BITPIX")))
       {
       case 8:
-        this->SetDataType( VTK_FLOAT );
-        this->SetDataScalarType( VTK_FLOAT );
+        this->ScaledIntegerData = this->KeepScaledIntegers;
+        this->SetDataType( this->KeepScaledIntegers ? VTK_UNSIGNED_CHAR : VTK_FLOAT );
+        this->SetDataScalarType( this->GetDataType() );
+        break;
       case 16:
-        this->SetDataType( VTK_FLOAT );
-        this->SetDataScalarType( VTK_FLOAT );
+        this->ScaledIntegerData = this->KeepScaledIntegers;
+        this->SetDataType( this->KeepScaledIntegers ? VTK_SHORT : VTK_FLOAT );
+        this->SetDataScalarType( this->GetDataType() );
         break;
       case 32:
-        this->SetDataType( VTK_FLOAT );
-        this->SetDataScalarType( VTK_FLOAT );
+        this->ScaledIntegerData = this->KeepScaledIntegers;
+        this->SetDataType( this->KeepScaledIntegers ? VTK_INT : VTK_FLOAT );
+        this->SetDataScalarType( this->GetDataType() );
         break;
       case -32:
-        this->SetDataType( VTK_FLOAT );
-        this->SetDataScalarType( VTK_FLOAT );
+        this->QuantizedData = this->QuantizeToShort;
+        this->SetDataType( this->QuantizeToShort ? VTK_SHORT : VTK_FLOAT );
+        this->SetDataScalarType( this->GetDataType() );
         break;
       case 64:
         this->SetDataType( VTK_DOUBLE );
         this->SetDataScalarType( VTK_DOUBLE );
         break;
       case -64:
-        this->SetDataType( VTK_DOUBLE );
-        this->SetDataScalarType( VTK_DOUBLE );
+        this->QuantizedData = this->QuantizeToShort;
+        this->SetDataType( this->QuantizeToShort ? VTK_SHORT : VTK_DOUBLE );
+        this->SetDataScalarType( this->GetDataType() );
         break;
       default:
         vtkErrorMacro("vtkFITSReader::ExecuteInformation: Could not allocate data type. \n");
@@ -488,12 +1011,8 @@ void vtkFITSReader::ExecuteInformation()
   this->SetDataSpacing(spacings);
   this->SetDataOrigin(origin);
 
+  // the file is kept open: ExecuteDataWithInformation reads from this handle
   this->vtkImageReader2::ExecuteInformation();
-
-  if (fits_close_file(fptr, &ReadStatus))
-    {
-    fits_report_error(stderr, ReadStatus);
-    }
 }
 
 bool vtkFITSReader::AllocateHeader()
@@ -506,13 +1025,29 @@ bool vtkFITSReader::AllocateHeader()
 
    int nkeys, ii;
 
-   fits_get_hdrspace(fptr, &nkeys, NULL, &ReadStatus); /* get # of keywords */
+   // tile-compressed images are stored in a binary table:
+   // parse the equivalent uncompressed image header instead
+   char *compressedHeader = NULL;
+   int isCompressed = fits_is_compressed_image(fptr, &ReadStatus);
+   if (isCompressed)
+     {
+     fits_convert_hdr2str(fptr, 0, NULL, 0, &compressedHeader, &nkeys, &ReadStatus);
+     }
+   else
+     {
+     fits_get_hdrspace(fptr, &nkeys, NULL, &ReadStatus); /* get # of keywords */
+     }
 
    /* Read and print each keywords */
    int histCont = 0, commCont = 0;
-   for (ii = 1; ii <= nkeys; ii++)
+   for (ii = 1; ii <= nkeys && !ReadStatus; ii++)
      {
-     if (fits_read_record(fptr, ii, card, &ReadStatus))break;
+     if (isCompressed)
+       {
+       strncpy(card, compressedHeader + (ii - 1) * (FLEN_CARD - 1), FLEN_CARD - 1);
+       card[FLEN_CARD - 1] = '\0';
+       }
+     else if (fits_read_record(fptr, ii, card, &ReadStatus))break;
      if (fits_get_keyname(card, key, &keylen, &ReadStatus)) break;
      std::string strkey(key);
      if (fits_parse_value(card, val, com, &ReadStatus)) break;
@@ -563,6 +1098,11 @@ bool vtkFITSReader::AllocateHeader()
        }
      }
 
+   if (compressedHeader)
+     {
+     free(compressedHeader);
+     }
+
    if(HeaderKeyValue.count("SlicerAstro.NAXIS") == 0)
      {
      vtkErrorMacro("vtkFITSReader::ExecuteInformation:"
@@ -580,12 +1120,27 @@ bool vtkFITSReader::AllocateHeader()
        HeaderKeyValue["SlicerAstro.NAXIS"] = "3";
        n = 3;
        }
+     else if (this->FourthAxisPlane < n4)
+       {
+       // only the selected plane (e.g. Stokes) is read: the header
+       // describes it as if the plane had been split from the file
+       double crpix4 = 1.;
+       if (HeaderKeyValue.count("SlicerAstro.CRPIX4"))
+         {
+         crpix4 = StringToNumber<double>(HeaderKeyValue.at("SlicerAstro.CRPIX4").c_str());
+         }
+       HeaderKeyValue["SlicerAstro.CRPIX4"] = DoubleToString(crpix4 - this->FourthAxisPlane);
+       HeaderKeyValue["SlicerAstro.NAXIS4"] = "1";
+       HeaderKeyValue["SlicerAstro.NAXIS"] = "3";
+       this->SelectedPlane = this->FourthAxisPlane;
+       n = 3;
+       }
      else
        {
        vtkErrorMacro("vtkFITSReader::ExecuteInformation: \n"
-                     "Datacube with polarization (NAXIS=4 and NAXIS4>1) at the moment are not supported. \n"<<
-                     "If you want to visulize such kind of datacube: please, contact me. \n"<<
-                     "Davide Punzo, punzodavide@hotmail.it \n");
+                     "the plane "<<this->FourthAxisPlane<<" of the 4th axis does not exist"
+                     " (NAXIS4 = "<<n4<<"). \n");
+       return false;
        }
      }
 
@@ -1153,7 +1708,8 @@ bool vtkFITSReader::AllocateWCS(){
   char *header;
   int  i, nkeyrec, nreject, stat[NWCSFIX];
 
-  if ((WCSStatus = fits_hdr2str(fptr, 1, NULL, 0, &header, &nkeyrec, &WCSStatus)))
+  // for tile-compressed images this returns the equivalent image header
+  if ((WCSStatus = fits_convert_hdr2str(fptr, 1, NULL, 0, &header, &nkeyrec, &WCSStatus)))
     {
     fits_report_error(stderr, WCSStatus);
     }
@@ -1285,6 +1841,13 @@ bool vtkFITSReader::AllocateWCS(){
                   "SlicerAstro assume only one WCS per volume.")
     }
 
+  // the selected plane of the 4th axis becomes its pixel 1
+  if (this->SelectedPlane > 0 && WCS->naxis > 3)
+    {
+    WCS->crpix[3] -= this->SelectedPlane;
+    WCS->flag = 0;
+    }
+
   if ((WCSStatus = wcsfixi(7, 0, WCS, stat, info)))
     {
     vtkErrorMacro("vtkFITSReader::AllocateWCS: wcsfix error: "<<WCSStatus<<"\n");
@@ -1366,14 +1929,20 @@ vtkImageData *vtkFITSReader::AllocateOutputData(vtkDataObject *out, vtkInformati
     return NULL;
     }
 
-  this->ExecuteInformation();
-
-  res->SetExtent(this->GetUpdateExtent());
-
-  if (!this->AllocatePointData(res, outInfo))
+  // honour the extent requested downstream instead of the whole extent
+  if (outInfo && outInfo->Has(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT()))
     {
-    vtkErrorMacro("vtkFITSReader::AllocateOutputData: AllocatePointData failed.");
-    return NULL;
+    res->SetExtent(outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT()));
+    }
+  else
+    {
+    res->SetExtent(this->GetUpdateExtent());
+    }
+
+  if (!this->AllocatePointData(res, outInfo))
+    {
+    vtkErrorMacro("vtkFITSReader::AllocateOutputData: AllocatePointData failed.");
+    return NULL;
     }
 
   return res;
@@ -1419,9 +1988,15 @@ bool vtkFITSReader::AllocatePointData(vtkImageData *out, vtkInformation* outInfo
     case VTK_FLOAT:
       pd = vtkFloatArray::New();
       break;
+    case VTK_INT:
+      pd = vtkIntArray::New();
+      break;
     case VTK_SHORT:
       pd = vtkShortArray::New();
       break;
+    case VTK_UNSIGNED_CHAR:
+      pd = vtkUnsignedCharArray::New();
+      break;
     default:
       vtkErrorMacro("vtkFITSReader::AllocatePointData: Could not allocate data type.");
       return false;
@@ -1444,17 +2019,11 @@ bool vtkFITSReader::AllocatePointData(vtkImageData *out, vtkInformation* outInfo
 }
 
 //----------------------------------------------------------------------------
-// This function reads a data from a file.  The datas extent/axes
-// are assumed to be the same as the file extent/order.
+// This function reads a data from a file. Only the requested UPDATE_EXTENT
+// is read from disk (through fits_read_subset), so that streaming or
+// slab-wise consumers of the reader do not pull the whole datacube.
 void vtkFITSReader::ExecuteDataWithInformation(vtkDataObject *output, vtkInformation* outInfo)
 {
-  if (this->GetOutputInformation(0))
-    {
-    this->GetOutputInformation(0)->Set(
-      vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),
-    this->GetOutputInformation(0)->Get(
-      vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT()), 6);
-    }
   vtkImageData *data = this->AllocateOutputData(output, outInfo);
 
   if (data == NULL)
@@ -1471,9 +2040,9 @@ void vtkFITSReader::ExecuteDataWithInformation(vtkDataObject *output, vtkInforma
     return;
     }
 
-  // Open the fits.  Yes, this means that the file is being opened
-  // twice: once by ExecuteInformation, and once here
-  if(fits_open_data(&fptr, this->GetFileName(), READONLY, &ReadStatus))
+  // Reuse the handle opened by CanReadFile/ExecuteInformation.
+  // The file is re-opened only if it has been closed by a previous read.
+  if (!this->OpenFile(this->GetFileName()))
     {
     vtkErrorMacro("vtkFITSReader::ExecuteDataWithInformation: "
                   "ERROR IN CFITSIO! Error reading "<< this->GetFileName() << ":\n");
@@ -1486,69 +2055,721 @@ void vtkFITSReader::ExecuteDataWithInformation(vtkDataObject *output, vtkInforma
   void *ptr = NULL;
   ptr = data->GetPointData()->GetScalars()->GetVoidPointer(0);
   this->ComputeDataIncrements();
-  unsigned int naxes = data->GetDataDimension();
-  int naxe[naxes];
-  data->GetDimensions(naxe);
-  int dim = 1;
-  for (unsigned int axii=0; axii < naxes; axii++)
+
+  int extent[6];
+  data->GetExtent(extent);
+
+  // the file is kept open while paging, it is closed by SetFileName
+  // and by the destructor
+  if (this->Paging)
     {
-    dim *= naxe[axii];
+    if (!this->ReadPagedDataSubset(extent, ptr))
+      {
+      vtkErrorMacro(<< "vtkFITSReader::ExecuteDataWithInformation: data is null.");
+      }
+    return;
     }
-  float nullval = NAN;
-  int anynull;
-  // load the data
-  switch (this->DataType)
+
+  if (!this->ReadDataSubset(extent, ptr))
+    {
+    vtkErrorMacro(<< "vtkFITSReader::ExecuteDataWithInformation: data is null.");
+    }
+
+  // A streamed (partial) read keeps the file open for the next
+  // UPDATE_EXTENT requests. Once the whole cube has been read the
+  // handle, and the in-memory copy of .gz and tile-compressed files,
+  // are released: the header and the WCS are kept.
+  int wholeExtent[6];
+  outInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+  if (std::equal(extent, extent + 6, wholeExtent))
+    {
+    this->CloseFile();
+    }
+}
+
+namespace
+{
+//----------------------------------------------------------------------------
+// fits_read_subset of the VTK (0-based) extent; the 4th axis is read at
+// plane and the axes above at pixel 1. If raw is set, the stored
+// integers are returned without applying BSCALE/BZERO and BLANK.
+bool ReadSubset(fitsfile *file, int naxis, int plane, int dataType, bool raw,
+                const int extent[6], void *ptr, int *status)
+{
+  if (raw && fits_set_bscale(file, 1., 0., status))
+    {
+    return false;
+    }
+
+  std::vector<long> fpixel(naxis, 1);
+  std::vector<long> lpixel(naxis, 1);
+  std::vector<long> inc(naxis, 1);
+
+  for (int axii = 0; axii < naxis && axii < 3; axii++)
+    {
+    fpixel[axii] = extent[2 * axii] + 1;
+    lpixel[axii] = extent[2 * axii + 1] + 1;
+    }
+  if (naxis > 3)
+    {
+    fpixel[3] = lpixel[3] = plane + 1;
+    }
+
+  int anynull = 0;
+  switch (dataType)
     {
     case VTK_DOUBLE:
-      if(fits_read_img(fptr, TDOUBLE, 1, dim, &nullval, ptr, &anynull, &ReadStatus))
-        {
-        fits_report_error(stderr, ReadStatus);
-        vtkErrorMacro(<< "vtkFITSReader::ExecuteDataWithInformation: data is null.");
-        return;
-        }
+      {
+      double dnull = NAN;
+      fits_read_subset(file, TDOUBLE, &fpixel[0], &lpixel[0], &inc[0],
+                       &dnull, ptr, &anynull, status);
       break;
+      }
     case VTK_FLOAT:
-      if(fits_read_img(fptr, TFLOAT, 1, dim, &nullval, ptr, &anynull, &ReadStatus))
-        {
-        fits_report_error(stderr, ReadStatus);
-        vtkErrorMacro(<< "vtkFITSReader::ExecuteDataWithInformation: data is null.");
-        return;
-        }
+      {
+      float fnull = NAN;
+      fits_read_subset(file, TFLOAT, &fpixel[0], &lpixel[0], &inc[0],
+                       &fnull, ptr, &anynull, status);
       break;
-  case VTK_SHORT:
-    if(fits_read_img(fptr, TSHORT, 1, dim, &nullval, ptr, &anynull, &ReadStatus))
+      }
+    case VTK_INT:
       {
-      fits_report_error(stderr, ReadStatus);
-      vtkErrorMacro(<< "vtkFITSReader::ExecuteDataWithInformation: data is null.");
-      return;
+      int inull = 0;
+      fits_read_subset(file, TINT, &fpixel[0], &lpixel[0], &inc[0],
+                       &inull, ptr, &anynull, status);
+      break;
+      }
+    case VTK_SHORT:
+      {
+      short snull = 0;
+      fits_read_subset(file, TSHORT, &fpixel[0], &lpixel[0], &inc[0],
+                       &snull, ptr, &anynull, status);
+      break;
+      }
+    case VTK_UNSIGNED_CHAR:
+      {
+      unsigned char bnull = 0;
+      fits_read_subset(file, TBYTE, &fpixel[0], &lpixel[0], &inc[0],
+                       &bnull, ptr, &anynull, status);
+      break;
       }
-    break;
     default:
-      vtkErrorMacro("vtkFITSReader::ExecuteDataWithInformation: Could not load data");
-      return;
+      return false;
+    }
+
+  return *status == 0;
+}
+
+} // end namespace
+
+//----------------------------------------------------------------------------
+bool vtkFITSReader::ReadDataSubset(int extent[6], void *ptr)
+{
+  // the HDU can have more axes than the ones exposed to VTK
+  // (e.g. NAXIS = 4): the 4th axis is read at SelectedPlane.
+  int naxis = 0;
+  if (fits_get_img_dim(fptr, &naxis, &ReadStatus))
+    {
+    fits_report_error(stderr, ReadStatus);
+    return false;
+    }
+
+  if (naxis < 1)
+    {
+    vtkErrorMacro("vtkFITSReader::ReadDataSubset: the HDU has no image data.");
+    return false;
+    }
+
+  if (this->DataType != VTK_DOUBLE &&
+      this->DataType != VTK_FLOAT &&
+      this->DataType != VTK_INT &&
+      this->DataType != VTK_SHORT &&
+      this->DataType != VTK_UNSIGNED_CHAR)
+    {
+    vtkErrorMacro("vtkFITSReader::ReadDataSubset: Could not load data");
+    return false;
+    }
+
+  if (this->QuantizedData)
+    {
+    return this->ReadQuantizedDataSubset(extent, ptr, naxis);
+    }
+
+  // tile-compressed HDUs are always decoded by CFITSIO: in parallel
+  // if the library is reentrant, otherwise serially with fits_read_subset
+  const bool compressed = fits_is_compressed_image(fptr, &ReadStatus) != 0;
+  if (compressed && extent[5] > extent[4] && fits_is_reentrant())
+    {
+    return this->ReadCompressedDataSubset(extent, ptr, naxis);
+    }
+
+  // fast path for plain floating point data,
+  // CFITSIO is the fallback for everything else
+  if (!compressed && this->ReadRawDataSubset(extent, ptr, naxis))
+    {
+    return true;
+    }
+
+  if (!ReadSubset(fptr, naxis, this->SelectedPlane, this->DataType, this->ScaledIntegerData, extent, ptr, &ReadStatus))
+    {
+    fits_report_error(stderr, ReadStatus);
+    return false;
+    }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Uncompressed BITPIX = -32/-64 data: the data unit is read with pread (or
+// copied, for in-memory files) straight into the output buffer, then
+// byteswapped and scaled by BSCALE/BZERO in the same pass, in parallel.
+// Returns false, without reporting errors, if the HDU is not eligible or
+// the read fails: the caller then falls back to CFITSIO.
+// Tile-compressed HDUs must never get here: their data unit is a binary
+// table, not the image (this is reported as an error).
+bool vtkFITSReader::ReadRawDataSubset(int extent[6], void *ptr, int naxis)
+{
+  int status = 0;
+  if (fits_is_compressed_image(fptr, &status) || status)
+    {
+    vtkErrorMacro("vtkFITSReader::ReadRawDataSubset: the HDU of "
+                  << this->OpenedFileName << " is tile-compressed, "
+                  "it can be read only by CFITSIO.");
+    return false;
+    }
+
+  int bitpix = 0;
+  if (fits_get_img_type(fptr, &bitpix, &status))
+    {
+    return false;
+    }
+
+  size_t elementSize = 0;
+  if (bitpix == FLOAT_IMG && this->DataType == VTK_FLOAT)
+    {
+    elementSize = 4;
+    }
+  else if (bitpix == DOUBLE_IMG && this->DataType == VTK_DOUBLE)
+    {
+    elementSize = 8;
+    }
+  else
+    {
+    return false;
+    }
+
+  long naxes[3] = {1, 1, 1};
+  LONGLONG headStart = 0, dataStart = 0, dataEnd = 0;
+  if (fits_get_img_size(fptr, naxis < 3 ? naxis : 3, naxes, &status) ||
+      fits_get_hduaddrll(fptr, &headStart, &dataStart, &dataEnd, &status))
+    {
+    return false;
+    }
+
+  // start of the selected plane of the 4th axis
+  dataStart += static_cast<LONGLONG>(this->SelectedPlane) * naxes[0] * naxes[1] * naxes[2] * elementSize;
+
+  double bscale = 1., bzero = 0.;
+  if (fits_read_key(fptr, TDOUBLE, "BSCALE", &bscale, NULL, &status) == KEY_NO_EXIST)
+    {
+    status = 0;
+    bscale = 1.;
+    }
+  if (fits_read_key(fptr, TDOUBLE, "BZERO", &bzero, NULL, &status) == KEY_NO_EXIST)
+    {
+    status = 0;
+    bzero = 0.;
+    }
+  if (status)
+    {
+    return false;
+    }
+  const bool scale = (bscale != 1. || bzero != 0.);
+
+  const size_t nx = extent[1] - extent[0] + 1;
+  const size_t ny = extent[3] - extent[2] + 1;
+  const size_t nz = extent[5] - extent[4] + 1;
+  const size_t rowSize = nx * elementSize;
+
+  // whole planes are contiguous on disk: read them in large chunks,
+  // otherwise read row by row
+  const bool contiguous = (nx == static_cast<size_t>(naxes[0]) &&
+                           ny == static_cast<size_t>(naxes[1]));
+  const size_t totalSize = rowSize * ny * nz;
+  const size_t chunkSize = 8 * 1024 * 1024;
+  const size_t numRuns = contiguous ? (totalSize + chunkSize - 1) / chunkSize : ny * nz;
+
+  const size_t lastByte = dataStart +
+    ((static_cast<size_t>(extent[5]) * naxes[1] + extent[3]) * naxes[0] + extent[1] + 1) * elementSize;
+  if (lastByte > static_cast<size_t>(dataEnd))
+    {
+    return false;
+    }
+
+  int fd = -1;
+  if (!this->MemoryBuffer)
+    {
+    fd = open(this->OpenedFileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      {
+      return false;
+      }
+    }
+
+  char *out = static_cast<char*>(ptr);
+  const char *memory = static_cast<const char*>(this->MemoryBuffer);
+  bool success = true;
+
+  const long long numberOfRuns = static_cast<long long>(numRuns);
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic) shared(success)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (long long run = 0; run < numberOfRuns; run++)
+    {
+    size_t fileOffset, outOffset, length;
+    if (contiguous)
+      {
+      outOffset = run * chunkSize;
+      length = std::min(chunkSize, totalSize - outOffset);
+      fileOffset = dataStart + extent[4] * rowSize * ny + outOffset;
+      }
+    else
+      {
+      const size_t z = extent[4] + run / ny;
+      const size_t y = extent[2] + run % ny;
+      outOffset = run * rowSize;
+      length = rowSize;
+      fileOffset = dataStart + ((z * naxes[1] + y) * naxes[0] + extent[0]) * elementSize;
+      }
+
+    char *dst = out + outOffset;
+    if (memory)
+      {
+      memcpy(dst, memory + fileOffset, length);
+      }
+    else
+      {
+      size_t done = 0;
+      while (done < length)
+        {
+        ssize_t num_read = pread(fd, dst + done, length - done, fileOffset + done);
+        if (num_read <= 0)
+          {
+          success = false;
+          break;
+          }
+        done += num_read;
+        }
+      }
+
+    // FITS is big-endian: swap and scale while the chunk is in cache
+    const size_t numValues = length / elementSize;
+    if (elementSize == 4)
+      {
+      vtkByteSwap::Swap4BERange(dst, numValues);
+      if (scale)
+        {
+        float *values = reinterpret_cast<float*>(dst);
+        for (size_t ii = 0; ii < numValues; ii++)
+          {
+          values[ii] = values[ii] * bscale + bzero;
+          }
+        }
+      }
+    else
+      {
+      vtkByteSwap::Swap8BERange(dst, numValues);
+      if (scale)
+        {
+        double *values = reinterpret_cast<double*>(dst);
+        for (size_t ii = 0; ii < numValues; ii++)
+          {
+          values[ii] = values[ii] * bscale + bzero;
+          }
+        }
+      }
     }
 
-  if (fits_close_file(fptr, &ReadStatus))
+  if (fd >= 0)
+    {
+    close(fd);
+    }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------
+// Tile-compressed HDUs: every thread decodes the tiles of a slab of channels
+// through its own CFITSIO handle. The handles are memory files opened on
+// one in-memory copy of the file, so that no state is shared between them
+// (CFITSIO would instead share a single FITSfile between handles opened
+// on the same disk file).
+bool vtkFITSReader::ReadCompressedDataSubset(int extent[6], void *ptr, int naxis)
+{
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  if (!this->MemoryBuffer &&
+      !vtkFITSReader::read_to_memory(this->OpenedFileName.c_str(),
+                                     &this->MemoryBuffer, &this->MemoryBufferSize))
     {
-    vtkErrorMacro("vtkFITSReader::ExecuteDataWithInformation: ERROR IN CFITSIO! Error closing "
-                  << this->GetFileName() << ":\n");
+    vtkErrorMacro("vtkFITSReader::ReadCompressedDataSubset: could not load "
+                  << this->OpenedFileName << " in memory.");
+    return false;
+    }
+
+  int hdunum = 1;
+  fits_get_hdu_num(fptr, &hdunum);
+
+  const int numSlices = extent[5] - extent[4] + 1;
+  const size_t sliceSize = static_cast<size_t>(extent[1] - extent[0] + 1) *
+                           static_cast<size_t>(extent[3] - extent[2] + 1) *
+                           vtkDataArray::GetDataTypeSize(this->DataType);
+  int numProcs = omp_get_num_procs();
+  if (numProcs > numSlices)
+    {
+    numProcs = numSlices;
+    }
+
+  int status = 0;
+  #pragma omp parallel num_threads(numProcs) shared(status)
+    {
+    const int thread = omp_get_thread_num();
+    const int numThreads = omp_get_num_threads();
+
+    int slabExtent[6];
+    for (int ii = 0; ii < 4; ii++)
+      {
+      slabExtent[ii] = extent[ii];
+      }
+    slabExtent[4] = extent[4] + (numSlices * thread) / numThreads;
+    slabExtent[5] = extent[4] + (numSlices * (thread + 1)) / numThreads - 1;
+
+    if (slabExtent[5] >= slabExtent[4])
+      {
+      fitsfile *slabFile = NULL;
+      int slabStatus = 0;
+      char *slabPtr = static_cast<char*>(ptr) + (slabExtent[4] - extent[4]) * sliceSize;
+
+      if (!fits_open_memfile(&slabFile, this->OpenedFileName.c_str(), READONLY,
+                             &this->MemoryBuffer, &this->MemoryBufferSize,
+                             0, NULL, &slabStatus))
+        {
+        fits_movabs_hdu(slabFile, hdunum, NULL, &slabStatus);
+        ReadSubset(slabFile, naxis, this->SelectedPlane, this->DataType, this->ScaledIntegerData, slabExtent, slabPtr, &slabStatus);
+        int closeStatus = 0;
+        fits_close_file(slabFile, &closeStatus);
+        }
+
+      if (slabStatus)
+        {
+        #pragma omp critical
+        status = slabStatus;
+        }
+      }
+    }
+
+  if (status)
+    {
+    this->ReadStatus = status;
     fits_report_error(stderr, ReadStatus);
+    return false;
+    }
+
+  return true;
+  #else
+  if (!ReadSubset(fptr, naxis, this->SelectedPlane, this->DataType, this->ScaledIntegerData, extent, ptr, &ReadStatus))
+    {
+    fits_report_error(stderr, ReadStatus);
+    return false;
     }
+  return true;
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+}
 
-  if (this->GetCompression())
+//----------------------------------------------------------------------------
+// Floating point data stored in 16 bits: the data are read as float in
+// slabs of channels (so that the whole float cube is never allocated) and
+// quantised to [-32767, 32767], NaNs are stored as BLANK = -32768.
+// The quantisation range is DATAMIN/DATAMAX, if in the header, otherwise
+// it is computed with a first pass over the whole data extent (not only
+// the requested one: with Paging all the slabs must share the same range).
+bool vtkFITSReader::ReadQuantizedDataSubset(int extent[6], void *ptr, int naxis)
+{
+  // the slab buffer is sized on the planes of the whole extent
+  const size_t planeElements = static_cast<size_t>(this->DataExtent[1] - this->DataExtent[0] + 1) *
+                               static_cast<size_t>(this->DataExtent[3] - this->DataExtent[2] + 1);
+  const int numPlanes = this->DataExtent[5] - this->DataExtent[4] + 1;
+  int slabSlices = static_cast<int>((64 * 1024 * 1024) / (planeElements * sizeof(float)));
+  if (slabSlices < 1)
+    {
+    slabSlices = 1;
+    }
+  if (slabSlices > numPlanes)
     {
-    if (remove(this->GetFileName()) != 0)
+    slabSlices = numPlanes;
+    }
+
+  std::vector<float> slab(planeElements * slabSlices);
+  short *outSPixel = static_cast<short*>(ptr);
+  bool success = true;
+
+  // tile-compressed slabs are decoded by CFITSIO
+  int status = 0;
+  const bool compressed = fits_is_compressed_image(fptr, &status) != 0;
+
+  // the slabs are read through the float code paths
+  this->DataType = VTK_FLOAT;
+
+  for (int pass = this->QuantizeRangeSet ? 1 : 0; pass < 2 && success; pass++)
+    {
+    double min = VTK_DOUBLE_MAX, max = VTK_DOUBLE_MIN;
+    if (pass == 0)
+      {
+      min = StringToDouble(this->GetHeaderValue("SlicerAstro.DATAMIN"));
+      max = StringToDouble(this->GetHeaderValue("SlicerAstro.DATAMAX"));
+      if (max > min)
+        {
+        pass++;
+        }
+      else
+        {
+        min = VTK_DOUBLE_MAX;
+        max = VTK_DOUBLE_MIN;
+        }
+      }
+
+    if (pass == 1 && !this->QuantizeRangeSet)
+      {
+      this->QuantizeScale = (max > min) ? (max - min) / 65534. : 1.;
+      this->QuantizeZero = (max > min) ? min + 32767. * this->QuantizeScale : 0.;
+      this->QuantizeRangeSet = true;
+      }
+    const double bscale = this->QuantizeScale;
+    const double bzero = this->QuantizeZero;
+
+    // the range is scanned on the whole data extent
+    const int *passExtent = (pass == 0) ? this->DataExtent : extent;
+    const size_t sliceElements = static_cast<size_t>(passExtent[1] - passExtent[0] + 1) *
+                                 static_cast<size_t>(passExtent[3] - passExtent[2] + 1);
+    const int numSlices = passExtent[5] - passExtent[4] + 1;
+
+    for (int firstSlice = 0; firstSlice < numSlices && success; firstSlice += slabSlices)
       {
-      vtkErrorMacro("vtkFITSReader::ExecuteDataWithInformation: "
-                    "Error deleting the decompressed file: "<< this->GetFileName() << ":\n");
+      int slabExtent[6];
+      for (int ii = 0; ii < 4; ii++)
+        {
+        slabExtent[ii] = passExtent[ii];
+        }
+      slabExtent[4] = passExtent[4] + firstSlice;
+      slabExtent[5] = std::min(passExtent[5], slabExtent[4] + slabSlices - 1);
+      const long slabElements = static_cast<long>(sliceElements) *
+                                (slabExtent[5] - slabExtent[4] + 1);
+
+      if ((compressed || !this->ReadRawDataSubset(slabExtent, &slab[0], naxis)) &&
+          !ReadSubset(fptr, naxis, this->SelectedPlane, VTK_FLOAT, false, slabExtent, &slab[0], &ReadStatus))
+        {
+        fits_report_error(stderr, ReadStatus);
+        success = false;
+        break;
+        }
+
+      if (pass == 0)
+        {
+        #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+        #pragma omp parallel
+        #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+          {
+          double threadMin = VTK_DOUBLE_MAX, threadMax = VTK_DOUBLE_MIN;
+          #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+          #pragma omp for schedule(static)
+          #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+          for (long elemCnt = 0; elemCnt < slabElements; elemCnt++)
+            {
+            const float value = slab[elemCnt];
+            if (value != value)
+              {
+              continue;
+              }
+            threadMin = std::min(threadMin, static_cast<double>(value));
+            threadMax = std::max(threadMax, static_cast<double>(value));
+            }
+          #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+          #pragma omp critical
+          #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+            {
+            min = std::min(min, threadMin);
+            max = std::max(max, threadMax);
+            }
+          }
+        continue;
+        }
+
+      short *slabSPixel = outSPixel + static_cast<size_t>(firstSlice) * sliceElements;
+      const float invScale = static_cast<float>(1. / bscale);
+      const float zero = static_cast<float>(bzero);
+      #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+      for (long elemCnt = 0; elemCnt < slabElements; elemCnt++)
+        {
+        const float value = slab[elemCnt];
+        float quantized = floorf((value - zero) * invScale + 0.5f);
+        quantized = quantized < -32767.f ? -32767.f : (quantized > 32767.f ? 32767.f : quantized);
+        slabSPixel[elemCnt] = (value != value) ? -32768 : static_cast<short>(quantized);
+        }
       }
+
+    if (pass == 0 && success && !this->QuantizeRangeSet)
+      {
+      // computed range, the quantisation is set at the next pass
+      this->HeaderKeyValue["SlicerAstro.DATAMIN"] = DoubleToString(min);
+      this->HeaderKeyValue["SlicerAstro.DATAMAX"] = DoubleToString(max);
+      this->QuantizeScale = (max > min) ? (max - min) / 65534. : 1.;
+      this->QuantizeZero = (max > min) ? min + 32767. * this->QuantizeScale : 0.;
+      this->QuantizeRangeSet = true;
+      }
+    }
+
+  this->DataType = VTK_SHORT;
+
+  if (!success)
+    {
+    return false;
     }
+
+  // the node attributes describe the stored data
+  this->HeaderKeyValue["SlicerAstro.BITPIX"] = "16";
+  this->HeaderKeyValue["SlicerAstro.BSCALE"] = DoubleToString(this->QuantizeScale);
+  this->HeaderKeyValue["SlicerAstro.BZERO"] = DoubleToString(this->QuantizeZero);
+  this->HeaderKeyValue["SlicerAstro.BLANK"] = "-32768";
+  this->ScaledIntegerData = true;
+
+  return true;
 }
 
+//----------------------------------------------------------------------------
+// Slabs are whole planes of PagingSlabThickness channels. The least recently
+// used slabs are dropped to make room for a new one.
+const char* vtkFITSReader::GetPagedSlab(int slab)
+{
+  std::map<int, std::vector<char> >::iterator it = this->SlabCache->Slabs.find(slab);
+  if (it != this->SlabCache->Slabs.end())
+    {
+    this->SlabCache->Touch(slab);
+    return &it->second[0];
+    }
+
+  int slabExtent[6];
+  for (int ii = 0; ii < 4; ii++)
+    {
+    slabExtent[ii] = this->DataExtent[ii];
+    }
+  slabExtent[4] = this->DataExtent[4] + slab * this->PagingSlabThickness;
+  slabExtent[5] = std::min(this->DataExtent[5], slabExtent[4] + this->PagingSlabThickness - 1);
+
+  const size_t slabSize = static_cast<size_t>(slabExtent[1] - slabExtent[0] + 1) *
+                          static_cast<size_t>(slabExtent[3] - slabExtent[2] + 1) *
+                          static_cast<size_t>(slabExtent[5] - slabExtent[4] + 1) *
+                          vtkDataArray::GetDataTypeSize(this->DataType);
+
+  while (!this->SlabCache->Recent.empty() &&
+         this->SlabCache->Size + slabSize > static_cast<size_t>(this->PagingMemoryBudget))
+    {
+    int oldSlab = this->SlabCache->Recent.back();
+    this->SlabCache->Recent.pop_back();
+    this->SlabCache->Size -= this->SlabCache->Slabs[oldSlab].size();
+    this->SlabCache->Slabs.erase(oldSlab);
+    }
+
+  std::vector<char> &data = this->SlabCache->Slabs[slab];
+  data.resize(slabSize);
+  if (!this->ReadDataSubset(slabExtent, &data[0]))
+    {
+    this->SlabCache->Slabs.erase(slab);
+    return NULL;
+    }
+
+  this->SlabCache->Size += slabSize;
+  this->SlabCache->Touch(slab);
+  this->NumberOfPagedSlabReads++;
+
+  return &data[0];
+}
+
+//----------------------------------------------------------------------------
+bool vtkFITSReader::ReadPagedDataSubset(int extent[6], void *ptr)
+{
+  const int thickness = this->PagingSlabThickness;
+  const size_t elementSize = vtkDataArray::GetDataTypeSize(this->DataType);
+  const size_t nx = this->DataExtent[1] - this->DataExtent[0] + 1;
+  const size_t ny = this->DataExtent[3] - this->DataExtent[2] + 1;
+  const size_t outRowSize = (extent[1] - extent[0] + 1) * elementSize;
+  const size_t outRows = extent[3] - extent[2] + 1;
+  char *outPtr = static_cast<char*>(ptr);
+
+  const int firstSlab = (extent[4] - this->DataExtent[4]) / thickness;
+  const int lastSlab = (extent[5] - this->DataExtent[4]) / thickness;
+  for (int slab = firstSlab; slab <= lastSlab; slab++)
+    {
+    const char *slabPtr = this->GetPagedSlab(slab);
+    if (!slabPtr)
+      {
+      return false;
+      }
+
+    const int slabStart = this->DataExtent[4] + slab * thickness;
+    const int zMin = std::max(extent[4], slabStart);
+    const int zMax = std::min(extent[5], slabStart + thickness - 1);
+    for (int zz = zMin; zz <= zMax; zz++)
+      {
+      for (int yy = extent[2]; yy <= extent[3]; yy++)
+        {
+        const char *src = slabPtr +
+          ((static_cast<size_t>(zz - slabStart) * ny + (yy - this->DataExtent[2])) * nx +
+           (extent[0] - this->DataExtent[0])) * elementSize;
+        char *dst = outPtr +
+          (static_cast<size_t>(zz - extent[4]) * outRows + (yy - extent[2])) * outRowSize;
+        memcpy(dst, src, outRowSize);
+        }
+      }
+    }
+
+  // prefetch the next slabs in the scrolling direction
+  if (this->SlabCache->LastSlab >= 0 && firstSlab != this->SlabCache->LastSlab)
+    {
+    this->SlabCache->Direction = firstSlab > this->SlabCache->LastSlab ? 1 : -1;
+    }
+  this->SlabCache->LastSlab = firstSlab;
+
+  const int numSlabs = (this->DataExtent[5] - this->DataExtent[4]) / thickness + 1;
+  const int direction = this->SlabCache->Direction;
+  for (int ii = 1; ii <= this->PagingPrefetch; ii++)
+    {
+    int slab = (direction > 0 ? lastSlab : firstSlab) + direction * ii;
+    if (slab < 0 || slab >= numSlabs)
+      {
+      break;
+      }
+    if (!this->GetPagedSlab(slab))
+      {
+      break;
+      }
+    }
+
+  return true;
+}
 
 //----------------------------------------------------------------------------
 void vtkFITSReader::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
+  os << indent << "KeepScaledIntegers: " << this->KeepScaledIntegers << "\n";
+  os << indent << "ScaledIntegerData: " << this->ScaledIntegerData << "\n";
+  os << indent << "QuantizeToShort: " << this->QuantizeToShort << "\n";
+  os << indent << "Paging: " << this->Paging << "\n";
+  os << indent << "PagingMemoryBudget: " << this->PagingMemoryBudget << "\n";
+  os << indent << "PagingSlabThickness: " << this->PagingSlabThickness << "\n";
+  os << indent << "PagingPrefetch: " << this->PagingPrefetch << "\n";
+  os << indent << "HDUNumber: " << this->HDUNumber << "\n";
+  os << indent << "FourthAxisPlane: " << this->FourthAxisPlane << "\n";
 }
 
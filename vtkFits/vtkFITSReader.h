@@ -22,6 +22,7 @@
 
 // std includes
 #include <map>
+#include <string>
 #include <vector>
 
 // VTK includes
@@ -78,13 +79,19 @@ public:
   virtual void PrintSelf(ostream& os, vtkIndent indent) VTK_OVERRIDE;
 
   ///  is the given file name a FITS file?
+  /// For .fits.gz files only the first header block is decompressed.
   virtual int CanReadFile(const char* filename) VTK_OVERRIDE;
 
+  ///
+  /// Set the file name. The open CFITSIO handle, kept across
+  /// the UPDATE_EXTENT requests, is closed if the name changes.
+  virtual void SetFileName(const char* filename) VTK_OVERRIDE;
+
   ///
   /// Valid extentsions
   virtual const char* GetFileExtensions() VTK_OVERRIDE
     {
-    return ".fits .fits.gz";
+    return ".fits .fits.gz .fits.fz";
     }
 
   ///
@@ -100,6 +107,20 @@ public:
   /// parsing the complete header information.
   vtkGetMacro(ReadStatus,int);
 
+  ///
+  /// Number of times a CFITSIO handle has been opened by this reader.
+  /// The header is parsed once per file name, and the same handle
+  /// is used by CanReadFile, UpdateInformation and the streamed Updates.
+  /// The handle is closed after a read of the whole extent (unless Paging).
+  vtkGetMacro(NumberOfFileOpens,int);
+
+  ///
+  /// True while the CFITSIO handle is open
+  bool IsFileOpen()
+    {
+    return this->fptr != NULL;
+    }
+
   ///
   /// Point data field type
   vtkSetMacro(PointDataType,int);
@@ -121,10 +142,63 @@ public:
   vtkGetMacro(WCSStatus,int);
 
   ///
-  /// Compression
+  /// Compression: the file is gzipped and is read from memory
   vtkSetMacro(Compression,bool);
   vtkGetMacro(Compression,bool);
 
+  ///
+  /// Keep BITPIX = 8/16/32 data as unsigned char/short/int arrays
+  /// of the stored values, instead of converting them to float.
+  /// The physical values are BSCALE * value + BZERO.
+  vtkSetMacro(KeepScaledIntegers,bool);
+  vtkGetMacro(KeepScaledIntegers,bool);
+  vtkBooleanMacro(KeepScaledIntegers,bool);
+
+  ///
+  /// Store BITPIX = -32/-64 data in 16 bits: the values are quantised
+  /// to short on read, with BSCALE/BZERO (and BLANK for NaNs) set in
+  /// the header values. Halves the memory of float cubes.
+  vtkSetMacro(QuantizeToShort,bool);
+  vtkGetMacro(QuantizeToShort,bool);
+  vtkBooleanMacro(QuantizeToShort,bool);
+
+  ///
+  /// On-demand (paged) reading: the requested UPDATE_EXTENT is served from
+  /// a LRU cache of slabs of PagingSlabThickness channels, read from the
+  /// file when missing. The cache holds at most PagingMemoryBudget bytes.
+  /// After each request the next PagingPrefetch slabs in the scrolling
+  /// direction are loaded. The file is kept open while paging.
+  vtkSetMacro(Paging,bool);
+  vtkGetMacro(Paging,bool);
+  vtkBooleanMacro(Paging,bool);
+  vtkSetMacro(PagingMemoryBudget,vtkIdType);
+  vtkGetMacro(PagingMemoryBudget,vtkIdType);
+  vtkSetClampMacro(PagingSlabThickness,int,1,VTK_INT_MAX);
+  vtkGetMacro(PagingSlabThickness,int);
+  vtkSetClampMacro(PagingPrefetch,int,0,VTK_INT_MAX);
+  vtkGetMacro(PagingPrefetch,int);
+
+  ///
+  /// Image HDU to read (1-based, as CFITSIO). With 0 the first HDU
+  /// with image data is read.
+  vtkSetClampMacro(HDUNumber,int,0,VTK_INT_MAX);
+  vtkGetMacro(HDUNumber,int);
+
+  ///
+  /// Plane (0-based) of the 4th axis, e.g. Stokes, read from NAXIS = 4
+  /// cubes. Only that hyperplane is read: the header and the WCS describe
+  /// it as a degenerate 4th axis (NAXIS4 = 1, with CRPIX4 shifted).
+  vtkSetClampMacro(FourthAxisPlane,int,0,VTK_INT_MAX);
+  vtkGetMacro(FourthAxisPlane,int);
+
+  ///
+  /// Number of slabs read from the file by the paging cache
+  vtkGetMacro(NumberOfPagedSlabReads,int);
+
+  ///
+  /// True if the output holds the stored (BSCALE/BZERO-unscaled) integers
+  vtkGetMacro(ScaledIntegerData,bool);
+
   ///
   /// Use image origin from the file
   void SetUseNativeOriginOn()
@@ -160,9 +234,40 @@ protected:
   int NumberOfComponents;
   bool Compression;
   bool UseNativeOrigin;
+  bool KeepScaledIntegers;
+  bool ScaledIntegerData;
+  bool QuantizeToShort;
+  bool QuantizedData;
+  bool QuantizeRangeSet;
+  double QuantizeScale;
+  double QuantizeZero;
+
+  bool Paging;
+  vtkIdType PagingMemoryBudget;
+  int PagingSlabThickness;
+  int PagingPrefetch;
+  int NumberOfPagedSlabReads;
+  class vtkSlabCache;
+  vtkSlabCache *SlabCache;
+
+  int HDUNumber;
+  int FourthAxisPlane;
+  /// HDU and plane of the current header
+  int CurrentHDUNumber;
+  int CurrentFourthAxisPlane;
+  int SelectedPlane;
+  /// HDU selected by fits_open_data
+  int DefaultHDUNumber;
 
   fitsfile *fptr;
   int ReadStatus;
+  std::string OpenedFileName;
+  int NumberOfFileOpens;
+
+  /// decompressed .fits.gz content, opened as a CFITSIO memory file,
+  /// or in-memory copy of a tile-compressed file
+  void *MemoryBuffer;
+  size_t MemoryBufferSize;
 
   struct wcsprm *WCS;
   int WCSStatus;
@@ -174,13 +279,54 @@ protected:
   virtual void ExecuteInformation() VTK_OVERRIDE;
   virtual void ExecuteDataWithInformation(vtkDataObject *output, vtkInformation* outInfo) VTK_OVERRIDE;
 
+  ///
+  /// Open filename with CFITSIO. If the same file is already open
+  /// the current handle is reused.
+  bool OpenFile(const char* filename);
+  void CloseFile();
+
   bool AllocateHeader();
   bool FixGipsyHeader();
   bool AllocateWCS();
 
+  ///
+  /// Read the [extent] sub-cube of the current HDU into ptr
+  /// (fits_read_subset). The extent is in VTK (0-based) indexes.
+  bool ReadDataSubset(int extent[6], void *ptr);
+
+  ///
+  /// Fast path for uncompressed BITPIX = -32/-64 HDUs: read the data
+  /// unit directly into ptr, then byteswap and apply BSCALE/BZERO in
+  /// parallel. Returns false if the HDU is not eligible.
+  bool ReadRawDataSubset(int extent[6], void *ptr, int naxis);
+
+  ///
+  /// Decode the tiles of a tile-compressed (Rice/GZIP/HCOMPRESS) HDU
+  /// in parallel, one slab of channels per thread.
+  bool ReadCompressedDataSubset(int extent[6], void *ptr, int naxis);
+
+  ///
+  /// Read floating point data in slabs of channels and quantise them
+  /// to short (see QuantizeToShort).
+  bool ReadQuantizedDataSubset(int extent[6], void *ptr, int naxis);
+
+  ///
+  /// Copy the [extent] sub-cube from the slab cache (see Paging)
+  bool ReadPagedDataSubset(int extent[6], void *ptr);
+
+  ///
+  /// Return the data of slab, reading it if it is not in the cache
+  const char* GetPagedSlab(int slab);
+
   bool FixGipsyHeaderOn;
 
-  static bool decompress_one_file(const char *infilename, const char *outfilename);
+  ///
+  /// Load a whole file into a malloc'ed buffer
+  static bool read_to_memory(const char *infilename, void **buffer, size_t *size);
+
+  ///
+  /// Inflate a (multi-member) gzip file into a malloc'ed buffer
+  static bool decompress_to_memory(const char *infilename, void **buffer, size_t *size);
 
 private:
   vtkFITSReader(const vtkFITSReader&);  /// Not implemented.
@@ -0,0 +1,355 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// STD includes
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+// vtkASTRO includes
+#include "vtkFITSStatisticsCache.h"
+
+// VTK includes
+#include <vtkDoubleArray.h>
+#include <vtkObjectFactory.h>
+#include <vtksys/SystemTools.hxx>
+
+namespace
+{
+const char* CacheFileSignature = "SlicerAstroStatisticsCache";
+const int CacheFileVersion = 1;
+
+//----------------------------------------------------------------------------
+// FNV-1a hash of the path, to tell apart the files with the same
+// name in the cache directory
+std::string PathHash(const std::string &path)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t ii = 0; ii < path.size(); ii++)
+    {
+    hash ^= static_cast<unsigned char>(path[ii]);
+    hash *= 1099511628211ULL;
+    }
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return ss.str();
+}
+}// end namespace
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkFITSStatisticsCache);
+
+//----------------------------------------------------------------------------
+vtkFITSStatisticsCache::vtkFITSStatisticsCache()
+{
+  this->FileName = NULL;
+  this->Selection = NULL;
+  this->CacheDirectory = NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkFITSStatisticsCache::~vtkFITSStatisticsCache()
+{
+  this->SetFileName(NULL);
+  this->SetSelection(NULL);
+  this->SetCacheDirectory(NULL);
+}
+
+//----------------------------------------------------------------------------
+std::string vtkFITSStatisticsCache::GetCacheFileName()
+{
+  if (!this->FileName)
+    {
+    return std::string();
+    }
+  if (!this->CacheDirectory || !*this->CacheDirectory)
+    {
+    return std::string(this->FileName) + ".astrostats";
+    }
+
+  std::string fileName = this->FileName;
+  return std::string(this->CacheDirectory) + "/" +
+         vtksys::SystemTools::GetFilenameName(fileName) + "." +
+         PathHash(vtksys::SystemTools::CollapseFullPath(fileName)) + ".astrostats";
+}
+
+//----------------------------------------------------------------------------
+bool vtkFITSStatisticsCache::GetFileStamp(unsigned long long &size, long long &mtime)
+{
+  if (!this->FileName || !vtksys::SystemTools::FileExists(this->FileName, true))
+    {
+    return false;
+    }
+  size = vtksys::SystemTools::FileLength(this->FileName);
+  mtime = vtksys::SystemTools::ModifiedTime(this->FileName);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkFITSStatisticsCache::Load()
+{
+  this->Clear();
+
+  unsigned long long size = 0;
+  long long mtime = 0;
+  if (!this->GetFileStamp(size, mtime))
+    {
+    return false;
+    }
+
+  std::ifstream in(this->GetCacheFileName().c_str());
+  if (!in.good())
+    {
+    return false;
+    }
+
+  std::string signature;
+  int version = 0;
+  in >> signature >> version;
+  if (signature != CacheFileSignature || version != CacheFileVersion)
+    {
+    return false;
+    }
+
+  // key: path, size, modification time and selection
+  std::string tag, path, selection;
+  unsigned long long cachedSize = 0;
+  long long cachedTime = 0;
+  in >> tag;
+  std::getline(in >> std::ws, path);
+  if (tag != "path" || path != this->FileName)
+    {
+    return false;
+    }
+  in >> tag >> cachedSize;
+  if (tag != "size" || cachedSize != size)
+    {
+    return false;
+    }
+  in >> tag >> cachedTime;
+  if (tag != "mtime" || cachedTime != mtime)
+    {
+    return false;
+    }
+  in >> tag;
+  std::getline(in, selection);
+  if (!selection.empty() && selection[0] == ' ')
+    {
+    selection.erase(0, 1);
+    }
+  if (tag != "selection" || selection != (this->Selection ? this->Selection : ""))
+    {
+    return false;
+    }
+
+  std::map<std::string, std::string> values;
+  std::map<std::string, std::vector<double> > arrays;
+  while (in >> tag)
+    {
+    std::string key;
+    in >> key;
+    if (tag == "value")
+      {
+      std::getline(in >> std::ws, values[key]);
+      }
+    else if (tag == "array")
+      {
+      size_t numberOfValues = 0;
+      in >> numberOfValues;
+      std::vector<double> &array = arrays[key];
+      array.resize(numberOfValues);
+      for (size_t ii = 0; ii < numberOfValues; ii++)
+        {
+        in >> array[ii];
+        }
+      }
+    else
+      {
+      vtkWarningMacro("vtkFITSStatisticsCache::Load : unknown entry "<<tag<<" in "
+                      <<this->GetCacheFileName());
+      return false;
+      }
+    if (in.fail())
+      {
+      vtkWarningMacro("vtkFITSStatisticsCache::Load : "<<this->GetCacheFileName()<<" is corrupted.");
+      return false;
+      }
+    }
+
+  this->Values.swap(values);
+  this->Arrays.swap(arrays);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkFITSStatisticsCache::Save()
+{
+  unsigned long long size = 0;
+  long long mtime = 0;
+  if (!this->GetFileStamp(size, mtime))
+    {
+    vtkErrorMacro("vtkFITSStatisticsCache::Save : could not access "
+                  <<(this->FileName ? this->FileName : "(null)"));
+    return false;
+    }
+
+  // write a temporary file and rename it, so that concurrent
+  // readers never see a partial cache
+  std::string cacheFileName = this->GetCacheFileName();
+  if (this->CacheDirectory && *this->CacheDirectory &&
+      !vtksys::SystemTools::MakeDirectory(this->CacheDirectory))
+    {
+    vtkDebugMacro("vtkFITSStatisticsCache::Save : could not create "<<this->CacheDirectory);
+    return false;
+    }
+  std::string tempFileName = cacheFileName + ".tmp";
+  std::ofstream out(tempFileName.c_str());
+  if (!out.good())
+    {
+    // read-only data directories are common: no cache then
+    vtkDebugMacro("vtkFITSStatisticsCache::Save : could not write "<<tempFileName);
+    return false;
+    }
+
+  out << std::setprecision(17);
+  out << CacheFileSignature << " " << CacheFileVersion << "\n";
+  out << "path " << this->FileName << "\n";
+  out << "size " << size << "\n";
+  out << "mtime " << mtime << "\n";
+  out << "selection " << (this->Selection ? this->Selection : "") << "\n";
+
+  std::map<std::string, std::string>::iterator vit;
+  for (vit = this->Values.begin(); vit != this->Values.end(); ++vit)
+    {
+    out << "value " << vit->first << " " << vit->second << "\n";
+    }
+
+  std::map<std::string, std::vector<double> >::iterator ait;
+  for (ait = this->Arrays.begin(); ait != this->Arrays.end(); ++ait)
+    {
+    out << "array " << ait->first << " " << ait->second.size();
+    for (size_t ii = 0; ii < ait->second.size(); ii++)
+      {
+      out << " " << ait->second[ii];
+      }
+    out << "\n";
+    }
+
+  out.close();
+  if (out.fail() || !vtksys::SystemTools::RenameFile(tempFileName.c_str(), cacheFileName.c_str()))
+    {
+    vtksys::SystemTools::RemoveFile(tempFileName.c_str());
+    vtkDebugMacro("vtkFITSStatisticsCache::Save : could not write "<<cacheFileName);
+    return false;
+    }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSStatisticsCache::Clear()
+{
+  this->Values.clear();
+  this->Arrays.clear();
+}
+
+//----------------------------------------------------------------------------
+bool vtkFITSStatisticsCache::HasValue(const char *key)
+{
+  return key && this->Values.count(key);
+}
+
+//----------------------------------------------------------------------------
+const char *vtkFITSStatisticsCache::GetValue(const char *key)
+{
+  if (!this->HasValue(key))
+    {
+    return NULL;
+    }
+  return this->Values[key].c_str();
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSStatisticsCache::SetValue(const char *key, const char *value)
+{
+  if (!key)
+    {
+    return;
+    }
+  if (!value)
+    {
+    this->Values.erase(key);
+    return;
+    }
+  this->Values[key] = value;
+}
+
+//----------------------------------------------------------------------------
+bool vtkFITSStatisticsCache::HasArray(const char *key)
+{
+  return key && this->Arrays.count(key);
+}
+
+//----------------------------------------------------------------------------
+bool vtkFITSStatisticsCache::GetArray(const char *key, vtkDoubleArray *array)
+{
+  if (!array || !this->HasArray(key))
+    {
+    return false;
+    }
+  const std::vector<double> &values = this->Arrays[key];
+  array->SetNumberOfComponents(1);
+  array->SetNumberOfValues(values.size());
+  for (size_t ii = 0; ii < values.size(); ii++)
+    {
+    array->SetValue(ii, values[ii]);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSStatisticsCache::SetArray(const char *key, vtkDoubleArray *array)
+{
+  if (!key)
+    {
+    return;
+    }
+  if (!array)
+    {
+    this->Arrays.erase(key);
+    return;
+    }
+  std::vector<double> &values = this->Arrays[key];
+  values.resize(array->GetNumberOfTuples());
+  for (vtkIdType ii = 0; ii < array->GetNumberOfTuples(); ii++)
+    {
+    values[ii] = array->GetComponent(ii, 0);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSStatisticsCache::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "FileName: " << (this->FileName ? this->FileName : "(none)") << "\n";
+  os << indent << "Selection: " << (this->Selection ? this->Selection : "(none)") << "\n";
+  os << indent << "CacheDirectory: " << (this->CacheDirectory ? this->CacheDirectory : "(none)") << "\n";
+  os << indent << "Number of values: " << this->Values.size() << "\n";
+  os << indent << "Number of arrays: " << this->Arrays.size() << "\n";
+}
@@ -0,0 +1,116 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+#ifndef __vtkFITSStatisticsCache_h
+#define __vtkFITSStatisticsCache_h
+
+// STD includes
+#include <map>
+#include <string>
+#include <vector>
+
+// VTK includes
+#include "vtkObject.h"
+
+// VTK declaration
+class vtkDoubleArray;
+
+#include "vtkFitsWin32Header.h"
+
+/// \brief Sidecar file with the statistics derived from a FITS file.
+///
+/// The values (e.g. range and noise) and arrays (e.g. histograms) are
+/// stored in CacheDirectory (or, if it is not set, next to the FITS file)
+/// and are valid as long as the path, the size and the modification
+/// time of the FITS file, and the Selection, do not change.
+class VTK_FITS_EXPORT vtkFITSStatisticsCache : public vtkObject
+{
+public:
+  static vtkFITSStatisticsCache *New();
+  vtkTypeMacro(vtkFITSStatisticsCache,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent) VTK_OVERRIDE;
+
+  ///
+  /// FITS file the statistics belong to
+  vtkSetStringMacro(FileName);
+  vtkGetStringMacro(FileName);
+
+  ///
+  /// Part of the file the statistics refer to (e.g. HDU and plane).
+  /// Part of the cache key.
+  vtkSetStringMacro(Selection);
+  vtkGetStringMacro(Selection);
+
+  ///
+  /// Directory of the sidecar files (e.g. the application cache).
+  /// If not set, the sidecar is FileName + ".astrostats".
+  vtkSetStringMacro(CacheDirectory);
+  vtkGetStringMacro(CacheDirectory);
+
+  ///
+  /// Name of the sidecar file
+  std::string GetCacheFileName();
+
+  ///
+  /// Read the sidecar file. Returns false, leaving the cache empty,
+  /// if it does not exist or it is stale.
+  bool Load();
+
+  ///
+  /// Write the sidecar file with the current size and modification
+  /// time of FileName
+  bool Save();
+
+  ///
+  /// Remove all the values and arrays
+  void Clear();
+
+  ///
+  /// Values, by key (e.g. SlicerAstro.DATAMIN)
+  bool HasValue(const char* key);
+  const char* GetValue(const char* key);
+  void SetValue(const char* key, const char* value);
+
+  ///
+  /// Arrays of doubles, by key (e.g. histograms)
+  bool HasArray(const char* key);
+  bool GetArray(const char* key, vtkDoubleArray* array);
+  void SetArray(const char* key, vtkDoubleArray* array);
+
+protected:
+  vtkFITSStatisticsCache();
+  ~vtkFITSStatisticsCache();
+
+  ///
+  /// Size and modification time of FileName
+  bool GetFileStamp(unsigned long long &size, long long &mtime);
+
+  char* FileName;
+  char* Selection;
+  char* CacheDirectory;
+
+  std::map<std::string, std::string> Values;
+  std::map<std::string, std::vector<double> > Arrays;
+
+private:
+  vtkFITSStatisticsCache(const vtkFITSStatisticsCache&);  /// Not implemented.
+  void operator=(const vtkFITSStatisticsCache&);  /// Not implemented.
+};
+
+#endif
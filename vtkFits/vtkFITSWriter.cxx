@@ -17,15 +17,22 @@
 
 ==============================================================================*/
 
-#include <map>
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
-#include <zlib.h>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
 #include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
 
 // vtkASTRO includes
+#include "vtkSlicerAstroConfigure.h"
 #include <vtkFITSWriter.h>
 
 // VTK includes
+#include <vtkByteSwap.h>
 #include <vtkDoubleArray.h>
 #include <vtkImageData.h>
 #include <vtkMatrix4x4.h>
@@ -36,6 +43,12 @@
 
 // STD includes
 #include <sstream>
+#include <vector>
+
+// OpenMP includes
+#ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+#include <omp.h>
+#endif
 
 class AttributeMapType: public std::map<std::string, std::string> {};
 
@@ -46,6 +59,9 @@ vtkFITSWriter::vtkFITSWriter()
 {
   this->FileName = NULL;
   this->UseCompression = 0;
+  this->TileCompression = NoTileCompression;
+  this->QuantizeLevel = 4.;
+  this->UseDirectIO = 0;
   this->FileType = VTK_BINARY;
   this->WriteErrorOff();
   this->Attributes = new AttributeMapType;
@@ -129,78 +145,546 @@ int vtkFITSWriter::FillInputPortInformation(
 
 }
 
-// Utility function for compressing files
+namespace
+{
+// uncompressed size of a block-gzip (BGZF) member
+const size_t BGZF_BLOCK_SIZE = 0xff00;
+
+// size of the data slabs streamed to disk
+const size_t STREAM_CHUNK = 64 * 1024 * 1024;
+
+// alignment of buffers, sizes and offsets for O_DIRECT writes
+const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+//----------------------------------------------------------------------------
+bool IsIntegerType(int vtkType)
+{
+  return vtkType == VTK_INT || vtkType == VTK_SHORT || vtkType == VTK_UNSIGNED_CHAR;
+}
+
+//----------------------------------------------------------------------------
+template <typename T> T Unscale(T value, double bscale, double bzero)
+{
+  return static_cast<T>((value - bzero) / bscale);
+}
+
+//----------------------------------------------------------------------------
+template <> short Unscale<short>(short value, double bscale, double bzero)
+{
+  return static_cast<short>(floor((value - bzero) / bscale + 0.5));
+}
+
+//----------------------------------------------------------------------------
+// Convert count values to FITS (big-endian, BSCALE/BZERO-unscaled) bytes.
+template <typename T> void ConvertToFITS(const T* src, size_t count, char* dst,
+                                         double bscale, double bzero)
+{
+  if (bscale != 1. || bzero != 0.)
+    {
+    for (size_t ii = 0; ii < count; ii++)
+      {
+      T value = Unscale<T>(src[ii], bscale, bzero);
+      memcpy(dst + ii * sizeof(T), &value, sizeof(T));
+      }
+    }
+  else
+    {
+    memcpy(dst, src, count * sizeof(T));
+    }
+
+  switch (sizeof(T))
+    {
+    case 2:
+      vtkByteSwap::Swap2BERange(dst, count);
+      break;
+    case 4:
+      vtkByteSwap::Swap4BERange(dst, count);
+      break;
+    case 8:
+      vtkByteSwap::Swap8BERange(dst, count);
+      break;
+    }
+}
+
+//----------------------------------------------------------------------------
+void ConvertToFITS(const void* src, int vtkType, size_t first, size_t count,
+                   char* dst, double bscale, double bzero)
+{
+  switch (vtkType)
+    {
+    case VTK_DOUBLE:
+      ConvertToFITS(static_cast<const double*>(src) + first, count, dst, bscale, bzero);
+      break;
+    case VTK_FLOAT:
+      ConvertToFITS(static_cast<const float*>(src) + first, count, dst, bscale, bzero);
+      break;
+    case VTK_INT:
+      ConvertToFITS(static_cast<const int*>(src) + first, count, dst, bscale, bzero);
+      break;
+    case VTK_SHORT:
+      ConvertToFITS(static_cast<const short*>(src) + first, count, dst, bscale, bzero);
+      break;
+    case VTK_UNSIGNED_CHAR:
+      ConvertToFITS(static_cast<const unsigned char*>(src) + first, count, dst, bscale, bzero);
+      break;
+    }
+}
+
 //----------------------------------------------------------------------------
-bool vtkFITSWriter::compress_one_file(const char *infilename, const char *outfilename)
+// Deflate one block into a BGZF member (a standard gzip member which
+// stores its compressed size in the 'BC' extra subfield).
+bool DeflateBlock(const char* in, size_t inSize, int level,
+                  std::vector<unsigned char>& out)
 {
-  FILE *infile = fopen(infilename, "rb");
-  gzFile outfile = gzopen(outfilename, "wb");
-  if (!infile || !outfile)
+  out.resize(26 + compressBound(static_cast<uLong>(inSize)));
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+    return false;
+    }
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+  strm.avail_in = static_cast<uInt>(inSize);
+  strm.next_out = &out[18];
+  strm.avail_out = static_cast<uInt>(out.size() - 26);
+  int ret = deflate(&strm, Z_FINISH);
+  size_t compressedSize = strm.total_out;
+  deflateEnd(&strm);
+
+  size_t blockSize = 18 + compressedSize + 8;
+  if (ret != Z_STREAM_END || blockSize > 65536)
     {
     return false;
     }
 
-  char inbuffer[128];
-  int num_read = 0;
-  unsigned long total_read = 0;
-  while ((num_read = fread(inbuffer, 1, sizeof(inbuffer), infile)) > 0)
+  const unsigned char header[18] =
+    {
+    0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+    static_cast<unsigned char>((blockSize - 1) & 0xff),
+    static_cast<unsigned char>((blockSize - 1) >> 8)
+    };
+  memcpy(&out[0], header, 18);
+
+  uLong crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(in),
+                    static_cast<uInt>(inSize));
+  unsigned char* footer = &out[18 + compressedSize];
+  for (int ii = 0; ii < 4; ii++)
     {
-    total_read += num_read;
-    gzwrite(outfile, inbuffer, num_read);
+    footer[ii] = static_cast<unsigned char>((crc >> (8 * ii)) & 0xff);
+    footer[4 + ii] = static_cast<unsigned char>((inSize >> (8 * ii)) & 0xff);
     }
-  fclose(infile);
-  gzclose(outfile);
 
+  out.resize(blockSize);
   return true;
 }
 
+//----------------------------------------------------------------------------
+bool CompressBlock(const char* in, size_t inSize, std::vector<unsigned char>& out)
+{
+  // incompressible data: fall back to stored deflate blocks,
+  // which always fit in a member
+  return DeflateBlock(in, inSize, Z_DEFAULT_COMPRESSION, out) ||
+         DeflateBlock(in, inSize, 0, out);
+}
 
 //----------------------------------------------------------------------------
-// Writes all the data from the input.
-void vtkFITSWriter::WriteData()
+// Compress [buffer, buffer + size) in BGZF blocks across threads and
+// append them to outfile. If final is false, the last partial block is
+// moved to the front of the buffer and its size returned.
+long long CompressAndWrite(char* buffer, size_t size, bool final, FILE* outfile)
 {
+  size_t numBlocks = size / BGZF_BLOCK_SIZE;
+  if (final && size % BGZF_BLOCK_SIZE)
+    {
+    numBlocks++;
+    }
 
-  this->WriteErrorOff();
-  if (this->GetFileName() == NULL)
+  std::vector<std::vector<unsigned char> > members(numBlocks);
+  bool success = true;
+  const long long numberOfBlocks = static_cast<long long>(numBlocks);
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(dynamic) shared(members, success)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (long long block = 0; block < numberOfBlocks; block++)
     {
-    vtkErrorMacro("FileName has not been set. Cannot save file");
-    this->WriteErrorOn();
-    return;
+    size_t offset = block * BGZF_BLOCK_SIZE;
+    size_t length = std::min(BGZF_BLOCK_SIZE, size - offset);
+    if (!CompressBlock(buffer + offset, length, members[block]))
+      {
+      success = false;
+      }
     }
 
-  // Fill in image information.
-  vtkImageData *input = this->GetInput();
-  vtkDataArray *array;
-  array = static_cast<vtkDataArray *> (input->GetPointData()->GetScalars());
-  int vtkType = array->GetDataType();
-  void *buffer = array->GetVoidPointer(0);
-  unsigned int naxes = input->GetDataDimension();
-  long int naxe[naxes];
-  int dim = 1;
+  for (size_t block = 0; block < numBlocks && success; block++)
+    {
+    if (fwrite(&members[block][0], 1, members[block].size(), outfile) != members[block].size())
+      {
+      success = false;
+      }
+    }
 
-  //allocate FITS struct
-  remove(this->GetFileName());
+  if (!success)
+    {
+    return -1;
+    }
 
-  fits_create_file(&fptr, this->GetFileName(), &WriteStatus);
+  size_t consumed = std::min(size, numBlocks * BGZF_BLOCK_SIZE);
+  memmove(buffer, buffer + consumed, size - consumed);
+  return static_cast<long long>(size - consumed);
+}
 
-  switch (vtkType){
-    case  VTK_DOUBLE:
-      fits_create_img(fptr, DOUBLE_IMG, naxes, naxe, &WriteStatus);
+//----------------------------------------------------------------------------
+bool WriteFully(int fd, const char* buffer, size_t size)
+{
+  size_t written = 0;
+  while (written < size)
+    {
+    ssize_t num_written = write(fd, buffer + written, size - written);
+    if (num_written <= 0)
+      {
+      return false;
+      }
+    written += num_written;
+    }
+  return true;
+}
+
+} // end namespace
+
+//----------------------------------------------------------------------------
+// The FITS header is generated by CFITSIO in a memory file, so that the
+// data can then be streamed to disk without CFITSIO.
+bool vtkFITSWriter::CreateHeader(int vtkType, unsigned int naxes, long *naxe,
+                                 std::string &header, double &bscale, double &bzero)
+{
+  size_t memorySize = 2880 * 10;
+  void *memory = malloc(memorySize);
+  if (!memory)
+    {
+    return false;
+    }
+
+  WriteStatus = 0;
+  if (fits_create_memfile(&fptr, &memory, &memorySize, 2880 * 10, realloc, &WriteStatus))
+    {
+    fits_report_error(stderr, WriteStatus);
+    free(memory);
+    return false;
+    }
+
+  int bitpix = FLOAT_IMG;
+  switch (vtkType)
+    {
+    case VTK_DOUBLE:
+      bitpix = DOUBLE_IMG;
       break;
-    case VTK_FLOAT:
-      fits_create_img(fptr, FLOAT_IMG, naxes, naxe, &WriteStatus);
+    case VTK_INT:
+      bitpix = LONG_IMG;
       break;
-    case  VTK_SHORT:
-      fits_create_img(fptr, SHORT_IMG, naxes, naxe, &WriteStatus);
+    case VTK_SHORT:
+      bitpix = SHORT_IMG;
       break;
-    default:
-      vtkErrorMacro("Could not write data type");
-      return;
-  }
+    case VTK_UNSIGNED_CHAR:
+      bitpix = BYTE_IMG;
+      break;
+    }
+  fits_create_img(fptr, bitpix, naxes, naxe, &WriteStatus);
 
-  // write the header.
+  this->WriteHeaderKeys();
+
+  int status = 0;
+  bscale = 1.;
+  bzero = 0.;
+  if (fits_read_key(fptr, TDOUBLE, "BSCALE", &bscale, NULL, &status))
+    {
+    status = 0;
+    bscale = 1.;
+    }
+  if (fits_read_key(fptr, TDOUBLE, "BZERO", &bzero, NULL, &status))
+    {
+    status = 0;
+    bzero = 0.;
+    }
+
+  // integer arrays hold the stored values already,
+  // BSCALE/BZERO are only written in the header
+  if (IsIntegerType(vtkType))
+    {
+    bscale = 1.;
+    bzero = 0.;
+    }
+
+  char *cards = NULL;
+  int nkeys = 0;
+  if (!WriteStatus)
+    {
+    fits_hdr2str(fptr, 0, NULL, 0, &cards, &nkeys, &WriteStatus);
+    }
+
+  // drop the data unit, CFITSIO would otherwise fill it in memory on close
+  fits_resize_img(fptr, bitpix, 0, naxe, &status);
+  status = 0;
+  fits_close_file(fptr, &status);
+  free(memory);
+
+  if (WriteStatus || !cards)
+    {
+    fits_report_error(stderr, WriteStatus);
+    if (cards)
+      {
+      free(cards);
+      }
+    return false;
+    }
+
+  header = cards;
+  free(cards);
+
+  if (header.size() < 80 || header.compare(header.size() - 80, 3, "END"))
+    {
+    header += "END";
+    header.resize(80 * ((header.size() + 79) / 80), ' ');
+    }
+  header.resize(2880 * ((header.size() + 2879) / 2880), ' ');
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Header and data are converted in slabs and compressed in parallel in
+// BGZF blocks: the output is a standard (multi-member) gzip file, written
+// without any temporary uncompressed file.
+bool vtkFITSWriter::WriteGzipStream(const char *filename, const std::string &header,
+                                    const void *data, int vtkType, size_t numElements,
+                                    double bscale, double bzero)
+{
+  FILE *outfile = fopen(filename, "wb");
+  if (!outfile)
+    {
+    vtkErrorMacro("vtkFITSWriter::WriteGzipStream: could not open "<< filename << "\n");
+    return false;
+    }
+
+  const size_t elementSize = vtkDataArray::GetDataTypeSize(vtkType);
+  size_t slabElements = STREAM_CHUNK / elementSize;
+  const size_t dataSize = numElements * elementSize;
+  const size_t padding = (2880 - dataSize % 2880) % 2880;
+
+  std::vector<char> buffer(std::max(header.size(), BGZF_BLOCK_SIZE + STREAM_CHUNK + 2880));
+
+  memcpy(&buffer[0], header.c_str(), header.size());
+  long long carry = CompressAndWrite(&buffer[0], header.size(), false, outfile);
+
+  for (size_t first = 0; first < numElements && carry >= 0; first += slabElements)
+    {
+    const size_t count = std::min(slabElements, numElements - first);
+    char *dst = &buffer[carry];
+
+    const long long numberOfChunks = static_cast<long long>((count + 65535) / 65536);
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    for (long long chunk = 0; chunk < numberOfChunks; chunk++)
+      {
+      size_t offset = chunk * 65536;
+      ConvertToFITS(data, vtkType, first + offset, std::min(static_cast<size_t>(65536), count - offset),
+                    dst + offset * elementSize, bscale, bzero);
+      }
+
+    size_t size = carry + count * elementSize;
+    bool final = (first + count == numElements);
+    if (final)
+      {
+      memset(&buffer[size], 0, padding);
+      size += padding;
+      }
+    carry = CompressAndWrite(&buffer[0], size, final, outfile);
+    }
+
+  // BGZF end-of-file marker: an empty member
+  std::vector<unsigned char> eof;
+  bool success = (carry >= 0) && CompressBlock(NULL, 0, eof) &&
+                 fwrite(&eof[0], 1, eof.size(), outfile) == eof.size();
+
+  if (fclose(outfile) != 0)
+    {
+    success = false;
+    }
+
+  if (!success)
+    {
+    vtkErrorMacro("vtkFITSWriter::WriteGzipStream: Error writing "<< filename << "\n");
+    }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------
+// Double-buffered write of header and data: while thread 0 writes slab k,
+// the other threads convert slab k+1 to big-endian in the second buffer.
+// Writes are done in multiples of DIRECT_IO_ALIGNMENT from aligned
+// buffers (the unaligned tail of a slab is carried in front of the next
+// one), so that the same path works with O_DIRECT.
+bool vtkFITSWriter::WriteRawStream(const char *filename, const std::string &header,
+                                   const void *data, int vtkType, size_t numElements,
+                                   size_t slabElements, double bscale, double bzero)
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  int fd = -1;
+  #ifdef O_DIRECT
+  if (this->UseDirectIO)
+    {
+    fd = open(filename, flags | O_DIRECT, 0644);
+    if (fd < 0)
+      {
+      vtkWarningMacro("vtkFITSWriter::WriteRawStream: O_DIRECT is not supported for "
+                      << filename << ", using buffered I/O.");
+      }
+    }
+  #endif
+  if (fd < 0)
+    {
+    fd = open(filename, flags, 0644);
+    }
+  if (fd < 0)
+    {
+    vtkErrorMacro("vtkFITSWriter::WriteRawStream: could not open "<< filename << "\n");
+    return false;
+    }
+
+  const size_t elementSize = vtkDataArray::GetDataTypeSize(vtkType);
+  const size_t slabSize = slabElements * elementSize;
+  const size_t numSlabs = (numElements + slabElements - 1) / slabElements;
+  const size_t dataSize = numElements * elementSize;
+  const size_t padding = (2880 - dataSize % 2880) % 2880;
+  const size_t A = DIRECT_IO_ALIGNMENT;
+
+  size_t bufferSize = std::max(header.size(), A + slabSize + 2880);
+  bufferSize = A * ((bufferSize + A - 1) / A);
+
+  char *buffers[2] = {NULL, NULL};
+  if (posix_memalign(reinterpret_cast<void**>(&buffers[0]), A, bufferSize) ||
+      posix_memalign(reinterpret_cast<void**>(&buffers[1]), A, bufferSize))
+    {
+    vtkErrorMacro("vtkFITSWriter::WriteRawStream: could not allocate the I/O buffers.");
+    free(buffers[0]);
+    close(fd);
+    return false;
+    }
+
+  // where each slab starts in its buffer: after the tail of the previous one
+  std::vector<size_t> carries(numSlabs + 1);
+  carries[0] = header.size() % A;
+  for (size_t slab = 0; slab < numSlabs; slab++)
+    {
+    size_t count = std::min(slabElements, numElements - slab * slabElements);
+    carries[slab + 1] = (carries[slab] + count * elementSize) % A;
+    }
+
+  memcpy(buffers[1], header.c_str(), header.size());
+  bool success = WriteFully(fd, buffers[1], header.size() - carries[0]);
+  memcpy(buffers[0], buffers[1] + header.size() - carries[0], carries[0]);
+  size_t tail = carries[0];
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel shared(success, tail, buffers, carries)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    {
+    int thread = 0, numThreads = 1;
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    thread = omp_get_thread_num();
+    numThreads = omp_get_num_threads();
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+
+    const int workers = numThreads > 1 ? numThreads - 1 : 1;
+    const int worker = numThreads > 1 ? thread - 1 : 0;
+
+    for (size_t step = 0; step <= numSlabs; step++)
+      {
+      // convert slab 'step'
+      if (step < numSlabs && worker >= 0)
+        {
+        size_t first = step * slabElements;
+        size_t count = std::min(slabElements, numElements - first);
+        size_t begin = (count * worker) / workers;
+        size_t end = (count * (worker + 1)) / workers;
+        ConvertToFITS(data, vtkType, first + begin, end - begin,
+                      buffers[step % 2] + carries[step] + begin * elementSize,
+                      bscale, bzero);
+        }
+
+      // write slab 'step - 1'
+      if (thread == 0 && step > 0)
+        {
+        size_t slab = step - 1;
+        size_t count = std::min(slabElements, numElements - slab * slabElements);
+        char *buffer = buffers[slab % 2];
+        size_t size = carries[slab] + count * elementSize;
+        if (slab == numSlabs - 1)
+          {
+          memset(buffer + size, 0, padding);
+          size += padding;
+          }
+        size_t aligned = size - size % A;
+        if (success && !WriteFully(fd, buffer, aligned))
+          {
+          success = false;
+          }
+        tail = size - aligned;
+        memcpy(buffers[step % 2], buffer + aligned, tail);
+        }
+
+      #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+      #pragma omp barrier
+      #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+      }
+    }
+
+  // the last, unaligned, block can not be written with O_DIRECT
+  if (numSlabs == 0 && padding)
+    {
+    memset(buffers[0] + tail, 0, padding);
+    tail += padding;
+    }
+  #ifdef O_DIRECT
+  int currentFlags = fcntl(fd, F_GETFL);
+  if (currentFlags != -1 && (currentFlags & O_DIRECT))
+    {
+    fcntl(fd, F_SETFL, currentFlags & ~O_DIRECT);
+    }
+  #endif
+  if (success && tail > 0)
+    {
+    success = WriteFully(fd, buffers[numSlabs % 2], tail);
+    }
+
+  free(buffers[0]);
+  free(buffers[1]);
+
+  if (close(fd) != 0)
+    {
+    success = false;
+    }
+
+  if (!success)
+    {
+    vtkErrorMacro("vtkFITSWriter::WriteRawStream: Error writing "<< filename << "\n");
+    }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------
+void vtkFITSWriter::WriteHeaderKeys()
+{
   fits_write_comment(fptr, "processed by SlicerAstro (https://github.com/Punzo/SlicerAstro)", &WriteStatus);
 
+  // the label values of masks are written as they are: the scaling
+  // of the volume they have been made from does not apply
+  const char *dataModel = this->GetAttribute("SlicerAstro.DATAMODEL");
+  const bool mask = dataModel && !strcmp(dataModel, "MASK");
+
   // fits_write_key
   AttributeMapType::iterator ait;
   for (ait = this->Attributes->begin(); ait != this->Attributes->end(); ++ait)
@@ -211,13 +695,30 @@ void vtkFITSWriter::WriteData()
       continue;
       }
     std::string tmp = ait->first.substr(pos+12);
-    if ((!tmp.compare(0,6,"SIMPLE")) ||
+    if (mask && ((!tmp.compare("BSCALE")) || (!tmp.compare("BZERO")) ||
+                 (!tmp.compare("BLANK"))))
+      {
+      continue;
+      }
+    // BITPIX follows the type of the array (set by fits_create_img)
+    if ((!tmp.compare(0,6,"SIMPLE")) || (!tmp.compare(0,6,"BITPIX")) ||
         (!tmp.compare(0,7,"RMSMEAN")) ||
         (!tmp.compare(0,9,"DATAMODEL")))
       {
       continue;
       }
 
+    // the structure of a compressed image is handled by CFITSIO
+    // (ZBITPIX, ZNAXISn, ZBLANK, ...)
+    if (this->TileCompression != NoTileCompression &&
+        ((!tmp.compare(0,6,"BITPIX")) || (!tmp.compare(0,5,"NAXIS")) ||
+         (!tmp.compare(0,5,"BLANK")) || (!tmp.compare(0,6,"EXTEND")) ||
+         (!tmp.compare(0,8,"XTENSION")) || (!tmp.compare(0,6,"PCOUNT")) ||
+         (!tmp.compare(0,6,"GCOUNT"))))
+      {
+      continue;
+      }
+
     std::string tmp2 = ait->second;
     if (!tmp2.compare("UNDEFINED"))
       {
@@ -292,80 +793,217 @@ void vtkFITSWriter::WriteData()
       }
     }
 
-  // Write the FITS to file.
+}
+
+//----------------------------------------------------------------------------
+// Writes all the data from the input.
+void vtkFITSWriter::WriteData()
+{
+
+  this->WriteErrorOff();
+  if (this->GetFileName() == NULL)
+    {
+    vtkErrorMacro("FileName has not been set. Cannot save file");
+    this->WriteErrorOn();
+    return;
+    }
+
+  // Fill in image information.
+  vtkImageData *input = this->GetInput();
+  vtkDataArray *array;
+  array = static_cast<vtkDataArray *> (input->GetPointData()->GetScalars());
+  int vtkType = array->GetDataType();
+  void *buffer = array->GetVoidPointer(0);
+  unsigned int naxes = input->GetDataDimension();
+  long int naxe[naxes];
+  int dim = 1;
+
   for (unsigned int axii=0; axii < naxes; axii++)
     {
     naxe[axii] = StringToInt(this->GetAttribute(("SlicerAstro.NAXIS"+IntToString(axii+1))));
     dim *= naxe[axii];
     }
 
-  int fileType = this->GetFileType();
+  if (vtkType != VTK_DOUBLE && vtkType != VTK_FLOAT && !IsIntegerType(vtkType))
+    {
+    vtkErrorMacro("Could not write data type");
+    this->WriteErrorOn();
+    return;
+    }
+
+  if (this->GetFileType() == VTK_ASCII)
+    {
+    vtkErrorMacro("In 3-DSlicer FITS table are not supported");
+    this->WriteErrorOn();
+    return;
+    }
 
-  switch (fileType)
+  if (this->GetUseCompression())
     {
-    case VTK_BINARY:
-      switch (vtkType)
+    if (this->TileCompression != NoTileCompression)
+      {
+      vtkWarningMacro("vtkFITSWriter::WriteData: tile-compressed FITS are not gzipped.");
+      }
+    else
+      {
+      // header and data are streamed through the compressor
+      std::string compressedName = this->GetFileName();
+      if (compressedName.size() < 3 ||
+          compressedName.compare(compressedName.size() - 3, 3, ".gz"))
         {
-        case  VTK_DOUBLE:
-          if(fits_write_img(fptr, TDOUBLE, 1, dim, buffer, &WriteStatus))
-            {
-            fits_report_error(stderr, WriteStatus);
-            vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
-            this->WriteErrorOn();
-            }
-          break;
-        case VTK_FLOAT:
-          if(fits_write_img(fptr, TFLOAT, 1, dim, buffer, &WriteStatus))
-            {
-            fits_report_error(stderr, WriteStatus);
-            vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
-            this->WriteErrorOn();
-            }
-          break;
-        case VTK_SHORT:
-          if(fits_write_img(fptr, TSHORT, 1, dim, buffer, &WriteStatus))
-            {
-            fits_report_error(stderr, WriteStatus);
-            vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
-            this->WriteErrorOn();
-            }
-          break;
+        compressedName += ".gz";
         }
-      break;
-    case VTK_ASCII:
-     vtkErrorMacro("In 3-DSlicer FITS table are not supported");
-    break;
-  }
 
-  // Free the FITS struct
-  fits_close_file(fptr, &WriteStatus);
-  fits_report_error(stderr, WriteStatus);
-
-  if (!this->GetUseCompression())
+      std::string header;
+      double bscale = 1., bzero = 0.;
+      if (!this->CreateHeader(vtkType, naxes, naxe, header, bscale, bzero) ||
+          !this->WriteGzipStream(compressedName.c_str(), header, buffer, vtkType,
+                                 array->GetNumberOfValues(), bscale, bzero))
+        {
+        vtkErrorMacro("Write: Error writing "<< compressedName << "\n");
+        this->WriteErrorOn();
+        }
+      return;
+      }
+    }
+  else if (this->TileCompression == NoTileCompression)
     {
+    // slabs of whole channels, converted and written in parallel
+    size_t numElements = array->GetNumberOfValues();
+    size_t planeElements = naxes >= 2 ? naxe[0] * naxe[1] : numElements;
+    size_t slabElements = STREAM_CHUNK / vtkDataArray::GetDataTypeSize(vtkType);
+    slabElements = std::max(planeElements, (slabElements / planeElements) * planeElements);
+
+    std::string header;
+    double bscale = 1., bzero = 0.;
+    remove(this->GetFileName());
+    if (!this->CreateHeader(vtkType, naxes, naxe, header, bscale, bzero) ||
+        !this->WriteRawStream(this->GetFileName(), header, buffer, vtkType,
+                              numElements, slabElements, bscale, bzero))
+      {
+      vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
+      this->WriteErrorOn();
+      }
     return;
     }
 
-  // Compress file
-  std::string FileName = this->GetFileName();
-  std::string compressedName = FileName + ".gz";
+  //allocate FITS struct
+  remove(this->GetFileName());
 
-  if(!vtkFITSWriter::compress_one_file(FileName.c_str(), compressedName.c_str()))
+  fits_create_file(&fptr, this->GetFileName(), &WriteStatus);
+
+  // tile compression has to be set before creating the image HDU
+  if (this->TileCompression != NoTileCompression)
     {
-    vtkErrorMacro(<<"vtkFITSWriter::WriteData Error: Compression failed.");
+    int compressionType = RICE_1;
+    switch (this->TileCompression)
+      {
+      case GzipTileCompression:
+        compressionType = GZIP_1;
+        break;
+      case HCompressTileCompression:
+        compressionType = HCOMPRESS_1;
+        break;
+      }
+
+    // one tile per channel
+    std::vector<long> tile(naxes, 1);
+    for (unsigned int axii = 0; axii < naxes && axii < 2; axii++)
+      {
+      tile[axii] = naxe[axii];
+      }
+
+    fits_set_compression_type(fptr, compressionType, &WriteStatus);
+    fits_set_tile_dim(fptr, naxes, &tile[0], &WriteStatus);
+    if (!IsIntegerType(vtkType))
+      {
+      fits_set_quantize_level(fptr, this->QuantizeLevel, &WriteStatus);
+      }
+    }
+
+  switch (vtkType){
+    case  VTK_DOUBLE:
+      fits_create_img(fptr, DOUBLE_IMG, naxes, naxe, &WriteStatus);
+      break;
+    case VTK_FLOAT:
+      fits_create_img(fptr, FLOAT_IMG, naxes, naxe, &WriteStatus);
+      break;
+    case VTK_INT:
+      fits_create_img(fptr, LONG_IMG, naxes, naxe, &WriteStatus);
+      break;
+    case  VTK_SHORT:
+      fits_create_img(fptr, SHORT_IMG, naxes, naxe, &WriteStatus);
+      break;
+    case VTK_UNSIGNED_CHAR:
+      fits_create_img(fptr, BYTE_IMG, naxes, naxe, &WriteStatus);
+      break;
+  }
+
+  // write the header.
+  this->WriteHeaderKeys();
+
+  // the integers are written as they are, without applying BSCALE/BZERO
+  if (IsIntegerType(vtkType))
+    {
+    fits_set_bscale(fptr, 1., 0., &WriteStatus);
     }
 
-  if (remove(this->GetFileName()) != 0)
+  // Write the FITS to file.
+  switch (vtkType)
     {
-    vtkErrorMacro("vtkFITSWriter::WriteData Error: Error deleting the decompressed file: "<< this->GetFileName() << ":\n");
+    case  VTK_DOUBLE:
+      if(fits_write_img(fptr, TDOUBLE, 1, dim, buffer, &WriteStatus))
+        {
+        fits_report_error(stderr, WriteStatus);
+        vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
+        this->WriteErrorOn();
+        }
+      break;
+    case VTK_FLOAT:
+      if(fits_write_img(fptr, TFLOAT, 1, dim, buffer, &WriteStatus))
+        {
+        fits_report_error(stderr, WriteStatus);
+        vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
+        this->WriteErrorOn();
+        }
+      break;
+    case VTK_INT:
+      if(fits_write_img(fptr, TINT, 1, dim, buffer, &WriteStatus))
+        {
+        fits_report_error(stderr, WriteStatus);
+        vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
+        this->WriteErrorOn();
+        }
+      break;
+    case VTK_SHORT:
+      if(fits_write_img(fptr, TSHORT, 1, dim, buffer, &WriteStatus))
+        {
+        fits_report_error(stderr, WriteStatus);
+        vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
+        this->WriteErrorOn();
+        }
+      break;
+    case VTK_UNSIGNED_CHAR:
+      if(fits_write_img(fptr, TBYTE, 1, dim, buffer, &WriteStatus))
+        {
+        fits_report_error(stderr, WriteStatus);
+        vtkErrorMacro("Write: Error writing "<< this->GetFileName() << "\n");
+        this->WriteErrorOn();
+        }
+      break;
     }
 
-  return;
+  // Free the FITS struct
+  fits_close_file(fptr, &WriteStatus);
+  fits_report_error(stderr, WriteStatus);
 }
 
 void vtkFITSWriter::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
+  os << indent << "TileCompression: " << this->TileCompression << "\n";
+  os << indent << "QuantizeLevel: " << this->QuantizeLevel << "\n";
+  os << indent << "UseDirectIO: " << this->UseDirectIO << "\n";
 }
 
 void vtkFITSWriter::SetAttribute(const std::string& name, const std::string& value)
@@ -20,6 +20,9 @@
 #ifndef __vtkFITSWriter_h
 #define __vtkFITSWriter_h
 
+// STD includes
+#include <string>
+
 // FITS includes
 #include "fitsio.h"
 
@@ -62,6 +65,38 @@ public:
   vtkGetMacro(UseCompression,int);
   vtkBooleanMacro(UseCompression,int);
 
+  enum TileCompressionTypes
+    {
+    NoTileCompression = 0,
+    RiceTileCompression,
+    GzipTileCompression,
+    HCompressTileCompression
+    };
+
+  ///
+  /// Write a tile-compressed image HDU (fpack convention, one tile
+  /// per channel). Default is NoTileCompression.
+  vtkSetClampMacro(TileCompression,int,NoTileCompression,HCompressTileCompression);
+  vtkGetMacro(TileCompression,int);
+  void SetTileCompressionToNone() {this->SetTileCompression(NoTileCompression);};
+  void SetTileCompressionToRice() {this->SetTileCompression(RiceTileCompression);};
+  void SetTileCompressionToGzip() {this->SetTileCompression(GzipTileCompression);};
+  void SetTileCompressionToHCompress() {this->SetTileCompression(HCompressTileCompression);};
+
+  ///
+  /// Quantization level of floating point data for tile compression:
+  /// the quantization step is the noise of the tile divided by this value.
+  /// Higher values are less lossy. 0 disables the quantization (lossless).
+  vtkSetMacro(QuantizeLevel,float);
+  vtkGetMacro(QuantizeLevel,float);
+
+  ///
+  /// Write uncompressed files with O_DIRECT (bypassing the page cache),
+  /// where supported. Data are always written in large aligned blocks.
+  vtkSetMacro(UseDirectIO,int);
+  vtkGetMacro(UseDirectIO,int);
+  vtkBooleanMacro(UseDirectIO,int);
+
   vtkSetClampMacro(FileType,int,VTK_ASCII,VTK_BINARY);
   vtkGetMacro(FileType,int);
   void SetFileTypeToASCII() {this->SetFileType(VTK_ASCII);};
@@ -93,6 +128,9 @@ protected:
   char *FileName;
 
   int UseCompression;
+  int TileCompression;
+  float QuantizeLevel;
+  int UseDirectIO;
   int FileType;
 
   AttributeMapType *Attributes;
@@ -100,7 +138,27 @@ protected:
   fitsfile *fptr;
   int WriteStatus;
 
-  static bool compress_one_file(const char *infilename, const char *outfilename);
+  ///
+  /// Write the keywords from the "SlicerAstro." attributes in the current HDU
+  void WriteHeaderKeys();
+
+  ///
+  /// Generate the header (padded to 2880 bytes) of the image HDU and
+  /// return the BSCALE/BZERO to apply to the data
+  bool CreateHeader(int vtkType, unsigned int naxes, long *naxe,
+                    std::string &header, double &bscale, double &bzero);
+
+  ///
+  /// Stream header and data to an uncompressed file, double-buffered
+  bool WriteRawStream(const char *filename, const std::string &header,
+                      const void *data, int vtkType, size_t numElements,
+                      size_t slabElements, double bscale, double bzero);
+
+  ///
+  /// Stream header and data into a block-gzip compressed file
+  bool WriteGzipStream(const char *filename, const std::string &header,
+                       const void *data, int vtkType, size_t numElements,
+                       double bscale, double bzero);
 
 private:
   vtkFITSWriter(const vtkFITSWriter&);  /// Not implemented.
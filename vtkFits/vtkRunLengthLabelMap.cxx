@@ -0,0 +1,364 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+// STD includes
+#include <algorithm>
+#include <cstring>
+
+// vtkASTRO includes
+#include "vtkSlicerAstroConfigure.h"
+#include "vtkRunLengthLabelMap.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+
+// OpenMP includes
+#ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+//----------------------------------------------------------------------------
+// Encode the spatial row j: the row is read one channel at a time, so that
+// the cube is traversed along contiguous memory, and the runs are then
+// gathered per pixel.
+template <typename T>
+void EncodeRow(const T *pixel, const int dims[3], int j,
+               std::vector<std::vector<vtkRunLengthLabelMap::Run> > &pixelRuns,
+               std::vector<vtkRunLengthLabelMap::Run> &rowRuns,
+               std::vector<int> &rowCounts)
+{
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  for (int ii = 0; ii < dims[0]; ii++)
+    {
+    pixelRuns[ii].clear();
+    }
+
+  for (int kk = 0; kk < dims[2]; kk++)
+    {
+    const T *row = pixel + kk * numSlice + static_cast<vtkIdType>(j) * dims[0];
+    for (int ii = 0; ii < dims[0]; ii++)
+      {
+      int label = static_cast<int>(row[ii]);
+      if (label == 0)
+        {
+        continue;
+        }
+      std::vector<vtkRunLengthLabelMap::Run> &runs = pixelRuns[ii];
+      if (!runs.empty() && runs.back().Last == kk - 1 && runs.back().Label == label)
+        {
+        runs.back().Last = kk;
+        continue;
+        }
+      vtkRunLengthLabelMap::Run run;
+      run.First = kk;
+      run.Last = kk;
+      run.Label = label;
+      runs.push_back(run);
+      }
+    }
+
+  rowRuns.clear();
+  rowCounts.resize(dims[0]);
+  for (int ii = 0; ii < dims[0]; ii++)
+    {
+    rowCounts[ii] = static_cast<int>(pixelRuns[ii].size());
+    rowRuns.insert(rowRuns.end(), pixelRuns[ii].begin(), pixelRuns[ii].end());
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename T>
+void DecodeVolume(vtkRunLengthLabelMap *labelMap, T *pixel, bool positiveOnly)
+{
+  int *dims = labelMap->GetDimensions();
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  memset(pixel, 0, numSlice * dims[2] * sizeof(T));
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (vtkIdType elemCnt = 0; elemCnt < numSlice; elemCnt++)
+    {
+    int numberOfRuns = 0;
+    const vtkRunLengthLabelMap::Run *runs = labelMap->GetPixelRuns(elemCnt, numberOfRuns);
+    for (int run = 0; run < numberOfRuns; run++)
+      {
+      if (positiveOnly && runs[run].Label <= 0)
+        {
+        continue;
+        }
+      T label = static_cast<T>(runs[run].Label);
+      for (int kk = runs[run].First; kk <= runs[run].Last; kk++)
+        {
+        pixel[elemCnt + kk * numSlice] = label;
+        }
+      }
+    }
+}
+
+}// end namespace
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkRunLengthLabelMap);
+
+//----------------------------------------------------------------------------
+vtkRunLengthLabelMap::vtkRunLengthLabelMap()
+{
+  this->Dimensions[0] = 0;
+  this->Dimensions[1] = 0;
+  this->Dimensions[2] = 0;
+  this->PixelOffsets.assign(1, 0);
+}
+
+//----------------------------------------------------------------------------
+vtkRunLengthLabelMap::~vtkRunLengthLabelMap()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkRunLengthLabelMap::Initialize()
+{
+  this->Dimensions[0] = 0;
+  this->Dimensions[1] = 0;
+  this->Dimensions[2] = 0;
+  std::vector<Run>().swap(this->Runs);
+  this->PixelOffsets.assign(1, 0);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+bool vtkRunLengthLabelMap::Encode(vtkImageData *labelMap)
+{
+  if (!labelMap || !labelMap->GetPointData() || !labelMap->GetPointData()->GetScalars())
+    {
+    vtkErrorMacro("vtkRunLengthLabelMap::Encode : labelMap or its scalars not found.");
+    return false;
+    }
+
+  vtkDataArray *scalars = labelMap->GetPointData()->GetScalars();
+  if (scalars->GetNumberOfComponents() != 1)
+    {
+    vtkErrorMacro("vtkRunLengthLabelMap::Encode : only single component label maps are supported.");
+    return false;
+    }
+
+  int dims[3];
+  labelMap->GetDimensions(dims);
+  const vtkIdType numSlice = static_cast<vtkIdType>(dims[0]) * dims[1];
+  const int dataType = scalars->GetDataType();
+  void *pixel = scalars->GetVoidPointer(0);
+
+  switch (dataType)
+    {
+    case VTK_CHAR:
+    case VTK_SIGNED_CHAR:
+    case VTK_UNSIGNED_CHAR:
+    case VTK_SHORT:
+    case VTK_UNSIGNED_SHORT:
+    case VTK_INT:
+      break;
+    default:
+      // the labels of the runs are int
+      vtkErrorMacro("vtkRunLengthLabelMap::Encode : label maps of type "
+                    <<scalars->GetDataTypeAsString()<<" are not supported.");
+      return false;
+    }
+
+  // runs and run counts of each spatial row
+  std::vector<std::vector<Run> > rowRuns(dims[1]);
+  std::vector<std::vector<int> > rowCounts(dims[1]);
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    {
+    std::vector<std::vector<Run> > pixelRuns(dims[0]);
+
+    #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    #pragma omp for schedule(dynamic)
+    #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+    for (int jj = 0; jj < dims[1]; jj++)
+      {
+      switch (dataType)
+        {
+        vtkTemplateMacro(EncodeRow(static_cast<VTK_TT*>(pixel), dims, jj,
+                                   pixelRuns, rowRuns[jj], rowCounts[jj]));
+        }
+      }
+    }
+
+  vtkIdType numberOfRuns = 0;
+  for (int jj = 0; jj < dims[1]; jj++)
+    {
+    numberOfRuns += rowRuns[jj].size();
+    }
+
+  this->Runs.clear();
+  this->Runs.reserve(numberOfRuns);
+  this->PixelOffsets.resize(numSlice + 1);
+  vtkIdType elemCnt = 0;
+  this->PixelOffsets[0] = 0;
+  for (int jj = 0; jj < dims[1]; jj++)
+    {
+    for (int ii = 0; ii < dims[0]; ii++, elemCnt++)
+      {
+      this->PixelOffsets[elemCnt + 1] = this->PixelOffsets[elemCnt] + rowCounts[jj][ii];
+      }
+    this->Runs.insert(this->Runs.end(), rowRuns[jj].begin(), rowRuns[jj].end());
+    std::vector<Run>().swap(rowRuns[jj]);
+    }
+
+  this->Dimensions[0] = dims[0];
+  this->Dimensions[1] = dims[1];
+  this->Dimensions[2] = dims[2];
+  this->Modified();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkRunLengthLabelMap::Decode(vtkImageData *image, int scalarType)
+{
+  if (!image)
+    {
+    vtkErrorMacro("vtkRunLengthLabelMap::Decode : image not found.");
+    return false;
+    }
+
+  image->SetDimensions(this->Dimensions);
+  image->AllocateScalars(scalarType, 1);
+  void *pixel = image->GetPointData()->GetScalars()->GetVoidPointer(0);
+
+  switch (scalarType)
+    {
+    vtkTemplateMacro(DecodeVolume(this, static_cast<VTK_TT*>(pixel), false));
+    default:
+      vtkErrorMacro("vtkRunLengthLabelMap::Decode : unknown scalar type.");
+      return false;
+    }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkRunLengthLabelMap::DecodeExtent(const int extent[6], short *buffer)
+{
+  if (!buffer)
+    {
+    vtkErrorMacro("vtkRunLengthLabelMap::DecodeExtent : buffer not found.");
+    return false;
+    }
+
+  for (int axis = 0; axis < 3; axis++)
+    {
+    if (extent[2 * axis] < 0 || extent[2 * axis + 1] >= this->Dimensions[axis] ||
+        extent[2 * axis] > extent[2 * axis + 1])
+      {
+      vtkErrorMacro("vtkRunLengthLabelMap::DecodeExtent : extent out of the dimensions.");
+      return false;
+      }
+    }
+
+  const int nx = extent[1] - extent[0] + 1;
+  const int ny = extent[3] - extent[2] + 1;
+  const int nz = extent[5] - extent[4] + 1;
+  const vtkIdType numSlice = static_cast<vtkIdType>(nx) * ny;
+  memset(buffer, 0, numSlice * nz * sizeof(short));
+
+  #ifdef VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  #pragma omp parallel for schedule(static)
+  #endif // VTK_SLICER_ASTRO_SUPPORT_OPENMP
+  for (int jj = extent[2]; jj <= extent[3]; jj++)
+    {
+    for (int ii = extent[0]; ii <= extent[1]; ii++)
+      {
+      const vtkIdType elemCnt = ii + static_cast<vtkIdType>(jj) * this->Dimensions[0];
+      const vtkIdType pos = (ii - extent[0]) + static_cast<vtkIdType>(jj - extent[2]) * nx;
+      for (vtkIdType run = this->PixelOffsets[elemCnt]; run < this->PixelOffsets[elemCnt + 1]; run++)
+        {
+        const int first = std::max(this->Runs[run].First, extent[4]);
+        const int last = std::min(this->Runs[run].Last, extent[5]);
+        const short label = static_cast<short>(this->Runs[run].Label);
+        for (int kk = first; kk <= last; kk++)
+          {
+          buffer[pos + (kk - extent[4]) * numSlice] = label;
+          }
+        }
+      }
+    }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkRunLengthLabelMap::DecodeMask(bool *mask)
+{
+  if (!mask)
+    {
+    return;
+    }
+
+  DecodeVolume(this, mask, true);
+}
+
+//----------------------------------------------------------------------------
+const vtkRunLengthLabelMap::Run* vtkRunLengthLabelMap::GetPixelRuns(vtkIdType pixel, int &numberOfRuns)
+{
+  numberOfRuns = static_cast<int>(this->PixelOffsets[pixel + 1] - this->PixelOffsets[pixel]);
+  return numberOfRuns > 0 ? &this->Runs[this->PixelOffsets[pixel]] : NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkRunLengthLabelMap::GetNumberOfRuns()
+{
+  return static_cast<vtkIdType>(this->Runs.size());
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkRunLengthLabelMap::GetNumberOfLabelledVoxels()
+{
+  vtkIdType numberOfVoxels = 0;
+  for (size_t run = 0; run < this->Runs.size(); run++)
+    {
+    numberOfVoxels += this->Runs[run].Last - this->Runs[run].First + 1;
+    }
+  return numberOfVoxels;
+}
+
+//----------------------------------------------------------------------------
+unsigned long vtkRunLengthLabelMap::GetActualMemorySize()
+{
+  size_t size = this->Runs.capacity() * sizeof(Run) +
+                this->PixelOffsets.capacity() * sizeof(vtkIdType);
+  return static_cast<unsigned long>((size + 1023) / 1024);
+}
+
+//----------------------------------------------------------------------------
+void vtkRunLengthLabelMap::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+  os << indent << "Dimensions: " << this->Dimensions[0] << " "
+     << this->Dimensions[1] << " " << this->Dimensions[2] << "\n";
+  os << indent << "NumberOfRuns: " << this->Runs.size() << "\n";
+  os << indent << "ActualMemorySize: " << this->GetActualMemorySize() << " KiB\n";
+}
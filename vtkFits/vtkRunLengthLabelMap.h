@@ -0,0 +1,109 @@
+/*==============================================================================
+
+  Copyright (c) Kapteyn Astronomical Institute
+  University of Groningen, Groningen, Netherlands. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Davide Punzo, Kapteyn Astronomical Institute,
+  and was supported through the European Research Council grant nr. 291531.
+
+==============================================================================*/
+
+#ifndef __vtkRunLengthLabelMap_h
+#define __vtkRunLengthLabelMap_h
+
+// STD includes
+#include <vector>
+
+// VTK includes
+#include "vtkObject.h"
+
+// VTK declaration
+class vtkImageData;
+
+#include "vtkFitsWin32Header.h"
+
+/// \brief Run-length encoded label map.
+///
+/// Source masks of HI cubes label a small fraction of the voxels.
+/// The labelled voxels are indexed as runs of equal labels along the
+/// spectral (Z) axis of each spatial pixel, so that the mask loops
+/// over the spectra (e.g. the moment maps) visit only the labelled
+/// channels. It is a temporary index built from the dense label map,
+/// which is still the stored form: it costs 8 bytes per spatial pixel
+/// plus 12 bytes per run on top of the label map.
+class VTK_FITS_EXPORT vtkRunLengthLabelMap : public vtkObject
+{
+public:
+  static vtkRunLengthLabelMap *New();
+  vtkTypeMacro(vtkRunLengthLabelMap,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent) VTK_OVERRIDE;
+
+  ///
+  /// Channels [First, Last] of a spatial pixel with label Label (!= 0)
+  struct Run
+    {
+    int First;
+    int Last;
+    int Label;
+    };
+
+  ///
+  /// Encode the single component scalars of labelMap. The labels are
+  /// int: char, short, unsigned short and int label maps are supported.
+  bool Encode(vtkImageData *labelMap);
+
+  ///
+  /// Allocate image with the Dimensions and scalarType and decode into it
+  bool Decode(vtkImageData *image, int scalarType = VTK_SHORT);
+
+  ///
+  /// Decode the [extent] sub-volume in buffer (X fastest), which has to
+  /// hold the number of voxels of the extent
+  bool DecodeExtent(const int extent[6], short *buffer);
+
+  ///
+  /// Fill the whole volume mask (X fastest) with true where the label is positive
+  void DecodeMask(bool *mask);
+
+  ///
+  /// Runs of the spatial pixel i + j * Dimensions[0], sorted by channel
+  const Run* GetPixelRuns(vtkIdType pixel, int &numberOfRuns);
+
+  ///
+  /// Remove all the runs
+  void Initialize();
+
+  vtkGetVector3Macro(Dimensions,int);
+
+  vtkIdType GetNumberOfRuns();
+  vtkIdType GetNumberOfLabelledVoxels();
+
+  ///
+  /// Memory used, in kibibytes (as vtkDataObject::GetActualMemorySize)
+  unsigned long GetActualMemorySize();
+
+protected:
+  vtkRunLengthLabelMap();
+  ~vtkRunLengthLabelMap();
+
+  int Dimensions[3];
+
+  std::vector<Run> Runs;
+  /// first run of each spatial pixel (size: number of pixels + 1)
+  std::vector<vtkIdType> PixelOffsets;
+
+private:
+  vtkRunLengthLabelMap(const vtkRunLengthLabelMap&);  /// Not implemented.
+  void operator=(const vtkRunLengthLabelMap&);  /// Not implemented.
+};
+
+#endif